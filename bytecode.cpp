@@ -0,0 +1,891 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include "regex.h"
+#include "matcher.h"
+#include "math-optimization.h"
+#include "bytecode.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define BYTECODE_COMPUTED_GOTO
+#endif
+
+bool matchDigitNot        (Uchar ch);
+bool matchDigit           (Uchar ch);
+bool matchSpaceNot        (Uchar ch);
+bool matchSpace           (Uchar ch);
+bool matchWordCharacterNot(Uchar ch);
+bool matchWordCharacter   (Uchar ch);
+
+enum BacktrackEntryType
+{
+    Choice_Jump,              // index = instruction to resume at
+    Choice_Repeat,            // index = the repetition's instruction; count = count currently tried
+    Choice_LoopExit,          // index = the loop's Op_LoopEnd; leave the group instead of starting another iteration
+    Choice_LoopAgain,         // index = the loop's Op_LoopEnd; start another iteration instead of leaving the group (lazy)
+    Choice_Lookahead,         // marks where a lookahead began; nothing to try if it is backtracked into
+    Choice_NegativeLookahead, // index = instruction after the lookahead, resumed when nothing inside it matched
+    Undo_Capture,             // index = backrefIndex; position = previous value
+    Undo_Register,            // index = register; position, count = previous values
+};
+
+struct RegexBytecode::BacktrackEntry
+{
+    Uint type;
+    Uint index;
+    Uint64 position;
+    Uint64 count;
+    Uint64 multiple;
+};
+
+const char *RegexBytecode::Compile(RegexGroupRoot &regex, Uint numCaptureGroups, char basicChar)
+{
+    if (enable_persistent_backrefs)
+        return "persistent backrefs";
+
+    code.clear();
+    this->numCaptureGroups   = numCaptureGroups;
+    this->basicChar          = basicChar;
+    basicCharIsWordCharacter = matchWordCharacter(basicChar);
+    emulateNPCGs             = emulate_ECMA_NPCGs;
+    noEmptyOptional          = no_empty_optional;
+    anchored                 = regex.anchored;
+    numRegisters             = 0;
+    numLookarounds           = 0;
+    numCapturesCompiled      = 0;
+
+    if (const char *unsupported = compileAlternatives(&regex))
+        return unsupported;
+    emit(Op_Match);
+    return NULL;
+}
+
+const char *RegexBytecode::compileAlternatives(RegexGroup *group)
+{
+    std::vector<Uint> jumpsToEnd;
+    for (RegexPattern **alternative = group->alternatives; *alternative; alternative++)
+    {
+        Uint split = UINT_MAX;
+        if (alternative[1])
+        {
+            emit(Op_Split);
+            split = emit(0);
+        }
+        if (const char *unsupported = compileSymbols((*alternative)->symbols))
+            return unsupported;
+        if (alternative[1])
+        {
+            emit(Op_Jump);
+            jumpsToEnd.push_back(emit(0));
+            code[split] = (Uint)code.size();
+        }
+    }
+    for (size_t i=0; i<jumpsToEnd.size(); i++)
+        code[jumpsToEnd[i]] = (Uint)code.size();
+    return NULL;
+}
+
+const char *RegexBytecode::compileSymbols(RegexSymbol **symbols)
+{
+    for (RegexSymbol **thisSymbol = symbols; *thisSymbol; thisSymbol++)
+    {
+        RegexSymbol *symbol = *thisSymbol;
+        const char *unsupported = NULL;
+        bool (*characterMatchFunction)(Uchar ch) = NULL;
+        switch (symbol->type)
+        {
+        case RegexSymbol_NoOp:
+            break;
+        case RegexSymbol_Group:
+            unsupported = compileGroup((RegexGroup*)symbol);
+            break;
+        case RegexSymbol_Verb:
+            if (symbol->verb != RegexVerb_Fail)
+                return "backtracking control verbs";
+            emit(Op_Fail);
+            break;
+        case RegexSymbol_Character:
+            // as in the tree walker, a character other than the basic one never matches, even if it is optional
+            if (symbol->characterAny || symbol->character == basicChar)
+                unsupported = compileRepeat(thisSymbol, Op_Repeat);
+            else
+                emit(Op_Fail);
+            break;
+        case RegexSymbol_CharacterClass:
+            if (((RegexCharacterClass*)symbol)->isInClass(basicChar))
+                unsupported = compileRepeat(thisSymbol, Op_Repeat);
+            else
+                emit(Op_Fail);
+            break;
+        case RegexSymbol_String:
+            emit(Op_Fail);
+            break;
+        case RegexSymbol_Backref:
+            unsupported = compileRepeat(thisSymbol, Op_RepeatBackref);
+            break;
+        case RegexSymbol_ResetStart:
+            return "\\K";
+        case RegexSymbol_AnchorStart:
+            if (symbol->minCount)
+                emit(Op_AnchorStart);
+            break;
+        case RegexSymbol_AnchorEnd:
+            if (symbol->minCount)
+                emit(Op_AnchorEnd);
+            break;
+        case RegexSymbol_WordBoundaryNot:
+            if (symbol->minCount)
+                emit(Op_WordBoundaryNot);
+            break;
+        case RegexSymbol_WordBoundary:
+            if (symbol->minCount)
+                emit(Op_WordBoundary);
+            break;
+        case RegexSymbol_DigitNot:         characterMatchFunction = matchDigitNot;         break;
+        case RegexSymbol_Digit:            characterMatchFunction = matchDigit;            break;
+        case RegexSymbol_SpaceNot:         characterMatchFunction = matchSpaceNot;         break;
+        case RegexSymbol_Space:            characterMatchFunction = matchSpace;            break;
+        case RegexSymbol_WordCharacterNot: characterMatchFunction = matchWordCharacterNot; break;
+        case RegexSymbol_WordCharacter:    characterMatchFunction = matchWordCharacter;    break;
+        case RegexSymbol_ConstGroupNonCapturing:
+        case RegexSymbol_ConstGroupCapturing:
+            if (!((RegexConstGroup*)symbol)->flat)
+                return "constant-width groups containing groups or lookaheads";
+            unsupported = compileRepeat(thisSymbol, Op_RepeatConst);
+            break;
+        case RegexSymbol_IsPrime:
+        case RegexSymbol_IsPowerOf2:
+            if (symbol->possessive) // the optimized form of a lookinto
+                return "lookinto";
+            emit(symbol->type == RegexSymbol_IsPrime ? Op_IsPrime : Op_IsPowerOf2);
+            emit(symbol->lazy);
+            break;
+        default:
+            UNREACHABLE_CODE;
+        }
+        if (characterMatchFunction)
+        {
+            if (characterMatchFunction(basicChar))
+                unsupported = compileRepeat(thisSymbol, Op_Repeat);
+            else
+                emit(Op_Fail);
+        }
+        if (unsupported)
+            return unsupported;
+    }
+    return NULL;
+}
+
+const char *RegexBytecode::compileRepeat(RegexSymbol **thisSymbol, Uint opcode)
+{
+    RegexSymbol *symbol = *thisSymbol;
+    if (symbol->possessive)
+        return "possessive quantifiers";
+
+    Uint flags = symbol->lazy ? RepeatFlag_Lazy : 0;
+    if (thisSymbol[1] && thisSymbol[1]->type == RegexSymbol_AnchorEnd && thisSymbol[1]->minCount)
+        flags |= RepeatFlag_ToEnd;
+
+    emit(opcode);
+    if (opcode == Op_RepeatBackref)
+        emit(((RegexBackref*)symbol)->index);
+    else
+    if (opcode == Op_RepeatConst)
+    {
+        // the group's length is the sum of its characters and backrefs, evaluated on entering it, as in the tree walker
+        Uint backrefIndex = UINT_MAX;
+        if (symbol->type == RegexSymbol_ConstGroupCapturing)
+        {
+            backrefIndex = ((RegexConstGroupCapturing*)symbol)->backrefIndex;
+            numCapturesCompiled++;
+        }
+        Uint numCharacters = 0;
+        std::vector<Uint> backrefs;
+        for (RegexSymbol **insideSymbol = ((RegexConstGroup*)symbol)->originalGroup->alternatives[0]->symbols; *insideSymbol; insideSymbol++)
+        {
+            if ((*insideSymbol)->type == RegexSymbol_Character)
+                numCharacters += (*insideSymbol)->minCount;
+            else
+            if ((*insideSymbol)->type == RegexSymbol_Backref)
+            {
+                backrefs.push_back(((RegexBackref*)*insideSymbol)->index);
+                backrefs.push_back((*insideSymbol)->minCount);
+            }
+        }
+        emit(backrefIndex);
+        emit(numCharacters);
+        emit(symbol->minCount);
+        emit(symbol->maxCount);
+        emit(flags);
+        emit((Uint)backrefs.size() / 2);
+        for (size_t i=0; i<backrefs.size(); i++)
+            emit(backrefs[i]);
+        return NULL;
+    }
+    emit(symbol->minCount);
+    emit(symbol->maxCount);
+    emit(flags);
+    return NULL;
+}
+
+const char *RegexBytecode::compileGroup(RegexGroup *group)
+{
+    if (group->maxCount == 0)
+        return NULL;
+    if (group->possessive)
+        return "possessive quantifiers";
+
+    switch (group->type)
+    {
+    case RegexGroup_NonCapturing:
+    case RegexGroup_Capturing:
+        break;
+    case RegexGroup_Lookahead:
+    case RegexGroup_NegativeLookahead:
+        {
+            if (group->minCount != 1 || group->maxCount != 1)
+                return "quantified lookaheads";
+            bool negative = group->type == RegexGroup_NegativeLookahead;
+            Uint lookaround = numLookarounds++;
+            emit(negative ? Op_NegativeLookaheadBegin : Op_LookaheadBegin);
+            emit(lookaround);
+            Uint target = negative ? emit(0) : 0;
+            if (const char *unsupported = compileAlternatives(group))
+                return unsupported;
+            emit(negative ? Op_NegativeLookaheadEnd : Op_LookaheadEnd);
+            emit(lookaround);
+            if (negative)
+                code[target] = (Uint)code.size();
+            return NULL;
+        }
+    case RegexGroup_Conditional:
+        {
+            if (group->minCount != 1 || group->maxCount != 1)
+                return "quantified conditionals";
+            emit(Op_IfCaptured);
+            emit(((RegexConditional*)group)->backrefIndex);
+            Uint elseTarget = emit(0);
+            if (const char *unsupported = compileSymbols(group->alternatives[0]->symbols))
+                return unsupported;
+            if (group->alternatives[1])
+            {
+                emit(Op_Jump);
+                Uint endTarget = emit(0);
+                code[elseTarget] = (Uint)code.size();
+                if (const char *unsupported = compileSymbols(group->alternatives[1]->symbols))
+                    return unsupported;
+                code[endTarget] = (Uint)code.size();
+            }
+            else
+                code[elseTarget] = (Uint)code.size();
+            return NULL;
+        }
+    case RegexGroup_Atomic:
+        return "atomic groups";
+    case RegexGroup_BranchReset:
+        return "branch reset groups";
+    case RegexGroup_LookaheadMolecular:
+        return "molecular lookahead";
+    case RegexGroup_Lookinto:
+    case RegexGroup_LookintoMolecular:
+    case RegexGroup_NegativeLookinto:
+        return "lookinto";
+    case RegexGroup_LookaroundConditional:
+        return "lookaround conditionals";
+    default:
+        UNREACHABLE_CODE;
+    }
+
+    Uint backrefIndex = UINT_MAX;
+    if (group->type == RegexGroup_Capturing)
+    {
+        backrefIndex = ((RegexGroupCapturing*)group)->backrefIndex;
+        numCapturesCompiled++;
+    }
+    // Without branch reset groups, the capture groups inside this one are numbered consecutively after it
+    Uint firstInnerBackref = numCapturesCompiled;
+
+    if (group->minCount == 1 && group->maxCount == 1)
+    {
+        if (backrefIndex == UINT_MAX)
+            return compileAlternatives(group);
+        Uint reg = numRegisters++;
+        emit(Op_GroupBegin);
+        emit(reg);
+        if (const char *unsupported = compileAlternatives(group))
+            return unsupported;
+        emit(Op_GroupEnd);
+        emit(reg);
+        emit(backrefIndex);
+        return NULL;
+    }
+
+    Uint reg = numRegisters++;
+    Uint skipTarget = UINT_MAX;
+    if (group->minCount == 0)
+    {
+        emit(Op_Split);
+        if (group->lazy)
+        {
+            Uint enterTarget = emit(0);
+            emit(Op_Jump);
+            skipTarget = emit(0);
+            code[enterTarget] = (Uint)code.size();
+        }
+        else
+            skipTarget = emit(0);
+    }
+    emit(Op_GroupBegin);
+    emit(reg);
+    Uint body = (Uint)code.size();
+    if (const char *unsupported = compileAlternatives(group))
+        return unsupported;
+    emit(Op_LoopEnd);
+    emit(reg);
+    emit(backrefIndex);
+    emit(group->minCount);
+    emit(group->maxCount);
+    emit(group->lazy);
+    emit(firstInnerBackref);
+    emit(numCapturesCompiled - firstInnerBackref);
+    emit(body);
+    if (skipTarget != UINT_MAX)
+        code[skipTarget] = (Uint)code.size();
+    return NULL;
+}
+
+static inline void decodeRepeat(const Uint *instruction, const Uint *&operands, const Uint *&next, Uint &backrefIndex)
+{
+    switch (instruction[0])
+    {
+    case Op_Repeat:
+        operands = instruction + 1;
+        next = operands + 3;
+        backrefIndex = UINT_MAX;
+        break;
+    case Op_RepeatBackref:
+        operands = instruction + 2;
+        next = operands + 3;
+        backrefIndex = UINT_MAX;
+        break;
+    case Op_RepeatConst:
+        operands = instruction + 3;
+        next = operands + 4 + 2*operands[3];
+        backrefIndex = instruction[1];
+        break;
+    default:
+        UNREACHABLE_CODE;
+    }
+}
+
+bool RegexBytecode::Match(Uint64 input, Uint returnMatch_backrefIndex, Uint64 &returnMatch, bool onlyAtStart) const
+{
+    struct Register
+    {
+        Uint64 loopCount;
+        Uint64 position; // where the current iteration began
+    };
+    std::vector<Uint64> captures(numCaptureGroups);
+    std::vector<Register> registers(numRegisters);
+    std::vector<size_t> lookarounds(numLookarounds); // stack depth at which each active lookahead began
+    std::vector<BacktrackEntry> stack;
+
+    const Uint *const program = &code[0];
+    const Uint *ip;
+    Uint64 position;
+    Uint64 startPosition;
+    Uint64 multiple;
+    bool matched = false;
+
+    auto setCapture = [&](Uint index, Uint64 value)
+    {
+        BacktrackEntry entry = { Undo_Capture, index, captures[index], 0, 0 };
+        stack.push_back(entry);
+        captures[index] = value;
+    };
+    auto saveRegister = [&](Uint index)
+    {
+        BacktrackEntry entry = { Undo_Register, index, registers[index].position, registers[index].loopCount, 0 };
+        stack.push_back(entry);
+    };
+    auto pushChoice = [&](Uint type, const Uint *target, Uint64 position, Uint64 count, Uint64 multiple)
+    {
+        BacktrackEntry entry = { type, (Uint)(target - program), position, count, multiple };
+        stack.push_back(entry);
+    };
+
+#ifdef BYTECODE_COMPUTED_GOTO
+    static const void *const dispatchTable[Op_Count] =
+    {
+        &&op_Match,
+        &&op_Fail,
+        &&op_Jump,
+        &&op_Split,
+        &&op_AnchorStart,
+        &&op_AnchorEnd,
+        &&op_WordBoundary,
+        &&op_WordBoundaryNot,
+        &&op_Repeat,
+        &&op_RepeatBackref,
+        &&op_RepeatConst,
+        &&op_IsPrime,
+        &&op_IsPowerOf2,
+        &&op_GroupBegin,
+        &&op_GroupEnd,
+        &&op_LoopEnd,
+        &&op_IfCaptured,
+        &&op_LookaheadBegin,
+        &&op_LookaheadEnd,
+        &&op_NegativeLookaheadBegin,
+        &&op_NegativeLookaheadEnd,
+    };
+#define DISPATCH goto *dispatchTable[*ip]
+#define OPCODE(name) op_##name
+#else
+#define DISPATCH goto dispatch
+#define OPCODE(name) case Op_##name
+#endif
+
+    for (startPosition=0;; startPosition++)
+    {
+        for (Uint i=0; i<numCaptureGroups; i++)
+            captures[i] = NON_PARTICIPATING_CAPTURE_GROUP;
+        stack.clear();
+        position = startPosition;
+        ip = program;
+
+#ifdef BYTECODE_COMPUTED_GOTO
+        DISPATCH;
+#else
+    dispatch:
+        switch (*ip)
+        {
+#endif
+        OPCODE(Match):
+            matched = true;
+            goto done;
+
+        OPCODE(Fail):
+            goto fail;
+
+        OPCODE(Jump):
+            ip = program + ip[1];
+            DISPATCH;
+
+        OPCODE(Split):
+            pushChoice(Choice_Jump, program + ip[1], position, 0, 0);
+            ip += 2;
+            DISPATCH;
+
+        OPCODE(AnchorStart):
+            if (position != 0)
+                goto fail;
+            ip += 1;
+            DISPATCH;
+
+        OPCODE(AnchorEnd):
+            if (position != input)
+                goto fail;
+            ip += 1;
+            DISPATCH;
+
+        OPCODE(WordBoundary):
+            if (!(basicCharIsWordCharacter && (position==0 || position==input) && input!=0))
+                goto fail;
+            ip += 1;
+            DISPATCH;
+
+        OPCODE(WordBoundaryNot):
+            if (basicCharIsWordCharacter && (position==0 || position==input) && input!=0)
+                goto fail;
+            ip += 1;
+            DISPATCH;
+
+        OPCODE(Repeat):
+            multiple = 1;
+            goto repeat;
+
+        OPCODE(RepeatBackref):
+            multiple = captures[ip[1]];
+            if (multiple == NON_PARTICIPATING_CAPTURE_GROUP)
+            {
+                if (!emulateNPCGs && ip[2] != 0)
+                    goto fail;
+                multiple = 0;
+            }
+            if (multiple == 0) // don't backtrack when it will make no difference to do so
+            {
+                ip += 5;
+                DISPATCH;
+            }
+            goto repeat;
+
+        OPCODE(RepeatConst):
+            {
+                multiple = ip[2];
+                Uint numBackrefs = ip[6];
+                for (Uint i=0; i<numBackrefs; i++)
+                {
+                    Uint64 capture = captures[ip[7 + 2*i]];
+                    if (capture == NON_PARTICIPATING_CAPTURE_GROUP)
+                    {
+                        if (!emulateNPCGs && ip[8 + 2*i] != 0)
+                            goto fail;
+                        capture = 0;
+                    }
+                    multiple += capture * ip[8 + 2*i];
+                }
+                if (multiple == 0 && ip[1] == UINT_MAX)
+                {
+                    ip += 7 + 2*numBackrefs;
+                    DISPATCH;
+                }
+                goto repeat;
+            }
+
+        repeat:
+            {
+                const Uint *operands, *next;
+                Uint backrefIndex;
+                decodeRepeat(ip, operands, next, backrefIndex);
+                Uint minCount = operands[0];
+                Uint64 maxCount = MAX_EXTEND(operands[1]);
+                Uint flags = operands[2];
+                Uint64 count;
+                if (multiple == 0)
+                {
+                    // only reachable by a capturing group of zero length, which matches the same way for every count
+                    count = (flags & RepeatFlag_Lazy) || maxCount == ULLONG_MAX ? minCount : maxCount;
+                    if ((flags & RepeatFlag_ToEnd) && position != input)
+                        goto fail;
+                }
+                else
+                {
+                    Uint64 spaceLeft = input - position;
+                    Uint64 maxFit = spaceLeft / multiple;
+                    if (flags & RepeatFlag_ToEnd)
+                    {
+                        if (spaceLeft % multiple != 0 || !inrange64(maxFit, minCount, maxCount))
+                            goto fail;
+                        count = maxFit;
+                    }
+                    else
+                    if (flags & RepeatFlag_Lazy)
+                    {
+                        count = minCount;
+                        if (count > maxFit)
+                            goto fail;
+                        if (count != maxCount && count != maxFit)
+                            pushChoice(Choice_Repeat, ip, position, count, multiple);
+                    }
+                    else
+                    {
+                        count = maxFit < maxCount ? maxFit : maxCount;
+                        if (count < minCount)
+                            goto fail;
+                        if (count != minCount)
+                            pushChoice(Choice_Repeat, ip, position, count, multiple);
+                    }
+                }
+                position += count * multiple;
+                if (backrefIndex != UINT_MAX && count)
+                    setCapture(backrefIndex, multiple);
+                ip = next;
+                DISPATCH;
+            }
+
+        OPCODE(IsPrime):
+            {
+                Uint64 spaceLeft = input - position;
+                if (!(inrange64(spaceLeft, ip[1], 1) || isPrime(spaceLeft)))
+                    goto fail;
+                ip += 2;
+                DISPATCH;
+            }
+
+        OPCODE(IsPowerOf2):
+            {
+                Uint64 spaceLeft = input - position;
+                if (!((spaceLeft != 0 || ip[1]) && !(spaceLeft & (spaceLeft - 1))))
+                    goto fail;
+                ip += 2;
+                DISPATCH;
+            }
+
+        OPCODE(GroupBegin):
+            saveRegister(ip[1]);
+            registers[ip[1]].loopCount = 1;
+            registers[ip[1]].position  = position;
+            ip += 2;
+            DISPATCH;
+
+        OPCODE(GroupEnd):
+            setCapture(ip[2], position - registers[ip[1]].position);
+            ip += 3;
+            DISPATCH;
+
+        OPCODE(LoopEnd):
+            {
+                // the same decisions, in the same order, as the tree walker makes on reaching the end of a group
+                const Register &reg = registers[ip[1]];
+                Uint minCount = ip[3];
+                Uint64 maxCount = MAX_EXTEND(ip[4]);
+                bool lazy = ip[5] != 0;
+                bool empty = position == reg.position;
+                if (noEmptyOptional && empty && minCount != ip[4] && reg.loopCount > minCount && reg.loopCount <= maxCount)
+                    goto fail;
+                if (lazy && reg.loopCount >= minCount)
+                {
+                    if (!(reg.loopCount == maxCount || empty && maxCount == ULLONG_MAX))
+                        pushChoice(Choice_LoopAgain, ip, position, 0, 0);
+                    goto leaveLoop;
+                }
+                if (reg.loopCount == maxCount || maxCount == ULLONG_MAX && reg.loopCount >= minCount && empty)
+                    goto leaveLoop;
+                if (!lazy && reg.loopCount >= minCount)
+                    pushChoice(Choice_LoopExit, ip, position, 0, 0);
+                goto loopAgain;
+            }
+
+        leaveLoop:
+            if (ip[2] != UINT_MAX)
+                setCapture(ip[2], position - registers[ip[1]].position);
+            ip += 9;
+            DISPATCH;
+
+        loopAgain:
+            {
+                saveRegister(ip[1]);
+                Register &reg = registers[ip[1]];
+                reg.loopCount++;
+                reg.position = position;
+                // captures made inside the group are reset on each iteration, as in ECMAScript
+                for (Uint i=ip[6]; i<ip[6]+ip[7]; i++)
+                    if (captures[i] != NON_PARTICIPATING_CAPTURE_GROUP)
+                        setCapture(i, NON_PARTICIPATING_CAPTURE_GROUP);
+                ip = program + ip[8];
+                DISPATCH;
+            }
+
+        OPCODE(IfCaptured):
+            if (captures[ip[1]] == NON_PARTICIPATING_CAPTURE_GROUP)
+                ip = program + ip[2];
+            else
+                ip += 3;
+            DISPATCH;
+
+        OPCODE(LookaheadBegin):
+            lookarounds[ip[1]] = stack.size();
+            pushChoice(Choice_Lookahead, ip, position, 0, 0);
+            ip += 2;
+            DISPATCH;
+
+        OPCODE(LookaheadEnd):
+            {
+                // atomic: discard the choices made inside the lookahead, but keep what is needed to undo its captures
+                size_t base = lookarounds[ip[1]];
+                position = stack[base].position;
+                size_t top = base;
+                for (size_t i=base+1; i<stack.size(); i++)
+                    if (stack[i].type >= Undo_Capture)
+                        stack[top++] = stack[i];
+                stack.resize(top);
+                ip += 2;
+                DISPATCH;
+            }
+
+        OPCODE(NegativeLookaheadBegin):
+            lookarounds[ip[1]] = stack.size();
+            pushChoice(Choice_NegativeLookahead, program + ip[2], position, 0, 0);
+            ip += 3;
+            DISPATCH;
+
+        OPCODE(NegativeLookaheadEnd):
+            {
+                // a match inside the negative lookahead is a non-match outside it
+                size_t base = lookarounds[ip[1]];
+                while (stack.size() > base)
+                {
+                    const BacktrackEntry &entry = stack.back();
+                    if (entry.type == Undo_Capture)
+                        captures[entry.index] = entry.position;
+                    else
+                    if (entry.type == Undo_Register)
+                    {
+                        registers[entry.index].position  = entry.position;
+                        registers[entry.index].loopCount = entry.count;
+                    }
+                    stack.pop_back();
+                }
+                goto fail;
+            }
+
+#ifndef BYTECODE_COMPUTED_GOTO
+        default:
+            UNREACHABLE_CODE;
+        }
+#endif
+
+    fail:
+        while (!stack.empty())
+        {
+            BacktrackEntry entry = stack.back();
+            stack.pop_back();
+            switch (entry.type)
+            {
+            case Undo_Capture:
+                captures[entry.index] = entry.position;
+                break;
+            case Undo_Register:
+                registers[entry.index].position  = entry.position;
+                registers[entry.index].loopCount = entry.count;
+                break;
+            case Choice_Lookahead:
+                break;
+            case Choice_Jump:
+            case Choice_NegativeLookahead:
+                position = entry.position;
+                ip = program + entry.index;
+                DISPATCH;
+            case Choice_LoopExit:
+                position = entry.position;
+                ip = program + entry.index;
+                goto leaveLoop;
+            case Choice_LoopAgain:
+                position = entry.position;
+                ip = program + entry.index;
+                goto loopAgain;
+            case Choice_Repeat:
+                {
+                    ip = program + entry.index;
+                    const Uint *operands, *next;
+                    Uint backrefIndex;
+                    decodeRepeat(ip, operands, next, backrefIndex);
+                    Uint64 count = entry.count;
+                    if (operands[2] & RepeatFlag_Lazy)
+                    {
+                        count++;
+                        if (count != MAX_EXTEND(operands[1]) && count != (input - entry.position) / entry.multiple)
+                            pushChoice(Choice_Repeat, ip, entry.position, count, entry.multiple);
+                    }
+                    else
+                    {
+                        count--;
+                        if (count != operands[0])
+                            pushChoice(Choice_Repeat, ip, entry.position, count, entry.multiple);
+                    }
+                    position = entry.position + count * entry.multiple;
+                    if (backrefIndex != UINT_MAX && count)
+                        setCapture(backrefIndex, entry.multiple);
+                    ip = next;
+                    DISPATCH;
+                }
+            default:
+                UNREACHABLE_CODE;
+            }
+        }
+
+        if (anchored || onlyAtStart || startPosition == input)
+            break;
+    }
+#undef DISPATCH
+#undef OPCODE
+
+done:
+    if (!matched)
+        returnMatch = 0;
+    else
+    if (returnMatch_backrefIndex == 0)
+        returnMatch = position - startPosition;
+    else
+    if (returnMatch_backrefIndex > numCaptureGroups || captures[returnMatch_backrefIndex - 1] == NON_PARTICIPATING_CAPTURE_GROUP)
+        returnMatch = 0;
+    else
+        returnMatch = captures[returnMatch_backrefIndex - 1];
+    return matched;
+}
+
+Uint RegexBytecode::instructionLength(const Uint *instruction)
+{
+    switch (instruction[0])
+    {
+    case Op_Match: case Op_Fail: case Op_AnchorStart: case Op_AnchorEnd: case Op_WordBoundary: case Op_WordBoundaryNot:
+        return 1;
+    case Op_Jump: case Op_Split: case Op_IsPrime: case Op_IsPowerOf2: case Op_GroupBegin: case Op_LookaheadBegin: case Op_LookaheadEnd: case Op_NegativeLookaheadEnd:
+        return 2;
+    case Op_GroupEnd: case Op_IfCaptured: case Op_NegativeLookaheadBegin:
+        return 3;
+    case Op_Repeat:
+        return 4;
+    case Op_RepeatBackref:
+        return 5;
+    case Op_RepeatConst:
+        return 7 + 2*instruction[6];
+    case Op_LoopEnd:
+        return 9;
+    default:
+        UNREACHABLE_CODE;
+    }
+}
+
+void RegexBytecode::fprintProgram(FILE *f) const
+{
+    static const char *const opcodeNames[Op_Count] =
+    {
+        "Match", "Fail", "Jump", "Split", "AnchorStart", "AnchorEnd", "WordBoundary", "WordBoundaryNot",
+        "Repeat", "RepeatBackref", "RepeatConst", "IsPrime", "IsPowerOf2", "GroupBegin", "GroupEnd", "LoopEnd",
+        "IfCaptured", "LookaheadBegin", "LookaheadEnd", "NegativeLookaheadBegin", "NegativeLookaheadEnd",
+    };
+    for (size_t pc=0; pc<code.size();)
+    {
+        Uint opcode = code[pc];
+        Uint length = instructionLength(&code[pc]);
+        fprintf(f, "%5u: %s", (Uint)pc, opcodeNames[opcode]);
+        for (Uint i=1; i<length; i++)
+        {
+            if (code[pc + i] == UINT_MAX)
+                fputs(" -", f);
+            else
+                fprintf(f, " %u", code[pc + i]);
+        }
+        fputc('\n', f);
+        pc += length;
+    }
+}
+
+void BytecodeBenchmark::record(Uint64 input, bool treeMatched, Uint64 treeReturnMatch, double treeTime, bool bytecodeMatched, Uint64 bytecodeReturnMatch, double bytecodeTime)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    numMatched++;
+    treeSeconds     += treeTime;
+    bytecodeSeconds += bytecodeTime;
+    if (treeMatched != bytecodeMatched || treeMatched && treeReturnMatch != bytecodeReturnMatch)
+    {
+        numMismatches++;
+        fprintf(stderr, "Mismatch on %llu: tree walker ", input);
+        if (treeMatched)
+            fprintf(stderr, "-> %llu", treeReturnMatch);
+        else
+            fputs("no match", stderr);
+        fputs(", bytecode interpreter ", stderr);
+        if (bytecodeMatched)
+            fprintf(stderr, "-> %llu\n", bytecodeReturnMatch);
+        else
+            fputs("no match\n", stderr);
+    }
+}
+
+void BytecodeBenchmark::printStatistics(FILE *f)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    fprintf(f, "Bytecode benchmark: %llu numbers matched, %llu mismatches; tree walker %.3f seconds, bytecode interpreter %.3f seconds (%.2fx)\n",
+        numMatched, numMismatches, treeSeconds, bytecodeSeconds, bytecodeSeconds > 0 ? treeSeconds / bytecodeSeconds : 0.);
+}
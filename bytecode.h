@@ -0,0 +1,100 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include <stdio.h>
+#include <vector>
+#include <mutex>
+
+class BigCount;
+
+enum RegexOpcode
+{
+    Op_Match,
+    Op_Fail,
+    Op_Jump,                 // target
+    Op_Split,                // target; tries target after the code that follows it has failed
+    Op_AnchorStart,
+    Op_AnchorEnd,
+    Op_WordBoundary,
+    Op_WordBoundaryNot,
+    Op_Repeat,               // minCount, maxCount, flags
+    Op_RepeatBackref,        // backrefIndex, minCount, maxCount, flags
+    Op_RepeatConst,          // backrefIndex (UINT_MAX if not capturing), numCharacters, minCount, maxCount, flags, numBackrefs, {backrefIndex, count}...
+    Op_IsPrime,              // lazy
+    Op_IsPowerOf2,           // lazy
+    Op_GroupBegin,           // register
+    Op_GroupEnd,             // register, backrefIndex
+    Op_LoopEnd,              // register, backrefIndex (UINT_MAX if not capturing), minCount, maxCount, lazy, firstInnerBackref, numInnerBackrefs, target
+    Op_IfCaptured,           // backrefIndex, target; jumps to target if the group did not participate
+    Op_LookaheadBegin,       // lookaround
+    Op_LookaheadEnd,         // lookaround
+    Op_NegativeLookaheadBegin, // lookaround, target
+    Op_NegativeLookaheadEnd, // lookaround
+    Op_Count
+};
+
+// A pattern lowered from its symbol tree (after the tree has been prepared for numerical mode, so that the tree
+// walker's static optimizations carry over) into one flat array of instructions, each an opcode followed by its
+// operands. It is run by a backtracking interpreter whose choice points and undo records share a single stack.
+// Only the constructs whose semantics are simple to reproduce exactly are supported; Compile() reports the first one
+// that isn't, so that the caller can keep using the tree walker for that pattern.
+class RegexBytecode
+{
+    enum
+    {
+        RepeatFlag_Lazy  = 1,
+        RepeatFlag_ToEnd = 2, // the repetition is followed by "$", so only the count that reaches the end can match
+    };
+    struct BacktrackEntry;
+    class Counter;
+
+    std::vector<Uint> code;
+    Uint numCaptureGroups;
+    Uint numRegisters; // one per capturing or quantified group, holding its iteration count and where the iteration began
+    Uint numLookarounds;
+    Uint numCapturesCompiled;
+    bool anchored;
+    char basicChar;
+    bool basicCharIsWordCharacter;
+    bool emulateNPCGs;
+    bool noEmptyOptional;
+
+    Uint emit(Uint value)
+    {
+        code.push_back(value);
+        return (Uint)code.size() - 1;
+    }
+    const char *compileAlternatives(RegexGroup *group);
+    const char *compileSymbols(RegexSymbol **symbols);
+    const char *compileGroup(RegexGroup *group);
+    const char *compileRepeat(RegexSymbol **thisSymbol, Uint opcode);
+    static Uint instructionLength(const Uint *instruction);
+public:
+    const char *Compile(RegexGroupRoot &regex, Uint numCaptureGroups, char basicChar); // returns NULL on success, or else a description of what isn't supported
+    bool Match(Uint64 input, Uint returnMatch_backrefIndex, Uint64 &returnMatch, bool onlyAtStart = false) const;
+    bool CountMatches(Uint64 input, BigCount &count) const; // counts what "-X" does without enumerating it, or returns false if it can't; see count.cpp
+    void fprintProgram(FILE *f) const;
+    void EmitCpp(FILE *f, const char *pattern) const; // writes a standalone matcher for this program; see codegen.cpp
+};
+
+// Running totals for "--bytecode-benchmark", which matches every number both ways
+class BytecodeBenchmark
+{
+    std::mutex mutex;
+    Uint64 numMatched, numMismatches;
+    double treeSeconds, bytecodeSeconds;
+public:
+    BytecodeBenchmark() : numMatched(0), numMismatches(0), treeSeconds(0), bytecodeSeconds(0)
+    {
+    }
+    void record(Uint64 input, bool treeMatched, Uint64 treeReturnMatch, double treeTime, bool bytecodeMatched, Uint64 bytecodeReturnMatch, double bytecodeTime);
+    void printStatistics(FILE *f);
+};
@@ -0,0 +1,163 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "tools.h"
+#include "cache.h"
+
+#define CACHE_FILE_SIGNATURE "#regex-cache"
+#define CACHE_FILE_VERSION   1
+
+// finalizer from MurmurHash3
+static inline Uint64 mix64(Uint64 h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDuLL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53uLL;
+    h ^= h >> 33;
+    return h;
+}
+
+ResultCache::ResultCache(Uint64 key, size_t capacity)
+    : key(key), capacity(capacity), slots(NULL), numSlots(0), numLookups(0), numMemoryHits(0), numFileHits(0)
+{
+}
+
+int ResultCache::openFile(const char *filename)
+{
+    if (file.open(filename, sizeof(FileHeader) + DEFAULT_FILE_SLOTS * sizeof(FileSlot)))
+    {
+        fprintf(stderr, "Error opening cache file \"%s\"\n", filename);
+        return -1;
+    }
+    FileHeader *header = (FileHeader*)file.getData();
+    Uint64 fileSlots = (file.getSize() - sizeof(FileHeader)) / sizeof(FileSlot);
+    if (header->signature[0] == '\0')
+    {
+        // a newly created file
+        strcpy(header->signature, CACHE_FILE_SIGNATURE);
+        header->version = CACHE_FILE_VERSION;
+        header->key = key;
+        header->numSlots = fileSlots;
+    }
+    else
+    if (strncmp(header->signature, CACHE_FILE_SIGNATURE, sizeof(header->signature)) != 0 || header->version != CACHE_FILE_VERSION ||
+        header->numSlots == 0 || header->numSlots > fileSlots)
+    {
+        fprintf(stderr, "Error: \"%s\" is not a valid cache file\n", filename);
+        file.close();
+        return -1;
+    }
+    else
+    if (header->key != key)
+    {
+        fprintf(stderr, "Error: Cache file \"%s\" was written for a different pattern or different options\n", filename);
+        file.close();
+        return -1;
+    }
+    slots = (FileSlot*)(header + 1);
+    numSlots = header->numSlots;
+    return 0;
+}
+
+Uint64 ResultCache::slotCheck(Uint64 input, Uint64 returnMatch, bool matched)
+{
+    return (mix64(key ^ mix64(input) ^ mix64(returnMatch + 1)) & ~(Uint64)3) | 2 | (matched ? 1 : 0);
+}
+
+void ResultCache::remember(Uint64 input, bool matched, Uint64 returnMatch)
+{
+    if (!capacity)
+        return;
+    if (entries.size() >= capacity)
+    {
+        entries.erase(lru.back().input);
+        lru.pop_back();
+    }
+    Entry entry = { input, returnMatch, matched };
+    lru.push_front(entry);
+    entries[input] = lru.begin();
+}
+
+bool ResultCache::lookup(Uint64 input, bool &matched, Uint64 &returnMatch)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    numLookups++;
+
+    auto found = entries.find(input);
+    if (found != entries.end())
+    {
+        lru.splice(lru.begin(), lru, found->second);
+        matched     = found->second->matched;
+        returnMatch = found->second->returnMatch;
+        numMemoryHits++;
+        return true;
+    }
+
+    if (slots)
+    {
+        Uint64 home = mix64(key ^ input) % numSlots;
+        for (Uint i=0; i<MAX_PROBES; i++)
+        {
+            // copy the slot first, since another process may be writing to it
+            FileSlot slot = slots[(home + i) % numSlots];
+            if (slot.check == 0)
+                break;
+            if (slot.input == input && (slot.check & ~(Uint64)1) == (slotCheck(input, slot.returnMatch, false) & ~(Uint64)1))
+            {
+                matched     = (slot.check & 1) != 0;
+                returnMatch = slot.returnMatch;
+                numFileHits++;
+                remember(input, matched, returnMatch);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ResultCache::store(Uint64 input, bool matched, Uint64 returnMatch)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (entries.find(input) == entries.end())
+        remember(input, matched, returnMatch);
+
+    if (slots)
+    {
+        // take the first empty slot in the probe sequence, or else evict whatever is in the home slot
+        Uint64 home = mix64(key ^ input) % numSlots;
+        FileSlot *slot = &slots[home];
+        for (Uint i=0; i<MAX_PROBES; i++)
+        {
+            FileSlot *probe = &slots[(home + i) % numSlots];
+            if (probe->check == 0 || probe->input == input)
+            {
+                slot = probe;
+                break;
+            }
+        }
+        slot->check = 0;
+        slot->input = input;
+        slot->returnMatch = returnMatch;
+        slot->check = slotCheck(input, returnMatch, matched);
+    }
+}
+
+void ResultCache::printStatistics(FILE *f)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Uint64 numHits = numMemoryHits + numFileHits;
+    fprintf(f, "Result cache: %llu lookups, %llu hits (%llu in memory, %llu in file), %llu misses; hit rate %.1f%%\n",
+        numLookups, numHits, numMemoryHits, numFileHits, numLookups - numHits, numLookups ? 100. * numHits / numLookups : 0.);
+}
@@ -0,0 +1,70 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+// Memoized results of matching numbers against one pattern with one set of options, identified by a key that the
+// caller makes from them. The most recently used results are kept in memory, up to a limit. Optionally they are also
+// kept in a memory-mapped file, so that they carry over from one run to the next and are shared between processes.
+// The file is a hash table that simply overwrites old results when it fills up. Safe to use from multiple threads.
+class ResultCache
+{
+public:
+    enum
+    {
+        DEFAULT_CAPACITY   = 1<<16,
+        DEFAULT_FILE_SLOTS = 1<<20,
+    };
+
+private:
+    enum { MAX_PROBES = 4 };
+    struct Entry
+    {
+        Uint64 input;
+        Uint64 returnMatch;
+        bool matched;
+    };
+    struct FileHeader
+    {
+        char signature[16];
+        Uint32 version;
+        Uint32 reserved;
+        Uint64 key;
+        Uint64 numSlots;
+    };
+    struct FileSlot
+    {
+        Uint64 input;
+        Uint64 returnMatch;
+        Uint64 check; // zero for an empty slot; otherwise validates the other fields, and records whether input matched
+    };
+
+    Uint64 key;
+    size_t capacity;
+    std::list<Entry> lru; // most recently used first
+    std::unordered_map<Uint64, std::list<Entry>::iterator> entries;
+    MappedFile file;
+    FileSlot *slots;
+    Uint64 numSlots;
+    std::mutex mutex;
+    Uint64 numLookups, numMemoryHits, numFileHits;
+
+    Uint64 slotCheck(Uint64 input, Uint64 returnMatch, bool matched);
+    void remember(Uint64 input, bool matched, Uint64 returnMatch);
+public:
+    ResultCache(Uint64 key, size_t capacity);
+    int openFile(const char *filename);
+    bool lookup(Uint64 input, bool &matched, Uint64 &returnMatch);
+    void store(Uint64 input, bool matched, Uint64 returnMatch);
+    void printStatistics(FILE *f);
+};
@@ -0,0 +1,568 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include <stdarg.h>
+#include <string.h>
+#include <string>
+#include "regex.h"
+#include "bytecode.h"
+#include "sweep.h"
+#include "codegen.h"
+
+#ifdef _MSC_VER
+#define popen  _popen
+#define pclose _pclose
+#endif
+
+// The generated matcher is the bytecode program with each instruction turned into a block of code, its operands
+// written in as constants, and the dispatch between instructions replaced by falling through or by goto. Backtracking
+// uses the same stack of choice points and undo records as the interpreter, except that a choice point names the
+// piece of code that resumes it instead of an instruction to be decoded again.
+
+static void appendf(std::string &s, const char *format, ...)
+{
+    char buf[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    s += buf;
+}
+
+static std::string countConstant(Uint count)
+{
+    if (count == UINT_MAX)
+        return "ULLONG_MAX";
+    char buf[32];
+    sprintf(buf, "%u", count);
+    return buf;
+}
+
+void RegexBytecode::EmitCpp(FILE *f, const char *pattern) const
+{
+    std::string body;
+    std::vector<std::string> resumes; // the code run on backtracking to each choice point, indexed by the number it is pushed with
+    bool usesIsPrime = false;
+
+    auto newResume = [&](const std::string &code) -> Uint
+    {
+        resumes.push_back(code);
+        return (Uint)resumes.size() - 1;
+    };
+    auto resumeAt = [&](Uint target) -> Uint
+    {
+        std::string code;
+        appendf(code, "goto pc_%u;", target);
+        return newResume(code);
+    };
+
+    for (Uint pc=0; pc<code.size(); pc+=instructionLength(&code[pc]))
+    {
+        const Uint *ip = &code[pc];
+        Uint next = pc + instructionLength(ip);
+        appendf(body, "    pc_%u:\n", pc);
+        switch (ip[0])
+        {
+        case Op_Match:
+            body += "        matched = true;\n"
+                    "        goto done;\n";
+            break;
+        case Op_Fail:
+            body += "        goto fail;\n";
+            break;
+        case Op_Jump:
+            appendf(body, "        goto pc_%u;\n", ip[1]);
+            break;
+        case Op_Split:
+            appendf(body, "        PUSH(Choice_Resume, %u, position, 0, 0);\n", resumeAt(ip[1]));
+            break;
+        case Op_AnchorStart:
+            body += "        if (position != 0)\n"
+                    "            goto fail;\n";
+            break;
+        case Op_AnchorEnd:
+            body += "        if (position != input)\n"
+                    "            goto fail;\n";
+            break;
+        case Op_WordBoundary:
+            if (basicCharIsWordCharacter)
+                body += "        if (!((position == 0 || position == input) && input != 0))\n"
+                        "            goto fail;\n";
+            else
+                body += "        goto fail;\n";
+            break;
+        case Op_WordBoundaryNot:
+            if (basicCharIsWordCharacter)
+                body += "        if ((position == 0 || position == input) && input != 0)\n"
+                        "            goto fail;\n";
+            break;
+        case Op_Repeat:
+        case Op_RepeatBackref:
+        case Op_RepeatConst:
+            {
+                const Uint *operands = ip + (ip[0] == Op_Repeat ? 1 : ip[0] == Op_RepeatBackref ? 2 : 3);
+                Uint minCount = operands[0];
+                std::string maxCount = countConstant(operands[1]);
+                Uint flags = operands[2];
+                Uint backrefIndex = ip[0] == Op_RepeatConst ? ip[1] : UINT_MAX;
+
+                body += "        {\n";
+                if (ip[0] == Op_Repeat)
+                    body += "            const Uint64 multiple = 1;\n";
+                else
+                if (ip[0] == Op_RepeatBackref)
+                {
+                    appendf(body, "            Uint64 multiple = captures[%u];\n", ip[1]);
+                    if (!emulateNPCGs && minCount != 0)
+                        appendf(body, "            if (multiple == NPCG)\n"
+                                      "                goto fail;\n"
+                                      "            if (multiple == 0)\n"
+                                      "                goto pc_%u;\n", next);
+                    else
+                        appendf(body, "            if (multiple == NPCG || multiple == 0)\n"
+                                      "                goto pc_%u;\n", next);
+                }
+                else
+                {
+                    appendf(body, "            Uint64 multiple = %u;\n", ip[2]);
+                    for (Uint i=0; i<ip[6]; i++)
+                    {
+                        Uint index = ip[7 + 2*i], count = ip[8 + 2*i];
+                        if (!emulateNPCGs && count != 0)
+                            appendf(body, "            if (captures[%u] == NPCG)\n"
+                                          "                goto fail;\n"
+                                          "            multiple += captures[%u] * %u;\n", index, index, count);
+                        else
+                        if (count != 0)
+                            appendf(body, "            if (captures[%u] != NPCG)\n"
+                                          "                multiple += captures[%u] * %u;\n", index, index, count);
+                    }
+                    if (backrefIndex == UINT_MAX)
+                        appendf(body, "            if (multiple == 0)\n"
+                                      "                goto pc_%u;\n", next);
+                    else
+                    {
+                        // a capturing group of zero length matches the same way for every count
+                        Uint64 count = (flags & RepeatFlag_Lazy) || operands[1] == UINT_MAX ? minCount : operands[1];
+                        body += "            if (multiple == 0)\n"
+                                "            {\n";
+                        if (flags & RepeatFlag_ToEnd)
+                            body += "                if (position != input)\n"
+                                    "                    goto fail;\n";
+                        if (count)
+                            appendf(body, "                SET_CAPTURE(%u, 0);\n", backrefIndex);
+                        appendf(body, "                goto pc_%u;\n"
+                                      "            }\n", next);
+                    }
+                }
+
+                body += "            Uint64 count;\n"
+                        "            Uint64 maxFit = (input - position) / multiple;\n";
+                if (flags & RepeatFlag_ToEnd)
+                    appendf(body, "            if ((input - position) %% multiple != 0 || !inrange64(maxFit, %u, %s))\n"
+                                  "                goto fail;\n"
+                                  "            count = maxFit;\n", minCount, maxCount.c_str());
+                else
+                {
+                    std::string resume;
+                    if (flags & RepeatFlag_Lazy)
+                        appendf(resume, "{\n"
+                                        "                        Uint64 count = entry.count + 1;\n"
+                                        "                        if (count != %s && count != (input - entry.position) / entry.multiple)\n", maxCount.c_str());
+                    else
+                        appendf(resume, "{\n"
+                                        "                        Uint64 count = entry.count - 1;\n"
+                                        "                        if (count != %u)\n", minCount);
+                    Uint resumeNumber = (Uint)resumes.size();
+                    appendf(resume, "                            PUSH(Choice_Resume, %u, entry.position, count, entry.multiple);\n"
+                                    "                        Uint64 multiple = entry.multiple;\n"
+                                    "                        position = entry.position + count * multiple;\n", resumeNumber);
+                    if (backrefIndex != UINT_MAX)
+                        appendf(resume, "                        if (count)\n"
+                                        "                            SET_CAPTURE(%u, multiple);\n", backrefIndex);
+                    appendf(resume, "                        goto pc_%u;\n"
+                                    "                    }", next);
+                    newResume(resume);
+
+                    if (flags & RepeatFlag_Lazy)
+                        appendf(body, "            count = %u;\n"
+                                      "            if (count > maxFit)\n"
+                                      "                goto fail;\n"
+                                      "            if (count != %s && count != maxFit)\n"
+                                      "                PUSH(Choice_Resume, %u, position, count, multiple);\n", minCount, maxCount.c_str(), resumeNumber);
+                    else
+                        appendf(body, "            count = maxFit < %s ? maxFit : %s;\n"
+                                      "            if (count < %u)\n"
+                                      "                goto fail;\n"
+                                      "            if (count != %u)\n"
+                                      "                PUSH(Choice_Resume, %u, position, count, multiple);\n", maxCount.c_str(), maxCount.c_str(), minCount, minCount, resumeNumber);
+                }
+                body += "            position += count * multiple;\n";
+                if (backrefIndex != UINT_MAX)
+                    appendf(body, "            if (count)\n"
+                                  "                SET_CAPTURE(%u, multiple);\n", backrefIndex);
+                body += "        }\n";
+                break;
+            }
+        case Op_IsPrime:
+            usesIsPrime = true;
+            appendf(body, "        if (!(inrange64(input - position, %u, 1) || isPrime(input - position)))\n"
+                          "            goto fail;\n", ip[1]);
+            break;
+        case Op_IsPowerOf2:
+            appendf(body, "        if (%s((input - position) & (input - position - 1)))\n"
+                          "            goto fail;\n", ip[1] ? "" : "input == position || ");
+            break;
+        case Op_GroupBegin:
+            appendf(body, "        SAVE_REGISTER(%u);\n"
+                          "        registerCount[%u] = 1;\n"
+                          "        registerPosition[%u] = position;\n", ip[1], ip[1], ip[1]);
+            break;
+        case Op_GroupEnd:
+            appendf(body, "        SET_CAPTURE(%u, position - registerPosition[%u]);\n", ip[2], ip[1]);
+            break;
+        case Op_LoopEnd:
+            {
+                // the same decisions, in the same order, as RegexBytecode::Match makes
+                Uint reg = ip[1], minCount = ip[3];
+                std::string maxCount = countConstant(ip[4]);
+                bool lazy = ip[5] != 0;
+                body += "        {\n";
+                appendf(body, "            bool empty = position == registerPosition[%u];\n", reg);
+                if (noEmptyOptional && minCount != ip[4])
+                    appendf(body, "            if (empty && registerCount[%u] > %u && registerCount[%u] <= %s)\n"
+                                  "                goto fail;\n", reg, minCount, reg, maxCount.c_str());
+                if (lazy)
+                {
+                    std::string loopAgain;
+                    appendf(loopAgain, "goto again_%u;", pc);
+                    appendf(body, "            if (registerCount[%u] >= %u)\n"
+                                  "            {\n", reg, minCount);
+                    if (ip[4] == UINT_MAX)
+                        body += "                if (!empty)\n";
+                    else
+                        appendf(body, "                if (registerCount[%u] != %s)\n", reg, maxCount.c_str());
+                    appendf(body, "                    PUSH(Choice_Resume, %u, position, 0, 0);\n"
+                                  "                goto leave_%u;\n"
+                                  "            }\n", newResume(loopAgain), pc);
+                }
+                else
+                {
+                    std::string loopExit;
+                    appendf(loopExit, "goto leave_%u;", pc);
+                    if (ip[4] == UINT_MAX)
+                        appendf(body, "            if (registerCount[%u] >= %u && empty)\n", reg, minCount);
+                    else
+                        appendf(body, "            if (registerCount[%u] == %s)\n", reg, maxCount.c_str());
+                    appendf(body, "                goto leave_%u;\n"
+                                  "            if (registerCount[%u] >= %u)\n"
+                                  "                PUSH(Choice_Resume, %u, position, 0, 0);\n", pc, reg, minCount, newResume(loopExit));
+                }
+                appendf(body, "        }\n"
+                              "        goto again_%u;\n"
+                              "    leave_%u:\n", pc, pc);
+                if (ip[2] != UINT_MAX)
+                    appendf(body, "        SET_CAPTURE(%u, position - registerPosition[%u]);\n", ip[2], reg);
+                appendf(body, "        goto pc_%u;\n"
+                              "    again_%u:\n"
+                              "        SAVE_REGISTER(%u);\n"
+                              "        registerCount[%u]++;\n"
+                              "        registerPosition[%u] = position;\n", next, pc, reg, reg, reg);
+                for (Uint i=ip[6]; i<ip[6]+ip[7]; i++)
+                    appendf(body, "        if (captures[%u] != NPCG)\n"
+                                  "            SET_CAPTURE(%u, NPCG);\n", i, i);
+                appendf(body, "        goto pc_%u;\n", ip[8]);
+                break;
+            }
+        case Op_IfCaptured:
+            appendf(body, "        if (captures[%u] == NPCG)\n"
+                          "            goto pc_%u;\n", ip[1], ip[2]);
+            break;
+        case Op_LookaheadBegin:
+            appendf(body, "        lookarounds[%u] = stack.size();\n"
+                          "        PUSH(Choice_Lookahead, 0, position, 0, 0);\n", ip[1]);
+            break;
+        case Op_LookaheadEnd:
+            appendf(body, "        {\n"
+                          "            size_t base = lookarounds[%u];\n"
+                          "            position = stack[base].position;\n"
+                          "            size_t top = base;\n"
+                          "            for (size_t i=base+1; i<stack.size(); i++)\n"
+                          "                if (stack[i].type <= Undo_Register)\n"
+                          "                    stack[top++] = stack[i];\n"
+                          "            stack.resize(top);\n"
+                          "        }\n", ip[1]);
+            break;
+        case Op_NegativeLookaheadBegin:
+            appendf(body, "        lookarounds[%u] = stack.size();\n"
+                          "        PUSH(Choice_Resume, %u, position, 0, 0);\n", ip[1], resumeAt(ip[2]));
+            break;
+        case Op_NegativeLookaheadEnd:
+            appendf(body, "        while (stack.size() > lookarounds[%u])\n"
+                          "            undo();\n"
+                          "        goto fail;\n", ip[1]);
+            break;
+        default:
+            UNREACHABLE_CODE;
+        }
+    }
+
+    fprintf(f, "// Generated by \"regex --emit-cpp\" from the pattern:\n//   ");
+    for (const char *s = pattern; *s; s++)
+    {
+        if (*s == '\n')
+            fputs("\n//   ", f);
+        else
+        if (*s != '\r')
+            fputc(*s, f);
+    }
+    fprintf(f, "\n"
+               "// to be matched in numerical mode with the basic character '%c', --npcg%c and --neo%c.\n"
+               "//\n"
+               "// Build it with the regex sources on the include path:\n"
+               "//   g++ -O3 -I<regex source directory> <this file>%s\n"
+               "// Running it with a range NUM0..NUM1 prints the numbers in that range that match, as \"regex -t\" does.\n"
+               "// \"regex --check-cpp=<program>\" runs it with \"--check\" to compare it with the tree walker.\n"
+               "\n"
+               "#include <stdio.h>\n"
+               "#include <stdlib.h>\n"
+               "#include <string.h>\n"
+               "#include <limits.h>\n"
+               "#include <vector>\n"
+               "#include <chrono>\n"
+               "#include \"tools.h\"\n"
+               "#include \"math-optimization.h\"\n"
+               "\n"
+               "#ifdef __GNUC__\n"
+               "#pragma GCC diagnostic ignored \"-Wunused-label\"\n"
+               "#pragma GCC diagnostic ignored \"-Wunused-variable\" // lookarounds[], if the pattern has none\n"
+               "#endif\n"
+               "\n"
+               "#define NPCG ULLONG_MAX\n"
+               "\n"
+               "enum\n"
+               "{\n"
+               "    Undo_Capture,     // index = backrefIndex; position = previous value\n"
+               "    Undo_Register,    // index = register; position, count = previous values\n"
+               "    Choice_Lookahead, // marks where a lookahead began\n"
+               "    Choice_Resume,    // index = which piece of code resumes it\n"
+               "};\n"
+               "\n"
+               "struct BacktrackEntry\n"
+               "{\n"
+               "    Uint type;\n"
+               "    Uint index;\n"
+               "    Uint64 position;\n"
+               "    Uint64 count;\n"
+               "    Uint64 multiple;\n"
+               "};\n"
+               "\n"
+               "static bool matchPattern(Uint64 input, Uint returnMatch_backrefIndex, Uint64 &returnMatch)\n"
+               "{\n"
+               "    static thread_local std::vector<BacktrackEntry> stack;\n"
+               "    Uint64 captures[%u];\n"
+               "    Uint64 registerCount[%u] = {}, registerPosition[%u] = {}; // zeroed only because SAVE_REGISTER copies a register before its group first sets it\n"
+               "    size_t lookarounds[%u];\n"
+               "    Uint64 position, startPosition;\n"
+               "    bool matched = false;\n"
+               "\n"
+               "#define PUSH(type, index, position, count, multiple) do { BacktrackEntry entry_ = { type, index, position, count, multiple }; stack.push_back(entry_); } while (0)\n"
+               "#define SET_CAPTURE(index, value) do { PUSH(Undo_Capture, index, captures[index], 0, 0); captures[index] = (value); } while (0)\n"
+               "#define SAVE_REGISTER(index) PUSH(Undo_Register, index, registerPosition[index], registerCount[index], 0)\n"
+               "    auto undo = [&]()\n"
+               "    {\n"
+               "        const BacktrackEntry &entry = stack.back();\n"
+               "        if (entry.type == Undo_Capture)\n"
+               "            captures[entry.index] = entry.position;\n"
+               "        else\n"
+               "        if (entry.type == Undo_Register)\n"
+               "        {\n"
+               "            registerPosition[entry.index] = entry.position;\n"
+               "            registerCount   [entry.index] = entry.count;\n"
+               "        }\n"
+               "        stack.pop_back();\n"
+               "    };\n"
+               "\n"
+               "    for (startPosition=0;; startPosition++)\n"
+               "    {\n"
+               "        for (Uint i=0; i<%u; i++)\n"
+               "            captures[i] = NPCG;\n"
+               "        stack.clear();\n"
+               "        position = startPosition;\n"
+               "\n",
+        basicChar, emulateNPCGs ? '+' : '-', noEmptyOptional ? '+' : '-',
+        usesIsPrime ? " <regex source directory>/math-optimization.cpp" : "",
+        numCaptureGroups ? numCaptureGroups : 1, numRegisters ? numRegisters : 1, numRegisters ? numRegisters : 1, numLookarounds ? numLookarounds : 1,
+        numCaptureGroups);
+
+    fputs(body.c_str(), f);
+
+    fprintf(f, "\n"
+               "    fail:\n"
+               "        while (!stack.empty())\n"
+               "        {\n"
+               "            if (stack.back().type != Choice_Resume)\n"
+               "            {\n"
+               "                undo();\n"
+               "                continue;\n"
+               "            }\n"
+               "            BacktrackEntry entry = stack.back();\n"
+               "            stack.pop_back();\n"
+               "            position = entry.position;\n"
+               "            switch (entry.index)\n"
+               "            {\n");
+    for (size_t i=0; i<resumes.size(); i++)
+        fprintf(f, "                case %u: %s\n", (Uint)i, resumes[i].c_str());
+    fprintf(f, "            }\n"
+               "        }\n"
+               "%s"
+               "    }\n"
+               "\n"
+               "done:\n"
+               "    if (!matched)\n"
+               "        returnMatch = 0;\n"
+               "    else\n"
+               "    if (returnMatch_backrefIndex == 0)\n"
+               "        returnMatch = position - startPosition;\n"
+               "    else\n"
+               "    if (returnMatch_backrefIndex > %u || captures[returnMatch_backrefIndex - 1] == NPCG)\n"
+               "        returnMatch = 0;\n"
+               "    else\n"
+               "        returnMatch = captures[returnMatch_backrefIndex - 1];\n"
+               "    return matched;\n"
+               "}\n"
+               "\n"
+               "int main(int argc, char *argv[])\n"
+               "{\n"
+               "    if (argc == 6 && strcmp(argv[1], \"--check\")==0)\n"
+               "    {\n"
+               "        // NUM0 INC LASTOFFSET BACKREF: match NUM0, NUM0+INC, ... and print each result, then the time taken\n"
+               "        Uint64 number0    = strtoull(argv[2], NULL, 10);\n"
+               "        bool descending   = strtoll(argv[3], NULL, 10) < 0;\n"
+               "        Uint64 lastOffset = strtoull(argv[4], NULL, 10);\n"
+               "        Uint backrefIndex = (Uint)strtoul(argv[5], NULL, 10);\n"
+               "        enum { CHUNK = 1<<16 };\n"
+               "        std::vector<Uint64> returnMatches(CHUNK);\n"
+               "        std::vector<char> matches(CHUNK);\n"
+               "        double seconds = 0;\n"
+               "        for (Uint64 offset=0;;)\n"
+               "        {\n"
+               "            Uint64 chunk = lastOffset - offset < CHUNK ? lastOffset - offset + 1 : CHUNK;\n"
+               "            std::chrono::steady_clock::time_point time0 = std::chrono::steady_clock::now();\n"
+               "            for (Uint64 i=0; i<chunk; i++)\n"
+               "                matches[i] = matchPattern(descending ? number0 - (offset + i) : number0 + (offset + i), backrefIndex, returnMatches[i]);\n"
+               "            seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - time0).count();\n"
+               "            for (Uint64 i=0; i<chunk; i++)\n"
+               "                printf(\"%%d %%llu\\n\", matches[i], returnMatches[i]);\n"
+               "            if (lastOffset - offset < CHUNK)\n"
+               "                break;\n"
+               "            offset += chunk;\n"
+               "        }\n"
+               "        printf(\"time %%.9f\\n\", seconds);\n"
+               "        return 0;\n"
+               "    }\n"
+               "    if (argc == 2)\n"
+               "    {\n"
+               "        char *end;\n"
+               "        Uint64 number0 = strtoull(argv[1], &end, 10);\n"
+               "        Uint64 number1 = number0;\n"
+               "        if (end[0] == '.' && end[1] == '.')\n"
+               "            number1 = strtoull(end + 2, &end, 10);\n"
+               "        if (end != argv[1] && *end == '\\0')\n"
+               "        {\n"
+               "            for (Uint64 n=number0;; n += number0 <= number1 ? 1 : -1)\n"
+               "            {\n"
+               "                Uint64 returnMatch;\n"
+               "                if (matchPattern(n, 0, returnMatch))\n"
+               "                    printf(\"%%llu\\n\", n);\n"
+               "                if (n == number1)\n"
+               "                    break;\n"
+               "            }\n"
+               "            return 0;\n"
+               "        }\n"
+               "    }\n"
+               "    fprintf(stderr, \"Usage: %%s NUM0[..NUM1]\\n\", argv[0]);\n"
+               "    return -1;\n"
+               "}\n",
+        anchored ? "        break;\n" : "        if (startPosition == input)\n"
+                                        "            break;\n",
+        numCaptureGroups);
+}
+
+int64 checkGeneratedMatcher(const char *program, SweepRange &range, Uint returnMatch_backrefIndex, const std::function<bool(Uint64 input, Uint64 &returnMatch)> &match)
+{
+    enum { CHUNK = 1<<16 };
+
+    std::string command;
+    appendf(command, "\"%s\" --check %llu %d %llu %u", program, range.testNum0, range.testNumInc < 0 ? -1 : 1, range.lastOffset(), returnMatch_backrefIndex);
+    FILE *results = popen(command.c_str(), "r");
+    if (!results)
+    {
+        fprintf(stderr, "Error running \"%s\"\n", program);
+        return -1;
+    }
+
+    std::vector<Uint64> returnMatches(CHUNK);
+    std::vector<char> matches(CHUNK);
+    double treeSeconds = 0, generatedSeconds = 0;
+    int64 numMismatches = 0;
+    Uint64 numChecked = 0;
+    for (Uint64 offset=0;;)
+    {
+        Uint64 lastOffset = range.lastOffset();
+        Uint64 chunk = lastOffset - offset < CHUNK ? lastOffset - offset + 1 : CHUNK;
+        std::chrono::steady_clock::time_point time0 = std::chrono::steady_clock::now();
+        for (Uint64 i=0; i<chunk; i++)
+            matches[i] = match(range.numberAt(offset + i), returnMatches[i]);
+        treeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - time0).count();
+
+        for (Uint64 i=0; i<chunk; i++)
+        {
+            int generatedMatched;
+            Uint64 generatedReturnMatch;
+            if (fscanf(results, "%d %llu", &generatedMatched, &generatedReturnMatch) != 2)
+            {
+                fprintf(stderr, "Error: \"%s\" did not produce the expected output\n", program);
+                pclose(results);
+                return -1;
+            }
+            if (!!generatedMatched != !!matches[i] || matches[i] && generatedReturnMatch != returnMatches[i])
+            {
+                numMismatches++;
+                fprintf(stderr, "Mismatch on %llu: tree walker ", range.numberAt(offset + i));
+                if (matches[i])
+                    fprintf(stderr, "-> %llu", returnMatches[i]);
+                else
+                    fputs("no match", stderr);
+                fputs(", generated matcher ", stderr);
+                if (generatedMatched)
+                    fprintf(stderr, "-> %llu\n", generatedReturnMatch);
+                else
+                    fputs("no match\n", stderr);
+            }
+        }
+        numChecked += chunk;
+        if (lastOffset - offset < CHUNK)
+            break;
+        offset += chunk;
+    }
+    if (fscanf(results, " time %lf", &generatedSeconds) != 1)
+    {
+        fprintf(stderr, "Error: \"%s\" did not produce the expected output\n", program);
+        pclose(results);
+        return -1;
+    }
+    pclose(results);
+
+    fprintf(stderr, "Generated matcher check: %llu numbers matched, %lld mismatches; tree walker %.3f seconds, generated matcher %.3f seconds (%.2fx)\n",
+        numChecked, numMismatches, treeSeconds, generatedSeconds, generatedSeconds > 0 ? treeSeconds / generatedSeconds : 0.);
+    return numMismatches;
+}
@@ -0,0 +1,17 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include <functional>
+
+// Runs a matcher program written by "--emit-cpp" (and compiled separately) over the given range, matches the same
+// numbers with the supplied function, and reports to standard error every number on which the two disagree, along
+// with the time each took. Returns the number of disagreements, or -1 if the program couldn't be run.
+int64 checkGeneratedMatcher(const char *program, SweepRange &range, Uint returnMatch_backrefIndex, const std::function<bool(Uint64 input, Uint64 &returnMatch)> &match);
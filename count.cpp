@@ -0,0 +1,685 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include <string.h>
+#include "regex.h"
+#include "matcher.h"
+#include "math-optimization.h"
+#include "bytecode.h"
+#include "count.h"
+
+BigCount &BigCount::operator+=(const BigCount &other)
+{
+    Uint64 sum = low + other.low;
+    Uint64 carry = sum < low;
+    low = sum;
+    if (high.size() < other.high.size())
+        high.resize(other.high.size(), 0);
+    for (size_t i=0; i<high.size(); i++)
+    {
+        Uint64 digit = i < other.high.size() ? other.high[i] : 0;
+        if (!carry && !digit && i >= other.high.size())
+            return *this;
+        sum = high[i] + digit;
+        Uint64 carryOut = sum < digit;
+        sum += carry;
+        carryOut |= sum < carry;
+        high[i] = sum;
+        carry = carryOut;
+    }
+    if (carry)
+        high.push_back(1);
+    return *this;
+}
+
+std::string BigCount::toString() const
+{
+    if (high.empty())
+        return std::to_string(low);
+
+    // divide repeatedly by 10^9, working in halves of each digit so that nothing wider than 64 bits is needed
+    std::vector<Uint> n; // each holding 32 bits; Uint32 is a long, which can be wider
+    n.push_back((Uint)low);
+    n.push_back((Uint)(low >> 32));
+    for (Uint64 digit : high)
+    {
+        n.push_back((Uint)digit);
+        n.push_back((Uint)(digit >> 32));
+    }
+    std::vector<Uint> groups; // of nine decimal digits, least significant first
+    while (!n.empty())
+    {
+        Uint64 remainder = 0;
+        for (size_t i=n.size(); i-->0;)
+        {
+            Uint64 current = remainder << 32 | n[i];
+            n[i] = (Uint)(current / 1000000000);
+            remainder = current % 1000000000;
+        }
+        groups.push_back((Uint)remainder);
+        while (!n.empty() && n.back() == 0)
+            n.pop_back();
+    }
+    std::string s = std::to_string(groups.back());
+    for (size_t i=groups.size()-1; i-->0;)
+    {
+        char buf[16];
+        sprintf(buf, "%09u", groups[i]);
+        s += buf;
+    }
+    return s;
+}
+
+// Counting possible matches by enumeration backtracks into every one of them, so it takes time proportional to their
+// number, which can grow exponentially with the input. But what can still happen after the interpreter reaches an
+// instruction depends only on the position, the registers and the captures at that point, so the matches that follow
+// from each such state need only be counted once, and the count of every state that leads to it is just the sum of
+// the counts of the states each of its choices leads to. Parts of that state that can't affect anything still to come
+// are left out, so that more paths arrive at the same one: a register outside its group, the iteration count of a loop
+// beyond the number at which its decisions stop changing, where an iteration began beyond whether it has advanced
+// (unless the group is captured into a capture that is read), and every capture that no backreference or conditional
+// reads. Only choice points are memoized; everything between them is run straight through.
+//
+// A lookahead matches only the first way it can, which isn't a property of the state it starts from that can be summed,
+// so patterns containing one are always counted by enumeration; so is any number whose states don't fit in the memory
+// allowed for them.
+
+static const size_t maxCountingMemory = (size_t)256 << 20;
+
+enum
+{
+    CountState_New,
+    CountState_Expanding,
+    CountState_Done,
+};
+
+class RegexBytecode::Counter
+{
+    enum AdvanceResult
+    {
+        Advance_Match,
+        Advance_Fail,
+        Advance_Choice, // stopped at a choice point with more than one way to continue
+    };
+    struct Register
+    {
+        Uint64 loopCount;
+        Uint64 position; // where the current iteration began
+    };
+    struct Machine
+    {
+        const Uint *ip;
+        Uint64 position;
+        Uint64 repeatCount; // at a choice point of a repetition, the count reached so far
+        std::vector<Register> registers;
+        std::vector<Uint64> captures;
+    };
+    struct Frame
+    {
+        Uint state;
+        Uint numChildren;
+        Uint children[2];
+        Uint nextChild;
+        Uint64 numMatches; // choices that led straight to a match
+    };
+
+    const RegexBytecode &bytecode;
+    const Uint *program;
+    Uint64 input;
+
+    // what each register and capture contributes to a state
+    std::vector<Uint> registerBegin, registerEnd; // a register is live between its Op_GroupBegin and its Op_LoopEnd or Op_GroupEnd
+    std::vector<Uint64> registerCountCap;         // iteration counts at or above this one are all alike; 0 if it is never read
+    std::vector<bool> registerIsLoop;             // ended by Op_LoopEnd, which compares where its iteration began with the position
+    std::vector<bool> registerPositionExact;      // whether its capture is read, so that where its iteration began matters
+    std::vector<Uint> captureSlot;                // where a capture that is read is kept in a state, or UINT_MAX
+    Uint numCaptureSlots;
+    Uint stateLength;
+
+    std::vector<Uint64> stateKeys; // stateLength values for each state
+    std::vector<BigCount> stateCounts;
+    std::vector<Uint8> stateStatus;
+    std::vector<Uint> hashTable;   // state indexes, with UINT_MAX for none
+    size_t maxStates;
+    std::vector<Uint64> key;       // the state being looked up
+    Machine ways[2];               // the ways of continuing from the state being expanded
+
+    AdvanceResult advance(Machine &m);
+    bool repeatMultiple(const Uint *ip, const Machine &m, Uint64 &multiple);
+    void setCapture(Machine &m, Uint index, Uint64 value)
+    {
+        m.captures[index] = value;
+    }
+    void leaveLoop(Machine &m)
+    {
+        const Uint *ip = m.ip;
+        if (ip[2] != UINT_MAX)
+            setCapture(m, ip[2], m.position - m.registers[ip[1]].position);
+        m.ip = ip + 9;
+    }
+    void loopAgain(Machine &m)
+    {
+        const Uint *ip = m.ip;
+        Register &reg = m.registers[ip[1]];
+        reg.loopCount++;
+        reg.position = m.position;
+        for (Uint i=ip[6]; i<ip[6]+ip[7]; i++)
+            m.captures[i] = NON_PARTICIPATING_CAPTURE_GROUP;
+        m.ip = program + ip[8];
+    }
+    static Uint64 hashKey(const Uint64 *key, Uint length)
+    {
+        Uint64 hash = 14695981039346656037ULL;
+        for (Uint i=0; i<length; i++)
+            hash = (hash ^ key[i]) * 1099511628211ULL ^ hash >> 29;
+        return hash;
+    }
+    bool findState(const Machine &m, Uint &index); // returns false if there's no room for another state
+    void decodeState(Uint index, Machine &m);
+    bool expand(Frame &frame);
+    void rehash(size_t size);
+public:
+    Counter(const RegexBytecode &bytecode, Uint64 input);
+    bool count(BigCount &total);
+};
+
+RegexBytecode::Counter::Counter(const RegexBytecode &bytecode, Uint64 input) : bytecode(bytecode), program(&bytecode.code[0]), input(input)
+{
+    registerBegin         .assign(bytecode.numRegisters, 0);
+    registerEnd           .assign(bytecode.numRegisters, 0);
+    registerCountCap      .assign(bytecode.numRegisters, 0);
+    registerIsLoop        .assign(bytecode.numRegisters, false);
+    registerPositionExact .assign(bytecode.numRegisters, false);
+    captureSlot           .assign(bytecode.numCaptureGroups, UINT_MAX);
+
+    std::vector<bool> captureRead(bytecode.numCaptureGroups, false);
+    for (size_t pc=0; pc<bytecode.code.size(); pc+=instructionLength(program + pc))
+    {
+        const Uint *ip = program + pc;
+        switch (ip[0])
+        {
+        case Op_RepeatBackref:
+        case Op_IfCaptured:
+            captureRead[ip[1]] = true;
+            break;
+        case Op_RepeatConst:
+            for (Uint i=0; i<ip[6]; i++)
+                captureRead[ip[7 + 2*i]] = true;
+            break;
+        }
+    }
+    numCaptureSlots = 0;
+    for (Uint i=0; i<bytecode.numCaptureGroups; i++)
+        if (captureRead[i])
+            captureSlot[i] = numCaptureSlots++;
+
+    for (size_t pc=0; pc<bytecode.code.size(); pc+=instructionLength(program + pc))
+    {
+        const Uint *ip = program + pc;
+        switch (ip[0])
+        {
+        case Op_GroupBegin:
+            registerBegin[ip[1]] = (Uint)pc;
+            break;
+        case Op_GroupEnd:
+            registerEnd[ip[1]] = (Uint)pc;
+            registerPositionExact[ip[1]] = captureRead[ip[2]];
+            break;
+        case Op_LoopEnd:
+            registerEnd[ip[1]] = (Uint)pc;
+            registerIsLoop[ip[1]] = true;
+            registerPositionExact[ip[1]] = ip[2] != UINT_MAX && captureRead[ip[2]];
+            registerCountCap[ip[1]] = ip[4] == UINT_MAX ? (Uint64)ip[3] + 1 : ip[4];
+            break;
+        }
+    }
+
+    stateLength = 3 + 2*bytecode.numRegisters + numCaptureSlots;
+    maxStates = maxCountingMemory / (stateLength*sizeof(Uint64) + sizeof(BigCount) + sizeof(Uint8) + 2*sizeof(Uint));
+    key.resize(stateLength);
+    for (Uint i=0; i<2; i++)
+    {
+        ways[i].registers.resize(bytecode.numRegisters);
+        ways[i].captures.resize(bytecode.numCaptureGroups);
+    }
+    rehash(1024);
+}
+
+void RegexBytecode::Counter::rehash(size_t size)
+{
+    hashTable.assign(size, UINT_MAX);
+    for (Uint index=0; index<stateStatus.size(); index++)
+    {
+        size_t slot = (size_t)hashKey(&stateKeys[(size_t)index * stateLength], stateLength) & (size - 1);
+        while (hashTable[slot] != UINT_MAX)
+            slot = (slot + 1) & (size - 1);
+        hashTable[slot] = index;
+    }
+}
+
+bool RegexBytecode::Counter::findState(const Machine &m, Uint &index)
+{
+    Uint pc = (Uint)(m.ip - program);
+    key[0] = pc;
+    key[1] = m.position;
+    key[2] = m.repeatCount;
+    for (Uint r=0; r<bytecode.numRegisters; r++)
+    {
+        Uint64 &loopCount = key[3 + 2*r];
+        Uint64 &position  = key[4 + 2*r];
+        const Register &reg = m.registers[r];
+        if (!(registerBegin[r] < pc && pc <= registerEnd[r]))
+            loopCount = position = 0;
+        else
+        {
+            loopCount = reg.loopCount < registerCountCap[r] ? reg.loopCount : registerCountCap[r];
+            position  = registerPositionExact[r] ? m.position - reg.position :
+                        registerIsLoop[r]        ? m.position != reg.position : 0;
+        }
+    }
+    for (Uint i=0; i<bytecode.numCaptureGroups; i++)
+        if (captureSlot[i] != UINT_MAX)
+            key[3 + 2*bytecode.numRegisters + captureSlot[i]] = m.captures[i];
+
+    size_t mask = hashTable.size() - 1;
+    size_t slot = (size_t)hashKey(&key[0], stateLength) & mask;
+    for (;; slot = (slot + 1) & mask)
+    {
+        index = hashTable[slot];
+        if (index == UINT_MAX)
+            break;
+        if (memcmp(&stateKeys[(size_t)index * stateLength], &key[0], stateLength * sizeof(Uint64)) == 0)
+            return true;
+    }
+    if (stateStatus.size() >= maxStates)
+        return false;
+    index = (Uint)stateStatus.size();
+    stateKeys.insert(stateKeys.end(), key.begin(), key.end());
+    stateCounts.push_back(BigCount());
+    stateStatus.push_back(CountState_New);
+    hashTable[slot] = index;
+    if (stateStatus.size() * 2 > hashTable.size())
+        rehash(hashTable.size() * 2);
+    return true;
+}
+
+// Fills in a machine that behaves the same as every one that the state stands for
+void RegexBytecode::Counter::decodeState(Uint index, Machine &m)
+{
+    const Uint64 *key = &stateKeys[(size_t)index * stateLength];
+    m.ip          = program + key[0];
+    m.position    = key[1];
+    m.repeatCount = key[2];
+    for (Uint r=0; r<bytecode.numRegisters; r++)
+    {
+        m.registers[r].loopCount = key[3 + 2*r];
+        m.registers[r].position  = m.position - key[4 + 2*r];
+    }
+    for (Uint i=0; i<bytecode.numCaptureGroups; i++)
+        m.captures[i] = captureSlot[i] != UINT_MAX ? key[3 + 2*bytecode.numRegisters + captureSlot[i]] : NON_PARTICIPATING_CAPTURE_GROUP;
+}
+
+bool RegexBytecode::Counter::repeatMultiple(const Uint *ip, const Machine &m, Uint64 &multiple)
+{
+    switch (ip[0])
+    {
+    case Op_Repeat:
+        multiple = 1;
+        return true;
+    case Op_RepeatBackref:
+        multiple = m.captures[ip[1]];
+        if (multiple == NON_PARTICIPATING_CAPTURE_GROUP)
+        {
+            if (!bytecode.emulateNPCGs && ip[2] != 0)
+                return false;
+            multiple = 0;
+        }
+        return true;
+    case Op_RepeatConst:
+        multiple = ip[2];
+        for (Uint i=0; i<ip[6]; i++)
+        {
+            Uint64 capture = m.captures[ip[7 + 2*i]];
+            if (capture == NON_PARTICIPATING_CAPTURE_GROUP)
+            {
+                if (!bytecode.emulateNPCGs && ip[8 + 2*i] != 0)
+                    return false;
+                capture = 0;
+            }
+            multiple += capture * ip[8 + 2*i];
+        }
+        return true;
+    default:
+        UNREACHABLE_CODE;
+    }
+}
+
+// Runs the machine up to its next choice point, making the same decisions the interpreter would wherever there is
+// only one way to continue
+RegexBytecode::Counter::AdvanceResult RegexBytecode::Counter::advance(Machine &m)
+{
+    for (;;)
+    {
+        const Uint *ip = m.ip;
+        switch (ip[0])
+        {
+        case Op_Match:
+            return Advance_Match;
+
+        case Op_Fail:
+            return Advance_Fail;
+
+        case Op_Jump:
+            m.ip = program + ip[1];
+            break;
+
+        case Op_Split:
+            return Advance_Choice;
+
+        case Op_AnchorStart:
+            if (m.position != 0)
+                return Advance_Fail;
+            m.ip += 1;
+            break;
+
+        case Op_AnchorEnd:
+            if (m.position != input)
+                return Advance_Fail;
+            m.ip += 1;
+            break;
+
+        case Op_WordBoundary:
+        case Op_WordBoundaryNot:
+            if ((bytecode.basicCharIsWordCharacter && (m.position==0 || m.position==input) && input!=0) != (ip[0] == Op_WordBoundary))
+                return Advance_Fail;
+            m.ip += 1;
+            break;
+
+        case Op_Repeat:
+        case Op_RepeatBackref:
+        case Op_RepeatConst:
+            {
+                const Uint *operands = ip + (ip[0] == Op_Repeat ? 1 : ip[0] == Op_RepeatBackref ? 2 : 3);
+                const Uint *next = ip[0] == Op_RepeatConst ? operands + 4 + 2*operands[3] : operands + 3;
+                Uint backrefIndex = ip[0] == Op_RepeatConst ? ip[1] : UINT_MAX;
+                Uint minCount = operands[0];
+                Uint64 maxCount = MAX_EXTEND(operands[1]);
+                Uint flags = operands[2];
+                Uint64 multiple;
+                if (!repeatMultiple(ip, m, multiple))
+                    return Advance_Fail;
+                if (multiple == 0 && backrefIndex == UINT_MAX && ip[0] != Op_Repeat)
+                {
+                    m.ip = next;
+                    break;
+                }
+                Uint64 count;
+                if (multiple == 0)
+                {
+                    count = (flags & RepeatFlag_Lazy) || maxCount == ULLONG_MAX ? minCount : maxCount;
+                    if ((flags & RepeatFlag_ToEnd) && m.position != input)
+                        return Advance_Fail;
+                }
+                else
+                {
+                    Uint64 spaceLeft = input - m.position;
+                    Uint64 maxFit = spaceLeft / multiple;
+                    if (flags & RepeatFlag_ToEnd)
+                    {
+                        if (spaceLeft % multiple != 0 || !inrange64(maxFit, minCount, maxCount))
+                            return Advance_Fail;
+                        count = maxFit;
+                    }
+                    else
+                    {
+                        if (minCount > maxFit)
+                            return Advance_Fail;
+                        count = minCount;
+                        if (count != maxCount && count != maxFit)
+                        {
+                            // each count from here up to the greatest that fits is one way to continue; they are
+                            // taken one repetition at a time, so that the state needn't include the count itself
+                            m.position += count * multiple;
+                            m.repeatCount = count;
+                            if (maxCount == ULLONG_MAX && m.repeatCount > 1)
+                                m.repeatCount = 1;
+                            return Advance_Choice;
+                        }
+                    }
+                }
+                m.position += count * multiple;
+                if (backrefIndex != UINT_MAX && count)
+                    setCapture(m, backrefIndex, multiple);
+                m.ip = next;
+                break;
+            }
+
+        case Op_IsPrime:
+            {
+                Uint64 spaceLeft = input - m.position;
+                if (!(inrange64(spaceLeft, ip[1], 1) || isPrime(spaceLeft)))
+                    return Advance_Fail;
+                m.ip += 2;
+                break;
+            }
+
+        case Op_IsPowerOf2:
+            {
+                Uint64 spaceLeft = input - m.position;
+                if (!((spaceLeft != 0 || ip[1]) && !(spaceLeft & (spaceLeft - 1))))
+                    return Advance_Fail;
+                m.ip += 2;
+                break;
+            }
+
+        case Op_GroupBegin:
+            m.registers[ip[1]].loopCount = 1;
+            m.registers[ip[1]].position  = m.position;
+            m.ip += 2;
+            break;
+
+        case Op_GroupEnd:
+            setCapture(m, ip[2], m.position - m.registers[ip[1]].position);
+            m.ip += 3;
+            break;
+
+        case Op_LoopEnd:
+            {
+                const Register &reg = m.registers[ip[1]];
+                Uint minCount = ip[3];
+                Uint64 maxCount = MAX_EXTEND(ip[4]);
+                bool lazy = ip[5] != 0;
+                bool empty = m.position == reg.position;
+                if (bytecode.noEmptyOptional && empty && minCount != ip[4] && reg.loopCount > minCount && reg.loopCount <= maxCount)
+                    return Advance_Fail;
+                if (lazy && reg.loopCount >= minCount)
+                {
+                    if (!(reg.loopCount == maxCount || (empty && maxCount == ULLONG_MAX)))
+                        return Advance_Choice;
+                    leaveLoop(m);
+                    break;
+                }
+                if (reg.loopCount == maxCount || (maxCount == ULLONG_MAX && reg.loopCount >= minCount && empty))
+                {
+                    leaveLoop(m);
+                    break;
+                }
+                if (!lazy && reg.loopCount >= minCount)
+                    return Advance_Choice;
+                loopAgain(m);
+                break;
+            }
+
+        case Op_IfCaptured:
+            if (m.captures[ip[1]] == NON_PARTICIPATING_CAPTURE_GROUP)
+                m.ip = program + ip[2];
+            else
+                m.ip += 3;
+            break;
+
+        default:
+            UNREACHABLE_CODE;
+        }
+    }
+}
+
+// Works out where each way of continuing from a frame's state leads; returns false if there's no room for a new state
+bool RegexBytecode::Counter::expand(Frame &frame)
+{
+    Machine &m = ways[0];
+    decodeState(frame.state, m);
+    frame.numChildren = 0;
+    frame.numMatches  = 0;
+    frame.nextChild   = 0;
+    Uint numWays = 2;
+    const Uint *ip = m.ip;
+    switch (ip[0])
+    {
+    case Op_Split:
+        ways[1] = m;
+        m.ip = ip + 2;
+        ways[1].ip = program + ip[1];
+        break;
+    case Op_LoopEnd:
+        ways[1] = m;
+        leaveLoop(m);
+        loopAgain(ways[1]);
+        break;
+    default:
+        {
+            // a repetition, which either stops at the count reached so far or goes on to the next one if that fits;
+            // going on leads straight to another of its own choice points
+            const Uint *operands = ip + (ip[0] == Op_Repeat ? 1 : ip[0] == Op_RepeatBackref ? 2 : 3);
+            const Uint *next = ip[0] == Op_RepeatConst ? operands + 4 + 2*operands[3] : operands + 3;
+            Uint backrefIndex = ip[0] == Op_RepeatConst ? ip[1] : UINT_MAX;
+            Uint64 maxCount = MAX_EXTEND(operands[1]);
+            Uint64 multiple;
+            repeatMultiple(ip, m, multiple);
+            if (m.repeatCount < maxCount && input - m.position >= multiple)
+            {
+                ways[1] = m;
+                ways[1].position += multiple;
+                if (maxCount != ULLONG_MAX || ways[1].repeatCount == 0)
+                    ways[1].repeatCount++;
+                if (!findState(ways[1], frame.children[frame.numChildren++]))
+                    return false;
+            }
+            if (backrefIndex != UINT_MAX && m.repeatCount)
+                setCapture(m, backrefIndex, multiple);
+            m.ip = next;
+            m.repeatCount = 0;
+            numWays = 1;
+            break;
+        }
+    }
+    for (Uint i=0; i<numWays; i++)
+    {
+        switch (advance(ways[i]))
+        {
+        case Advance_Match:
+            frame.numMatches++;
+            break;
+        case Advance_Fail:
+            break;
+        case Advance_Choice:
+            if (!findState(ways[i], frame.children[frame.numChildren++]))
+                return false;
+            break;
+        }
+    }
+    return true;
+}
+
+// Returns false if the states don't fit in the memory allowed for them
+bool RegexBytecode::Counter::count(BigCount &total)
+{
+    total = BigCount();
+    Machine start;
+    start.registers.resize(bytecode.numRegisters);
+    start.captures.resize(bytecode.numCaptureGroups);
+    std::vector<Frame> stack;
+    for (Uint64 startPosition=0;; startPosition++)
+    {
+        for (Uint r=0; r<bytecode.numRegisters; r++)
+            start.registers[r].loopCount = start.registers[r].position = 0;
+        for (Uint i=0; i<bytecode.numCaptureGroups; i++)
+            start.captures[i] = NON_PARTICIPATING_CAPTURE_GROUP;
+        start.ip = program;
+        start.position = startPosition;
+        start.repeatCount = 0;
+
+        switch (advance(start))
+        {
+        case Advance_Match:
+            total += 1;
+            break;
+        case Advance_Fail:
+            break;
+        case Advance_Choice:
+            {
+                Frame frame;
+                if (!findState(start, frame.state))
+                    return false;
+                if (stateStatus[frame.state] == CountState_Done)
+                {
+                    total += stateCounts[frame.state];
+                    break;
+                }
+                stateStatus[frame.state] = CountState_Expanding;
+                if (!expand(frame))
+                    return false;
+                stack.push_back(frame);
+                while (!stack.empty())
+                {
+                    Frame &top = stack.back();
+                    if (top.nextChild < top.numChildren)
+                    {
+                        Uint child = top.children[top.nextChild];
+                        if (stateStatus[child] == CountState_Done)
+                        {
+                            top.nextChild++;
+                            continue;
+                        }
+                        if (stateStatus[child] == CountState_Expanding) // can't happen, as every way around a loop makes progress, but a cycle would have no finite count
+                            return false;
+                        Frame childFrame;
+                        childFrame.state = child;
+                        stateStatus[child] = CountState_Expanding;
+                        if (!expand(childFrame))
+                            return false;
+                        stack.push_back(childFrame);
+                        continue;
+                    }
+                    BigCount sum(top.numMatches);
+                    for (Uint i=0; i<top.numChildren; i++)
+                        sum += stateCounts[top.children[i]];
+                    stateCounts[top.state] = sum;
+                    stateStatus[top.state] = CountState_Done;
+                    stack.pop_back();
+                }
+                total += stateCounts[frame.state];
+                break;
+            }
+        }
+
+        if (bytecode.anchored || startPosition == input)
+            break;
+    }
+    return true;
+}
+
+bool RegexBytecode::CountMatches(Uint64 input, BigCount &count) const
+{
+    if (numLookarounds != 0)
+        return false;
+    Counter counter(*this, input);
+    return counter.count(count);
+}
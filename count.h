@@ -0,0 +1,39 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include <vector>
+#include <string>
+
+// An unsigned integer of any size, for counts of possible matches, which can grow exponentially with the input. Only
+// what counting needs is provided; the first 64 bits are kept inline, so that small counts never allocate.
+class BigCount
+{
+    Uint64 low;
+    std::vector<Uint64> high; // the digits above low, in base 2^64, least significant first
+public:
+    BigCount(Uint64 n = 0) : low(n)
+    {
+    }
+    BigCount &operator+=(const BigCount &other);
+    bool isZero() const
+    {
+        return low == 0 && high.empty();
+    }
+    bool fitsIn64Bits() const
+    {
+        return high.empty();
+    }
+    Uint64 saturated() const // the count, or ULLONG_MAX if it doesn't fit
+    {
+        return high.empty() ? low : ULLONG_MAX;
+    }
+    std::string toString() const;
+};
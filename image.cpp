@@ -0,0 +1,439 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+#include "regex.h"
+#include "image.h"
+
+#define IMAGE_FILE_SIGNATURE "#regex-image\x1A\0\0"
+#define IMAGE_FILE_VERSION   2
+
+struct RegexImage::Header
+{
+    char signature[16];
+    Uint32 version;
+    Uint32 layout;
+    Uint64 patternOffset; // the pattern's text, including its terminating zero; these two stay where they are in every version
+    Uint64 patternLength;
+    Uint64 checksum;      // of the whole file, with this field taken as 0; it stays where it is in every version from 2 on
+    Uint64 options;
+    Uint64 alternatives;  // offset of the root group's list of alternatives
+    Uint32 numCaptureGroups;
+    Uint32 maxGroupDepth;
+    Uint32 maxLookintoDepth;
+    Uint32 anchored;
+};
+
+struct RegexImageCorrupt {};
+
+Uint32 parsingOptions()
+{
+    bool options[] =
+    {
+        free_spacing_mode,
+        allow_empty_character_classes,
+        no_empty_optional,
+        allow_quantifiers_on_assertions,
+        allow_molecular_lookaround,
+        allow_lookinto,
+        allow_atomic_groups,
+        allow_branch_reset_groups,
+        allow_possessive_quantifiers,
+        allow_conditionals,
+        allow_lookaround_conditionals,
+        allow_reset_start,
+        enable_persistent_backrefs,
+    };
+    Uint32 packed = 0;
+    for (size_t i=0; i<sizeof(options)/sizeof(options[0]); i++)
+        packed |= (Uint32)options[i] << i;
+    return packed;
+}
+
+// Changes whenever a build lays out the symbol tree differently, as an image can then only be read by the same build
+Uint32 RegexImage::layoutSignature()
+{
+    size_t sizes[] =
+    {
+        sizeof(void*),
+        sizeof(RegexSymbol), sizeof(RegexPattern), sizeof(RegexGroup), sizeof(RegexGroupCapturing), sizeof(RegexConditional),
+        sizeof(RegexLookaroundConditional), sizeof(RegexGroupLookinto), sizeof(RegexBackref), sizeof(RegexCharacterClass),
+        offsetof(RegexSymbol, type), offsetof(RegexSymbol, originalCode), offsetof(RegexGroup, alternatives),
+    };
+    Uint32 signature = 0;
+    for (size_t i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++)
+        signature = signature * 31 + (Uint32)sizes[i];
+    return signature;
+}
+
+// FNV-1a, skipping over the header's checksum field
+Uint64 RegexImage::checksum(const Uint8 *image, size_t size)
+{
+    const size_t skipStart = offsetof(Header, checksum);
+    const size_t skipEnd   = skipStart + sizeof(((Header*)0)->checksum);
+    Uint64 hash = 14695981039346656037ULL;
+    for (size_t i=0; i<size; i++)
+        hash = (hash ^ (i >= skipStart && i < skipEnd ? 0 : image[i])) * 1099511628211ULL;
+    return hash;
+}
+
+// The value of an enum or bool field as the file holds it, which needn't be one that its type can hold
+template <typename T>
+static Uint rawValue(const T &field)
+{
+    typename std::conditional<sizeof(T) == 1, Uint8, Uint>::type value;
+    static_assert(sizeof(value) == sizeof(T), "an enum is expected to be the size of an int");
+    memcpy(&value, &field, sizeof(value));
+    return value;
+}
+
+// How many bytes a symbol of the type it says it is takes, or SIZE_MAX if the type isn't one the parser produces
+size_t RegexImage::symbolSize(RegexSymbol *symbol)
+{
+    switch (rawValue(symbol->type))
+    {
+    case RegexSymbol_Group:
+        switch (rawValue(((RegexGroup*)symbol)->type))
+        {
+        case RegexGroup_NonCapturing:
+        case RegexGroup_Atomic:
+        case RegexGroup_BranchReset:
+        case RegexGroup_Lookahead:
+        case RegexGroup_LookaheadMolecular:
+        case RegexGroup_NegativeLookahead:
+            return sizeof(RegexGroup);
+        case RegexGroup_Capturing:
+            return sizeof(RegexGroupCapturing);
+        case RegexGroup_Lookinto:
+        case RegexGroup_LookintoMolecular:
+        case RegexGroup_NegativeLookinto:
+            return sizeof(RegexGroupLookinto);
+        case RegexGroup_Conditional:
+            return sizeof(RegexConditional);
+        case RegexGroup_LookaroundConditional:
+            return sizeof(RegexLookaroundConditional);
+        default:
+            return SIZE_MAX;
+        }
+    case RegexSymbol_CharacterClass:
+        return sizeof(RegexCharacterClass);
+    case RegexSymbol_Backref:
+        return sizeof(RegexBackref);
+    default:
+        return rawValue(symbol->type) <= RegexSymbol_WordCharacter ? sizeof(RegexSymbol) : SIZE_MAX;
+    }
+}
+
+// Calls relocate(pointer) on every pointer in the tree below the root group (but not the root's own), each one before
+// it is followed, so that relocate may either translate it in place or only read it. Before any field of an object or
+// any element of a list is read, check(start, size) is called on the memory it occupies, each byte of it only once.
+template <typename RELOCATE, typename CHECK>
+void RegexImage::relocateTree(RegexGroup *root, RELOCATE relocate, CHECK check)
+{
+    std::vector<RegexGroup*> groups(1, root);
+    while (!groups.empty())
+    {
+        RegexGroup *group = groups.back();
+        groups.pop_back();
+        for (RegexPattern **alternative = group->alternatives;; alternative++)
+        {
+            check(alternative, sizeof(*alternative));
+            relocate((void*&)*alternative);
+            if (!*alternative)
+                break;
+            check(*alternative, sizeof(RegexPattern));
+            relocate((void*&)(*alternative)->symbols);
+            for (RegexSymbol **thisSymbol = (*alternative)->symbols;; thisSymbol++)
+            {
+                check(thisSymbol, sizeof(*thisSymbol));
+                relocate((void*&)*thisSymbol);
+                RegexSymbol *symbol = *thisSymbol;
+                if (!symbol)
+                    break;
+                for (;;)
+                {
+                    check(symbol, sizeof(RegexSymbol));
+                    check((Uint8*)symbol + sizeof(RegexSymbol), symbolSize(symbol) - sizeof(RegexSymbol)); // the rest of its subclass
+                    relocate((void*&)symbol->parentAlternative);
+                    relocate((void*&)symbol->self);
+                    relocate((void*&)symbol->originalCode);
+                    if (symbol->type == RegexSymbol_String)
+                    {
+                        relocate((void*&)symbol->string);
+                        check(symbol->string, symbol->strLength);
+                        check(symbol->string + symbol->strLength, 1); // its terminating zero
+                    }
+                    if (symbol->type != RegexSymbol_Group)
+                        break;
+                    RegexGroup *subgroup = (RegexGroup*)symbol;
+                    relocate((void*&)subgroup->alternatives);
+                    groups.push_back(subgroup);
+                    if (subgroup->type != RegexGroup_LookaroundConditional)
+                        break;
+                    relocate((void*&)((RegexLookaroundConditional*)subgroup)->lookaround);
+                    symbol = ((RegexLookaroundConditional*)subgroup)->lookaround;
+                }
+            }
+        }
+    }
+}
+
+// Checks what relocateTree can't: that the relocated tree is linked the way the parser links it, and that every
+// capture index, nesting depth and quantifier in it agrees with the counts in the header, which the matcher sizes its
+// arrays by. Throws RegexImageCorrupt if not.
+void RegexImage::checkTree(RegexGroup *root, const char *pattern, Uint64 patternLength, Uint64 numCaptureGroups, Uint64 maxGroupDepth, Uint64 maxLookintoDepth)
+{
+    struct NestedGroup
+    {
+        RegexGroup *group;
+        Uint64 depth, lookintoDepth; // counting the root group, and any group it is nested in, as in the group stack
+    };
+    std::vector<NestedGroup> groups(1, NestedGroup{root, 1, 0});
+    Uint64 numCapturingGroupsFound = 0; // one more than the highest index of a capturing group
+    Uint64 deepest = 1;
+    while (!groups.empty())
+    {
+        NestedGroup outer = groups.back();
+        groups.pop_back();
+        if (!outer.group->alternatives[0])
+            throw RegexImageCorrupt();
+        for (RegexPattern **alternative = outer.group->alternatives; *alternative; alternative++)
+            for (RegexSymbol **thisSymbol = (*alternative)->symbols; *thisSymbol; thisSymbol++)
+            {
+                RegexSymbol *symbol = *thisSymbol;
+                if (symbol->self != thisSymbol || symbol->parentAlternative != alternative)
+                    throw RegexImageCorrupt();
+                Uint64 depth = outer.depth, lookintoDepth = outer.lookintoDepth;
+                for (;;)
+                {
+                    if ((symbol->originalCode && (symbol->originalCode < pattern || symbol->originalCode > pattern + patternLength)) ||
+                        (symbol->type == RegexSymbol_Verb && rawValue(symbol->verb) > RegexVerb_Then) ||
+                        (symbol->type == RegexSymbol_Backref && ((RegexBackref*)symbol)->index >= numCaptureGroups) ||
+                        (symbol->type != RegexSymbol_String && symbol->type != RegexSymbol_Verb &&
+                            (symbol->minCount > symbol->maxCount || rawValue(symbol->lazy) > 1 || rawValue(symbol->possessive) > 1)) ||
+                        (symbol->type == RegexSymbol_Character && rawValue(symbol->characterAny) > 1))
+                        throw RegexImageCorrupt();
+                    if (symbol->type != RegexSymbol_Group)
+                        break;
+                    RegexGroup *group = (RegexGroup*)symbol;
+                    switch (group->type)
+                    {
+                    case RegexGroup_Capturing:
+                        if (numCapturingGroupsFound < (Uint64)((RegexGroupCapturing*)group)->backrefIndex + 1)
+                            numCapturingGroupsFound = (Uint64)((RegexGroupCapturing*)group)->backrefIndex + 1;
+                        break;
+                    case RegexGroup_Conditional:
+                        if (((RegexConditional*)group)->backrefIndex >= numCaptureGroups)
+                            throw RegexImageCorrupt();
+                        break;
+                    case RegexGroup_Lookinto:
+                    case RegexGroup_LookintoMolecular:
+                    case RegexGroup_NegativeLookinto:
+                        if (((RegexGroupLookinto*)group)->backrefIndex != UINT_MAX && ((RegexGroupLookinto*)group)->backrefIndex > numCaptureGroups)
+                            throw RegexImageCorrupt();
+                        lookintoDepth++;
+                        break;
+                    default:
+                        break;
+                    }
+                    depth++;
+                    if (deepest < depth)
+                        deepest = depth;
+                    if (depth > maxGroupDepth || lookintoDepth > maxLookintoDepth)
+                        throw RegexImageCorrupt();
+                    groups.push_back(NestedGroup{group, depth, lookintoDepth});
+                    if (group->type != RegexGroup_LookaroundConditional)
+                        break;
+                    // its condition is entered as a group nested in it, and linked to its first alternative
+                    symbol = ((RegexLookaroundConditional*)group)->lookaround;
+                    if (symbol->self || symbol->parentAlternative != group->alternatives)
+                        throw RegexImageCorrupt();
+                }
+            }
+    }
+    // the parser leaves room for at most one group wrapped around each group, so anything more is a bogus count that
+    // would only make the matcher allocate far more than it needs
+    if (numCapturingGroupsFound != numCaptureGroups || maxGroupDepth > deepest * 2 || maxLookintoDepth >= maxGroupDepth)
+        throw RegexImageCorrupt();
+}
+
+bool RegexImage::isImage(FILE *f)
+{
+    char signature[sizeof(((Header*)0)->signature)];
+    bool result = fread(signature, 1, sizeof(signature), f) == sizeof(signature) && memcmp(signature, IMAGE_FILE_SIGNATURE, sizeof(signature))==0;
+    fseek(f, 0, SEEK_SET);
+    return result;
+}
+
+int RegexImage::save(const char *filename, RegexGroupRoot &regex, const char *pattern, Uint numCaptureGroups, Uint maxGroupDepth, Uint maxLookintoDepth)
+{
+    struct Region
+    {
+        const Uint8 *start;
+        size_t size;
+        Uint64 offset;
+    };
+    std::vector<Region> regions;
+    Uint64 imageSize = sizeof(Header);
+    auto addRegion = [&](const Uint8 *start, size_t size)
+    {
+        imageSize = (imageSize + 15) & ~(Uint64)15; // keep the alignment that the arena gave everything
+        Region region = { start, size, imageSize };
+        regions.push_back(region);
+        imageSize += size;
+    };
+    addRegion((const Uint8*)pattern, strlen(pattern) + 1);
+    regex.arena.forEachChunk(addRegion);
+
+    std::vector<Uint8> image((size_t)imageSize);
+    for (size_t i=0; i<regions.size(); i++)
+        memcpy(&image[(size_t)regions[i].offset], regions[i].start, regions[i].size);
+    auto translate = [&](const void *p) -> Uint64
+    {
+        for (size_t i=0; i<regions.size(); i++)
+            if ((const Uint8*)p >= regions[i].start && (const Uint8*)p < regions[i].start + regions[i].size)
+                return regions[i].offset + ((const Uint8*)p - regions[i].start);
+        THROW_ENGINEBUG;
+    };
+    relocateTree(&regex, [&](void *&p)
+    {
+        size_t offset = p ? (size_t)translate(p) : 0;
+        memcpy(&image[(size_t)translate(&p)], &offset, sizeof(offset));
+    }, [](const void *start, size_t size) {});
+
+    Header *header = (Header*)&image[0];
+    memcpy(header->signature, IMAGE_FILE_SIGNATURE, sizeof(header->signature));
+    header->version          = IMAGE_FILE_VERSION;
+    header->layout           = layoutSignature();
+    header->patternOffset    = regions[0].offset;
+    header->patternLength    = regions[0].size - 1;
+    header->options          = parsingOptions();
+    header->alternatives     = translate(regex.alternatives);
+    header->numCaptureGroups = numCaptureGroups;
+    header->maxGroupDepth    = maxGroupDepth;
+    header->maxLookintoDepth = maxLookintoDepth;
+    header->anchored         = regex.anchored;
+    header->checksum         = checksum(&image[0], image.size());
+
+    FILE *f = fopen(filename, "wb");
+    if (!f)
+    {
+        fprintf(stderr, "Error opening \"%s\" for writing\n", filename);
+        return -1;
+    }
+    bool written = fwrite(&image[0], 1, image.size(), f) == image.size();
+    if (fclose(f) != 0 || !written)
+    {
+        fprintf(stderr, "Error writing \"%s\"\n", filename);
+        remove(filename);
+        return -1;
+    }
+    return 0;
+}
+
+int RegexImage::open(const char *filename)
+{
+    if (file.openPrivate(filename))
+    {
+        fprintf(stderr, "Error opening compiled pattern file \"%s\"\n", filename);
+        return -1;
+    }
+    Header *header = (Header*)file.getData();
+    if (file.getSize() < sizeof(Header) || memcmp(header->signature, IMAGE_FILE_SIGNATURE, sizeof(header->signature))!=0 ||
+        header->patternOffset >= file.getSize() || header->patternLength >= file.getSize() - header->patternOffset ||
+        getPattern()[header->patternLength] != '\0')
+    {
+        file.close();
+        fprintf(stderr, "Error: \"%s\" is not a valid compiled pattern file\n", filename);
+        return -1;
+    }
+    // An image from before there were checksums is only used for its pattern text, which was checked above
+    if (header->version >= 2 && header->checksum != checksum((const Uint8*)file.getData(), file.getSize()))
+    {
+        file.close();
+        fprintf(stderr, "Error: The compiled pattern file \"%s\" is corrupt\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+char *RegexImage::getPattern()
+{
+    return (char*)file.getData() + ((Header*)file.getData())->patternOffset;
+}
+
+const char *RegexImage::load(RegexGroupRoot &regex, Uint &numCaptureGroups, Uint &maxGroupDepth, Uint &maxLookintoDepth)
+{
+    Header *header = (Header*)file.getData();
+    if (header->version != IMAGE_FILE_VERSION || header->layout != layoutSignature())
+        return "The compiled pattern file was made by a different version of this program";
+    if (header->options != parsingOptions())
+        return "The compiled pattern file was made with different options";
+
+    // The checksum has already caught any damage done to the file by accident, but the tree is still checked to be
+    // well-formed, so that no file can make the matcher read outside the image or outside its own arrays
+    Uint8 *base = (Uint8*)file.getData();
+    size_t size = file.getSize();
+    auto relocate = [&](void *&p)
+    {
+        if (p)
+        {
+            if ((size_t)p >= size)
+                throw RegexImageCorrupt();
+            p = base + (size_t)p;
+        }
+    };
+    // nothing in the tree may overlap the header or the pattern text, which relocating it would otherwise overwrite,
+    // and which are still needed if the tree turns out to be unusable
+    size_t patternStart = (size_t)header->patternOffset;
+    size_t patternEnd   = patternStart + (size_t)header->patternLength + 1;
+    std::vector< std::pair<size_t, size_t> > used; // the offset and size of everything in the tree, to check that none of it overlaps
+    auto check = [&](const void *start, size_t bytes)
+    {
+        size_t offset = (const Uint8*)start - base;
+        if ((const Uint8*)start < base + sizeof(Header) || offset > size || bytes > size - offset ||
+            (offset < patternEnd && offset + bytes > patternStart))
+            throw RegexImageCorrupt();
+        if (bytes)
+            used.push_back(std::make_pair(offset, bytes));
+    };
+    try
+    {
+        void *alternatives = (void*)(size_t)header->alternatives;
+        if (!alternatives)
+            throw RegexImageCorrupt();
+        relocate(alternatives);
+        regex.alternatives = (RegexPattern**)alternatives;
+        relocateTree(&regex, relocate, check); // a pointer reached twice would be relocated twice, which takes it out of bounds
+        // but two pointers can still lead to objects or lists that overlap without sharing a pointer, and which the
+        // matcher could then change from under each other
+        std::sort(used.begin(), used.end());
+        for (size_t i=1; i<used.size(); i++)
+            if (used[i].first < used[i-1].first + used[i-1].second)
+                throw RegexImageCorrupt();
+        checkTree(&regex, getPattern(), header->patternLength, header->numCaptureGroups, header->maxGroupDepth, header->maxLookintoDepth);
+    }
+    catch (RegexImageCorrupt)
+    {
+        regex.alternatives = NULL;
+        return "The compiled pattern file is corrupt";
+    }
+    regex.originalCode      = getPattern();
+    regex.parentAlternative = NULL;
+    regex.anchored          = header->anchored != 0;
+    numCaptureGroups = header->numCaptureGroups;
+    maxGroupDepth    = header->maxGroupDepth;
+    maxLookintoDepth = header->maxLookintoDepth;
+    return NULL;
+}
@@ -0,0 +1,45 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include <stdio.h>
+
+// A parsed pattern, saved by "--save-compiled" to a file that "-f" maps back into memory instead of parsing the pattern
+// again. The file holds the pattern's text and the arena chunks that its symbol tree was parsed into, with every
+// pointer replaced by its offset within the file, so that loading it only needs to add the address it was mapped at to
+// each one. The mapping is private and copy-on-write, so neither that nor anything the matcher changes in the tree
+// while preparing it reaches the file. An image made by another version, or with other parsing options, is rejected,
+// in which case the pattern text it holds is parsed instead. A checksum over the whole file is verified before anything
+// in it is used, and the tree is checked to stay within the file and to agree with the counts stored with it.
+class RegexImage
+{
+    struct Header;
+
+    MappedFile file;
+
+    static Uint32 layoutSignature();
+    static Uint64 checksum(const Uint8 *image, size_t size);
+    static size_t symbolSize(RegexSymbol *symbol);
+    template <typename RELOCATE, typename CHECK>
+    static void relocateTree(RegexGroup *root, RELOCATE relocate, CHECK check);
+    static void checkTree(RegexGroup *root, const char *pattern, Uint64 patternLength, Uint64 numCaptureGroups, Uint64 maxGroupDepth, Uint64 maxLookintoDepth);
+public:
+    static bool isImage(FILE *f); // checks whether f, positioned at its start, begins like an image
+    static int save(const char *filename, RegexGroupRoot &regex, const char *pattern, Uint numCaptureGroups, Uint maxGroupDepth, Uint maxLookintoDepth);
+    int open(const char *filename); // prints an error message and returns -1 if the file can't be used
+    bool isOpen() { return file.getData() != NULL; }
+    char *getPattern();
+    // Relocates the tree and hands it to regex, which must not outlive this image. Returns NULL on success, or else
+    // the reason the tree can't be used.
+    const char *load(RegexGroupRoot &regex, Uint &numCaptureGroups, Uint &maxGroupDepth, Uint &maxLookintoDepth);
+};
+
+// The options that change how a pattern is parsed, packed into a number
+Uint32 parsingOptions();
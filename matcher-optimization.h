@@ -1,95 +1,290 @@
 #include "math-optimization.h"
 
-template <bool USE_STRINGS> // currently implemented only for !USE_STRINGS
-Uint64 RegexMatcher<USE_STRINGS>::matchSymbol_ConstGroup(RegexSymbol *thisSymbol, bool capturing)
+static inline Uint64 addLengths(Uint64 a, Uint64 b)
 {
-    RegexGroup *const group = ((RegexConstGroup*)thisSymbol)->originalGroup;
-    RegexPattern **insideAlternative = group->alternatives;
-    Uint64 multiple = 0;
-    for (RegexSymbol **insideSymbol = insideAlternative[0]->symbols; *insideSymbol; insideSymbol++)
+    return a > ULLONG_MAX - b ? ULLONG_MAX : a + b;
+}
+
+static inline Uint64 multiplyLength(Uint64 length, Uint64 count)
+{
+    return length == 0 || count == 0 ? 0 : length > ULLONG_MAX / count ? ULLONG_MAX : length * count;
+}
+
+static inline Uint64 gcdLength(Uint64 a, Uint64 b)
+{
+    while (b)
     {
-        switch ((*insideSymbol)->type)
+        Uint64 remainder = a % b;
+        a = b;
+        b = remainder;
+    }
+    return a;
+}
+
+template <bool USE_STRINGS>
+Uint64 RegexMatcher<USE_STRINGS>::getConstantWidth(RegexSymbol **symbols)
+// return the width of symbols accepted by isConstantWidth(), not counting lookaheads, or NON_PARTICIPATING_CAPTURE_GROUP if a backreference in them can't match
+{
+    Uint64 width = 0;
+    for (; *symbols; symbols++)
+    {
+        switch ((*symbols)->type)
         {
-        case RegexSymbol_NoOp:
-            break;
         case RegexSymbol_Character:
-            multiple += (*insideSymbol)->minCount;
+            width += (*symbols)->minCount;
+            break;
+        case RegexSymbol_String:
+            width += (*symbols)->strLength;
             break;
         case RegexSymbol_Backref:
             {
-                Uint64 thisMultiple;
+                Uint64 thisWidth;
                 const char *pBackref;
-                readCapture(((RegexBackref*)*insideSymbol)->index, thisMultiple, pBackref);
-                if (thisMultiple == NON_PARTICIPATING_CAPTURE_GROUP)
+                readCapture(((RegexBackref*)*symbols)->index, thisWidth, pBackref);
+                if (thisWidth == NON_PARTICIPATING_CAPTURE_GROUP)
                 {
-                    if (!emulate_ECMA_NPCGs && (*insideSymbol)->minCount != 0)
-                    {
-                        nonMatch();
+                    if (!emulate_ECMA_NPCGs && (*symbols)->minCount != 0)
                         return NON_PARTICIPATING_CAPTURE_GROUP;
-                    }
-                    thisMultiple = 0;
+                    thisWidth = 0;
                 }
-                multiple += thisMultiple * (*insideSymbol)->minCount;
+                width += thisWidth * (*symbols)->minCount;
                 break;
             }
+        case RegexSymbol_Group:
+            if (!((RegexGroup*)*symbols)->isLookaround() && (*symbols)->minCount)
+            {
+                Uint64 groupWidth = getConstantWidth(((RegexGroup*)*symbols)->alternatives[0]->symbols);
+                if (groupWidth == NON_PARTICIPATING_CAPTURE_GROUP)
+                    return NON_PARTICIPATING_CAPTURE_GROUP;
+                width += groupWidth * (*symbols)->minCount;
+            }
+            break;
+        }
+    }
+    return width;
+}
+template <bool USE_STRINGS>
+bool RegexMatcher<USE_STRINGS>::getConstGroupLength(RegexSymbol *thisSymbol, Uint64 &multiple)
+// return false if the group can't match, because a backreference in it can't
+{
+    multiple = getConstantWidth(((RegexConstGroup*)thisSymbol)->originalGroup->alternatives[0]->symbols);
+    return multiple != NON_PARTICIPATING_CAPTURE_GROUP;
+}
+template<>
+inline const char *RegexMatcher<false>::getConstGroupRepetend(RegexSymbol *thisSymbol, Uint64 multiple)
+{
+    return NULL;
+}
+template<>
+inline const char *RegexMatcher<true>::getConstGroupRepetend(RegexSymbol *thisSymbol, Uint64 multiple)
+// return the multiple characters matched by each iteration of a flat group, given the current captures, so that a run
+// of iterations can be matched as a backreference to them would be
+{
+    if (multiple > constGroupRepetendCapacity)
+    {
+        delete [] constGroupRepetend;
+        constGroupRepetend = new char [(size_t)multiple];
+        constGroupRepetendCapacity = (size_t)multiple;
+    }
+    char *s = constGroupRepetend;
+    for (RegexSymbol **insideSymbol = ((RegexConstGroup*)thisSymbol)->originalGroup->alternatives[0]->symbols; *insideSymbol; insideSymbol++)
+    {
+        switch ((*insideSymbol)->type)
+        {
+        case RegexSymbol_Character:
+            memset(s, (*insideSymbol)->character, (*insideSymbol)->minCount);
+            s += (*insideSymbol)->minCount;
+            break;
+        case RegexSymbol_String:
+            memcpy(s, (*insideSymbol)->string, (*insideSymbol)->strLength);
+            s += (*insideSymbol)->strLength;
+            break;
+        case RegexSymbol_Backref:
+            {
+                Uint64 length;
+                const char *pBackref;
+                readCapture(((RegexBackref*)*insideSymbol)->index, length, pBackref);
+                if (length == NON_PARTICIPATING_CAPTURE_GROUP) // getConstGroupLength() will already have failed unless this matches emptily
+                    break;
+                for (Uint i=0; i<(*insideSymbol)->minCount; i++, s+=length)
+                    memcpy(s, pBackref, (size_t)length);
+                break;
+            }
+        }
+    }
+    return constGroupRepetend;
+}
+template <bool USE_STRINGS> // currently implemented only for !USE_STRINGS
+Uint64 RegexMatcher<USE_STRINGS>::getConstGroupCountLimit(RegexSymbol *thisSymbol, Uint64 multiple)
+// return the greatest count of a non-flat group for which each of its lookaheads matches in every iteration; any smaller
+// count satisfies them too, as each iteration starts multiple characters closer to the end than the one before it
+{
+    Uint64 spaceLeft = input - position;
+    Uint64 limit = spaceLeft / multiple;
+    Uint64 offset = 0;
+    for (RegexSymbol **insideSymbol = ((RegexConstGroup*)thisSymbol)->originalGroup->alternatives[0]->symbols; *insideSymbol; insideSymbol++)
+    {
+        if ((*insideSymbol)->type != RegexSymbol_Group || !((RegexGroup*)*insideSymbol)->isLookaround())
+        {
+            RegexSymbol *symbolOnly[] = {*insideSymbol, NULL};
+            offset += getConstantWidth(symbolOnly);
+            continue;
         }
+        RegexGroup *lookahead = (RegexGroup*)*insideSymbol;
+        RegexSymbol **lookaheadSymbols = lookahead->alternatives[0]->symbols;
+        bool negative = lookahead->type == RegexGroup_NegativeLookahead;
+        bool toEnd = false;
+        for (RegexSymbol **lookaheadSymbol = lookaheadSymbols; *lookaheadSymbol; lookaheadSymbol++)
+            if ((*lookaheadSymbol)->type == RegexSymbol_AnchorEnd && (*lookaheadSymbol)->minCount)
+                toEnd = true;
+        Uint64 width = getConstantWidth(lookaheadSymbols);
+        Uint64 bound;
+        if (width == NON_PARTICIPATING_CAPTURE_GROUP)
+            bound = negative ? ULLONG_MAX : 0;
+        else
+        if (spaceLeft < offset) // not even the first iteration can reach the lookahead
+            bound = ULLONG_MAX;
+        else
+        {
+            Uint64 spaceAtLookahead = spaceLeft - offset; // in the first iteration, shrinking by multiple in each one after it
+            if (!toEnd)
+                bound = negative ? (spaceAtLookahead < width ? ULLONG_MAX : 0) : (spaceAtLookahead < width ? 0 : (spaceAtLookahead - width) / multiple + 1);
+            else
+            if (!negative)
+                bound = spaceAtLookahead == width ? 1 : 0;
+            else
+                bound = spaceAtLookahead >= width && (spaceAtLookahead - width) % multiple == 0 ? (spaceAtLookahead - width) / multiple : ULLONG_MAX;
+        }
+        if (limit > bound)
+            limit = bound;
+    }
+    return limit;
+}
+template <bool USE_STRINGS>
+void RegexMatcher<USE_STRINGS>::captureConstGroup(Uint backrefIndex, Uint64 length)
+{
+    Backtrack_LeaveConstGroupCapturing<USE_STRINGS> *pushStack = stack.template push< Backtrack_LeaveConstGroupCapturing<USE_STRINGS> >(Backtrack_LeaveConstGroupCapturing<USE_STRINGS>::get_size());
+    pushStack->backrefIndex = backrefIndex;
+    if (enable_persistent_backrefs)
+    {
+        const char *&dummy = (const char *&)pushStack->buffer;
+        if (!USE_STRINGS)
+            readCapture(backrefIndex, *(Uint64*)(pushStack->buffer                      ), dummy);
+        else
+            readCapture(backrefIndex, *(Uint64*)(pushStack->buffer + sizeof(const char*)), *(const char**)pushStack->buffer);
+    }
+
+    Uint64 prevValue = captures[backrefIndex];
+    writeCaptureRelative(backrefIndex, position - length, position);
+    if (!enable_persistent_backrefs || prevValue == NON_PARTICIPATING_CAPTURE_GROUP)
+    {
+        *captureStackTop++ = backrefIndex;
+        groupStackTop->numCaptured++;
+    }
+}
+template <bool USE_STRINGS> // currently implemented only for !USE_STRINGS
+void RegexMatcher<USE_STRINGS>::captureConstGroupContents(RegexSymbol **symbols)
+// write the captures made inside a non-flat group by its last iteration, all of whose widths are known from before it
+{
+    for (; *symbols; symbols++)
+    {
+        if ((*symbols)->type != RegexSymbol_Group || ((RegexGroup*)*symbols)->isLookaround() || (*symbols)->minCount == 0)
+            continue;
+        RegexGroup *group = (RegexGroup*)*symbols;
+        if (group->type == RegexGroup_Capturing)
+            captureConstGroup(((RegexGroupCapturing*)group)->backrefIndex, getConstantWidth(group->alternatives[0]->symbols));
+        captureConstGroupContents(group->alternatives[0]->symbols);
+    }
+}
+template <bool USE_STRINGS>
+Uint64 RegexMatcher<USE_STRINGS>::matchSymbol_ConstGroup(RegexSymbol *thisSymbol, bool capturing)
+{
+    Uint64 multiple;
+    if (!getConstGroupLength(thisSymbol, multiple))
+    {
+        nonMatch();
+        return NON_PARTICIPATING_CAPTURE_GROUP;
     }
     if (multiple == 0 && !capturing) // don't backtrack when it will make no difference to do so
     {
         symbol++;
         return 0;
     }
-    if (matchSymbol_Character_or_Backref(thisSymbol, multiple, (const char *)NULL))
-        return multiple;
-    return NON_PARTICIPATING_CAPTURE_GROUP;
+    bool flat = ((RegexConstGroup*)thisSymbol)->flat;
+    if (!flat)
+    {
+        countLimit = getConstGroupCountLimit(thisSymbol, multiple);
+        if (countLimit < thisSymbol->minCount)
+        {
+            countLimit = ULLONG_MAX;
+            nonMatch();
+            return NON_PARTICIPATING_CAPTURE_GROUP;
+        }
+    }
+    bool matched = matchSymbol_Character_or_Backref(thisSymbol, multiple, flat ? getConstGroupRepetend(thisSymbol, multiple) : (const char *)NULL);
+    countLimit = ULLONG_MAX;
+    if (!matched)
+        return NON_PARTICIPATING_CAPTURE_GROUP;
+    if (!flat)
+        captureConstGroupContents(((RegexConstGroup*)thisSymbol)->originalGroup->alternatives[0]->symbols);
+    return multiple;
 }
-template <bool USE_STRINGS> // currently implemented only for !USE_STRINGS
+template <bool USE_STRINGS>
 void RegexMatcher<USE_STRINGS>::matchSymbol_ConstGroupNonCapturing(RegexSymbol *thisSymbol)
 {
     matchSymbol_ConstGroup(thisSymbol, false);
 }
-template <bool USE_STRINGS> // currently implemented only for !USE_STRINGS
+template <bool USE_STRINGS>
 void RegexMatcher<USE_STRINGS>::matchSymbol_ConstGroupCapturing(RegexSymbol *thisSymbol)
 {
-    Uint64 position0 = position;
     Uint64 multiple = matchSymbol_ConstGroup(thisSymbol, true);
     if (multiple != NON_PARTICIPATING_CAPTURE_GROUP)
-    {
-        Uint backrefIndex = ((RegexConstGroupCapturing*)thisSymbol)->backrefIndex;
-
-        Backtrack_LeaveConstGroupCapturing<USE_STRINGS> *pushStack = stack.template push< Backtrack_LeaveConstGroupCapturing<USE_STRINGS> >(Backtrack_LeaveConstGroupCapturing<USE_STRINGS>::get_size());
-        pushStack->backrefIndex = backrefIndex;
-        if (enable_persistent_backrefs)
-        {
-            const char *&dummy = (const char *&)pushStack->buffer;
-            if (!USE_STRINGS)
-                readCapture(backrefIndex, *(Uint64*)(pushStack->buffer                      ), dummy);
-            else
-                readCapture(backrefIndex, *(Uint64*)(pushStack->buffer + sizeof(const char*)), *(const char**)pushStack->buffer);
-        }
-
-        Uint64 prevValue = captures[backrefIndex];
-        writeCapture(backrefIndex, multiple, (const char *)NULL);
-        if (!enable_persistent_backrefs || prevValue == NON_PARTICIPATING_CAPTURE_GROUP)
-        {
-            *captureStackTop++ = backrefIndex;
-            groupStackTop->numCaptured++;
-        }
-    }
+        captureConstGroup(((RegexConstGroupCapturing*)thisSymbol)->backrefIndex, multiple);
 }
 
+template<>
+inline bool RegexMatcher<false>::isArithmeticSpanUniform(RegexSymbol *thisSymbol, Uint64 spaceLeft, const char *lookintoPtr)
+{
+    return true;
+}
+template<>
+inline bool RegexMatcher<true>::isArithmeticSpanUniform(RegexSymbol *thisSymbol, Uint64 spaceLeft, const char *lookintoPtr)
+// return true if the span an IsPrime or IsPowerOf2 symbol tests consists only of the one character its lookaround matches;
+// it does if its first character is that one and every other character equals the one before it
+{
+    const char *s = !thisSymbol->possessive ? stringToMatchAgainst + position : lookintoPtr ? lookintoPtr : stringToMatchAgainst0;
+    if (spaceLeft == 0)
+        return true;
+    if (*s != thisSymbol->character)
+        return false;
+    return subjectRuns ? (Uint64)(getRunEnd(s) - s) >= spaceLeft : memcmp(s, s + 1, (size_t)spaceLeft - 1) == 0;
+}
 template <bool USE_STRINGS>
-void RegexMatcher<USE_STRINGS>::matchSymbol_IsPrime(RegexSymbol *thisSymbol)
+bool RegexMatcher<USE_STRINGS>::getArithmeticSpaceLeft(RegexSymbol *thisSymbol, Uint64 &spaceLeft)
+// get the length of the span that the negative lookaround (or lookinto) replaced by an IsPrime or IsPowerOf2 symbol tests;
+// return false if it has already been matched or failed to match, in which case there is nothing more to do
 {
-    Uint64 spaceLeft;
+    const char *lookintoPtr = NULL;
     if (!thisSymbol->possessive)
         spaceLeft = input - position;
     else
+    if (!getLookintoEntrace(((RegexBackref*)thisSymbol)->index, spaceLeft, lookintoPtr))
+        return false;
+    if (!isArithmeticSpanUniform(thisSymbol, spaceLeft, lookintoPtr))
     {
-        const char *ptr;
-        if (!getLookintoEntrace(((RegexBackref*)thisSymbol)->index, spaceLeft, ptr))
-            return;
+        // everything inside the lookaround can match only its one character, so it can't get as far as the $ at its end
+        symbol++;
+        return false;
     }
+    return true;
+}
+
+template <bool USE_STRINGS>
+void RegexMatcher<USE_STRINGS>::matchSymbol_IsPrime(RegexSymbol *thisSymbol)
+{
+    Uint64 spaceLeft;
+    if (!getArithmeticSpaceLeft(thisSymbol, spaceLeft))
+        return;
     if (inrange64(spaceLeft, thisSymbol->lazy, 1) || isPrime(spaceLeft))
     {
         symbol++;
@@ -102,14 +297,8 @@ template <bool USE_STRINGS>
 void RegexMatcher<USE_STRINGS>::matchSymbol_IsPowerOf2(RegexSymbol *thisSymbol)
 {
     Uint64 spaceLeft;
-    if (!thisSymbol->possessive)
-        spaceLeft = input - position;
-    else
-    {
-        const char *ptr;
-        if (!getLookintoEntrace(((RegexBackref*)thisSymbol)->index, spaceLeft, ptr))
-            return;
-    }
+    if (!getArithmeticSpaceLeft(thisSymbol, spaceLeft))
+        return;
     if ((spaceLeft != 0 || thisSymbol->lazy) && !(spaceLeft & (spaceLeft - 1)))
     {
         symbol++;
@@ -118,11 +307,79 @@ void RegexMatcher<USE_STRINGS>::matchSymbol_IsPowerOf2(RegexSymbol *thisSymbol)
     nonMatch();
 }
 
+template <bool USE_STRINGS>
+bool RegexMatcher<USE_STRINGS>::isConstantWidth(RegexSymbol **symbols, bool topLevel, bool inLookahead, Uint64 &numCharacters, std::vector<Uint> &captureIndexes, std::vector<Uint> &backrefIndexes)
+// return true if every match of symbols has the same width, given the captures made before them: characters and backreferences
+// repeated a fixed number of times, and groups of them; lookaheads of them, which may end in $, are allowed only at the top level.
+// Counts the characters outside lookaheads, and collects the capture groups and backreferences found.
+{
+    for (; *symbols; symbols++)
+    {
+        RegexSymbol *insideSymbol = *symbols;
+        switch (insideSymbol->type)
+        {
+        case RegexSymbol_NoOp:
+            break;
+        case RegexSymbol_AnchorEnd:
+            if (!inLookahead || insideSymbol->minCount && symbols[+1])
+                return false;
+            break;
+        case RegexSymbol_Character:
+            if (insideSymbol->minCount != insideSymbol->maxCount || !characterCanMatch(insideSymbol))
+                return false;
+            numCharacters += insideSymbol->minCount;
+            break;
+        case RegexSymbol_Backref:
+            if (insideSymbol->minCount != insideSymbol->maxCount)
+                return false;
+            backrefIndexes.push_back(((RegexBackref*)insideSymbol)->index);
+            break;
+        case RegexSymbol_Group:
+            {
+                RegexGroup *group = (RegexGroup*)insideSymbol;
+                if (group->alternatives[1] || group->minCount != group->maxCount)
+                    return false;
+                Uint64 groupCharacters = 0;
+                if (group->type == RegexGroup_Lookahead || group->type == RegexGroup_NegativeLookahead)
+                {
+                    if (!topLevel || group->minCount != 1)
+                        return false;
+                    if (!isConstantWidth(group->alternatives[0]->symbols, false, true, groupCharacters, captureIndexes, backrefIndexes))
+                        return false;
+                    break;
+                }
+                if (group->type == RegexGroup_Capturing && !inLookahead)
+                    captureIndexes.push_back(((RegexGroupCapturing*)group)->backrefIndex);
+                else
+                if (group->type != RegexGroup_NonCapturing)
+                    return false;
+                if (!isConstantWidth(group->alternatives[0]->symbols, false, inLookahead, groupCharacters, captureIndexes, backrefIndexes))
+                    return false;
+                numCharacters += groupCharacters * group->minCount;
+                break;
+            }
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+template <bool USE_STRINGS>
+bool RegexMatcher<USE_STRINGS>::isArithmeticCharacter(RegexSymbol *thisSymbol, RegexSymbol *firstCharacter)
+// return true if thisSymbol is a character that can be part of a lookaround rewritten into an IsPrime or IsPowerOf2 symbol;
+// in string mode, that means the same literal character as firstCharacter, unless it is NULL
+{
+    if (thisSymbol->type != RegexSymbol_Character || !characterCanMatch(thisSymbol))
+        return false;
+    return !USE_STRINGS || !thisSymbol->characterAny && (!firstCharacter || thisSymbol->character == firstCharacter->character);
+}
+
 template <bool USE_STRINGS>
 ALWAYS_INLINE bool RegexMatcher<USE_STRINGS>::staticallyOptimizeGroup(RegexSymbol **thisSymbol)
 // return true if the group has been rewritten into a specialized symbol
 {
-    if (optimizationLevel && !USE_STRINGS)
+    if (optimizationLevel)
     {
         RegexGroup *const group = (RegexGroup*)(*thisSymbol);
         if ((group->type == RegexGroup_NonCapturing || group->type == RegexGroup_Capturing) && group->maxCount)
@@ -131,28 +388,56 @@ ALWAYS_INLINE bool RegexMatcher<USE_STRINGS>::staticallyOptimizeGroup(RegexSymbo
             if (!insideAlternative[+1])
             {
                 Uint backrefIndex = group->type == RegexGroup_Capturing ? ((RegexGroupCapturing*)group)->backrefIndex : UINT_MAX;
-                for (RegexSymbol **insideSymbol = insideAlternative[0]->symbols; *insideSymbol;)
+                RegexSymbol **insideSymbol;
+                bool hasCharacters = false;
+                for (insideSymbol = insideAlternative[0]->symbols; *insideSymbol; insideSymbol++)
                 {
+                    if (USE_STRINGS && (*insideSymbol)->type == RegexSymbol_String) // has no count
+                    {
+                        hasCharacters = true;
+                        continue;
+                    }
                     if ((*insideSymbol)->type != RegexSymbol_Character && (*insideSymbol)->type != RegexSymbol_Backref && (*insideSymbol)->type != RegexSymbol_NoOp || (*insideSymbol)->minCount != (*insideSymbol)->maxCount)
                         break;
+                    if ((*insideSymbol)->type == RegexSymbol_Character && (*insideSymbol)->minCount && !characterCanMatch(*insideSymbol))
+                        break;
+                    if (USE_STRINGS && (*insideSymbol)->type == RegexSymbol_Character && (*insideSymbol)->characterAny) // can't be compared against as part of a string
+                        break;
                     if ((*insideSymbol)->type == RegexSymbol_Backref && ((RegexBackref*)*insideSymbol)->index == backrefIndex)
                         break;
-                    insideSymbol++;
-                    if (!*insideSymbol)
-                    {
-                        const char    *originalCode      = (*thisSymbol)->originalCode;
-                        RegexPattern **parentAlternative = (*thisSymbol)->parentAlternative;
+                    if ((*insideSymbol)->type == RegexSymbol_Character && (*insideSymbol)->minCount)
+                        hasCharacters = true;
+                }
+                bool flat = !*insideSymbol;
+                // a capture group of nothing but backreferences can have a width of zero, whose iterations can't be counted by dividing
+                bool constantWidth = flat && (hasCharacters || backrefIndex == UINT_MAX);
+                if (!flat && optimizationLevel >= 2 && !USE_STRINGS) // only in numerical mode can what its groups and lookaheads match be known from their widths
+                {
+                    // (?:(?=xxx)(x)\2x)* - every iteration has the same width, so this can still be matched arithmetically, provided that
+                    // nothing in it refers back to a capture that changes from one iteration to the next
+                    Uint64 numCharacters = 0;
+                    std::vector<Uint> captureIndexes, backrefIndexes;
+                    constantWidth = isConstantWidth(insideAlternative[0]->symbols, true, false, numCharacters, captureIndexes, backrefIndexes) && numCharacters;
+                    captureIndexes.push_back(backrefIndex);
+                    for (size_t i=0; i<backrefIndexes.size(); i++)
+                        for (size_t j=0; j<captureIndexes.size(); j++)
+                            if (backrefIndexes[i] == captureIndexes[j])
+                                constantWidth = false;
+                }
+                if (constantWidth)
+                {
+                    const char    *originalCode      = (*thisSymbol)->originalCode;
+                    RegexPattern **parentAlternative = (*thisSymbol)->parentAlternative;
 
-                        *thisSymbol = group->type == RegexGroup_NonCapturing ? new RegexConstGroup(group) : new RegexConstGroupCapturing(group, backrefIndex);
-                        (*thisSymbol)->minCount          = group->minCount;
-                        (*thisSymbol)->maxCount          = group->maxCount;
-                        (*thisSymbol)->lazy              = group->lazy;
-                        (*thisSymbol)->possessive        = group->possessive;
-                        (*thisSymbol)->parentAlternative = parentAlternative;
-                        (*thisSymbol)->self              = thisSymbol;
-                        (*thisSymbol)->originalCode      = originalCode;
-                        return true;
-                    }
+                    *thisSymbol = group->type == RegexGroup_NonCapturing ? new (*arena) RegexConstGroup(group, flat) : new (*arena) RegexConstGroupCapturing(group, backrefIndex, flat);
+                    (*thisSymbol)->minCount          = group->minCount;
+                    (*thisSymbol)->maxCount          = group->maxCount;
+                    (*thisSymbol)->lazy              = group->lazy;
+                    (*thisSymbol)->possessive        = group->possessive;
+                    (*thisSymbol)->parentAlternative = parentAlternative;
+                    (*thisSymbol)->self              = thisSymbol;
+                    (*thisSymbol)->originalCode      = originalCode;
+                    return true;
                 }
             }
         }
@@ -184,17 +469,18 @@ ALWAYS_INLINE bool RegexMatcher<USE_STRINGS>::staticallyOptimizeGroup(RegexSymbo
                     else
                         innerSymbol = innerAlternative[0]->symbols;
 
-                    if (innerSymbol[0] && innerSymbol[0]->type==RegexSymbol_Character && innerSymbol[0]->minCount==1 && innerSymbol[0]->maxCount==1        && characterCanMatch(innerSymbol[0]) &&
-                        innerSymbol[1] && innerSymbol[1]->type==RegexSymbol_Character && innerSymbol[1]->minCount==1 && innerSymbol[1]->maxCount==UINT_MAX && characterCanMatch(innerSymbol[1]) && !innerSymbol[2])
+                    if (innerSymbol[0] && isArithmeticCharacter(innerSymbol[0], NULL)           && innerSymbol[0]->minCount==1 && innerSymbol[0]->maxCount==1 &&
+                        innerSymbol[1] && isArithmeticCharacter(innerSymbol[1], innerSymbol[0]) && innerSymbol[1]->minCount==1 && innerSymbol[1]->maxCount==UINT_MAX && !innerSymbol[2])
                     {
                         RegexSymbol   *originalSymbol    = (*thisSymbol);
                         const char    *originalCode      = (*thisSymbol)->originalCode;
                         RegexPattern **parentAlternative = (*thisSymbol)->parentAlternative;
 
                         bool isLookinto = group->type == RegexGroup_NegativeLookinto;
-                        *thisSymbol = isLookinto ? new RegexBackref(RegexSymbol_IsPrime) : new RegexSymbol(RegexSymbol_IsPrime);
+                        *thisSymbol = isLookinto ? new (*arena) RegexBackref(RegexSymbol_IsPrime) : new (*arena) RegexSymbol(RegexSymbol_IsPrime);
                         (*thisSymbol)->lazy              = matchZero ? 0 : 1;
                         (*thisSymbol)->possessive        = isLookinto;
+                        (*thisSymbol)->character         = innerSymbol[0]->character;
                         (*thisSymbol)->parentAlternative = parentAlternative;
                         (*thisSymbol)->self              = thisSymbol;
                         (*thisSymbol)->originalCode      = originalCode;
@@ -241,7 +527,7 @@ ALWAYS_INLINE bool RegexMatcher<USE_STRINGS>::staticallyOptimizeGroup(RegexSymbo
                             innerSymbol1 = innerSymbol[1];
                             innerSymbol2 = innerSymbol[0];
                         }
-                        if (innerSymbol1->type==RegexSymbol_Character && innerSymbol1->minCount==1 && innerSymbol1->maxCount==1        && characterCanMatch(innerSymbol1) &&
+                        if (isArithmeticCharacter(innerSymbol1, NULL) && innerSymbol1->minCount==1 && innerSymbol1->maxCount==1 &&
                             innerSymbol2->type==RegexSymbol_Group     && innerSymbol2->minCount==1 && innerSymbol2->maxCount==UINT_MAX && !innerSymbol2->possessive)
                         {
                             RegexGroup *innerGroup = (RegexGroup*)innerSymbol2;
@@ -252,16 +538,17 @@ ALWAYS_INLINE bool RegexMatcher<USE_STRINGS>::staticallyOptimizeGroup(RegexSymbo
                                 if (!innermostAlternative[1])
                                 {
                                     innermostSymbol = innermostAlternative[0]->symbols;
-                                    if (innermostSymbol[0] && innermostSymbol[0]->type==RegexSymbol_Character && innermostSymbol[0]->minCount==2 && innermostSymbol[0]->maxCount==2 && characterCanMatch(innermostSymbol[0]) && !innermostSymbol[1])
+                                    if (innermostSymbol[0] && isArithmeticCharacter(innermostSymbol[0], innerSymbol1) && innermostSymbol[0]->minCount==2 && innermostSymbol[0]->maxCount==2 && !innermostSymbol[1])
                                     {
                                         RegexSymbol   *originalSymbol    = (*thisSymbol);
                                         const char    *originalCode      = (*thisSymbol)->originalCode;
                                         RegexPattern **parentAlternative = (*thisSymbol)->parentAlternative;
 
                                         bool isLookinto = group->type == RegexGroup_NegativeLookinto;
-                                        *thisSymbol = isLookinto ? new RegexBackref(RegexSymbol_IsPowerOf2) : new RegexSymbol(RegexSymbol_IsPowerOf2);
+                                        *thisSymbol = isLookinto ? new (*arena) RegexBackref(RegexSymbol_IsPowerOf2) : new (*arena) RegexSymbol(RegexSymbol_IsPowerOf2);
                                         (*thisSymbol)->lazy              = matchZero;
                                         (*thisSymbol)->possessive        = isLookinto;
+                                        (*thisSymbol)->character         = innerSymbol1->character;
                                         (*thisSymbol)->parentAlternative = parentAlternative;
                                         (*thisSymbol)->self              = thisSymbol;
                                         (*thisSymbol)->originalCode      = originalCode;
@@ -292,7 +579,7 @@ ALWAYS_INLINE bool RegexMatcher<USE_STRINGS>::staticallyOptimizeGroup(RegexSymbo
                 {
                     RegexSymbol **innerSymbol1 = insideGroup1->alternatives[0]->symbols;
                     RegexSymbol **innerSymbol2 = insideGroup2->alternatives[0]->symbols;
-                    if (innerSymbol1[0] && innerSymbol1[0]->type==RegexSymbol_Character && innerSymbol1[0]->minCount<=1 && innerSymbol1[0]->maxCount==UINT_MAX && characterCanMatch(innerSymbol1[0]) && !innerSymbol1[1] &&
+                    if (innerSymbol1[0] && isArithmeticCharacter(innerSymbol1[0], NULL) && innerSymbol1[0]->minCount<=1 && innerSymbol1[0]->maxCount==UINT_MAX && !innerSymbol1[1] &&
                         innerSymbol2[0] && innerSymbol2[0]->type==RegexSymbol_Backref   && innerSymbol2[0]->minCount==1 && innerSymbol2[0]->maxCount==1 &&
                         innerSymbol2[1] && innerSymbol2[1]->type==RegexSymbol_Backref   && innerSymbol2[1]->minCount==1 && innerSymbol2[1]->maxCount==1 && !innerSymbol2[2])
                     {
@@ -305,9 +592,10 @@ ALWAYS_INLINE bool RegexMatcher<USE_STRINGS>::staticallyOptimizeGroup(RegexSymbo
                             RegexPattern **parentAlternative = (*thisSymbol)->parentAlternative;
 
                             bool isLookinto = group->type == RegexGroup_NegativeLookinto;
-                            *thisSymbol = isLookinto ? new RegexBackref(RegexSymbol_IsPowerOf2) : new RegexSymbol(RegexSymbol_IsPowerOf2);
+                            *thisSymbol = isLookinto ? new (*arena) RegexBackref(RegexSymbol_IsPowerOf2) : new (*arena) RegexSymbol(RegexSymbol_IsPowerOf2);
                             (*thisSymbol)->lazy              = (bool&)innerSymbol1[0]->minCount; // can be cast by reinterpretation since the value has already been narrowed down to being 0 or 1
                             (*thisSymbol)->possessive        = isLookinto;
+                            (*thisSymbol)->character         = innerSymbol1[0]->character;
                             (*thisSymbol)->parentAlternative = parentAlternative;
                             (*thisSymbol)->self              = thisSymbol;
                             (*thisSymbol)->originalCode      = originalCode;
@@ -326,6 +614,134 @@ ALWAYS_INLINE bool RegexMatcher<USE_STRINGS>::staticallyOptimizeGroup(RegexSymbo
     return false;
 }
 
+// A symbol followed, past any zero-width assertions, only by quantified symbols of constant length and then by $, can
+// only lead to a match with a count of it that leaves room for a whole number of each of them. Their lengths are all
+// fixed by the time it is matched, so the counts that do are those in a range that leave a remainder a multiple of the
+// gcd of the lengths whose counts can vary, i.e. the solutions of a linear congruence. Returns false if the symbol isn't
+// followed by such a tail; otherwise the counts worth trying are those from firstCount to lastCount that are congruent
+// to residue modulo period (none if firstCount > lastCount). This is a necessary condition rather than a sufficient one,
+// so each symbol of the tail narrows down its own counts in turn, and the last is matched exactly as a single
+// quantified symbol followed by $ always is.
+template <bool USE_STRINGS>
+bool RegexMatcher<USE_STRINGS>::findCountsLeavingRoomForTail(RegexSymbol *thisSymbol, Uint64 multiple, Uint64 &firstCount, Uint64 &lastCount, Uint64 &residue, Uint64 &period)
+{
+    if (USE_STRINGS || multiple == 0 || isNonFlatConstGroup(thisSymbol)) // a non-flat group writes captures after its count is chosen
+        return false;
+    RegexSymbol **tailSymbol = symbol + 1;
+    while (*tailSymbol && ((*tailSymbol)->type == RegexSymbol_IsPrime || (*tailSymbol)->type == RegexSymbol_IsPowerOf2 || (*tailSymbol)->type == RegexSymbol_Group && ((RegexGroup*)*tailSymbol)->isNegativeLookaround()))
+        tailSymbol++;
+    // a capture made by this symbol is only written after its count has been chosen
+    Uint thisBackrefIndex = thisSymbol->type == RegexSymbol_ConstGroupCapturing ? ((RegexConstGroupCapturing*)thisSymbol)->backrefIndex : UINT_MAX;
+    Uint64 tailMinLength = 0, tailMaxLength = 0, tailStride = 0;
+    bool tailCanMatch = true;
+    RegexSymbol **tailStart = tailSymbol;
+    for (;; tailSymbol++)
+    {
+        RegexSymbol *term = *tailSymbol;
+        if (!term)
+            return false;
+        void (RegexMatcher<USE_STRINGS>::*termFunction)(RegexSymbol *thisSymbol) = matchFunction(term);
+        if (termFunction == &RegexMatcher<USE_STRINGS>::matchSymbol_AnchorEnd)
+            break;
+        Uint64 length;
+        if (termFunction == &RegexMatcher<USE_STRINGS>::matchSymbol_Character || termFunction == &RegexMatcher<USE_STRINGS>::matchSymbol_CharacterClass)
+            length = 1;
+        else
+        if (termFunction == &RegexMatcher<USE_STRINGS>::matchSymbol_Backref)
+        {
+            if (((RegexBackref*)term)->index == thisBackrefIndex)
+                return false;
+            const char *pBackref;
+            readCapture(((RegexBackref*)term)->index, length, pBackref);
+            if (length == NON_PARTICIPATING_CAPTURE_GROUP)
+            {
+                if (!emulate_ECMA_NPCGs && term->minCount != 0)
+                    tailCanMatch = false;
+                length = 0;
+            }
+        }
+        else
+        if (termFunction == &RegexMatcher<USE_STRINGS>::matchSymbol_ConstGroupNonCapturing && thisBackrefIndex == UINT_MAX && !isNonFlatConstGroup(term))
+        {
+            if (!getConstGroupLength(term, length))
+                tailCanMatch = false;
+        }
+        else
+            return false;
+        tailMinLength = addLengths(tailMinLength, multiplyLength(length, term->minCount));
+        tailMaxLength = term->maxCount == UINT_MAX ? (length ? ULLONG_MAX : tailMaxLength) : addLengths(tailMaxLength, multiplyLength(length, term->maxCount));
+        if (term->minCount != term->maxCount)
+            tailStride = gcdLength(tailStride, length);
+    }
+    if (tailSymbol == tailStart || tailMinLength == ULLONG_MAX)
+        return false;
+
+    Uint64 spaceLeft = input - position;
+    firstCount = thisSymbol->minCount;
+    lastCount  = MAX_EXTEND(thisSymbol->maxCount);
+    residue    = 0;
+    period     = 1;
+    if (!tailCanMatch || spaceLeft < tailMinLength)
+    {
+        firstCount = 1;
+        lastCount  = 0;
+        return true;
+    }
+    Uint64 room = spaceLeft - tailMinLength; // to be shared by this symbol and the counts of the tail that can vary
+    if (lastCount > room / multiple)
+        lastCount = room / multiple;
+    if (tailMaxLength < spaceLeft)
+    {
+        Uint64 roomNotInTail = spaceLeft - tailMaxLength;
+        Uint64 fewestCount = roomNotInTail / multiple + (roomNotInTail % multiple != 0);
+        if (firstCount < fewestCount)
+            firstCount = fewestCount;
+    }
+    if (tailStride) // solve count * multiple == room (mod tailStride)
+    {
+        Uint64 divisor = gcdLength(multiple, tailStride);
+        if (room % divisor != 0)
+        {
+            firstCount = 1;
+            lastCount  = 0;
+            return true;
+        }
+        period = tailStride / divisor;
+        if (period > 1)
+            residue = multiplyModulo(room / divisor % period, inverseModulo(multiple / divisor % period, period), period);
+    }
+    return true;
+}
+
+// The counts that findCountsLeavingRoomForTail() allows nearest to count, no greater or no less than it; return false
+// if there are none
+static inline bool lastCountUpTo(Uint64 count, Uint64 firstCount, Uint64 lastCount, Uint64 residue, Uint64 period, Uint64 &found)
+{
+    if (count > lastCount)
+        count = lastCount;
+    if (count < firstCount)
+        return false;
+    Uint64 remainder = count % period;
+    Uint64 back = remainder >= residue ? remainder - residue : remainder + (period - residue);
+    if (back > count - firstCount)
+        return false;
+    found = count - back;
+    return true;
+}
+static inline bool firstCountFrom(Uint64 count, Uint64 firstCount, Uint64 lastCount, Uint64 residue, Uint64 period, Uint64 &found)
+{
+    if (count < firstCount)
+        count = firstCount;
+    if (count > lastCount)
+        return false;
+    Uint64 remainder = count % period;
+    Uint64 forward = residue >= remainder ? residue - remainder : residue + (period - remainder);
+    if (forward > lastCount - count)
+        return false;
+    found = count + forward;
+    return true;
+}
+
 template <bool USE_STRINGS>
 template <typename MATCH_TYPE>
 ALWAYS_INLINE int8 RegexMatcher<USE_STRINGS>::runtimeOptimize_matchSymbol_Character_or_Backref(RegexSymbol *const thisSymbol, Uint64 const multiple, MATCH_TYPE const repetend)
@@ -342,7 +758,7 @@ ALWAYS_INLINE int8 RegexMatcher<USE_STRINGS>::runtimeOptimize_matchSymbol_Charac
         {
             Uint64 spaceLeft = input - position;
             currentMatch = spaceLeft / multiple;
-            if (!inrange64(currentMatch, thisSymbol->minCount, MAX_EXTEND(thisSymbol->maxCount)))
+            if (!inrange64(currentMatch, thisSymbol->minCount, getMaxCount(thisSymbol)))
             {
                 nonMatch();
                 return -1;
@@ -358,9 +774,32 @@ ALWAYS_INLINE int8 RegexMatcher<USE_STRINGS>::runtimeOptimize_matchSymbol_Charac
             symbol++;
             return matched;
         }
+        // the optimizations below read captures that a non-flat group would change
+        if (isNonFlatConstGroup(thisSymbol))
+            return 0;
+        Uint64 firstCount, lastCount, residue, period;
+        if (findCountsLeavingRoomForTail(thisSymbol, multiple, firstCount, lastCount, residue, period))
+        {
+            Uint64 count, nextCount;
+            if (thisSymbol->lazy ? !firstCountFrom(0, firstCount, lastCount, residue, period, count) : !lastCountUpTo(ULLONG_MAX, firstCount, lastCount, residue, period, count))
+            {
+                nonMatch();
+                return -1;
+            }
+            currentMatch = count;
+            if (thisSymbol->lazy ? count != ULLONG_MAX && firstCountFrom(count + 1, firstCount, lastCount, residue, period, nextCount)
+                                 : count != 0          && lastCountUpTo (count - 1, firstCount, lastCount, residue, period, nextCount))
+                pushStack();
+            int8 matched = count != 0 ? +1 : -1;
+            position    += count * multiple;
+            currentMatch = ULLONG_MAX;
+            symbol++;
+            return matched;
+        }
         RegexGroup *thisGroup = groupStackTop->group;
         bool afterEndOfGroup = false;
-        if (nextSymbol && nextSymbol->type==RegexSymbol_Backref && nextSymbolPtr[+1] && nextSymbolPtr[+1]->type==RegexSymbol_AnchorEnd && nextSymbol->minCount==1 && nextSymbol->maxCount==1)
+        if (nextSymbol && nextSymbol->type==RegexSymbol_Backref && nextSymbolPtr[+1] && nextSymbolPtr[+1]->type==RegexSymbol_AnchorEnd && nextSymbol->minCount==1 && nextSymbol->maxCount==1 &&
+            !(thisSymbol->type==RegexSymbol_ConstGroupCapturing && ((RegexConstGroupCapturing*)thisSymbol)->backrefIndex == ((RegexBackref*)nextSymbol)->index)) // not yet captured
         {
             Uint64 subtract = captures[((RegexBackref*)nextSymbol)->index];
             if (subtract == NON_PARTICIPATING_CAPTURE_GROUP)
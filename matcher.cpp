@@ -10,12 +10,15 @@
  */
 
 #include "regex.h"
+#include "runs.h"
 #include "matcher.h"
 #include "matcher-optimization.h"
 
 RegexPattern *nullAlternative = NULL;
 RegexSymbol  *nullSymbol      = NULL;
 
+BacktrackStatistics *backtrackStatistics = NULL;
+
 template <bool USE_STRINGS>
 void RegexMatcher<USE_STRINGS>::nonMatch(NonMatchType type)
 {
@@ -54,7 +57,9 @@ void RegexMatcher<USE_STRINGS>::nonMatch(NonMatchType type)
         if (*alternative && (stack.empty() || stack->okayToTryAlternatives(*this)) && !inrange(groupStackTop->group->type, RegexGroup_Conditional, RegexGroup_LookaroundConditional))
         {
             alternative++;
-            if (*alternative)
+            if (groupStackTop == groupStackBase)
+                alternative = skipInfeasibleRootAlternatives(alternative, input - groupStackBase->position);
+            if (*alternative && alternative != rootAlternativesEnd)
             {
                 verb = RegexVerb_None;
                 if (groupStackTop->group->type==RegexGroup_Lookinto || groupStackTop->group->type==RegexGroup_LookintoMolecular || groupStackTop->group->type==RegexGroup_NegativeLookinto)
@@ -331,13 +336,53 @@ void *RegexMatcher<USE_STRINGS>::loopGroup(Backtrack_LoopGroup<USE_STRINGS> *pus
     pushLoop->oldPosition = oldPosition;
     pushLoop->alternative = alternativeNum;
 
+    if (optimizationLevel && collapseLoopGroup(pushLoop))
+        pushLoop = NULL;
+
     if (group->type == RegexGroup_Atomic)
         stack.template push< Backtrack_BeginAtomicGroup<USE_STRINGS> >();
     else
     if (group->type == RegexGroup_LookaroundConditional)
         enterGroup(((RegexLookaroundConditional*)group)->lookaround);
 
-    return (void*)pushLoop->buffer;
+    return pushLoop ? (void*)pushLoop->buffer : NULL;
+}
+
+// If the iteration just recorded by pushLoop left everything as the one before it did, apart from positions advanced by
+// the same stride, replace its record with a count in a Backtrack_LoopGroupRun. Returns true if this was done.
+template <bool USE_STRINGS>
+bool RegexMatcher<USE_STRINGS>::collapseLoopGroup(Backtrack_LoopGroup<USE_STRINGS> *pushLoop)
+{
+    // Entering or leaving a group always pushes a node, so a loop record directly under this one is of the same group
+    BacktrackNode<USE_STRINGS> *under = stack.nodeUnderTop(*this);
+    if (!under)
+        return false;
+    Uint64 iterations = under->getLoopIterations();
+    if (iterations == 0)
+        return false;
+    Backtrack_LoopGroupRun<USE_STRINGS> *run = iterations == 1 ? NULL : (Backtrack_LoopGroupRun<USE_STRINGS>*)under;
+    Backtrack_LoopGroup<USE_STRINGS> *first = run ? run->first : (Backtrack_LoopGroup<USE_STRINGS>*)under;
+
+    Uint64 stride = first->position - first->oldPosition;
+    if (pushLoop->position - pushLoop->oldPosition != stride ||
+        pushLoop->oldPosition != first->oldPosition + iterations * stride ||
+        pushLoop->numCaptured != first->numCaptured ||
+        pushLoop->alternative != first->alternative)
+        return false;
+    size_t bufferSize = Backtrack_LoopGroup<USE_STRINGS>::get_size(first->numCaptured) - Backtrack_LoopGroup<USE_STRINGS>::get_size(0);
+    if (memcmp(pushLoop->buffer, first->buffer, bufferSize) != 0)
+        return false;
+
+    stack.unpush(*this);
+    if (run)
+        run->runLength++;
+    else
+    {
+        run = stack.template push< Backtrack_LoopGroupRun<USE_STRINGS> >();
+        run->first = first;
+        run->runLength = 1;
+    }
+    return true;
 }
 
 bool matchWordCharacter(Uchar ch);
@@ -378,12 +423,33 @@ template<> bool RegexMatcher<false>::doesRepetendMatch(RegexCharacterClass *char
 {
     return true;
 }
+template<> const char *RegexMatcher<true>::getRunEnd(const char *s)
+{
+    return stringToMatchAgainst0 + subjectRuns->getRunEnd(s - stringToMatchAgainst0);
+}
+template<> bool RegexMatcher<true>::isRepetendUniform(const char *pBackref, Uint64 multiple)
+// return true if the multiple characters at pBackref are all the same, so that any number of repetitions of them are
+// matched by a long enough run of that character; pBackref is either in the subject or a short string of the pattern's
+{
+    if (pBackref >= stringToMatchAgainst0 && pBackref < stringToMatchAgainst0 + input0)
+        return getRunEnd(pBackref) - pBackref >= multiple;
+    return multiple <= 1 || memcmp(pBackref, pBackref + 1, (size_t)multiple - 1) == 0;
+}
+
 template<> bool RegexMatcher<true>::doesRepetendMatch(const char *pBackref, Uint64 multiple, Uint64 count)
 {
     if (pBackref)
     {
         const char *s          = stringToMatchAgainst + position;
         const char *upperBound = stringToMatchAgainst + input - multiple;
+        if (subjectRuns && multiple && isRepetendUniform(pBackref, multiple))
+        {
+            Uint64 length = (input - position) / multiple;
+            if (length > count)
+                length = count;
+            length *= multiple;
+            return length == 0 || *s == *pBackref && (Uint64)(getRunEnd(s) - s) >= length;
+        }
         for (Uint64 i=0; i < count && s <= upperBound; i++, s+=multiple)
             if (memcmp(s, pBackref, (size_t)multiple)!=0)
                 return false;
@@ -394,6 +460,13 @@ template<> bool RegexMatcher<true>::doesRepetendMatch(bool (*matchFunction)(Ucha
 {
     const char *s          = stringToMatchAgainst + position;
     const char *upperBound = stringToMatchAgainst + input - 1;
+    if (subjectRuns)
+    {
+        for (const char *end = s + (count < input - position ? count : input - position); s < end; s = getRunEnd(s))
+            if (!matchFunction(*s))
+                return false;
+        return true;
+    }
     for (Uint64 i=0; i < count && s <= upperBound; i++, s+=1)
         if (!matchFunction(*s))
             return false;
@@ -403,6 +476,13 @@ template<> bool RegexMatcher<true>::doesRepetendMatch(RegexCharacterClass *charC
 {
     const char *s          = stringToMatchAgainst + position;
     const char *upperBound = stringToMatchAgainst + input - 1;
+    if (subjectRuns)
+    {
+        for (const char *end = s + (count < input - position ? count : input - position); s < end; s = getRunEnd(s))
+            if (!charClass->isInClass(*s))
+                return false;
+        return true;
+    }
     for (Uint64 i=0; i < count && s <= upperBound; i++, s+=1)
         if (!charClass->isInClass(*s))
             return false;
@@ -452,6 +532,13 @@ template<> void RegexMatcher<true>::countRepetendMatches(const char *pBackref, U
 {
     const char *s = stringToMatchAgainst + position;
     Uint64 count;
+    if (subjectRuns && multiple && isRepetendUniform(pBackref, multiple))
+    {
+        count = *s == *pBackref ? (getRunEnd(s) - s) / multiple : 0;
+        if (currentMatch > count)
+            currentMatch = count;
+        return;
+    }
     for (count = 0; count < currentMatch; count++, s+=multiple)
         if (memcmp(s, pBackref, (size_t)multiple)!=0)
             break;
@@ -461,6 +548,16 @@ template<> void RegexMatcher<true>::countRepetendMatches(bool (*matchFunction)(U
 {
     const char *s = stringToMatchAgainst + position;
     Uint64 count;
+    if (subjectRuns)
+    {
+        const char *subjectEnd = stringToMatchAgainst0 + input0;
+        const char *end = currentMatch < (Uint64)(subjectEnd - s) ? s + currentMatch : subjectEnd;
+        const char *run = s;
+        while (run < end && matchFunction(*run))
+            run = getRunEnd(run);
+        currentMatch = (run < end ? run : end) - s;
+        return;
+    }
     for (count = 0; count < currentMatch; count++, s+=1)
         if (!matchFunction(*s))
             break;
@@ -470,6 +567,16 @@ template<> void RegexMatcher<true>::countRepetendMatches(RegexCharacterClass *ch
 {
     const char *s = stringToMatchAgainst + position;
     Uint64 count;
+    if (subjectRuns)
+    {
+        const char *subjectEnd = stringToMatchAgainst0 + input0;
+        const char *end = currentMatch < (Uint64)(subjectEnd - s) ? s + currentMatch : subjectEnd;
+        const char *run = s;
+        while (run < end && charClass->isInClass(*run))
+            run = getRunEnd(run);
+        currentMatch = (run < end ? run : end) - s;
+        return;
+    }
     for (count = 0; count < currentMatch; count++, s+=1)
         if (!charClass->isInClass(*s))
             break;
@@ -591,7 +698,7 @@ bool RegexMatcher<USE_STRINGS>::matchSymbol_Character_or_Backref(RegexSymbol *th
         }
         else
         {
-            if (thisSymbol->maxCount == UINT_MAX)
+            if (getMaxCount(thisSymbol) == ULLONG_MAX)
             {
                 Uint64 spaceLeft = input - position;
                 currentMatch = spaceLeft / multiple;
@@ -622,7 +729,7 @@ bool RegexMatcher<USE_STRINGS>::matchSymbol_Character_or_Backref(RegexSymbol *th
             }
             else
             {
-                currentMatch = thisSymbol->maxCount;
+                currentMatch = getMaxCount(thisSymbol);
                 if (USE_STRINGS && repetend)
                 {
                     countRepetendMatches(repetend, multiple);
@@ -649,7 +756,7 @@ bool RegexMatcher<USE_STRINGS>::matchSymbol_Character_or_Backref(RegexSymbol *th
                     return false;
                 }
                 bool matched = currentMatch != 0;
-                if (currentMatch != (thisSymbol->lazy ? MAX_EXTEND(thisSymbol->maxCount) : thisSymbol->minCount))
+                if (currentMatch != (thisSymbol->lazy ? getMaxCount(thisSymbol) : thisSymbol->minCount))
                     pushStack();
                 position     = neededMatch;
                 currentMatch = ULLONG_MAX;
@@ -663,9 +770,24 @@ bool RegexMatcher<USE_STRINGS>::matchSymbol_Character_or_Backref(RegexSymbol *th
             return false;
         }
     try_next_match:
+        if (!USE_STRINGS && optimizationLevel && !thisSymbol->possessive)
+        {
+            // skip straight to the next count that can leave room for what follows, if that is known
+            Uint64 firstCount, lastCount, residue, period;
+            if (findCountsLeavingRoomForTail(thisSymbol, multiple, firstCount, lastCount, residue, period))
+            {
+                if (thisSymbol->lazy ? !firstCountFrom(currentMatch + 1, firstCount, lastCount, residue, period, currentMatch)
+                                     : currentMatch == 0 || !lastCountUpTo(currentMatch - 1, firstCount, lastCount, residue, period, currentMatch))
+                {
+                    nonMatch();
+                    return false;
+                }
+                continue;
+            }
+        }
         if (thisSymbol->lazy)
         {
-            if (currentMatch == MAX_EXTEND(thisSymbol->maxCount))
+            if (currentMatch == getMaxCount(thisSymbol))
             {
                 nonMatch();
                 return false;
@@ -894,7 +1016,6 @@ template<> void (RegexMatcher<true>::*RegexMatcher<true>::chooseBuiltinCharacter
 template <bool USE_STRINGS>
 void RegexMatcher<USE_STRINGS>::virtualizeSymbols(RegexGroup *rootGroup)
 {
-    // Note that this group iterator code is redundant with that at the end of RegexParser::RegexParser(); todo: Factor it out into a separate function
     RegexPattern **thisAlternative;
     RegexSymbol  **thisSymbol = &(RegexSymbol*&)rootGroup;
     for (;;)
@@ -992,12 +1113,6 @@ void RegexMatcher<USE_STRINGS>::virtualizeSymbols(RegexGroup *rootGroup)
                 break;
             case RegexSymbol_IsPrime:
             case RegexSymbol_IsPowerOf2:
-                if (USE_STRINGS)
-                {
-                    RegexSymbol *originalSymbol = (*thisSymbol)->originalSymbol;
-                    delete *thisSymbol;
-                    *thisSymbol = originalSymbol;
-                }
                 thisSymbol++;
                 break;
             case RegexSymbol_Verb:
@@ -1143,20 +1258,407 @@ template<> void RegexMatcher<true>::popLookintoInput()
     stringToMatchAgainst = *--stringLookintoTop;
 }
 
+// The lengths that a match of some part of a pattern can have: a range, together with a stride that the difference of
+// each of them from the minimum is a multiple of (0 if there is only one length). A minimum that has saturated at
+// ULLONG_MAX tells nothing about which lengths are possible modulo the stride, so it is then 1.
+class RegexLengths
+{
+public:
+    Uint64 minLength, maxLength, stride;
+    RegexLengths(Uint64 minLength = 0, Uint64 maxLength = 0, Uint64 stride = 0) : minLength(minLength), maxLength(maxLength), stride(minLength == ULLONG_MAX ? 1 : stride)
+    {
+    }
+    // the lengths of a match of this followed by a match of other
+    RegexLengths operator+(const RegexLengths &other) const
+    {
+        return RegexLengths(addLengths(minLength, other.minLength), addLengths(maxLength, other.maxLength), gcdLength(stride, other.stride));
+    }
+    // the lengths of a match of either this or other
+    RegexLengths operator|(const RegexLengths &other) const
+    {
+        Uint64 difference = minLength > other.minLength ? minLength - other.minLength : other.minLength - minLength;
+        return RegexLengths(minLength < other.minLength ? minLength : other.minLength,
+                            maxLength > other.maxLength ? maxLength : other.maxLength,
+                            minLength == ULLONG_MAX || other.minLength == ULLONG_MAX ? 1 : gcdLength(gcdLength(stride, other.stride), difference));
+    }
+    // the lengths of from minCount to maxCount consecutive matches of this (UINT_MAX meaning no limit); each match beyond
+    // minCount adds at least minLength, which is why it is then a factor of the stride
+    RegexLengths repeated(Uint minCount, Uint maxCount) const
+    {
+        if (maxCount == 0)
+            return RegexLengths();
+        return RegexLengths(multiplyLength(minLength, minCount),
+                            maxCount == UINT_MAX ? (maxLength ? ULLONG_MAX : 0) : multiplyLength(maxLength, maxCount),
+                            minCount == maxCount ? stride : gcdLength(stride, minLength));
+    }
+};
+
+// Static analysis of a pattern, done before static optimization rewrites its tree. It measures how long a match of each
+// part of the pattern can be, used to rule out start positions and alternatives that can't possibly match before trying
+// them, and finds whether anything in the pattern can tell where its match started.
+//
+// A backreference can only match what its group captured, so the pattern is measured twice: first taking every
+// backreference to be of any length, to find how long each capture can be, then again with those lengths. The second
+// pass also turns each lookahead at the top level of a root alternative that must reach the end of the input into a
+// condition on how much of the input is left, which, being arithmetic, is checked before any backtracking is done.
+class RegexAnalysis
+{
+    bool dependsOnStartPosition;
+    bool measuringCaptures;
+    std::vector<bool> captured;               // indexed by backref index; whether any group captures into it
+    std::vector<RegexLengths> captureLengths; // and if so, how long what it captures can be
+    std::vector<bool> captureRead;            // indexed by backref index; whether anything in the pattern reads it
+    RegexArena *arena;                        // where to put the length conditions, on the second pass
+    void markCaptureRead(Uint index);
+    void findCaptureReads(RegexGroup *group);
+    void elideUnreadCaptures(RegexGroup *group);
+    void measureAlternative(RegexPattern *alternative, bool isRoot);
+    void measureGroup(RegexGroup *group, RegexLengths &lengths, bool &endAnchored, bool isRoot = false);
+    RegexAnalysis() : dependsOnStartPosition(false), measuringCaptures(true), arena(NULL) {}
+public:
+    static void analyze(RegexGroupRoot &regex);
+};
+
+// Once a match is at the end of the input, nothing after that can move it, so an alternative is end-anchored if any
+// symbol in it that must match at least once is, wherever that symbol is in it
+void RegexAnalysis::measureAlternative(RegexPattern *alternative, bool isRoot)
+{
+    RegexLengths lengths;
+    bool endAnchored = false;
+    alternative->lengthConditions = NULL;
+    // a capture group matched once and followed directly by backreferences to it, repeated a fixed number of times,
+    // matches a whole multiple of one of the lengths it can capture, e.g. an even number of characters for (x*)\1
+    RegexGroupCapturing *justCaptured = NULL;
+    RegexLengths lengthsBeforeCapture, capturedLengths;
+    Uint64 captureMultiple = 0;
+    for (RegexSymbol **symbol = alternative->symbols; *symbol; symbol++)
+    {
+        RegexSymbol *thisSymbol = *symbol;
+        RegexLengths symbolLengths;
+        RegexGroupCapturing *previousCapture = justCaptured;
+        justCaptured = NULL;
+        switch (thisSymbol->type)
+        {
+        case RegexSymbol_ResetStart:
+        case RegexSymbol_AnchorStart:
+        case RegexSymbol_WordBoundaryNot:
+        case RegexSymbol_WordBoundary: // in numerical mode, the start of the input is the only place a word boundary can be
+            dependsOnStartPosition = true;
+            // fall through
+        case RegexSymbol_NoOp:
+        case RegexSymbol_Verb:
+            break;
+        case RegexSymbol_AnchorEnd:
+            if (thisSymbol->minCount != 0)
+                endAnchored = true;
+            break;
+        case RegexSymbol_Character:
+        case RegexSymbol_CharacterClass:
+        case RegexSymbol_DigitNot:
+        case RegexSymbol_Digit:
+        case RegexSymbol_SpaceNot:
+        case RegexSymbol_Space:
+        case RegexSymbol_WordCharacterNot:
+        case RegexSymbol_WordCharacter:
+            symbolLengths = RegexLengths(1, 1).repeated(thisSymbol->minCount, thisSymbol->maxCount);
+            break;
+        case RegexSymbol_String:
+            symbolLengths = RegexLengths(thisSymbol->strLength, thisSymbol->strLength);
+            break;
+        case RegexSymbol_Group:
+            {
+                RegexGroup *group = (RegexGroup*)thisSymbol;
+                RegexLengths groupLengths;
+                bool groupEndAnchored;
+                measureGroup(group, groupLengths, groupEndAnchored);
+                if (inrange(group->type, RegexGroup_Lookinto, RegexGroup_NegativeLookinto))
+                    dependsOnStartPosition = true;
+                if (group->type == RegexGroup_LookaroundConditional)
+                {
+                    RegexGroup *lookaround = ((RegexLookaroundConditional*)group)->lookaround;
+                    RegexLengths lookaroundLengths;
+                    bool lookaroundEndAnchored;
+                    measureGroup(lookaround, lookaroundLengths, lookaroundEndAnchored);
+                    if (inrange(lookaround->type, RegexGroup_Lookinto, RegexGroup_NegativeLookinto))
+                        dependsOnStartPosition = true;
+                }
+                if (group->isLookaround())
+                {
+                    if (isRoot && arena && group->minCount != 0 && groupEndAnchored && inrange(group->type, RegexGroup_Lookahead, RegexGroup_LookaheadMolecular))
+                    {
+                        RegexLengths conditionLengths = lengths + groupLengths;
+                        RegexLengthCondition *condition = new (*arena) RegexLengthCondition;
+                        condition->minLength = conditionLengths.minLength;
+                        condition->maxLength = conditionLengths.maxLength;
+                        condition->stride    = conditionLengths.stride;
+                        condition->next      = alternative->lengthConditions;
+                        alternative->lengthConditions = condition;
+                    }
+                    break;
+                }
+                symbolLengths = groupLengths.repeated(group->minCount, group->maxCount);
+                if (groupEndAnchored && group->minCount != 0)
+                    endAnchored = true;
+                if (group->type == RegexGroup_Capturing && group->minCount == 1 && group->maxCount == 1)
+                {
+                    justCaptured         = (RegexGroupCapturing*)group;
+                    lengthsBeforeCapture = lengths;
+                    capturedLengths      = groupLengths;
+                    captureMultiple      = 1;
+                }
+                break;
+            }
+        case RegexSymbol_Backref:
+            {
+                Uint index = ((RegexBackref*)thisSymbol)->index;
+                if (previousCapture && previousCapture->backrefIndex == index && thisSymbol->minCount == thisSymbol->maxCount)
+                {
+                    captureMultiple = addLengths(captureMultiple, thisSymbol->minCount);
+                    Uint64 stride = multiplyLength(capturedLengths.stride, captureMultiple);
+                    lengths = lengthsBeforeCapture + RegexLengths(multiplyLength(capturedLengths.minLength, captureMultiple),
+                                                                  multiplyLength(capturedLengths.maxLength, captureMultiple), stride == ULLONG_MAX ? 1 : stride);
+                    justCaptured = previousCapture;
+                    continue;
+                }
+                RegexLengths backrefLengths(0, ULLONG_MAX, 1);
+                if (!measuringCaptures && index < captured.size() && captured[index])
+                {
+                    backrefLengths = captureLengths[index];
+                    if (emulate_ECMA_NPCGs) // then a backreference to a group that hasn't captured anything matches empty
+                        backrefLengths = backrefLengths | RegexLengths();
+                }
+                symbolLengths = backrefLengths.repeated(thisSymbol->minCount, thisSymbol->maxCount);
+                break;
+            }
+        default:
+            symbolLengths = RegexLengths(0, ULLONG_MAX, 1);
+            break;
+        }
+        lengths = lengths + symbolLengths;
+    }
+    alternative->minLength    = lengths.minLength;
+    alternative->maxLength    = lengths.maxLength;
+    alternative->lengthStride = lengths.stride;
+    alternative->endAnchored  = endAnchored;
+}
+
+void RegexAnalysis::measureGroup(RegexGroup *group, RegexLengths &lengths, bool &endAnchored, bool isRoot)
+{
+    lengths = RegexLengths();
+    endAnchored = true;
+    Uint numAlternatives = 0;
+    for (RegexPattern **alternative = group->alternatives; *alternative; alternative++, numAlternatives++)
+    {
+        measureAlternative(*alternative, isRoot);
+        RegexLengths alternativeLengths((*alternative)->minLength, (*alternative)->maxLength, (*alternative)->lengthStride);
+        lengths = numAlternatives == 0 ? alternativeLengths : lengths | alternativeLengths;
+        endAnchored = endAnchored && (*alternative)->endAnchored;
+    }
+    // conditionals with only 1 alternative have an implied empty second alternative
+    if (numAlternatives == 0 || inrange(group->type, RegexGroup_Conditional, RegexGroup_LookaroundConditional) && numAlternatives == 1)
+    {
+        lengths = lengths | RegexLengths();
+        endAnchored = false;
+    }
+    if (measuringCaptures && group->type == RegexGroup_Capturing)
+    {
+        Uint index = ((RegexGroupCapturing*)group)->backrefIndex;
+        if (index >= captured.size())
+        {
+            captured      .resize(index + 1, false);
+            captureLengths.resize(index + 1);
+        }
+        captureLengths[index] = captured[index] ? captureLengths[index] | lengths : lengths;
+        captured[index] = true;
+    }
+}
+
+static void fprintLengthCondition(FILE *f, Uint64 minLength, Uint64 maxLength, Uint64 stride)
+{
+    if (minLength == maxLength)
+        fprintf(f, "    n == %llu\n", minLength);
+    else
+    {
+        fprintf(f, maxLength == ULLONG_MAX ? "    n >= %llu" : "    %llu <= n <= %llu", minLength, maxLength);
+        if (stride > 1)
+            fprintf(f, ", n %% %llu == %llu", stride, minLength % stride);
+        fputc('\n', f);
+    }
+}
+
+void RegexAnalysis::markCaptureRead(Uint index)
+{
+    if (index >= captureRead.size())
+        captureRead.resize(index + 1, false);
+    captureRead[index] = true;
+}
+
+// A capture is read by backreferences to it, by conditionals on it, and by lookintos into it
+void RegexAnalysis::findCaptureReads(RegexGroup *group)
+{
+    switch (group->type)
+    {
+    case RegexGroup_Conditional:
+        markCaptureRead(((RegexConditional*)group)->backrefIndex);
+        break;
+    case RegexGroup_LookaroundConditional:
+        findCaptureReads(((RegexLookaroundConditional*)group)->lookaround);
+        break;
+    case RegexGroup_Lookinto:
+    case RegexGroup_LookintoMolecular:
+    case RegexGroup_NegativeLookinto:
+        {
+            Uint backrefIndex = ((RegexGroupLookinto*)group)->backrefIndex;
+            if (backrefIndex != UINT_MAX && backrefIndex != 0)
+                markCaptureRead(backrefIndex - 1);
+            break;
+        }
+    default:
+        break;
+    }
+    for (RegexPattern **alternative = group->alternatives; *alternative; alternative++)
+        for (RegexSymbol **symbol = (*alternative)->symbols; *symbol; symbol++)
+            if ((*symbol)->type == RegexSymbol_Group)
+                findCaptureReads((RegexGroup*)*symbol);
+            else
+            if ((*symbol)->type == RegexSymbol_Backref)
+                markCaptureRead(((RegexBackref*)*symbol)->index);
+}
+
+// A capture that nothing reads doesn't need to be recorded, nor restored on backtracking, so its groups are matched as
+// non-capturing groups; they keep their backref index, so the numbering of the other groups is unchanged
+void RegexAnalysis::elideUnreadCaptures(RegexGroup *group)
+{
+    if (group->type == RegexGroup_Capturing)
+    {
+        Uint index = ((RegexGroupCapturing*)group)->backrefIndex;
+        if (index >= captureRead.size() || !captureRead[index])
+            group->type = RegexGroup_NonCapturing;
+    }
+    else
+    if (group->type == RegexGroup_LookaroundConditional)
+        elideUnreadCaptures(((RegexLookaroundConditional*)group)->lookaround);
+    for (RegexPattern **alternative = group->alternatives; *alternative; alternative++)
+        for (RegexSymbol **symbol = (*alternative)->symbols; *symbol; symbol++)
+            if ((*symbol)->type == RegexSymbol_Group)
+                elideUnreadCaptures((RegexGroup*)*symbol);
+}
+
+// Backtracking verbs can stop the search at a start position before any match is attempted from a later one, so they
+// rule out skipping any start position, and make what is found depend on where the search started. (*ACCEPT) can also
+// end a match, or a capture, anywhere, so with verbs enabled nothing is concluded from the second pass.
+void RegexAnalysis::analyze(RegexGroupRoot &regex)
+{
+    RegexAnalysis analysis;
+    analysis.findCaptureReads(&regex);
+    if (regex.returnMatch_backrefIndex != 0)
+        analysis.markCaptureRead(regex.returnMatch_backrefIndex - 1);
+    analysis.elideUnreadCaptures(&regex);
+
+    RegexLengths lengths;
+    bool endAnchored;
+    analysis.measureGroup(&regex, lengths, endAnchored);
+    if (!enable_verbs)
+    {
+        analysis.measuringCaptures = false;
+        analysis.arena = &regex.arena;
+        analysis.measureGroup(&regex, lengths, endAnchored, true);
+    }
+    regex.startPositionIndependent = !analysis.dependsOnStartPosition && !enable_verbs;
+    if (enable_verbs)
+    {
+        lengths.minLength = 0;
+        endAnchored = false;
+        for (RegexPattern **alternative = regex.alternatives; *alternative; alternative++)
+        {
+            (*alternative)->minLength    = 0;
+            (*alternative)->maxLength    = ULLONG_MAX;
+            (*alternative)->lengthStride = 1;
+            (*alternative)->endAnchored  = false;
+        }
+    }
+    regex.minLength      = lengths.minLength;
+    regex.maxLengthToEnd = endAnchored ? lengths.maxLength : ULLONG_MAX;
+
+    if (debugTrace)
+    {
+        Uint i = 1;
+        for (RegexPattern **alternative = regex.alternatives; *alternative; alternative++, i++)
+        {
+            fprintf(stderr, "Root alternative %u can only match where the number of characters n from its start to the end of the input has:\n", i);
+            if ((*alternative)->endAnchored)
+                fprintLengthCondition(stderr, (*alternative)->minLength, (*alternative)->maxLength, (*alternative)->lengthStride);
+            else
+                fprintLengthCondition(stderr, (*alternative)->minLength, ULLONG_MAX, 1);
+            for (RegexLengthCondition *condition = (*alternative)->lengthConditions; condition; condition = condition->next)
+                fprintLengthCondition(stderr, condition->minLength, condition->maxLength, condition->stride);
+        }
+        fputc('\n', stderr);
+    }
+}
+
 template <bool USE_STRINGS>
-bool RegexMatcher<USE_STRINGS>::Match(RegexGroupRoot &regex, Uint numCaptureGroups, Uint maxGroupDepth, Uint maxLookintoDepth, Uint64 _input, Uint returnMatch_backrefIndex, Uint64 &returnMatchOffset, Uint64 &returnMatchLength, Uint64 *possibleMatchesCount_ptr)
+void RegexMatcher<USE_STRINGS>::Prepare(RegexGroupRoot &regex, Uint maxGroupDepth)
 {
     delete [] groupStackBase;
     groupStackBase = new GroupStackNode [maxGroupDepth];
     groupStackTop = groupStackBase;
+    if (matchFunction(&regex) != &RegexMatcher<USE_STRINGS>::matchSymbol_Group)
+    {
+        RegexAnalysis::analyze(regex);
+        arena = &regex.arena;
+        virtualizeSymbols(&regex);
+    }
+}
+
+// Skips past the root alternatives that can't match from a start position with spaceLeft characters of the input after it
+template <bool USE_STRINGS>
+RegexPattern **RegexMatcher<USE_STRINGS>::skipInfeasibleRootAlternatives(RegexPattern **rootAlternative, Uint64 spaceLeft)
+{
+    while (*rootAlternative && rootAlternative != rootAlternativesEnd && !(*rootAlternative)->canMatchWithLengthLeft(spaceLeft))
+        rootAlternative++;
+    return rootAlternative;
+}
+
+template <bool USE_STRINGS>
+bool RegexMatcher<USE_STRINGS>::Match(RegexGroupRoot &regex, Uint numCaptureGroups, Uint maxGroupDepth, Uint maxLookintoDepth, Uint64 _input, Uint returnMatch_backrefIndex, Uint64 &returnMatchOffset, Uint64 &returnMatchLength, Uint64 *possibleMatchesCount_ptr)
+{
+    Prepare(regex, maxGroupDepth);
+
+    // Only start positions leaving room for the shortest possible match, and, if every match must end at the end of
+    // the input, close enough to it for the longest, can match; when there is only one, what the root alternatives
+    // require of the length of the input after it can rule it out too. If there are none, don't bother setting up
+    Uint64 inputLength = USE_STRINGS ? strlen((const char *)_input) : _input;
+    Uint64 firstStartPosition = inputLength > regex.maxLengthToEnd ? inputLength - regex.maxLengthToEnd : 0;
+    bool cannotMatch = inputLength < regex.minLength ||
+                       regex.anchored && firstStartPosition > 0 ||
+                       onlyStartPosition != ULLONG_MAX && (onlyStartPosition < firstStartPosition || onlyStartPosition > inputLength - regex.minLength);
+    if (!cannotMatch && (regex.anchored || onlyStartPosition != ULLONG_MAX))
+    {
+        RegexPattern **feasibleAlternative = skipInfeasibleRootAlternatives(onlyRootAlternative ? onlyRootAlternative : regex.alternatives,
+                                                                            inputLength - (onlyStartPosition != ULLONG_MAX ? onlyStartPosition : 0));
+        cannotMatch = !*feasibleAlternative || feasibleAlternative == rootAlternativesEnd;
+    }
+    if (cannotMatch)
+    {
+        if (possibleMatchesCount_ptr)
+            *possibleMatchesCount_ptr = 0;
+        returnMatchOffset = 0;
+        returnMatchLength = 0;
+        return false;
+    }
+    Uint64 lastStartPosition = inputLength - regex.minLength;
+
+    stepsTaken = 0;
+    stack.resetStatistics();
+
     delete [] inputLookintoBase;
     inputLookintoBase = new Uint64 [maxLookintoDepth];
     inputLookintoTop = inputLookintoBase;
-    if (matchFunction(&regex) != &RegexMatcher<USE_STRINGS>::matchSymbol_Group)
-        virtualizeSymbols(&regex);
 
     delete [] captures;
     captures = new Uint64 [numCaptureGroups];
+    memset(captures, (Uint8)NON_PARTICIPATING_CAPTURE_GROUP, numCaptureGroups * sizeof(Uint64));
 
     if (enable_persistent_backrefs)
     {
@@ -1172,6 +1674,7 @@ bool RegexMatcher<USE_STRINGS>::Match(RegexGroupRoot &regex, Uint numCaptureGrou
 
     delete [] captureStackBase;
     captureStackBase = new Uint[numCaptureGroups];
+    captureStackTop = captureStackBase;
 
     verb = RegexVerb_None;
 
@@ -1180,25 +1683,40 @@ bool RegexMatcher<USE_STRINGS>::Match(RegexGroupRoot &regex, Uint numCaptureGrou
     if (possibleMatchesCount_ptr)
         *possibleMatchesCount_ptr = 0;
 
-    Uint64 curPosition=0;
-    for (; curPosition<=input; curPosition++)
+    Uint64 curPosition = onlyStartPosition == ULLONG_MAX ? firstStartPosition : onlyStartPosition;
+    for (; curPosition<=lastStartPosition; curPosition++)
     {
         numSteps = 0;
-        alternative   = regex.alternatives;
-        symbol        = regex.alternatives[0]->symbols;
         position      = curPosition;
         startPosition = curPosition;
         currentMatch  = ULLONG_MAX;
+        countLimit    = ULLONG_MAX;
 
         groupStackTop->position    = curPosition;
         groupStackTop->loopCount   = 1;
         groupStackTop->group       = &regex;
         groupStackTop->numCaptured = 0;
 
-        memset(captures, (Uint8)NON_PARTICIPATING_CAPTURE_GROUP, numCaptureGroups * sizeof(Uint64));
+        alternative = skipInfeasibleRootAlternatives(onlyRootAlternative ? onlyRootAlternative : regex.alternatives, inputLength - curPosition);
+        if (!*alternative || alternative == rootAlternativesEnd)
+        {
+            if (debugTrace)
+                fprintf(stderr, "No alternative can match from {%llu}\n\n", curPosition);
+            match = -1;
+            if (regex.anchored || onlyStartPosition != ULLONG_MAX)
+                break;
+            continue;
+        }
+        symbol = (*alternative)->symbols;
 
-        captureStackTop = captureStackBase;
+        // Every capture that is set has its index on the capture stack, and an attempt that failed will have unset them
+        // all by backtracking out of it, so unless a backtracking verb cut that short, there is nothing left to reset
+        while (captureStackTop > captureStackBase)
+            captures[*--captureStackTop] = NON_PARTICIPATING_CAPTURE_GROUP;
 #ifdef _DEBUG
+        for (Uint i=0; i<numCaptureGroups; i++)
+            if (captures[i] != NON_PARTICIPATING_CAPTURE_GROUP)
+                THROW_ENGINEBUG;
         memset(captureStackBase, -1, numCaptureGroups*sizeof(Uint));
 #endif
 
@@ -1206,6 +1724,7 @@ bool RegexMatcher<USE_STRINGS>::Match(RegexGroupRoot &regex, Uint numCaptureGrou
 
         do
         {
+            stepsTaken++;
             RegexSymbol *thisSymbol = *symbol;
             if (!thisSymbol) // exiting a group?
             {
@@ -1520,11 +2039,11 @@ bool RegexMatcher<USE_STRINGS>::Match(RegexGroupRoot &regex, Uint numCaptureGrou
         if (debugTrace)
         {
             fputs("No match found", stderr);
-            if (curPosition+1 <= input && !regex.anchored)
+            if (curPosition+1 <= lastStartPosition && !regex.anchored)
                 fprintf(stderr, "; trying at {%llu}", curPosition+1);
             fputs("\n\n", stderr);
         }
-        if (regex.anchored)
+        if (regex.anchored || onlyStartPosition != ULLONG_MAX)
             break;
     }
 
@@ -1552,6 +2071,9 @@ bool RegexMatcher<USE_STRINGS>::Match(RegexGroupRoot &regex, Uint numCaptureGrou
                 returnMatchLength = 0;
         }
     }
+
+    if (backtrackStatistics)
+        backtrackStatistics->record(stepsTaken, stack.getBytesPushed(), stack.getPeakBytesInUse());
     
     return match > 0;
 }
@@ -1605,5 +2127,55 @@ void RegexMatcher<true>::fprintCapture(FILE *f, Uint i)
     fprintCapture(f, captures[i], captureOffsets[i]);
 }
 
+template void RegexMatcher<false>::Prepare(RegexGroupRoot &regex, Uint maxGroupDepth);
+template void RegexMatcher<true >::Prepare(RegexGroupRoot &regex, Uint maxGroupDepth);
+template <bool USE_STRINGS>
+Uint64 RegexMatcher<USE_STRINGS>::CountPossibleMatches(RegexGroupRoot &regex, Uint numCaptureGroups, Uint maxGroupDepth, Uint maxLookintoDepth, Uint64 _input, Uint64 startPosition, Uint rootAlternative)
+{
+    onlyStartPosition = startPosition;
+    if (rootAlternative != UINT_MAX)
+    {
+        onlyRootAlternative = regex.alternatives + rootAlternative;
+        rootAlternativesEnd = onlyRootAlternative + 1;
+    }
+    Uint64 returnMatchOffset, returnMatchLength, possibleMatchesCount;
+    Match(regex, numCaptureGroups, maxGroupDepth, maxLookintoDepth, _input, 0, returnMatchOffset, returnMatchLength, &possibleMatchesCount);
+    onlyStartPosition   = ULLONG_MAX;
+    onlyRootAlternative = NULL;
+    rootAlternativesEnd = NULL;
+    return possibleMatchesCount;
+}
+
+template <bool USE_STRINGS>
+bool RegexMatcher<USE_STRINGS>::MatchAtStart(RegexGroupRoot &regex, Uint numCaptureGroups, Uint maxGroupDepth, Uint maxLookintoDepth, Uint64 _input, Uint returnMatch_backrefIndex, Uint64 &returnMatchOffset, Uint64 &returnMatchLength)
+{
+    onlyStartPosition = 0;
+    bool matched = Match(regex, numCaptureGroups, maxGroupDepth, maxLookintoDepth, _input, returnMatch_backrefIndex, returnMatchOffset, returnMatchLength, NULL);
+    onlyStartPosition = ULLONG_MAX;
+    return matched;
+}
+
 template bool RegexMatcher<false>::Match(RegexGroupRoot &regex, Uint numCaptureGroups, Uint maxGroupDepth, Uint maxLookintoDepth, Uint64 _input, Uint returnMatch_backrefIndex, Uint64 &returnMatchOffset, Uint64 &returnMatchLength, Uint64 *possibleMatchesCount_ptr);
 template bool RegexMatcher<true >::Match(RegexGroupRoot &regex, Uint numCaptureGroups, Uint maxGroupDepth, Uint maxLookintoDepth, Uint64 _input, Uint returnMatch_backrefIndex, Uint64 &returnMatchOffset, Uint64 &returnMatchLength, Uint64 *possibleMatchesCount_ptr);
+template Uint64 RegexMatcher<false>::CountPossibleMatches(RegexGroupRoot &regex, Uint numCaptureGroups, Uint maxGroupDepth, Uint maxLookintoDepth, Uint64 _input, Uint64 startPosition, Uint rootAlternative);
+template Uint64 RegexMatcher<true >::CountPossibleMatches(RegexGroupRoot &regex, Uint numCaptureGroups, Uint maxGroupDepth, Uint maxLookintoDepth, Uint64 _input, Uint64 startPosition, Uint rootAlternative);
+template bool RegexMatcher<false>::MatchAtStart(RegexGroupRoot &regex, Uint numCaptureGroups, Uint maxGroupDepth, Uint maxLookintoDepth, Uint64 _input, Uint returnMatch_backrefIndex, Uint64 &returnMatchOffset, Uint64 &returnMatchLength);
+template bool RegexMatcher<true >::MatchAtStart(RegexGroupRoot &regex, Uint numCaptureGroups, Uint maxGroupDepth, Uint maxLookintoDepth, Uint64 _input, Uint returnMatch_backrefIndex, Uint64 &returnMatchOffset, Uint64 &returnMatchLength);
+
+void BacktrackStatistics::record(Uint64 steps, Uint64 pushed, Uint64 peakBytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    numMatches++;
+    numSteps    += steps;
+    bytesPushed += pushed;
+    sumPeakBytes += peakBytes;
+    if (maxPeakBytes < peakBytes)
+        maxPeakBytes = peakBytes;
+}
+
+void BacktrackStatistics::printStatistics(FILE *f)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    fprintf(f, "Backtracking stack: %llu matches, %llu steps; %.2f bytes pushed per step, peak of %llu bytes (%.0f on average)\n",
+        numMatches, numSteps, numSteps ? (double)bytesPushed / numSteps : 0., maxPeakBytes, numMatches ? (double)sumPeakBytes / numMatches : 0.);
+}
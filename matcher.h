@@ -9,6 +9,8 @@
  *   David Ellsworth <davide.by.zero@gmail.com>
  */
 
+#include <mutex>
+
 #define NON_PARTICIPATING_CAPTURE_GROUP ULLONG_MAX
 
 #pragma warning(push)
@@ -22,7 +24,9 @@ extern RegexSymbol  *nullSymbol;
 template <bool> class BacktrackNode;
 template <bool> class RegexMatcher;
 template <bool> class Backtrack_EnterGroupLookinto;
+template <bool> class Backtrack_LoopGroupRun;
 class GroupStackNode;
+class SubjectRuns;
 
 template <bool USE_STRINGS>
 class Backtrack
@@ -37,6 +41,7 @@ class Backtrack
     Uint8 *chunkBase;
     Uint8 *pendingChunkDeletion;
     BacktrackNode<USE_STRINGS> *nextToBePopped;
+    Uint64 bytesInUse, peakBytesInUse, bytesPushed; // for BacktrackStatistics; not counting the chunks' bookkeeping
 
     struct ChunkInfo
     {
@@ -46,7 +51,7 @@ class Backtrack
 
 public:
     Backtrack()
-        : pendingChunkDeletion(NULL)
+        : pendingChunkDeletion(NULL), bytesInUse(0), peakBytesInUse(0), bytesPushed(0)
 #ifdef _DEBUG
         , stack(*this), stackDepth(0)
 #endif
@@ -67,6 +72,8 @@ public:
     template <class NODE_TYPE> NODE_TYPE *push(size_t size);
     template <class NODE_TYPE> NODE_TYPE *push() { return push<NODE_TYPE>(sizeof(NODE_TYPE)); }
     void pop(RegexMatcher<USE_STRINGS> &matcher, bool delayChunkDeletion = false);
+    void unpush(RegexMatcher<USE_STRINGS> &matcher); // pop the node just pushed, as if it never had been
+    BacktrackNode<USE_STRINGS> *nodeUnderTop(RegexMatcher<USE_STRINGS> &matcher); // NULL if there is none in the same chunk
     void fprint(RegexMatcher<USE_STRINGS> &matcher, FILE *f);
     void deletePendingChunk()
     {
@@ -90,6 +97,18 @@ public:
         return stackDepth;
     }
 #endif
+    Uint64 getPeakBytesInUse()
+    {
+        return bytesInUse > peakBytesInUse ? bytesInUse : peakBytesInUse;
+    }
+    Uint64 getBytesPushed()
+    {
+        return bytesPushed;
+    }
+    void resetStatistics()
+    {
+        peakBytesInUse = bytesPushed = 0;
+    }
 };
 
 extern const char Backtrack_VerbName_Commit[];
@@ -127,6 +146,11 @@ struct RegexMatcherBase<true>
 
     const char **stringLookintoBase;
     const char **stringLookintoTop;
+
+    char *constGroupRepetend; // one iteration of the flat constant-width group being matched, as assembled by getConstGroupRepetend()
+    size_t constGroupRepetendCapacity;
+
+    const SubjectRuns *subjectRuns; // the runs of identical characters in stringToMatchAgainst0, or NULL if they aren't known
 };
 
 template <bool USE_STRINGS>
@@ -175,13 +199,21 @@ class RegexMatcher : public RegexMatcherBase<USE_STRINGS>
     Uint *captureStackTop;
     GroupStackNode *groupStackBase;
     GroupStackNode *groupStackTop;
+    RegexArena *arena; // where static optimization allocates the symbols it substitutes
 
     Uint64 position, startPosition;
     Uint64 currentMatch; // ULLONG_MAX means no match has been tried yet
+    Uint64 countLimit;   // the most iterations the lookaheads of the non-flat constant-width group being matched allow, else ULLONG_MAX
     RegexPattern **alternative;
     RegexSymbol  **symbol;
 
+    // Set only by CountPossibleMatches and MatchAtStart, to confine the search to one part of its tree
+    Uint64 onlyStartPosition;             // ULLONG_MAX to try every start position
+    RegexPattern **onlyRootAlternative;   // NULL to try every alternative of the root group
+    RegexPattern **rootAlternativesEnd;   // the root alternative after onlyRootAlternative, at which backtracking stops
+
     Uint64 numSteps;
+    Uint64 stepsTaken; // unlike numSteps, counted over all start positions and regardless of debugTrace, for BacktrackStatistics
 
     char match; // zero = looking for match, negative = match failed, positive = match found
 
@@ -202,6 +234,7 @@ class RegexMatcher : public RegexMatcherBase<USE_STRINGS>
     void leaveMaxedOutGroup();
     Backtrack_LoopGroup<USE_STRINGS> *pushStack_LoopGroup();
     void *loopGroup(Backtrack_LoopGroup<USE_STRINGS> *pushLoop, Uint64 pushPosition, Uint64 oldPosition, Uint alternativeNum);
+    bool collapseLoopGroup(Backtrack_LoopGroup<USE_STRINGS> *pushLoop);
     void popAtomicGroup(RegexGroup *const group);
     inline void pushLookintoInput(Uint64 newInput, const char *newStringToMatchAgainst);
     inline void  popLookintoInput();
@@ -226,6 +259,9 @@ class RegexMatcher : public RegexMatcherBase<USE_STRINGS>
     inline void countRepetendMatches(bool (*matchFunction)(Uchar ch), Uint64 multiple);
     inline void countRepetendMatches(RegexCharacterClass *charClass, Uint64 multiple);
 
+    inline const char *getRunEnd(const char *s); // only used with subjectRuns
+    inline bool isRepetendUniform(const char *pBackref, Uint64 multiple);
+
     inline bool doesStringMatch(RegexSymbol *stringSymbol);
     inline bool matchWordBoundary();
 
@@ -258,6 +294,24 @@ class RegexMatcher : public RegexMatcherBase<USE_STRINGS>
     void matchSymbol_IsPowerOf2              (RegexSymbol *thisSymbol);
 
     Uint64 matchSymbol_ConstGroup(RegexSymbol *thisSymbol, bool capturing);
+    inline Uint64 getConstantWidth(RegexSymbol **symbols);
+    inline bool getConstGroupLength(RegexSymbol *thisSymbol, Uint64 &multiple);
+    inline const char *getConstGroupRepetend(RegexSymbol *thisSymbol, Uint64 multiple);
+    inline Uint64 getConstGroupCountLimit(RegexSymbol *thisSymbol, Uint64 multiple);
+    inline bool isArithmeticSpanUniform(RegexSymbol *thisSymbol, Uint64 spaceLeft, const char *lookintoPtr);
+    inline bool getArithmeticSpaceLeft(RegexSymbol *thisSymbol, Uint64 &spaceLeft);
+    inline void captureConstGroup(Uint backrefIndex, Uint64 length);
+    void captureConstGroupContents(RegexSymbol **symbols);
+    static bool isNonFlatConstGroup(RegexSymbol *thisSymbol)
+    {
+        return (thisSymbol->type == RegexSymbol_ConstGroupNonCapturing || thisSymbol->type == RegexSymbol_ConstGroupCapturing) && !((RegexConstGroup*)thisSymbol)->flat;
+    }
+    Uint64 getMaxCount(RegexSymbol *thisSymbol) // the symbol's maximum count, narrowed by countLimit
+    {
+        return thisSymbol->maxCount == UINT_MAX || thisSymbol->maxCount > countLimit ? countLimit : thisSymbol->maxCount;
+    }
+
+    inline bool findCountsLeavingRoomForTail(RegexSymbol *thisSymbol, Uint64 multiple, Uint64 &firstCount, Uint64 &lastCount, Uint64 &residue, Uint64 &period);
 
     template <typename MATCH_TYPE>
     inline int8 runtimeOptimize_matchSymbol_Character_or_Backref(RegexSymbol *const thisSymbol, Uint64 const multiple, MATCH_TYPE const repetend);
@@ -268,8 +322,11 @@ class RegexMatcher : public RegexMatcherBase<USE_STRINGS>
     inline bool characterCanMatch(RegexSymbol *thisSymbol);
     inline bool8 characterClassCanMatch(RegexCharacterClass *thisSymbol);
     inline void (RegexMatcher<USE_STRINGS>::*chooseBuiltinCharacterClassFunction(bool (*characterMatchFunction)(Uchar ch), void (RegexMatcher<USE_STRINGS>::*matchFunction)(RegexSymbol *thisSymbol)))(RegexSymbol *thisSymbol);
+    inline bool isArithmeticCharacter(RegexSymbol *thisSymbol, RegexSymbol *firstCharacter);
     inline bool staticallyOptimizeGroup(RegexSymbol **thisSymbol);
+    bool isConstantWidth(RegexSymbol **symbols, bool topLevel, bool inLookahead, Uint64 &numCharacters, std::vector<Uint> &captureIndexes, std::vector<Uint> &backrefIndexes);
     inline void virtualizeSymbols(RegexGroup *rootGroup);
+    inline RegexPattern **skipInfeasibleRootAlternatives(RegexPattern **rootAlternative, Uint64 spaceLeft);
 
     inline void fprintCapture(FILE *f, Uint i);
     inline void fprintCapture(FILE *f, Uint64 length, const char *offset);
@@ -277,7 +334,14 @@ class RegexMatcher : public RegexMatcherBase<USE_STRINGS>
 public:
     inline RegexMatcher();
     inline ~RegexMatcher();
+    void Prepare(RegexGroupRoot &regex, Uint maxGroupDepth); // virtualizes the symbol tree if this hasn't already been done; after that, matching only reads it
     bool Match(RegexGroupRoot &regex, Uint numCaptureGroups, Uint maxGroupDepth, Uint maxLookintoDepth, Uint64 _input, Uint returnMatch_backrefIndex, Uint64 &returnMatchOffset, Uint64 &returnMatchLength, Uint64 *possibleMatchesCount_ptr);
+    // Counts the possible matches that start at startPosition and, unless rootAlternative is UINT_MAX, take that
+    // alternative of the root group. The counts of all the parts add up to what Match would count, as long as no
+    // backtracking verbs are enabled, so the parts can be counted on separate threads, each with its own matcher.
+    Uint64 CountPossibleMatches(RegexGroupRoot &regex, Uint numCaptureGroups, Uint maxGroupDepth, Uint maxLookintoDepth, Uint64 _input, Uint64 startPosition, Uint rootAlternative);
+    // Like Match, but only tries a match starting at the start of the input, as if the pattern began with "^"
+    bool MatchAtStart(RegexGroupRoot &regex, Uint numCaptureGroups, Uint maxGroupDepth, Uint maxLookintoDepth, Uint64 _input, Uint returnMatch_backrefIndex, Uint64 &returnMatchOffset, Uint64 &returnMatchLength);
 };
 
 template <> void RegexMatcher<false>::pushLookintoInput(Uint64 newInput, const char *newStringToMatchAgainst);
@@ -285,6 +349,9 @@ template <> void RegexMatcher<false>::popLookintoInput();
 template <> void RegexMatcher<true>::pushLookintoInput(Uint64 newInput, const char *newStringToMatchAgainst);
 template <> void RegexMatcher<true>::popLookintoInput();
 
+template <> const char *RegexMatcher<true>::getRunEnd(const char *s);
+template <> bool RegexMatcher<true>::isRepetendUniform(const char *pBackref, Uint64 multiple);
+
 template <> void RegexMatcher<false>::fprintCapture(FILE *f, Uint64 length, const char *offset);
 template <> void RegexMatcher<false>::fprintCapture(FILE *f, Uint i);
 template <> void RegexMatcher<true>::fprintCapture(FILE *f, Uint64 length, const char *offset);
@@ -374,6 +441,14 @@ class BacktrackNode
     {
         return false;
     }
+    virtual Uint64 getLoopIterations() // how many iterations of a loop the node records the backtracking state of
+    {
+        return 0;
+    }
+    virtual bool popIteration() // for a node standing for more than one iteration, drop the last of them; returns true if any are left, so that the node stays on the stack
+    {
+        return false;
+    }
     virtual void fprintDebug(RegexMatcher<USE_STRINGS> &matcher, FILE *f)=0;
 };
 
@@ -388,6 +463,9 @@ void Backtrack<USE_STRINGS>::flush()
         free(oldChunk);
     }
     nextToBePopped = (BacktrackNode<USE_STRINGS>*)(chunkBase + CHUNK_SIZE);
+    if (peakBytesInUse < bytesInUse)
+        peakBytesInUse = bytesInUse;
+    bytesInUse = 0;
 }
 
 template <bool USE_STRINGS>
@@ -396,6 +474,8 @@ template <class NODE_TYPE> NODE_TYPE *Backtrack<USE_STRINGS>::push(size_t size)
 #ifdef _DEBUG
     stackDepth++;
 #endif
+    bytesInUse  += size;
+    bytesPushed += size;
     Uint8 *newNode = (Uint8*)nextToBePopped - size;
     if (newNode < chunkBase)
     {
@@ -412,10 +492,16 @@ template <class NODE_TYPE> NODE_TYPE *Backtrack<USE_STRINGS>::push(size_t size)
 template <bool USE_STRINGS>
 void Backtrack<USE_STRINGS>::pop(RegexMatcher<USE_STRINGS> &matcher, bool delayChunkDeletion/* = false*/)
 {
+    if (nextToBePopped->popIteration())
+        return;
 #ifdef _DEBUG
     stackDepth--;
 #endif
-    Uint8 *next = (Uint8*)nextToBePopped + nextToBePopped->getSize(matcher);
+    size_t size = nextToBePopped->getSize(matcher);
+    if (peakBytesInUse < bytesInUse)
+        peakBytesInUse = bytesInUse;
+    bytesInUse -= size;
+    Uint8 *next = (Uint8*)nextToBePopped + size;
     if (next == chunkBase + CHUNK_SIZE - sizeof(ChunkInfo) && chunkBase != firstChunk)
     {
         ChunkInfo *node = (ChunkInfo*)next;
@@ -431,6 +517,24 @@ void Backtrack<USE_STRINGS>::pop(RegexMatcher<USE_STRINGS> &matcher, bool delayC
     nextToBePopped = (BacktrackNode<USE_STRINGS>*)next;
 }
 
+template <bool USE_STRINGS>
+void Backtrack<USE_STRINGS>::unpush(RegexMatcher<USE_STRINGS> &matcher)
+{
+    bytesPushed -= nextToBePopped->getSize(matcher);
+    Uint64 peak = peakBytesInUse;
+    pop(matcher);
+    peakBytesInUse = peak;
+}
+
+template <bool USE_STRINGS>
+BacktrackNode<USE_STRINGS> *Backtrack<USE_STRINGS>::nodeUnderTop(RegexMatcher<USE_STRINGS> &matcher)
+{
+    Uint8 *next = (Uint8*)nextToBePopped + nextToBePopped->getSize(matcher);
+    if (next == chunkBase + CHUNK_SIZE || next == chunkBase + CHUNK_SIZE - sizeof(ChunkInfo) && chunkBase != firstChunk)
+        return NULL;
+    return (BacktrackNode<USE_STRINGS>*)next;
+}
+
 template <bool USE_STRINGS>
 void Backtrack<USE_STRINGS>::fprint(RegexMatcher<USE_STRINGS> &matcher, FILE *f)
 {
@@ -780,7 +884,7 @@ class Backtrack_EnterGroup : public BacktrackNode<USE_STRINGS>
             matcher.currentMatch = ULLONG_MAX;
             return true;
         }
-        if (matcher.groupStackTop[+1].loopCount > group->minCount && group->minCount != group->maxCount)
+        if (matcher.groupStackTop[+1].loopCount > group->minCount && group->minCount != group->maxCount && !group->lazy) // a lazy group's skipping was already tried, by Backtrack_SkipGroup
         {
             matcher.symbol = group->self + 1;
             matcher.currentMatch = ULLONG_MAX;
@@ -1177,9 +1281,10 @@ protected:
         if (matcher.groupStackTop->loopCount == MAX_EXTEND(this->group->maxCount) ||
             positionDiff == 0 && matcher.groupStackTop->group->maxCount == UINT_MAX && matcher.groupStackTop->loopCount >= matcher.groupStackTop->group->minCount)
         {
+            // the iteration can't be followed by another, but its remaining alternatives can still be tried;
+            // its capture was already restored by Backtrack_LeaveGroup::popTo(), so it mustn't be popped again here
+            // (e.g. with -x pbr, "(x(\2|x)+?xx(?=y))" on "xxx" used to pop it twice and underflow the capture stack)
             matcher.position = matcher.groupStackTop->position -= positionDiff;
-            matcher.alternative = &nullAlternative;
-            this->popCapture(matcher);
             return false;
         }
 
@@ -1377,6 +1482,7 @@ class Backtrack_LoopGroup : public BacktrackNode<USE_STRINGS>
 {
     friend class RegexMatcher<USE_STRINGS>;
     friend class Backtrack_LeaveGroupLazily<USE_STRINGS>;
+    friend class Backtrack_LoopGroupRun<USE_STRINGS>;
 
 protected:
     Uint64 position;
@@ -1397,6 +1503,12 @@ protected:
         return get_size(numCaptured);
     }
     virtual bool popTo(RegexMatcher<USE_STRINGS> &matcher)
+    {
+        return popToPositions(matcher, position, oldPosition);
+    }
+    // Pops the iteration whose record this is, or one that differs from it only by its positions, which are given here.
+    // Nothing is read from this node after the group is left, since leaving it may push a node over this one.
+    bool popToPositions(RegexMatcher<USE_STRINGS> &matcher, Uint64 position, Uint64 oldPosition)
     {
         const RegexGroup *group = matcher.groupStackTop->group;
         if (!enable_persistent_backrefs)
@@ -1552,10 +1664,69 @@ protected:
         }
         fputc('\n', f);
     }
+    virtual Uint64 getLoopIterations()
+    {
+        return 1;
+    }
 };
 
 #pragma warning(pop)
 
+// Stands for runLength more iterations of a loop, directly following the one recorded by "first", that would each
+// have pushed a Backtrack_LoopGroup identical to it except for positions advanced by the same stride every time.
+template <bool USE_STRINGS>
+class Backtrack_LoopGroupRun : public BacktrackNode<USE_STRINGS>
+{
+    friend class RegexMatcher<USE_STRINGS>;
+
+    Backtrack_LoopGroup<USE_STRINGS> *first;
+    Uint64 runLength;
+
+    virtual size_t getSize(RegexMatcher<USE_STRINGS> &matcher)
+    {
+        return sizeof(*this);
+    }
+    virtual bool popIteration()
+    {
+        return --runLength != 0;
+    }
+    virtual bool popTo(RegexMatcher<USE_STRINGS> &matcher)
+    {
+        // popIteration() has already been called for the iteration being popped, which is number runLength+1 counting "first"
+        // as number 0. Once the last of them is popped, this node may be overwritten by what "first" pushes, so copy from it.
+        // "first" itself mustn't be modified, even temporarily: popping the iteration can leave a possessive group, whose
+        // unwinding pops "first" too and may push a node over it.
+        Backtrack_LoopGroup<USE_STRINGS> *first = this->first;
+        Uint64 stride = first->position - first->oldPosition;
+        Uint64 oldPosition = first->position + runLength * stride;
+        return first->popToPositions(matcher, oldPosition + stride, oldPosition);
+    }
+    virtual void popForNegativeLookahead(RegexMatcher<USE_STRINGS> &matcher)
+    {
+        first->Backtrack_LoopGroup<USE_STRINGS>::popForNegativeLookahead(matcher);
+    }
+    virtual int popForAtomicCapture(RegexMatcher<USE_STRINGS> &matcher)
+    {
+        return first->Backtrack_LoopGroup<USE_STRINGS>::popForAtomicCapture(matcher);
+    }
+    virtual captureTuple popForAtomicForwardCapture(RegexMatcher<USE_STRINGS> &matcher, Uint captureNum)
+    {
+        return first->Backtrack_LoopGroup<USE_STRINGS>::popForAtomicForwardCapture(matcher, captureNum);
+    }
+    virtual bool okayToTryAlternatives(RegexMatcher<USE_STRINGS> &matcher)
+    {
+        return true;
+    }
+    virtual Uint64 getLoopIterations()
+    {
+        return 1 + runLength;
+    }
+    void fprintDebug(RegexMatcher<USE_STRINGS> &matcher, FILE *f)
+    {
+        fprintf(f, "Backtrack_LoopGroupRun: runLength=%llu, stride=%llu\n", runLength, first->position - first->oldPosition);
+    }
+};
+
 template <bool USE_STRINGS>
 class Backtrack_TryMatch : public BacktrackNode<USE_STRINGS>
 {
@@ -1644,6 +1815,9 @@ template<> inline RegexMatcher<false>::RegexMatcher() :
 #endif
 {
     captures = NULL;
+    onlyStartPosition   = ULLONG_MAX;
+    onlyRootAlternative = NULL;
+    rootAlternativesEnd = NULL;
     if (enable_persistent_backrefs)
     {
         captureIndexUsedAtomicTmp = NULL;
@@ -1660,6 +1834,9 @@ template<> inline RegexMatcher<true>::RegexMatcher() :
 #endif
 {
     captures = NULL;
+    onlyStartPosition   = ULLONG_MAX;
+    onlyRootAlternative = NULL;
+    rootAlternativesEnd = NULL;
     captureOffsets = NULL;
     if (enable_persistent_backrefs)
     {
@@ -1669,6 +1846,9 @@ template<> inline RegexMatcher<true>::RegexMatcher() :
         captureOffsetsAtomicTmp = NULL;
     }
     stringLookintoBase = NULL;
+    constGroupRepetend = NULL;
+    constGroupRepetendCapacity = 0;
+    subjectRuns = NULL;
 }
 
 template<> inline RegexMatcher<false>::~RegexMatcher()
@@ -1699,8 +1879,25 @@ template<> inline RegexMatcher<true>::~RegexMatcher()
         delete [] captureOffsetsAtomicTmp;
     }
     delete [] stringLookintoBase;
+    delete [] constGroupRepetend;
 }
 
 #pragma pack( pop )
 
 #pragma warning(pop)
+
+// Totals, over the matches made while it is installed as backtrackStatistics, of how much work the backtracking stack
+// was given; for judging changes to what gets pushed onto it.
+class BacktrackStatistics
+{
+    std::mutex mutex;
+    Uint64 numMatches, numSteps, bytesPushed, maxPeakBytes, sumPeakBytes;
+public:
+    BacktrackStatistics() : numMatches(0), numSteps(0), bytesPushed(0), maxPeakBytes(0), sumPeakBytes(0)
+    {
+    }
+    void record(Uint64 steps, Uint64 pushed, Uint64 peakBytes);
+    void printStatistics(FILE *f);
+};
+
+extern BacktrackStatistics *backtrackStatistics;
@@ -16,8 +16,9 @@
 
 #pragma comment(lib, "libgmp-10.lib")
 
-static int isPrime_is_initialized = false;
-static mpz_t mpzN;
+// thread-local, so that matchers running on different threads don't share the scratch variable
+static thread_local int isPrime_is_initialized = false;
+static thread_local mpz_t mpzN;
 
 void init_isPrime()
 {
@@ -32,6 +33,7 @@ void init_isPrime()
 
 int isPrime(Uint64 n)
 {
+    init_isPrime();
     mpz_set_uint64(mpzN, n);
     return mpz_probab_prime_p(mpzN, 12); // 12 is enough for < 2^64, according to http://www.trnicely.net/misc/mpzspsp.html and to Jiang and Deng (2014) (doi:10.1090/S0025-5718-2014-02830-5)
 }
@@ -66,3 +68,40 @@ int isPrime(Uint64 n)
 }
 
 #endif
+
+Uint64 multiplyModulo(Uint64 a, Uint64 b, Uint64 modulus)
+{
+#ifdef __GNUC__
+    return (Uint64)((unsigned __int128)a * b % modulus);
+#else
+    a %= modulus;
+    b %= modulus;
+    Uint64 product = 0;
+    for (; b; b >>= 1)
+    {
+        if (b & 1)
+            product = product >= modulus - a ? product - (modulus - a) : product + a;
+        a = a >= modulus - a ? a - (modulus - a) : a + a;
+    }
+    return product;
+#endif
+}
+
+// by the extended Euclidean algorithm, keeping only the coefficients of a, reduced modulo modulus
+Uint64 inverseModulo(Uint64 a, Uint64 modulus)
+{
+    Uint64 r0 = modulus, r1 = a % modulus;
+    Uint64 t0 = 0, t1 = 1;
+    while (r1)
+    {
+        Uint64 quotient = r0 / r1;
+        Uint64 product  = multiplyModulo(quotient, t1, modulus);
+        Uint64 r2 = r0 - quotient * r1;
+        Uint64 t2 = t0 >= product ? t0 - product : t0 + (modulus - product);
+        r0 = r1;
+        r1 = r2;
+        t0 = t1;
+        t1 = t2;
+    }
+    return t0 % modulus;
+}
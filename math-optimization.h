@@ -1,5 +1,7 @@
 extern void init_isPrime();
 extern int isPrime(Uint64 n);
+extern Uint64 multiplyModulo(Uint64 a, Uint64 b, Uint64 modulus);
+extern Uint64 inverseModulo(Uint64 a, Uint64 modulus); // a must be coprime to modulus
 
 #ifdef USE_GMP
 
@@ -0,0 +1,144 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+// A FIFO that blocks producers while it is full and consumers while it is empty. Once close() has been called,
+// consumers drain whatever is left and then get a return value of false from pop().
+template <typename TYPE>
+class BoundedQueue
+{
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<TYPE> queue;
+    size_t capacity;
+    bool closed;
+public:
+    BoundedQueue(size_t capacity) : capacity(capacity), closed(false)
+    {
+    }
+    void push(TYPE item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&]{ return queue.size() < capacity; });
+        queue.push_back(item);
+        notEmpty.notify_one();
+    }
+    bool pop(TYPE &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&]{ return !queue.empty() || closed; });
+        if (queue.empty())
+            return false;
+        item = queue.front();
+        queue.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+};
+
+// Runs read() on a reader thread, process() on numThreads worker threads, and write() on the calling thread. write()
+// sees the blocks in exactly the order read() filled them, regardless of which worker finishes first. No more than
+// maxBlocksInFlight blocks ever exist, so a slow writer throttles the reader instead of letting memory use grow.
+// read() returns false (leaving its block unused) once there is no more input.
+template <class BLOCK, class READ, class PROCESS, class WRITE>
+void runOrderedPipeline(Uint numThreads, Uint maxBlocksInFlight, READ read, PROCESS process, WRITE write)
+{
+    struct Slot
+    {
+        BLOCK block;
+        bool done;
+    };
+    std::vector<Slot> slots(maxBlocksInFlight);
+    BoundedQueue<Slot*> freeSlots(maxBlocksInFlight);
+    BoundedQueue<Slot*> workQueue(maxBlocksInFlight);
+    BoundedQueue<Slot*> writeQueue(maxBlocksInFlight);
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+
+    for (Uint i=0; i<maxBlocksInFlight; i++)
+        freeSlots.push(&slots[i]);
+
+    std::thread reader([&]()
+    {
+        Slot *slot;
+        while (freeSlots.pop(slot))
+        {
+            slot->done = false;
+            if (!read(slot->block))
+                break;
+            writeQueue.push(slot);
+            workQueue .push(slot);
+        }
+        workQueue .close();
+        writeQueue.close();
+    });
+
+    std::vector<std::thread> workers;
+    for (Uint i=0; i<numThreads; i++)
+        workers.push_back(std::thread([&]()
+        {
+            Slot *slot;
+            while (workQueue.pop(slot))
+            {
+                process(slot->block);
+                std::lock_guard<std::mutex> lock(doneMutex);
+                slot->done = true;
+                doneCondition.notify_all();
+            }
+        }));
+
+    Slot *slot;
+    while (writeQueue.pop(slot))
+    {
+        {
+            std::unique_lock<std::mutex> lock(doneMutex);
+            doneCondition.wait(lock, [&]{ return slot->done; });
+        }
+        write(slot->block);
+        freeSlots.push(slot);
+    }
+    freeSlots.close();
+
+    reader.join();
+    for (Uint i=0; i<numThreads; i++)
+        workers[i].join();
+}
+
+// Runs process(task, worker) for every task from 0 to numTasks-1 on numThreads threads, where worker identifies the
+// thread so that it can keep state of its own. Each thread takes the next task as soon as it finishes one, so tasks of
+// very uneven size still keep every thread busy; giving the largest ones the lowest numbers keeps the tail short.
+template <class PROCESS>
+void runTasks(Uint numThreads, Uint64 numTasks, PROCESS process)
+{
+    std::atomic<Uint64> nextTask(0);
+    std::vector<std::thread> workers;
+    for (Uint i=0; i<numThreads; i++)
+        workers.push_back(std::thread([&, i]()
+        {
+            for (Uint64 task; (task = nextTask++) < numTasks;)
+                process(task, i);
+        }));
+    for (Uint i=0; i<numThreads; i++)
+        workers[i].join();
+}
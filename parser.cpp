@@ -11,14 +11,6 @@
 
 #include "regex.h"
 #include "parser.h"
-#include <stack>
-
-struct anchorStackNode
-{
-    bool allAlternativesAreAnchored;
-    bool currentAlternativeAnchored;
-    anchorStackNode(int) : allAlternativesAreAnchored(true), currentAlternativeAnchored(false) {}
-};
 
 RegexSymbolType RegexParser::symbolWithLowercaseOpposite(RegexSymbolType neg, RegexSymbolType pos, char ch, char chNeg)
 {
@@ -29,12 +21,25 @@ RegexSymbolType RegexParser::symbolWithLowercaseOpposite(RegexSymbolType neg, Re
 
 void RegexParser::addSymbol(const char *buf, RegexSymbol *newSymbol)
 {
+    settleAnchoredGroup();
+    if (newSymbol->type == RegexSymbol_AnchorStart)
+        stack->currentAlternativeAnchored = true;
     newSymbol->originalCode = buf;
-    stack->symbols.push(newSymbol);
+    symbolStack.push_back(newSymbol);
     symbolCountSpecified = false;
     symbolLazinessSpecified = false;
 }
 
+// A reference to a capture group that hasn't been opened yet can only be checked once the whole pattern has been parsed
+void RegexParser::referenceCaptureGroup(RegexSymbol *symbol, Uint64 captureGroupsNeeded)
+{
+    if (captureGroupsNeeded > backrefIndex)
+    {
+        ForwardReference reference = { symbol->originalCode, captureGroupsNeeded };
+        forwardReferences.push_back(reference);
+    }
+}
+
 void RegexParser::fixLookaheadQuantifier()
 {
     // It makes no difference whether a lookahead is repeated once or an infinite number of times, so limit them to 1 iteration.
@@ -58,7 +63,64 @@ void RegexParser::skipWhitespace(const char *&buf)
         buf++;
 }
 
-void RegexParser::closeAlternative(RegexSymbol **&symbols, std::queue<RegexSymbol*> &symbolQueue)
+void RegexParser::pushParsingStack(RegexGroup *group)
+{
+    ParsingStack *stackDown = stack;
+    stack = new ParsingStack;
+    stack->below = stackDown;
+    stack->alternativesBase = alternativeStack.size();
+    stack->symbolsBase      = symbolStack.size();
+    stack->group = group;
+    stack->anchoredGroup = NULL;
+    stack->allAlternativesAreAnchored = true;
+    stack->currentAlternativeAnchored = false;
+    alternativeStack.push_back(new (arena) RegexPattern);
+}
+
+// A group that is anchored anchors the alternative containing it only if it must match at least once, which isn't
+// known until the symbol after it (or the end of the alternative) is reached, as its quantifier comes in between.
+void RegexParser::settleAnchoredGroup()
+{
+    if (RegexGroup *group = stack->anchoredGroup)
+    {
+        if (group->minCount && !group->isNegativeLookaround())
+            stack->currentAlternativeAnchored = true;
+        stack->anchoredGroup = NULL;
+    }
+}
+
+// The current lookaround and atomic group matching code can't handle quantifiers, so wrap such a group in a
+// non-capturing group with the quantifier if it needs one.
+RegexGroup *RegexParser::wrapQuantifiedGroup(RegexGroup *group)
+{
+    if (!(group->isLookaround()            && (group->maxCount != group->minCount || group->maxCount > 1) ||
+          group->type == RegexGroup_Atomic &&                                        group->maxCount > 1))
+        return group;
+
+    RegexGroup *wrapper = new (arena) RegexGroup(RegexGroup_NonCapturing);
+    wrapper->originalCode = group->originalCode;
+    wrapper->minCount     = group->minCount;
+    wrapper->maxCount     = group->maxCount;
+    wrapper->lazy         = group->lazy;
+    wrapper->possessive   = group->possessive;
+    group->minCount   = 1;
+    group->maxCount   = 1;
+    group->lazy       = false;
+    group->possessive = false;
+    wrapper->alternatives    = arena.allocateArray<RegexPattern*>(1 + 1);
+    wrapper->alternatives[0] = new (arena) RegexPattern;
+    wrapper->alternatives[0]->symbols = arena.allocateArray<RegexSymbol*>(1 + 1);
+    wrapper->alternatives[0]->symbols[0] = group;
+    wrapper->alternatives[0]->symbols[1] = NULL;
+    wrapper->alternatives[1] = NULL;
+    group->parentAlternative = &wrapper->alternatives[0];
+    group->self              = &wrapper->alternatives[0]->symbols[0];
+    return wrapper;
+}
+
+// Moves the symbols of the alternative being closed from the top of symbolStack into an array of their own, combining
+// runs of characters into strings and wrapping quantified lookarounds and atomic groups as it goes.
+void RegexParser::closeAlternative(RegexSymbol **&symbols)
 {
     RegexSymbol **potentialString = NULL;
     Uint potentialStringLength = 0;
@@ -66,16 +128,25 @@ void RegexParser::closeAlternative(RegexSymbol **&symbols, std::queue<RegexSymbo
     bool moreThanOneTypeOfChar;
     bool wildcardUsed = false;
 
-    symbols = (RegexSymbol**)malloc((symbolQueue.size() + 1) * sizeof(RegexSymbol*));
+    settleAnchoredGroup();
+    stack->allAlternativesAreAnchored &= stack->currentAlternativeAnchored;
+    stack->currentAlternativeAnchored = false;
+
+    RegexSymbol **parsedSymbols = symbolStack.data() + stack->symbolsBase;
+    size_t numSymbols = symbolStack.size() - stack->symbolsBase;
+    size_t nextSymbol = 0;
+    symbols = arena.allocateArray<RegexSymbol*>(numSymbols + 1);
     size_t i;
     for (i=0;; i++)
     {
-        if (symbolQueue.empty())
+        if (nextSymbol == numSymbols)
             symbols[i] = NULL;
         else
         {
-            symbols[i] = symbolQueue.front();
-            symbolQueue.pop();
+            RegexSymbol *newSymbol = parsedSymbols[nextSymbol++];
+            if (newSymbol->type == RegexSymbol_Group)
+                newSymbol = wrapQuantifiedGroup((RegexGroup*)newSymbol);
+            symbols[i] = newSymbol;
             symbols[i]->self = &symbols[i];
         }
 
@@ -103,11 +174,9 @@ void RegexParser::closeAlternative(RegexSymbol **&symbols, std::queue<RegexSymbo
                 {
                     RegexSymbol *symbolAfter = symbols[i];
 
-                    RegexSymbol *charactersSymbol = new RegexSymbol(RegexSymbol_Character);
+                    RegexSymbol *charactersSymbol = new (arena) RegexSymbol(RegexSymbol_Character);
                     charactersSymbol->originalCode = (*potentialString)->originalCode;
                     charactersSymbol->self = potentialString;
-                    for (RegexSymbol **sym = potentialString; sym < &symbols[i]; sym++)
-                        delete *sym;
                     charactersSymbol->minCount = potentialStringLength;
                     charactersSymbol->maxCount = potentialStringLength;
                     charactersSymbol->lazy = false;
@@ -128,16 +197,15 @@ void RegexParser::closeAlternative(RegexSymbol **&symbols, std::queue<RegexSymbo
                 {
                     RegexSymbol *symbolAfter = symbols[i];
 
-                    RegexSymbol *stringSymbol = new RegexSymbol(RegexSymbol_String);
+                    RegexSymbol *stringSymbol = new (arena) RegexSymbol(RegexSymbol_String);
                     stringSymbol->originalCode = (*potentialString)->originalCode;
                     stringSymbol->self = potentialString;
-                    stringSymbol->string = new char [potentialStringLength + 1];
+                    stringSymbol->string = arena.allocateArray<char>(potentialStringLength + 1);
                     size_t len = 0;
                     for (RegexSymbol **sym = potentialString; sym < &symbols[i]; sym++)
                     {
                         memset(stringSymbol->string + len, (*sym)->character, (*sym)->minCount);
                         len += (*sym)->minCount;
-                        delete *sym;
                     }
                     stringSymbol->string[len] = '\0';
                     stringSymbol->strLength = len;
@@ -157,20 +225,22 @@ void RegexParser::closeAlternative(RegexSymbol **&symbols, std::queue<RegexSymbo
             potentialStringLength = 0;
         }
     }
+    symbolStack.resize(stack->symbolsBase);
 }
 
-void RegexParser::closeGroup(RegexPattern **&alternatives, std::queue<RegexPattern*> &patternQueue)
+void RegexParser::closeGroup(RegexPattern **&alternatives)
 {
-    alternatives = new RegexPattern* [patternQueue.size() + 1];
-    Uint i;
-    for (i=0; !patternQueue.empty(); i++)
+    RegexPattern **parsedAlternatives = alternativeStack.data() + stack->alternativesBase;
+    size_t numAlternatives = alternativeStack.size() - stack->alternativesBase;
+    alternatives = arena.allocateArray<RegexPattern*>(numAlternatives + 1);
+    for (size_t i=0; i<numAlternatives; i++)
     {
-        alternatives[i] = patternQueue.front();
-        patternQueue.pop();
+        alternatives[i] = parsedAlternatives[i];
         for (RegexSymbol **symbol = alternatives[i]->symbols; *symbol; symbol++)
             (*symbol)->parentAlternative = &alternatives[i];
     }
-    alternatives[i] = NULL;
+    alternatives[numAlternatives] = NULL;
+    alternativeStack.resize(stack->alternativesBase);
 }
 
 RegexGroup *RegexParser::parseLookinto(const char *&buf)
@@ -192,24 +262,38 @@ RegexGroup *RegexParser::parseLookinto(const char *&buf)
     }
     switch (*buf)
     {
-    case '=':                                                                                                     group = new RegexGroupLookinto(RegexGroup_Lookinto         , backrefIndex); break;
-    case '*': if (!allow_molecular_lookaround) throw RegexParsingError(buf, "Unrecognized character after (?^");  group = new RegexGroupLookinto(RegexGroup_LookintoMolecular, backrefIndex); break;
-    case '!':                                                                                                     group = new RegexGroupLookinto(RegexGroup_NegativeLookinto , backrefIndex); break;
+    case '=':                                                                                                     group = new (arena) RegexGroupLookinto(RegexGroup_Lookinto         , backrefIndex); break;
+    case '*': if (!allow_molecular_lookaround) throw RegexParsingError(buf, "Unrecognized character after (?^");  group = new (arena) RegexGroupLookinto(RegexGroup_LookintoMolecular, backrefIndex); break;
+    case '!':                                                                                                     group = new (arena) RegexGroupLookinto(RegexGroup_NegativeLookinto , backrefIndex); break;
     default:                                   throw RegexParsingError(buf, "Unrecognized character after (?^");
     }
     buf++;
     return group;
 }
 
-RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf)
+RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf) : arena(regex.arena)
 {
+    arena.reserve(strlen(buf) * (sizeof(RegexSymbol) + sizeof(RegexSymbol*)));
     regex.originalCode = buf;
     regex.parentAlternative = NULL;
 
-    stack = new ParsingStack;
-    stack->below = NULL;
-    stack->group = &regex;
-    stack->alternatives.push(new RegexPattern);
+    // if a parsing error is thrown, free the parsing stack that was in progress (the arena frees the symbols)
+    struct ParsingStackCleanup
+    {
+        ParsingStack *&stack;
+        ~ParsingStackCleanup()
+        {
+            while (stack)
+            {
+                ParsingStack *stackDown = stack->below;
+                delete stack;
+                stack = stackDown;
+            }
+        }
+    } parsingStackCleanup = { stack };
+
+    stack = NULL;
+    pushParsingStack(&regex);
     symbol = NULL;
     backrefIndex = 0;
     maxGroupDepth = 1;
@@ -236,7 +320,7 @@ RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf)
             // else fall through
         literal_char:
         default:
-            symbol = new RegexSymbol(RegexSymbol_Character);
+            symbol = new (arena) RegexSymbol(RegexSymbol_Character);
             symbol->characterAny = false;
             symbol->character = *buf;
             addSymbol(buf++, symbol);
@@ -257,15 +341,15 @@ RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf)
             }
             break;
         case '^':
-            addSymbol(buf++, symbol = new RegexSymbol(RegexSymbol_AnchorStart));
+            addSymbol(buf++, symbol = new (arena) RegexSymbol(RegexSymbol_AnchorStart));
             if (!allow_quantifiers_on_assertions) symbol = NULL;
             break;
         case '$':
-            addSymbol(buf++, symbol = new RegexSymbol(RegexSymbol_AnchorEnd));
+            addSymbol(buf++, symbol = new (arena) RegexSymbol(RegexSymbol_AnchorEnd));
             if (!allow_quantifiers_on_assertions) symbol = NULL;
             break;
         case '.':
-            addSymbol(buf++, symbol = new RegexSymbol(RegexSymbol_Character));
+            addSymbol(buf++, symbol = new (arena) RegexSymbol(RegexSymbol_Character));
             symbol->characterAny = true;
             break;
         case '[':
@@ -424,7 +508,7 @@ RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf)
                     ((Uint64*)allowedChars)[2] = ~((Uint64*)allowedChars)[2];
                     ((Uint64*)allowedChars)[3] = ~((Uint64*)allowedChars)[3];
                 }
-                addSymbol(buf0, symbol = new RegexCharacterClass(allowedChars));
+                addSymbol(buf0, symbol = new (arena) RegexCharacterClass(allowedChars));
                 break;
             }
         case '(':
@@ -438,12 +522,12 @@ RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf)
                 case '?':
                     switch (buf[1])
                     {
-                    case ':':                                                                                                    buf+=2; group = new RegexGroup(RegexGroup_NonCapturing);       break;
-                    case '>': if (!allow_atomic_groups       ) throw RegexParsingError(buf, "Unrecognized character after (?");  buf+=2; group = new RegexGroup(RegexGroup_Atomic);             break;
-                    case '|': if (!allow_branch_reset_groups ) throw RegexParsingError(buf, "Unrecognized character after (?");  buf+=2; group = new RegexGroup(RegexGroup_BranchReset);        break;
-                    case '=':                                                                                                    buf+=2; group = new RegexGroup(RegexGroup_Lookahead);          break;
-                    case '*': if (!allow_molecular_lookaround) throw RegexParsingError(buf, "Unrecognized character after (?");  buf+=2; group = new RegexGroup(RegexGroup_LookaheadMolecular); break;
-                    case '!':                                                                                                    buf+=2; group = new RegexGroup(RegexGroup_NegativeLookahead);  break;
+                    case ':':                                                                                                    buf+=2; group = new (arena) RegexGroup(RegexGroup_NonCapturing);       break;
+                    case '>': if (!allow_atomic_groups       ) throw RegexParsingError(buf, "Unrecognized character after (?");  buf+=2; group = new (arena) RegexGroup(RegexGroup_Atomic);             break;
+                    case '|': if (!allow_branch_reset_groups ) throw RegexParsingError(buf, "Unrecognized character after (?");  buf+=2; group = new (arena) RegexGroup(RegexGroup_BranchReset);        break;
+                    case '=':                                                                                                    buf+=2; group = new (arena) RegexGroup(RegexGroup_Lookahead);          break;
+                    case '*': if (!allow_molecular_lookaround) throw RegexParsingError(buf, "Unrecognized character after (?");  buf+=2; group = new (arena) RegexGroup(RegexGroup_LookaheadMolecular); break;
+                    case '!':                                                                                                    buf+=2; group = new (arena) RegexGroup(RegexGroup_NegativeLookahead);  break;
                     case '^':                                                                                                    buf+=2; group = parseLookinto(buf);                            break;
                     case '(':
                         if (!allow_conditionals && !allow_lookaround_conditionals)
@@ -453,7 +537,7 @@ RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf)
                         {
                             try
                             {
-                                group = new RegexConditional(readNumericConstant<Uint>(buf) - 1);
+                                group = new (arena) RegexConditional(readNumericConstant<Uint>(buf) - 1);
                             }
                             catch (ParsingError)
                             {
@@ -469,14 +553,14 @@ RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf)
                             const char *bufOrig = buf-1;
                             switch (buf[1])
                             {
-                            case '=':                                                                                                    buf+=2; lookaroundCondition = new RegexGroup(RegexGroup_Lookahead);          break;
-                            case '*': if (!allow_molecular_lookaround) throw RegexParsingError(buf, "Unrecognized character after (?");  buf+=2; lookaroundCondition = new RegexGroup(RegexGroup_LookaheadMolecular); break;
-                            case '!':                                                                                                    buf+=2; lookaroundCondition = new RegexGroup(RegexGroup_NegativeLookahead);  break;
+                            case '=':                                                                                                    buf+=2; lookaroundCondition = new (arena) RegexGroup(RegexGroup_Lookahead);          break;
+                            case '*': if (!allow_molecular_lookaround) throw RegexParsingError(buf, "Unrecognized character after (?");  buf+=2; lookaroundCondition = new (arena) RegexGroup(RegexGroup_LookaheadMolecular); break;
+                            case '!':                                                                                                    buf+=2; lookaroundCondition = new (arena) RegexGroup(RegexGroup_NegativeLookahead);  break;
                             case '^':                                                                                                    buf+=2; lookaroundCondition = parseLookinto(buf);                            break;
                             default:
                                 goto condition_not_found;
                             }
-                            group = new RegexLookaroundConditional(lookaroundCondition);
+                            group = new (arena) RegexLookaroundConditional(lookaroundCondition);
                             lookaroundCondition->originalCode = bufOrig;
                         }
                         else condition_not_found:
@@ -502,7 +586,7 @@ RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf)
                     }
                     break;
                 case '*':
-                    symbol = new RegexSymbol(RegexSymbol_Verb);
+                    symbol = new (arena) RegexSymbol(RegexSymbol_Verb);
                     addSymbol(buf-1, symbol);
                     buf++;
                     {{}} if (strncmp(buf, "ACCEPT)", strlength("ACCEPT)"))==0 ) { buf += strlength("ACCEPT)"); symbol->verb = RegexVerb_Accept; }
@@ -518,10 +602,25 @@ RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf)
                     goto not_a_group;
                     break;
                 default:
-                    group = new RegexGroupCapturing(backrefIndex++);
+                    group = new (arena) RegexGroupCapturing(backrefIndex++);
                     break;
                 }
                 addSymbol(bufGroup, group);
+                {
+                    RegexGroup *lookinto = group->type == RegexGroup_LookaroundConditional ? ((RegexLookaroundConditional*)group)->lookaround : group;
+                    switch (lookinto->type)
+                    {
+                    case RegexGroup_Lookinto:
+                    case RegexGroup_LookintoMolecular:
+                    case RegexGroup_NegativeLookinto:
+                        if (((RegexGroupLookinto*)lookinto)->backrefIndex != UINT_MAX)
+                            referenceCaptureGroup(group, ((RegexGroupLookinto*)lookinto)->backrefIndex);
+                        break;
+                    case RegexGroup_Conditional:
+                        referenceCaptureGroup(group, (Uint64)((RegexConditional*)group)->backrefIndex + 1);
+                        break;
+                    }
+                }
 
             add_nested_group:
                 curGroupDepth++;
@@ -543,15 +642,8 @@ RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf)
 
                 group->parentAlternative = NULL;
                 group->self = NULL;
-                
-                {
-                    ParsingStack *stackDown = stack;
-                    stack = new ParsingStack;
-                    stack->below = stackDown;
-                }
 
-                stack->alternatives.push(new RegexPattern);
-                stack->group = group;
+                pushParsingStack(group);
                 if (group->type == RegexGroup_BranchReset)
                 {
                     stack->BranchResetGroup.backrefIndexFirst = backrefIndex;
@@ -580,8 +672,12 @@ RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf)
         close_group:
             {
                 RegexGroup *group = stack->group;
-                closeAlternative(stack->alternatives.back()->symbols, stack->symbols);
-                closeGroup(group->alternatives, stack->alternatives);
+                closeAlternative(alternativeStack.back()->symbols);
+                bool anchored = stack->allAlternativesAreAnchored;
+                // conditionals with only 1 alternative have an implied empty second alternative (which is not anchored)
+                if ((group->type==RegexGroup_Conditional || group->type==RegexGroup_LookaroundConditional) && alternativeStack.size() - stack->alternativesBase == 1)
+                    anchored = false;
+                closeGroup(group->alternatives);
 
                 if (group->type == RegexGroup_BranchReset)
                 {
@@ -612,12 +708,17 @@ RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf)
                 delete stack;
                 stack = stackDown;
                 if (!stack)
+                {
+                    regex.anchored = anchored;
                     goto finished_parsing;
+                }
 
                 if (stack->group->type == RegexGroup_LookaroundConditional)
                     symbol = NULL; // don't allow a quantifier on a lookaround conditional's lookaround
                 else
                     symbol = group;
+                if (anchored && !(stack->group->type == RegexGroup_LookaroundConditional && ((RegexLookaroundConditional*)stack->group)->lookaround == group))
+                    stack->anchoredGroup = group;
                 symbolCountSpecified = false;
                 symbolLazinessSpecified = false;
                 break;
@@ -625,11 +726,11 @@ RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf)
         case '|':
             {
                 RegexGroup *group = stack->group;
-                if (inrange(group->type, RegexGroup_Conditional, RegexGroup_LookaroundConditional) && stack->alternatives.size() == 2)
+                if (inrange(group->type, RegexGroup_Conditional, RegexGroup_LookaroundConditional) && alternativeStack.size() - stack->alternativesBase == 2)
                     throw RegexParsingError(buf, "Conditional group contains more than two branches");
                 buf++;
-                closeAlternative(stack->alternatives.back()->symbols, stack->symbols);
-                stack->alternatives.push(new RegexPattern);
+                closeAlternative(alternativeStack.back()->symbols);
+                alternativeStack.push_back(new (arena) RegexPattern);
                 if (group->type == RegexGroup_BranchReset)
                 {
                     if (stack->BranchResetGroup.backrefIndexNext < backrefIndex)
@@ -644,7 +745,7 @@ RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf)
                 buf++;
                 if (inrange(*buf, '1', '9'))
                 {
-                    RegexBackref *backref = new RegexBackref;
+                    RegexBackref *backref = new (arena) RegexBackref;
                     addSymbol(buf0, symbol = backref);
                     try
                     {
@@ -654,6 +755,7 @@ RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf)
                     {
                         throw RegexParsingError(buf, "Group number is too big");
                     }
+                    referenceCaptureGroup(backref, (Uint64)backref->index + 1);
                 }
                 else
                 {
@@ -672,7 +774,7 @@ RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf)
                     process_literal_char:
                         ch = *buf;
                     process_char:
-                        symbol = new RegexSymbol(RegexSymbol_Character);
+                        symbol = new (arena) RegexSymbol(RegexSymbol_Character);
                         symbol->characterAny = false;
                         symbol->character = ch;
                         addSymbol(buf0, symbol);
@@ -681,29 +783,29 @@ RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf)
                     case 'K':
                         if (!allow_reset_start)
                             goto process_literal_char;
-                        addSymbol(buf0, new RegexSymbol(RegexSymbol_ResetStart));
+                        addSymbol(buf0, new (arena) RegexSymbol(RegexSymbol_ResetStart));
                         symbol = NULL; // don't allow this symbol to be quantified
                         buf++;
                         break;
                     case 'B':
                     case 'b':
-                        addSymbol(buf0, symbol = new RegexSymbol(symbolWithLowercaseOpposite(RegexSymbol_WordBoundaryNot, RegexSymbol_WordBoundary, *buf, 'B')));
+                        addSymbol(buf0, symbol = new (arena) RegexSymbol(symbolWithLowercaseOpposite(RegexSymbol_WordBoundaryNot, RegexSymbol_WordBoundary, *buf, 'B')));
                         if (!allow_quantifiers_on_assertions) symbol = NULL;
                         buf++;
                         break;
                     case 'D':
                     case 'd':
-                        addSymbol(buf0, symbol = new RegexSymbol(symbolWithLowercaseOpposite(RegexSymbol_DigitNot, RegexSymbol_Digit, *buf, 'D')));
+                        addSymbol(buf0, symbol = new (arena) RegexSymbol(symbolWithLowercaseOpposite(RegexSymbol_DigitNot, RegexSymbol_Digit, *buf, 'D')));
                         buf++;
                         break;
                     case 'S':
                     case 's':
-                        addSymbol(buf0, symbol = new RegexSymbol(symbolWithLowercaseOpposite(RegexSymbol_SpaceNot, RegexSymbol_Space, *buf, 'S')));
+                        addSymbol(buf0, symbol = new (arena) RegexSymbol(symbolWithLowercaseOpposite(RegexSymbol_SpaceNot, RegexSymbol_Space, *buf, 'S')));
                         buf++;
                         break;
                     case 'W':
                     case 'w':
-                        addSymbol(buf0, symbol = new RegexSymbol(symbolWithLowercaseOpposite(RegexSymbol_WordCharacterNot, RegexSymbol_WordCharacter, *buf, 'W')));
+                        addSymbol(buf0, symbol = new (arena) RegexSymbol(symbolWithLowercaseOpposite(RegexSymbol_WordCharacterNot, RegexSymbol_WordCharacter, *buf, 'W')));
                         buf++;
                         break;
                     }
@@ -808,137 +910,7 @@ RegexParser::RegexParser(RegexGroupRoot &regex, const char *buf)
         }
     }
 finished_parsing:
-
-    // Note that this group iterator code is redundant with that in RegexMatcher::virtualizeSymbols(); todo: Factor it out into a separate function
-    RegexGroup **groupStackBase = new RegexGroup *[maxGroupDepth];
-    RegexGroup **groupStackTop = groupStackBase;
-    RegexGroup *rootGroup = &regex;
-    RegexPattern **thisAlternative;
-    RegexSymbol  **thisSymbol = &(RegexSymbol*&)rootGroup;
-    std::stack<anchorStackNode> anchorStack;
-    for (;;)
-    {
-        if (*thisSymbol)
-        {
-            switch ((*thisSymbol)->type)
-            {
-            case RegexSymbol_AnchorStart:
-                anchorStack.top().currentAlternativeAnchored = true;
-                thisSymbol++;
-                break;
-            case RegexSymbol_Backref:
-                if (((RegexBackref*)(*thisSymbol))->index >= backrefIndex)
-                    throw RegexParsingError((*thisSymbol)->originalCode, "reference to non-existent capture group");
-                // fall through
-            default:
-                thisSymbol++;
-                break;
-            case RegexSymbol_Group:
-                RegexGroup *group = (RegexGroup*)(*thisSymbol);
-                switch (group->type)
-                {
-                case RegexGroup_Lookinto:
-                case RegexGroup_LookintoMolecular:
-                case RegexGroup_NegativeLookinto:
-                    if (((RegexGroupLookinto*)group)->backrefIndex+1 > backrefIndex+1)
-                        throw RegexParsingError((*thisSymbol)->originalCode, "reference to non-existent capture group");
-                    break;
-                case RegexGroup_Conditional:
-                    if (((RegexConditional*)group)->backrefIndex >= backrefIndex)
-                        throw RegexParsingError((*thisSymbol)->originalCode, "reference to non-existent capture group");
-                    break;
-                case RegexGroup_LookaroundConditional:
-                    {
-                        RegexGroup *lookaround = ((RegexLookaroundConditional*)group)->lookaround;
-                        switch (lookaround->type)
-                        {
-                        case RegexGroup_Lookinto:
-                        case RegexGroup_LookintoMolecular:
-                        case RegexGroup_NegativeLookinto:
-                            if (((RegexGroupLookinto*)lookaround)->backrefIndex+1 > backrefIndex+1)
-                                throw RegexParsingError((*thisSymbol)->originalCode, "reference to non-existent capture group");
-                            break;
-                        }
-                        break;
-                    }
-                }
-                // The current lookaround matching code can't handle quantifiers, so wrap it in a non-capturing group with a quantifier if it needs one.
-                if (group->isLookaround()            && (group->maxCount != group->minCount || group->maxCount > 1) ||
-                    group->type == RegexGroup_Atomic &&                                        group->maxCount > 1)
-                {
-                    RegexGroup *wrapper = new RegexGroup(RegexGroup_NonCapturing);
-                    wrapper->originalCode = group->originalCode;
-                    wrapper->minCount     = group->minCount;
-                    wrapper->maxCount     = group->maxCount;
-                    wrapper->lazy         = group->lazy;
-                    wrapper->possessive   = group->possessive;
-                    group->minCount   = 1;
-                    group->maxCount   = 1;
-                    group->lazy       = false;
-                    group->possessive = false;
-                    wrapper->alternatives    = new RegexPattern* [1 + 1];
-                    wrapper->alternatives[0] = new RegexPattern;
-                    wrapper->alternatives[0]->symbols = (RegexSymbol**)malloc((1 + 1) * sizeof(RegexSymbol*));
-                    wrapper->alternatives[0]->symbols[0] = group;
-                    wrapper->alternatives[0]->symbols[1] = NULL;
-                    wrapper->alternatives[1] = NULL;
-                    wrapper->parentAlternative = thisAlternative;
-                    wrapper->self              = thisSymbol;
-                    group  ->parentAlternative = &wrapper->alternatives[0];
-                    group  ->self              = &wrapper->alternatives[0]->symbols[0];
-                    *groupStackTop++ = wrapper;
-                    *thisSymbol      = wrapper;
-                    thisAlternative = &wrapper->alternatives[0];
-                    thisSymbol      = &wrapper->alternatives[0]->symbols[0];
-                    anchorStack.push(0);
-                }
-                *groupStackTop++ = group;
-                thisAlternative = group->alternatives;
-                thisSymbol      = group->alternatives[0]->symbols;
-                anchorStack.push(0);
-                if (group->type == RegexGroup_LookaroundConditional)
-                {
-                    group = ((RegexLookaroundConditional*)group)->lookaround;
-                    *groupStackTop++ = group;
-                    thisAlternative = group->alternatives;
-                    thisSymbol      = group->alternatives[0]->symbols;
-                    anchorStack.push(0);
-                }
-                break;
-            }
-        }
-        else
-        {
-            anchorStack.top().allAlternativesAreAnchored &= anchorStack.top().currentAlternativeAnchored;
-            anchorStack.top().currentAlternativeAnchored = false;
-            thisAlternative++;
-            if (*thisAlternative)
-                thisSymbol = (*thisAlternative)->symbols;
-            else
-            {
-                RegexGroup *group = *--groupStackTop;
-                if (groupStackTop == groupStackBase)
-                    break;
-
-                bool anchored = anchorStack.top().allAlternativesAreAnchored;
-                // conditionals with only 1 alternative have an implied empty second alternative (which is not anchored)
-                if ((group->type==RegexGroup_Conditional || group->type==RegexGroup_LookaroundConditional) && (thisAlternative - group->alternatives)==1)
-                    anchored = false;
-
-                thisAlternative = group->parentAlternative;
-                thisSymbol      = group->self ? group->self + 1 : (*thisAlternative)->symbols; // group->self will be NULL if this is the lookaround in a conditional
-
-                anchorStack.pop();
-                if (group->self && group->minCount && !group->isNegativeLookaround() )
-                    anchorStack.top().currentAlternativeAnchored |= anchored;
-            }
-        }
-    }
-    delete [] groupStackBase;
-
-#ifdef _DEBUG
-    if (anchorStack.size() != 1)
-        throw "Anchor stack error";
-#endif
-    regex.anchored = anchorStack.top().allAlternativesAreAnchored;
+    for (size_t i=0; i<forwardReferences.size(); i++)
+        if (forwardReferences[i].captureGroupsNeeded > backrefIndex)
+            throw RegexParsingError(forwardReferences[i].originalCode, "reference to non-existent capture group");
 }
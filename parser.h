@@ -13,9 +13,12 @@ class ParsingStack
 {
     friend class RegexParser;
     ParsingStack *below;
-    std::queue<RegexPattern*> alternatives;
-    std::queue<RegexSymbol*> symbols;
+    size_t alternativesBase; // where this group's alternatives begin in RegexParser::alternativeStack
+    size_t symbolsBase;      // where its current alternative's symbols begin in RegexParser::symbolStack
     RegexGroup *group;
+    RegexGroup *anchoredGroup; // the last group closed in the current alternative, if it is anchored; its quantifier may still follow
+    bool allAlternativesAreAnchored;
+    bool currentAlternativeAnchored;
     union
     {
         struct
@@ -30,7 +33,17 @@ class RegexParser
 {
     friend class Regex;
 
+    struct ForwardReference
+    {
+        const char *originalCode;
+        Uint64 captureGroupsNeeded;
+    };
+
+    RegexArena &arena;
     ParsingStack *stack;
+    std::vector<RegexPattern*> alternativeStack; // the alternatives of every group still open, innermost last
+    std::vector<RegexSymbol*> symbolStack; // the symbols of every alternative still open, innermost last
+    std::vector<ForwardReference> forwardReferences; // references to capture groups that had not been opened yet where they were made
     RegexSymbol *symbol;
     Uint backrefIndex; // zero-numbered; 0 corresponds to \1
     Uint maxGroupDepth; // minimum is 1 (meaning, root group only)
@@ -43,10 +56,14 @@ class RegexParser
     inline RegexSymbolType symbolWithLowercaseOpposite(RegexSymbolType neg, RegexSymbolType pos, char ch, char chNeg);
 
     void addSymbol(const char *buf, RegexSymbol *symbol);
+    void referenceCaptureGroup(RegexSymbol *symbol, Uint64 captureGroupsNeeded);
     void fixLookaheadQuantifier();
     static void skipWhitespace(const char *&buf);
-    void closeAlternative(RegexSymbol **&symbols, std::queue<RegexSymbol*> &symbolQueue);
-    void closeGroup(RegexPattern **&alternatives, std::queue<RegexPattern*> &patternQueue);
+    void pushParsingStack(RegexGroup *group);
+    void settleAnchoredGroup();
+    RegexGroup *wrapQuantifiedGroup(RegexGroup *group);
+    void closeAlternative(RegexSymbol **&symbols);
+    void closeGroup(RegexPattern **&alternatives);
     RegexGroup *parseLookinto(const char *&buf);
 public:
     RegexParser(RegexGroupRoot &regex, const char *buf);
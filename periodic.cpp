@@ -0,0 +1,377 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include <algorithm>
+#include "regex.h"
+#include "periodic.h"
+
+bool matchDigitNot        (Uchar ch);
+bool matchDigit           (Uchar ch);
+bool matchSpaceNot        (Uchar ch);
+bool matchSpace           (Uchar ch);
+bool matchWordCharacterNot(Uchar ch);
+bool matchWordCharacter   (Uchar ch);
+
+extern Uint optimizationLevel;
+
+// A Thompson NFA for the pattern over the one character there is in numerical mode, which every state that consumes a
+// character either matches or never matches. Quantifiers are expanded into copies of what they quantify, so that the
+// NFA has no counters, only a set of active states; the supported constructs are those whose set of matches doesn't
+// depend on how the backtracking matcher chooses among them.
+class UnaryNFA
+{
+public:
+    enum
+    {
+        MAX_STATES = 1<<15,
+        MAX_STEPS  = 1<<20,
+        MAX_WORK   = 1<<28, // the number of steps times the number of states
+    };
+    enum StateType
+    {
+        State_Character,   // consumes a character, going to out1
+        State_Split,       // goes to both out1 and out2
+        State_AnchorStart, // goes to out1 at the start of the input
+        State_AnchorEnd,   // goes to out1 at the end of the input
+        State_Fail,
+        State_Match,       // stays matched, however many characters follow
+    };
+    struct State
+    {
+        Uint type;
+        Uint out1, out2;
+    };
+    std::vector<State> states;
+private:
+    char basicChar;
+
+    Uint newState(Uint type, Uint out1 = UINT_MAX, Uint out2 = UINT_MAX)
+    {
+        State state = { type, out1, out2 };
+        states.push_back(state);
+        return (Uint)states.size() - 1;
+    }
+    template <class BODY>
+    const char *compileRepeat(Uint minCount, Uint maxCount, Uint next, Uint &entry, BODY body);
+    const char *compileAlternatives(RegexGroup *group, Uint next, Uint &entry);
+    const char *compileSymbols(RegexSymbol **symbols, Uint next, Uint &entry);
+    const char *compileGroup(RegexGroup *group, Uint next, Uint &entry);
+public:
+    Uint start, match;
+    bool anchored;
+    const char *Compile(RegexGroupRoot &regex, char basicChar);
+    void closure(Uint64 *set, bool atStart, bool atEnd, std::vector<Uint> &stack) const;
+};
+
+const char *UnaryNFA::Compile(RegexGroupRoot &regex, char basicChar)
+{
+    if (enable_persistent_backrefs)
+        return "persistent backrefs";
+    this->basicChar = basicChar;
+    anchored = regex.anchored;
+    states.clear();
+    match = newState(State_Match);
+    return compileAlternatives(&regex, match, start);
+}
+
+// Builds count copies of the body, followed by the rest of the pattern at next; body(next, entry) builds one of them
+template <class BODY>
+const char *UnaryNFA::compileRepeat(Uint minCount, Uint maxCount, Uint next, Uint &entry, BODY body)
+{
+    if (minCount > MAX_STATES || maxCount != UINT_MAX && maxCount > MAX_STATES)
+        return "too many states";
+    Uint current = next;
+    auto addCopy = [&](Uint copyNext, Uint &copyEntry) -> const char *
+    {
+        if (const char *unsupported = body(copyNext, copyEntry))
+            return unsupported;
+        return states.size() > MAX_STATES ? "too many states" : NULL;
+    };
+    if (maxCount == UINT_MAX)
+    {
+        Uint loop = newState(State_Split);
+        Uint bodyEntry;
+        if (const char *unsupported = addCopy(loop, bodyEntry))
+            return unsupported;
+        states[loop].out1 = bodyEntry;
+        states[loop].out2 = next;
+        current = loop;
+    }
+    else
+    {
+        for (Uint i=minCount; i<maxCount; i++)
+        {
+            Uint bodyEntry;
+            if (const char *unsupported = addCopy(current, bodyEntry))
+                return unsupported;
+            current = newState(State_Split, bodyEntry, next);
+        }
+    }
+    for (Uint i=0; i<minCount; i++)
+    {
+        if (const char *unsupported = addCopy(current, current))
+            return unsupported;
+    }
+    entry = current;
+    return NULL;
+}
+
+const char *UnaryNFA::compileAlternatives(RegexGroup *group, Uint next, Uint &entry)
+{
+    Uint numAlternatives = 0;
+    entry = next;
+    while (group->alternatives[numAlternatives])
+        numAlternatives++;
+    for (Uint i=numAlternatives; i--;)
+    {
+        Uint alternativeEntry;
+        if (const char *unsupported = compileSymbols(group->alternatives[i]->symbols, next, alternativeEntry))
+            return unsupported;
+        entry = i == numAlternatives-1 ? alternativeEntry : newState(State_Split, alternativeEntry, entry);
+    }
+    return NULL;
+}
+
+const char *UnaryNFA::compileSymbols(RegexSymbol **symbols, Uint next, Uint &entry)
+{
+    RegexSymbol **end = symbols;
+    while (*end)
+        end++;
+    entry = next;
+    for (RegexSymbol **thisSymbol = end; thisSymbol-- != symbols;)
+    {
+        RegexSymbol *symbol = *thisSymbol;
+        bool matchesBasicChar = false;
+        switch (symbol->type)
+        {
+        case RegexSymbol_NoOp:
+        case RegexSymbol_ResetStart: // only moves where the match is reported to start
+            continue;
+        case RegexSymbol_Group:
+            if (const char *unsupported = compileGroup((RegexGroup*)symbol, entry, entry))
+                return unsupported;
+            continue;
+        case RegexSymbol_Verb:
+            if (symbol->verb != RegexVerb_Fail)
+                return "backtracking control verbs";
+            entry = newState(State_Fail);
+            continue;
+        case RegexSymbol_Backref:
+            return "backreferences";
+        case RegexSymbol_AnchorStart:
+            if (symbol->minCount)
+                entry = newState(State_AnchorStart, entry);
+            continue;
+        case RegexSymbol_AnchorEnd:
+            if (symbol->minCount)
+                entry = newState(State_AnchorEnd, entry);
+            continue;
+        case RegexSymbol_WordBoundaryNot:
+        case RegexSymbol_WordBoundary:
+            return "word boundaries";
+        case RegexSymbol_Character:
+            // as in the tree walker, a character other than the basic one never matches, even if it is optional
+            matchesBasicChar = symbol->characterAny || symbol->character == basicChar;
+            break;
+        case RegexSymbol_CharacterClass:   matchesBasicChar = ((RegexCharacterClass*)symbol)->isInClass(basicChar); break;
+        case RegexSymbol_String:           matchesBasicChar = false;                                                 break;
+        case RegexSymbol_DigitNot:         matchesBasicChar = matchDigitNot        (basicChar);                      break;
+        case RegexSymbol_Digit:            matchesBasicChar = matchDigit           (basicChar);                      break;
+        case RegexSymbol_SpaceNot:         matchesBasicChar = matchSpaceNot        (basicChar);                      break;
+        case RegexSymbol_Space:            matchesBasicChar = matchSpace           (basicChar);                      break;
+        case RegexSymbol_WordCharacterNot: matchesBasicChar = matchWordCharacterNot(basicChar);                      break;
+        case RegexSymbol_WordCharacter:    matchesBasicChar = matchWordCharacter   (basicChar);                      break;
+        default:
+            return "patterns already rewritten by static optimization";
+        }
+        if (!matchesBasicChar)
+        {
+            entry = newState(State_Fail);
+            continue;
+        }
+        if (symbol->possessive)
+            return "possessive quantifiers";
+        if (const char *unsupported = compileRepeat(symbol->minCount, symbol->maxCount, entry, entry, [&](Uint bodyNext, Uint &bodyEntry) -> const char *
+            {
+                bodyEntry = newState(State_Character, bodyNext);
+                return NULL;
+            }))
+            return unsupported;
+    }
+    return NULL;
+}
+
+const char *UnaryNFA::compileGroup(RegexGroup *group, Uint next, Uint &entry)
+{
+    entry = next;
+    if (group->maxCount == 0)
+        return NULL;
+    if (group->possessive)
+        return "possessive quantifiers";
+    switch (group->type)
+    {
+    case RegexGroup_NonCapturing:
+    case RegexGroup_Capturing:
+    case RegexGroup_BranchReset:
+        break;
+    case RegexGroup_Atomic:
+        return "atomic groups";
+    case RegexGroup_Conditional:
+    case RegexGroup_LookaroundConditional:
+        return "conditionals";
+    default:
+        return "lookarounds";
+    }
+    if (optimizationLevel && group->type != RegexGroup_BranchReset && !group->alternatives[1])
+    {
+        // the matcher rewrites a group of fixed-count characters into a count of them, without comparing each one
+        // with the basic character, so such a group is left to it rather than answered differently here
+        bool isConstGroup = true, hasOtherChar = false;
+        for (RegexSymbol **symbol = group->alternatives[0]->symbols; *symbol && isConstGroup; symbol++)
+        {
+            isConstGroup = ((*symbol)->type == RegexSymbol_Character || (*symbol)->type == RegexSymbol_NoOp) && (*symbol)->minCount == (*symbol)->maxCount;
+            if ((*symbol)->type == RegexSymbol_Character && !(*symbol)->characterAny && (*symbol)->character != basicChar)
+                hasOtherChar = true;
+        }
+        if (isConstGroup && hasOtherChar)
+            return "groups of constant length containing other characters";
+    }
+    return compileRepeat(group->minCount, group->maxCount, next, entry, [&](Uint bodyNext, Uint &bodyEntry) -> const char *
+    {
+        return compileAlternatives(group, bodyNext, bodyEntry);
+    });
+}
+
+// Adds to the set every state reachable from it without consuming a character
+void UnaryNFA::closure(Uint64 *set, bool atStart, bool atEnd, std::vector<Uint> &stack) const
+{
+    stack.clear();
+    for (Uint i=0; i<(Uint)states.size(); i++)
+        if (set[i/64] & (1ULL << i%64))
+            stack.push_back(i);
+    auto add = [&](Uint i)
+    {
+        if (!(set[i/64] & (1ULL << i%64)))
+        {
+            set[i/64] |= 1ULL << i%64;
+            stack.push_back(i);
+        }
+    };
+    while (!stack.empty())
+    {
+        const State &state = states[stack.back()];
+        stack.pop_back();
+        switch (state.type)
+        {
+        case State_Split:
+            add(state.out1);
+            add(state.out2);
+            break;
+        case State_AnchorStart:
+            if (atStart)
+                add(state.out1);
+            break;
+        case State_AnchorEnd:
+            if (atEnd)
+                add(state.out1);
+            break;
+        }
+    }
+}
+
+// The set of active states after N characters is a function of the set after N-1 (except for N=0, at which "^" can
+// match), so once a set repeats, every set after it does too.
+const char *PeriodicMatchSet::Compute(RegexGroupRoot &regex, char basicChar)
+{
+    UnaryNFA nfa;
+    if (const char *unsupported = nfa.Compile(regex, basicChar))
+        return unsupported;
+
+    const Uint numStates = (Uint)nfa.states.size();
+    const Uint numWords = (numStates + 63) / 64;
+    const Uint64 maxSteps = std::min((Uint64)UnaryNFA::MAX_STEPS, (Uint64)UnaryNFA::MAX_WORK / numStates);
+    std::vector<Uint64> history; // the sets after 1, 2, 3... characters
+    std::vector<Uint64> current(numWords), next(numWords), ending(numWords);
+    std::vector<Uint> stack;
+    std::vector<Uint> table(1<<10, UINT_MAX); // open-addressed, from the hash of a set to where it is in history
+    Uint numInTable = 0;
+    auto hashOf = [&](const Uint64 *set) -> Uint64
+    {
+        Uint64 hash = 0;
+        for (Uint i=0; i<numWords; i++)
+            hash = (hash ^ set[i]) * 0x9E3779B97F4A7C15ULL;
+        return hash;
+    };
+    auto isMatch = [&](bool atStart) -> bool
+    {
+        ending = current;
+        nfa.closure(&ending[0], atStart, true, stack);
+        return (ending[nfa.match/64] & (1ULL << nfa.match%64)) != 0;
+    };
+
+    // Unless the pattern is anchored, a match can start after any number of characters, so the start state is active
+    // after each of them; the matcher's own judgement of that is used, as it only ever tries the first start position
+    // of an anchored pattern
+    matches.clear();
+    current[nfa.start/64] |= 1ULL << nfa.start%64;
+    nfa.closure(&current[0], true, false, stack);
+    matches.push_back(isMatch(true));
+
+    for (Uint64 n=1;; n++)
+    {
+        if (n > maxSteps)
+            return "a period too long to find";
+        std::fill(next.begin(), next.end(), 0);
+        for (Uint i=0; i<numStates; i++)
+        {
+            if (!(current[i/64] & (1ULL << i%64)))
+                continue;
+            if (nfa.states[i].type == UnaryNFA::State_Character)
+                next[nfa.states[i].out1/64] |= 1ULL << nfa.states[i].out1%64;
+            else
+            if (nfa.states[i].type == UnaryNFA::State_Match)
+                next[i/64] |= 1ULL << i%64;
+        }
+        if (!nfa.anchored)
+            next[nfa.start/64] |= 1ULL << nfa.start%64;
+        nfa.closure(&next[0], false, false, stack);
+        current.swap(next);
+
+        Uint mask = (Uint)table.size() - 1;
+        Uint slot = (Uint)(hashOf(&current[0]) >> 32) & mask;
+        for (; table[slot] != UINT_MAX; slot = (slot + 1) & mask)
+        {
+            Uint64 earlier = table[slot];
+            if (std::equal(current.begin(), current.end(), history.begin() + (size_t)(earlier * numWords)))
+            {
+                threshold = earlier + 1;
+                period = n - threshold;
+                return NULL;
+            }
+        }
+        matches.push_back(isMatch(false));
+        table[slot] = (Uint)(n - 1);
+        history.insert(history.end(), current.begin(), current.end());
+        if (++numInTable * 2 > table.size())
+        {
+            std::fill(table.begin(), table.end(), UINT_MAX);
+            table.resize(table.size() * 2, UINT_MAX);
+            mask = (Uint)table.size() - 1;
+            for (Uint k=0; k<numInTable; k++)
+            {
+                Uint rehashSlot = (Uint)(hashOf(&history[(size_t)k * numWords]) >> 32) & mask;
+                while (table[rehashSlot] != UINT_MAX)
+                    rehashSlot = (rehashSlot + 1) & mask;
+                table[rehashSlot] = k;
+            }
+        }
+    }
+}
@@ -0,0 +1,41 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include <vector>
+
+// The numbers matched in numerical mode by a pattern that has no backreferences or lookarounds, which (as for any
+// regular language over a one-letter alphabet) are the same from some threshold onward in every period. They are found
+// by running the pattern as an NFA over successive characters until its set of active states repeats, after which
+// whether any number matches can be looked up directly. Nothing is known about what the match would have returned.
+class PeriodicMatchSet
+{
+    Uint64 threshold, period;
+    std::vector<bool> matches; // whether each number below threshold + period matches
+public:
+    PeriodicMatchSet() : threshold(0), period(0)
+    {
+    }
+    // Must be called before the pattern is prepared for matching, which rewrites its tree. Returns NULL on success, or
+    // else what isn't supported, which includes a pattern too large, or with too long a period, to be worth running.
+    const char *Compute(RegexGroupRoot &regex, char basicChar);
+    bool Contains(Uint64 n) const
+    {
+        return n < matches.size() ? matches[(size_t)n] : matches[(size_t)(threshold + (n - threshold) % period)];
+    }
+    Uint64 Threshold() const
+    {
+        return threshold;
+    }
+    Uint64 Period() const
+    {
+        return period;
+    }
+};
@@ -11,10 +11,24 @@
 
 #include <stdio.h>
 #include <math.h>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <mutex>
 
 #include "regex.h"
 #include "parser.h"
+#include "runs.h"
 #include "matcher.h"
+#include "parallel.h"
+#include "sweep.h"
+#include "cache.h"
+#include "bytecode.h"
+#include "count.h"
+#include "codegen.h"
+#include "image.h"
+#include "server.h"
+#include "periodic.h"
 
 class Regex
 {
@@ -22,43 +36,496 @@ class Regex
     Uint numCaptureGroups;
     Uint maxGroupDepth;
     Uint maxLookintoDepth;
+    ResultCache *resultCache;
+    RegexBytecode *bytecode;
+    BytecodeBenchmark *bytecodeBenchmark;
+    RegexBytecode *countingBytecode;
+    Uint countingThreads;
+    PeriodicMatchSet *periodicMatches;
+    bool periodicMatchesDecideMatches; // whether a match can be reported without running the matcher for what it returns
+    bool sweepPrepared;
+    Uint64 sweepInput; // the number last matched by MatchNextNumber, whose result follows
+    bool sweepMatched;
+    Uint64 sweepReturnMatch;
+    Uint64 countPossibleMatchesInParallel(Uint64 input, char basicChar);
+    bool matchNumberWithTree(Uint64 input, char basicChar, Uint returnMatch_backrefIndex, Uint64 &returnMatch, Uint64 *possibleMatchesCount_ptr, bool onlyAtStart = false);
+    bool matchNumberPeriodically(Uint64 input, bool &matched, Uint64 &returnMatch); // returns false if the matcher must be run
 public:
-    Regex(const char *buf);
+    Regex(const char *buf, RegexImage *image = NULL); // with an image, its tree is used instead of parsing buf if possible; the image must outlive the Regex
+    ~Regex();
+    int SaveImage(const char *filename, const char *pattern);
+    void SetResultCache(ResultCache *cache); // the cache must only ever be used with one basicChar and returnMatch_backrefIndex
+    void SetReturnMatchBackref(Uint returnMatch_backrefIndex); // must be called before the pattern is prepared for matching
+    void SetCountingThreads(Uint numThreads); // how many threads MatchNumber uses to count the possible matches of each number
+    const char *UseBytecode(char basicChar, BytecodeBenchmark *benchmark); // returns NULL on success, or else what the bytecode compiler doesn't support
+    const char *EmitCpp(char basicChar, FILE *f, const char *pattern); // likewise
+    const char *UseCountingEngine(char basicChar); // likewise
+    const char *UsePeriodicMatchSet(char basicChar, bool returnMatchUnused); // likewise; must be called before anything else prepares the pattern
+    void PrepareNumber(char basicChar);
+    void PrepareString();
     bool MatchNumber(Uint64 input, char basicChar, Uint returnMatch_backrefIndex, Uint64 &returnMatch, Uint64 *possibleMatchesCount_ptr);
-    bool MatchString(const char *stringToMatchAgainst, Uint returnMatch_backrefIndex, const char *&returnMatch, size_t &returnMatchLength, Uint64 *possibleMatchesCount_ptr);
+    bool MatchNextNumber(Uint64 input, char basicChar, Uint returnMatch_backrefIndex, Uint64 &returnMatch); // for ascending sweeps, on one thread
+    void CountNumber(Uint64 input, char basicChar, BigCount &possibleMatchesCount);
+    bool MatchString(const char *stringToMatchAgainst, Uint returnMatch_backrefIndex, const char *&returnMatch, size_t &returnMatchLength, Uint64 *possibleMatchesCount_ptr, const SubjectRuns *subjectRuns); // subjectRuns, if given, must be those of stringToMatchAgainst
 };
 
-Regex::Regex(const char *buf)
+Regex::Regex(const char *buf, RegexImage *image)
 {
     regex.type = RegexGroup_NonCapturing;
     regex.minCount = 1;
     regex.maxCount = 1;
     regex.lazy = 0;
     regex.possessive = 0;
+    regex.returnMatch_backrefIndex = 0;
 
-    RegexParser parser(regex, buf);
-    numCaptureGroups = parser.backrefIndex;
-    maxGroupDepth    = parser.maxGroupDepth;
-    maxLookintoDepth = parser.maxLookintoDepth;
+    const char *imageUnusable = image ? image->load(regex, numCaptureGroups, maxGroupDepth, maxLookintoDepth) : NULL;
+    if (imageUnusable)
+        fprintf(stderr, "Warning: %s; parsing the pattern it holds instead\n", imageUnusable);
+    if (!image || imageUnusable)
+    {
+        RegexParser parser(regex, buf);
+        numCaptureGroups = parser.backrefIndex;
+        maxGroupDepth    = parser.maxGroupDepth;
+        maxLookintoDepth = parser.maxLookintoDepth;
+    }
+    resultCache      = NULL;
+    bytecode         = NULL;
+    bytecodeBenchmark = NULL;
+    countingBytecode = NULL;
+    countingThreads  = 1;
+    periodicMatches  = NULL;
+    periodicMatchesDecideMatches = false;
+    sweepPrepared    = false;
+    sweepInput       = 0;
+    sweepMatched     = false;
+    sweepReturnMatch = 0;
 }
 
-bool Regex::MatchNumber(Uint64 input, char basicChar, Uint returnMatch_backrefIndex, Uint64 &returnMatch, Uint64 *possibleMatchesCount_ptr=NULL)
+Regex::~Regex()
+{
+    delete bytecode;
+    delete countingBytecode;
+    delete periodicMatches;
+}
+
+// Must be called before the pattern is prepared for matching, which rewrites its tree
+int Regex::SaveImage(const char *filename, const char *pattern)
+{
+    return RegexImage::save(filename, regex, pattern, numCaptureGroups, maxGroupDepth, maxLookintoDepth);
+}
+
+void Regex::SetResultCache(ResultCache *cache)
+{
+    resultCache = cache;
+}
+
+// Preparing the pattern matches the groups whose captures nothing in it reads as non-capturing groups, except for the
+// one given here; a match asked to return any other such capture returns it as not having participated
+void Regex::SetReturnMatchBackref(Uint returnMatch_backrefIndex)
+{
+    regex.returnMatch_backrefIndex = returnMatch_backrefIndex;
+}
+
+void Regex::SetCountingThreads(Uint numThreads)
+{
+    countingThreads = numThreads;
+}
+
+// Matching virtualizes the symbol tree on first use. Doing that up front means that any number of threads can then
+// match against this Regex concurrently, since from then on each match only reads the tree.
+void Regex::PrepareNumber(char basicChar)
+{
+    RegexMatcher<false> match;
+    match.basicChar = basicChar;
+    match.Prepare(regex, maxGroupDepth);
+}
+
+void Regex::PrepareString()
+{
+    RegexMatcher<true> match;
+    match.Prepare(regex, maxGroupDepth);
+}
+
+// Compiles the pattern, as prepared for numerical mode, to bytecode to be used by MatchNumber from then on, except for
+// counting possible matches. With a benchmark, every number is matched by both the tree walker and the bytecode
+// interpreter, and the tree walker's result is the one returned.
+const char *Regex::UseBytecode(char basicChar, BytecodeBenchmark *benchmark)
+{
+    PrepareNumber(basicChar);
+    RegexBytecode *compiled = new RegexBytecode;
+    if (const char *unsupported = compiled->Compile(regex, numCaptureGroups, basicChar))
+    {
+        delete compiled;
+        return unsupported;
+    }
+    if (debugTrace)
+        compiled->fprintProgram(stderr);
+    delete bytecode;
+    bytecode = compiled;
+    bytecodeBenchmark = benchmark;
+    return NULL;
+}
+
+// Writes a standalone C++ program that matches numbers against this pattern alone, generated from its bytecode
+const char *Regex::EmitCpp(char basicChar, FILE *f, const char *pattern)
+{
+    PrepareNumber(basicChar);
+    RegexBytecode compiled;
+    if (const char *unsupported = compiled.Compile(regex, numCaptureGroups, basicChar))
+        return unsupported;
+    compiled.EmitCpp(f, pattern);
+    return NULL;
+}
+
+// Compiles the pattern to bytecode for CountNumber, which then counts each number's possible matches by summing them
+// over the states of the bytecode interpreter (see count.cpp) rather than by enumerating them with the tree walker
+const char *Regex::UseCountingEngine(char basicChar)
+{
+    PrepareNumber(basicChar);
+    RegexBytecode *compiled = new RegexBytecode;
+    if (const char *unsupported = compiled->Compile(regex, numCaptureGroups, basicChar))
+    {
+        delete compiled;
+        return unsupported;
+    }
+    delete countingBytecode;
+    countingBytecode = compiled;
+    return NULL;
+}
+
+// Finds which numbers the pattern matches, once and for all, for MatchNumber to look up instead of matching them. Unless
+// what a match returns is unused, only non-matches can be answered this way; matches are still run to find it.
+const char *Regex::UsePeriodicMatchSet(char basicChar, bool returnMatchUnused)
+{
+    PeriodicMatchSet *computed = new PeriodicMatchSet;
+    if (const char *unsupported = computed->Compute(regex, basicChar))
+    {
+        delete computed;
+        return unsupported;
+    }
+    if (debugTrace)
+        fprintf(stderr, "The numbers matched repeat with period %llu from %llu onward\n\n", computed->Period(), computed->Threshold());
+    delete periodicMatches;
+    periodicMatches = computed;
+    periodicMatchesDecideMatches = returnMatchUnused;
+    return NULL;
+}
+
+bool Regex::matchNumberPeriodically(Uint64 input, bool &matched, Uint64 &returnMatch)
+{
+    if (!periodicMatches)
+        return false;
+    matched = periodicMatches->Contains(input);
+    returnMatch = 0;
+    return !matched || periodicMatchesDecideMatches;
+}
+
+bool Regex::matchNumberWithTree(Uint64 input, char basicChar, Uint returnMatch_backrefIndex, Uint64 &returnMatch, Uint64 *possibleMatchesCount_ptr, bool onlyAtStart)
 {
     RegexMatcher<false> match;
     match.basicChar = basicChar;
     Uint64 returnMatchOffset;
+    if (onlyAtStart)
+        return match.MatchAtStart(regex, numCaptureGroups, maxGroupDepth, maxLookintoDepth, input, returnMatch_backrefIndex, returnMatchOffset, returnMatch);
     return match.Match(regex, numCaptureGroups, maxGroupDepth, maxLookintoDepth, input, returnMatch_backrefIndex, returnMatchOffset, returnMatch, possibleMatchesCount_ptr);
 }
 
-bool Regex::MatchString(const char *stringToMatchAgainst, Uint returnMatch_backrefIndex, const char *&returnMatch, size_t &returnMatchLength, Uint64 *possibleMatchesCount_ptr=NULL)
+// Counting every possible match backtracks through the whole search tree, but its parts that start at different
+// positions, or take different alternatives of the root group, never share any state, so each of them is counted on
+// its own by whichever thread is free. Backtracking verbs can cut across those parts, so they rule this out.
+Uint64 Regex::countPossibleMatchesInParallel(Uint64 input, char basicChar)
+{
+    PrepareNumber(basicChar);
+    Uint numRootAlternatives = 0;
+    while (regex.alternatives[numRootAlternatives])
+        numRootAlternatives++;
+    Uint64 numStartPositions = regex.anchored ? 1 : input + 1;
+
+    RegexMatcher<false> *matchers = new RegexMatcher<false> [countingThreads];
+    std::atomic<Uint64> possibleMatchesCount(0);
+    runTasks(countingThreads, numStartPositions * numRootAlternatives, [&](Uint64 task, Uint worker)
+    {
+        RegexMatcher<false> &match = matchers[worker];
+        match.basicChar = basicChar;
+        possibleMatchesCount += match.CountPossibleMatches(regex, numCaptureGroups, maxGroupDepth, maxLookintoDepth, input,
+                                                           task / numRootAlternatives, numRootAlternatives == 1 ? UINT_MAX : (Uint)(task % numRootAlternatives));
+    });
+    delete [] matchers;
+    return possibleMatchesCount;
+}
+
+bool Regex::MatchNumber(Uint64 input, char basicChar, Uint returnMatch_backrefIndex, Uint64 &returnMatch, Uint64 *possibleMatchesCount_ptr=NULL)
+{
+    bool matched;
+    if (!possibleMatchesCount_ptr && matchNumberPeriodically(input, matched, returnMatch))
+        return matched;
+    if (resultCache && !possibleMatchesCount_ptr && resultCache->lookup(input, matched, returnMatch))
+        return matched;
+    if (possibleMatchesCount_ptr && countingThreads > 1 && !enable_verbs && input < UINT_MAX) // counting every match of anything larger would never finish anyway
+    {
+        *possibleMatchesCount_ptr = countPossibleMatchesInParallel(input, basicChar);
+        returnMatch = 0;
+        return false; // as with a single thread, since every match is turned into a non-match to keep counting
+    }
+    if (!bytecode || possibleMatchesCount_ptr)
+        matched = matchNumberWithTree(input, basicChar, returnMatch_backrefIndex, returnMatch, possibleMatchesCount_ptr);
+    else
+    if (!bytecodeBenchmark)
+        matched = bytecode->Match(input, returnMatch_backrefIndex, returnMatch);
+    else
+    {
+        typedef std::chrono::steady_clock Clock;
+        Uint64 bytecodeReturnMatch;
+        Clock::time_point time0 = Clock::now();
+        matched = matchNumberWithTree(input, basicChar, returnMatch_backrefIndex, returnMatch, NULL);
+        Clock::time_point time1 = Clock::now();
+        bool bytecodeMatched = bytecode->Match(input, returnMatch_backrefIndex, bytecodeReturnMatch);
+        Clock::time_point time2 = Clock::now();
+        bytecodeBenchmark->record(input, matched, returnMatch, std::chrono::duration<double>(time1 - time0).count(),
+                                  bytecodeMatched, bytecodeReturnMatch, std::chrono::duration<double>(time2 - time1).count());
+    }
+    if (resultCache && !possibleMatchesCount_ptr)
+        resultCache->store(input, matched, returnMatch);
+    return matched;
+}
+
+// If nothing in the pattern can tell where its match started, a match of N starting at P is the same as a match of N-P
+// starting at 0, so the first match of N+1 is either the one starting at 0, or else the first match of N, moved along
+// by one. Each number of an ascending sweep can then be answered by trying only one start position, as long as the
+// number before it was the last one answered.
+bool Regex::MatchNextNumber(Uint64 input, char basicChar, Uint returnMatch_backrefIndex, Uint64 &returnMatch)
+{
+    if (!sweepPrepared)
+    {
+        PrepareNumber(basicChar);
+        sweepPrepared = true;
+    }
+    else
+    if (regex.startPositionIndependent && !bytecodeBenchmark && input != 0 && input - 1 == sweepInput)
+    {
+        bool matched;
+        if (!matchNumberPeriodically(input, matched, returnMatch) && (!resultCache || !resultCache->lookup(input, matched, returnMatch)))
+        {
+            if (bytecode)
+                matched = bytecode->Match(input, returnMatch_backrefIndex, returnMatch, true);
+            else
+                matched = matchNumberWithTree(input, basicChar, returnMatch_backrefIndex, returnMatch, NULL, true);
+            if (!matched)
+            {
+                matched     = sweepMatched;
+                returnMatch = sweepReturnMatch;
+            }
+            if (resultCache)
+                resultCache->store(input, matched, returnMatch);
+        }
+        sweepInput       = input;
+        sweepMatched     = matched;
+        sweepReturnMatch = returnMatch;
+        return matched;
+    }
+    sweepInput       = input;
+    sweepMatched     = MatchNumber(input, basicChar, returnMatch_backrefIndex, returnMatch);
+    sweepReturnMatch = returnMatch;
+    return sweepMatched;
+}
+
+// Falls back to enumerating the possible matches wherever the counting engine can't count them
+void Regex::CountNumber(Uint64 input, char basicChar, BigCount &possibleMatchesCount)
+{
+    if (countingBytecode && countingBytecode->CountMatches(input, possibleMatchesCount))
+        return;
+    Uint64 returnMatch, enumeratedCount;
+    MatchNumber(input, basicChar, 0, returnMatch, &enumeratedCount);
+    possibleMatchesCount = enumeratedCount;
+}
+
+// Compiled patterns kept for reuse, so that a repeated request for a pattern with the same options gets the Regex that
+// was compiled for the first one, without parsing it again. Each Regex is prepared for the mode it was first requested
+// in (the basicChar of numerical mode, or '\0' for string mode) before it is handed out, so it can be shared by threads.
+// Those for numerical mode can also be made ready to count possible matches as "-X" does, with its counting engine and
+// the given number of threads for what has to be enumerated.
+class CompiledPatternCache
+{
+    std::mutex mutex;
+    std::unordered_map<std::string, Regex*> patterns; // keyed by the pattern's text followed by the options in effect
+    bool useCountingEngine;
+    Uint countingThreads;
+public:
+    CompiledPatternCache(bool useCountingEngine = false, Uint countingThreads = 1) : useCountingEngine(useCountingEngine), countingThreads(countingThreads)
+    {
+    }
+    ~CompiledPatternCache()
+    {
+        for (auto &entry : patterns)
+            delete entry.second;
+    }
+    Regex &get(const char *pattern, char basicChar, Uint returnMatch_backrefIndex); // throws RegexParsingError, pointing into the given pattern
+};
+
+Regex &CompiledPatternCache::get(const char *pattern, char basicChar, Uint returnMatch_backrefIndex)
+{
+    std::string key(pattern);
+    Uint32 options[] = { parsingOptions(), emulate_ECMA_NPCGs, optimizationLevel, (Uint8)basicChar, returnMatch_backrefIndex };
+    key.append(1, '\0').append((const char*)options, sizeof(options));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto inserted = patterns.emplace(key, (Regex*)NULL);
+    if (!inserted.second)
+        return *inserted.first->second;
+    const char *storedPattern = inserted.first->first.c_str(); // the Regex points into its pattern, so it parses this copy
+    try
+    {
+        Regex *regex = new Regex(storedPattern);
+        regex->SetReturnMatchBackref(returnMatch_backrefIndex);
+        if (basicChar)
+        {
+            regex->PrepareNumber(basicChar);
+            if (useCountingEngine)
+                regex->UseCountingEngine(basicChar); // if it can't be used, every count is made by enumeration
+            regex->SetCountingThreads(countingThreads);
+        }
+        else
+            regex->PrepareString();
+        inserted.first->second = regex;
+        return *regex;
+    }
+    catch (RegexParsingError err)
+    {
+        const char *errorPosition = pattern + (err.buf - storedPattern);
+        patterns.erase(inserted.first);
+        throw RegexParsingError(errorPosition, err.msg);
+    }
+}
+
+// "--compile-benchmark": times the parsing, and preparation for numerical mode, of synthetic patterns of the size and
+// shape that programs generating patterns tend to produce (a long list of alternatives, a long run of quantified
+// groups and backrefs, and deep nesting), and reports the throughput of each in megabytes of pattern per second,
+// along with how long a repeated request for the same pattern takes to be answered by a CompiledPatternCache.
+static int benchmarkCompilation()
+{
+    const size_t PATTERN_SIZE = 1 << 20;
+    const int REPETITIONS = 3;
+    char piece[64];
+    std::string patterns[3];
+    const char *const patternNames[3] = {"alternation", "sequence", "nesting"};
+
+    patterns[0] = "^(?:";
+    for (Uint i=1, group=1; patterns[0].size() < PATTERN_SIZE; i++)
+    {
+        if (i % 3)
+            sprintf(piece, "x{%u}|", i);
+        else
+            sprintf(piece, "(x{%u})\\%u*|", i, group++);
+        patterns[0] += piece;
+    }
+    patterns[0] += "x)$";
+
+    patterns[1] = "^";
+    for (Uint i=1; patterns[1].size() < PATTERN_SIZE; i++)
+    {
+        sprintf(piece, "(x+?)(?=\\%u)(?:xx|\\%u)*", i, i);
+        patterns[1] += piece;
+    }
+    patterns[1] += "$";
+
+    const Uint NESTING_DEPTH = 64;
+    patterns[2] = "^";
+    while (patterns[2].size() < PATTERN_SIZE)
+    {
+        for (Uint depth=0; depth<NESTING_DEPTH; depth++)
+            patterns[2] += depth % 2 ? "(?:x" : "(x";
+        for (Uint depth=NESTING_DEPTH; depth--;)
+            patterns[2] += depth % 2 ? "|xx)*" : ")?";
+    }
+    patterns[2] += "$";
+
+    typedef std::chrono::steady_clock Clock;
+    CompiledPatternCache cache;
+    printf("%-12s %10s %24s %24s %12s\n", "pattern", "bytes", "parse", "prepare", "cached");
+    for (int p=0; p<3; p++)
+    {
+        double parseSeconds = 0, prepareSeconds = 0, cachedSeconds = 0;
+        for (int repetition=0; repetition<REPETITIONS; repetition++)
+        {
+            Clock::time_point time0 = Clock::now();
+            Regex regex(patterns[p].c_str());
+            Clock::time_point time1 = Clock::now();
+            regex.PrepareNumber('x');
+            Clock::time_point time2 = Clock::now();
+            double parse   = std::chrono::duration<double>(time1 - time0).count();
+            double prepare = std::chrono::duration<double>(time2 - time1).count();
+            if (repetition == 0 || parseSeconds   > parse  ) parseSeconds   = parse;
+            if (repetition == 0 || prepareSeconds > prepare) prepareSeconds = prepare;
+
+            cache.get(patterns[p].c_str(), 'x', 0);
+            Clock::time_point time3 = Clock::now();
+            cache.get(patterns[p].c_str(), 'x', 0);
+            double cached = std::chrono::duration<double>(Clock::now() - time3).count();
+            if (repetition == 0 || cachedSeconds > cached) cachedSeconds = cached;
+        }
+        double megabytes = patterns[p].size() / (1024. * 1024.);
+        printf("%-12s %10llu %9.2f ms (%6.1f MB/s) %9.2f ms (%6.1f MB/s) %9.2f ms\n", patternNames[p], (Uint64)patterns[p].size(),
+               parseSeconds * 1e3, megabytes / parseSeconds, prepareSeconds * 1e3, megabytes / prepareSeconds, cachedSeconds * 1e3);
+    }
+    return 0;
+}
+
+bool Regex::MatchString(const char *stringToMatchAgainst, Uint returnMatch_backrefIndex, const char *&returnMatch, size_t &returnMatchLength, Uint64 *possibleMatchesCount_ptr=NULL, const SubjectRuns *subjectRuns=NULL)
 {
     RegexMatcher<true> match;
+    match.subjectRuns = subjectRuns;
     bool result = match.Match(regex, numCaptureGroups, maxGroupDepth, maxLookintoDepth, (Uint64)stringToMatchAgainst, returnMatch_backrefIndex, (Uint64 &)returnMatch, (Uint64 &)returnMatchLength, possibleMatchesCount_ptr);
     (const char *&)returnMatch = stringToMatchAgainst + (size_t)(Uint64 &)returnMatch;
     return result;
 }
 
 
+// A run of input lines handed from the reader to a worker thread and then to the writer, along with each line's result
+struct LineBlock
+{
+    enum
+    {
+        MAX_LINES = 4096,
+        MAX_BYTES = 1<<20,
+    };
+    struct Result
+    {
+        bool matched;
+        Uint64 returnMatch; // only used in numerical mode
+        const char *returnMatchString; // only used in string mode
+        size_t returnMatchLength;
+        Uint64 possibleMatchesCount;
+    };
+    std::vector<char>   text; // each line is stored NUL-terminated
+    std::vector<size_t> lineOffsets;
+    std::vector<Result> results;
+
+    bool read(LineGetter &lineGetter, FILE *f)
+    {
+        text.clear();
+        lineOffsets.clear();
+        while (lineOffsets.size() < MAX_LINES && text.size() < MAX_BYTES)
+        {
+            const char *line = lineGetter.fgets(f);
+            if (!line)
+                break;
+            lineOffsets.push_back(text.size());
+            text.insert(text.end(), line, line + strlen(line) + 1);
+        }
+        results.resize(lineOffsets.size());
+        return !lineOffsets.empty();
+    }
+    size_t numLines()
+    {
+        return lineOffsets.size();
+    }
+    const char *line(size_t i)
+    {
+        return &text[lineOffsets[i]];
+    }
+};
+
+
 enum StringModeTest
 {
     StringModeTest_NONE,
@@ -121,7 +588,15 @@ static void printUsage(const char *argv0)
 Usage: \"%s\" [OPTION]... [PATTERN]\n\
 \n\
 Options:\n\
-  -f, --file=FILE     Read pattern from file with filename FILE\n\
+  -f, --file=FILE     Read pattern from file with filename FILE. This may also\n\
+                      be a compiled pattern file written by \"--save-compiled\",\n\
+                      in which case the pattern is not parsed again.\n\
+  --save-compiled=FILE\n\
+                      Parse the pattern and write it to FILE in compiled form,\n\
+                      to be loaded quickly by \"-f\" later, and then exit. The\n\
+                      compiled form can only be used by the same build of this\n\
+                      program with the same extensions and parsing options;\n\
+                      otherwise the pattern it holds is parsed again.\n\
   --line-buffered     Flush output after each line is printed\n\
   -n, --num=CHAR      Enable numerical mode, which operates on numbers instead\n\
                       of strings; abstractly, a number N represents a string of\n\
@@ -173,6 +648,12 @@ Options:\n\
                       is equivalent to:\n\
                       --npcg- --ecc- --neo- -x ag,pq,cnd,rs,pbr\n\
   -o                  Show only the part of the line that matched\n\
+  --rle-input         In string mode, read each line run-length encoded, with a\n\
+                      character followed by {N} standing for N of it, e.g.\n\
+                      \"x{1000000},x{999}\" (\"{{1}\" is a literal \"{\"). The\n\
+                      matcher checks repetitions a run at a time, so the time\n\
+                      taken by unary inputs hardly depends on their size. Parts\n\
+                      shown by \"-o\" are written in the same form.\n\
   -v, --invert-match  Show non-matching inputs instead of matching inputs\n\
   -q [NUM0[..NUM1]]   Show the NUM0th..NUM1th (zero-indexed) number(s) that are\n\
                       a match. Implies \"--num=x\" if \"--num\" was not specified.\n\
@@ -183,7 +664,14 @@ Options:\n\
                       with \"--invert-match\". If NUM is not specified, it will be\n\
                       read from standard input.\n\
   -X                  Exhaustive mode; counts the number of possible matches,\n\
-                      without reporting what the actual matches are.\n\
+                      without reporting what the actual matches are. In\n\
+                      numerical mode, patterns without lookaheads are counted\n\
+                      without enumerating each match, by summing the matches\n\
+                      that can follow each state the matcher can be in.\n\
+  --count-by-enumeration\n\
+                      Count the possible matches for \"-X\" by backtracking\n\
+                      into every one of them, as is otherwise done only for\n\
+                      what can't be counted by summing them.\n\
   -O NUMBER           Specifies the optimization level, from 0 to 2. This\n\
                       controls whether optimizations are enabled which skip\n\
                       unnecessary backtracking. The default is the maximum, 2.\n\
@@ -203,6 +691,89 @@ Options:\n\
   --verbose           Print both matches and non-matches along with the input\n\
                       number. Currently works only in numerical mode when\n\
                       taking input from standard input.\n\
+  --threads=NUM       Match lines read from standard input on NUM worker\n\
+                      threads. Output is identical to, and in the same order\n\
+                      as, that of the default single-threaded mode. Does not\n\
+                      apply to \"-q\" or \"-Q\" queries. With \"-X\" in\n\
+                      numerical mode, the possible matches of each number,\n\
+                      whether from standard input or \"-t\", are instead\n\
+                      counted by NUM threads together, unless backtracking\n\
+                      verbs are enabled.\n\
+  --shard=I/N         Test only the I-th of N interleaved portions of the range\n\
+                      given by \"-t\", or of a numerical mode \"--test=\", and\n\
+                      write its results to standard output (or to the file\n\
+                      given by \"--shard-file=FILE\") in a form that can be\n\
+                      combined by \"--merge-shards\".\n\
+  --shard-block=SIZE  Size of the blocks of numbers that are dealt out to the\n\
+                      shards in turn. All shards of a sweep must use the same\n\
+                      size. The default is 65536.\n\
+  --merge-shards FILE...\n\
+                      Combine the files written by all N shards of a sweep,\n\
+                      printing exactly what the sweep would have printed if run\n\
+                      in a single process. Must be the last option. If some of\n\
+                      the shards haven't finished, merges as far as all of them\n\
+                      have gotten.\n\
+  --compile-benchmark Report how quickly synthetic patterns of 1 MB each, of a\n\
+                      few shapes typical of machine-generated patterns, are\n\
+                      parsed and prepared for matching.\n\
+  --serve=SOCKET      Run as a daemon, answering numerical mode requests from\n\
+                      local clients over the Unix domain socket SOCKET until\n\
+                      killed. Each pattern is compiled on its first request and\n\
+                      kept for later ones; requests are split into batches run\n\
+                      by \"--threads\" workers. No pattern may be given, and the\n\
+                      extensions and options of this command line apply to\n\
+                      every pattern the clients send. Counting requests are\n\
+                      answered as \"-X\" would answer them.\n\
+  --serve-load=SOCKET Send the numbers of the range given by \"-t\", and the\n\
+                      pattern, to the daemon listening on SOCKET as fast as it\n\
+                      answers, over \"--threads\" connections; report the\n\
+                      throughput and latency, and the daemon's statistics.\n\
+                      Requires numerical mode, and may be combined with \"-oN\"\n\
+                      or \"-X\".\n\
+  --batch=N           How many numbers \"--serve-load\" sends in each request.\n\
+                      The default is 1000.\n\
+  --checkpoint=FILE   While sweeping through the range given by \"-t\", or\n\
+                      running a numerical mode \"--test=\", periodically record\n\
+                      how far the sweep has gotten in FILE.\n\
+  --resume            Continue the sweep from where FILE shows it stopped,\n\
+                      first cutting its output back to what it was at that\n\
+                      point. The output must be appended to (\">>\") rather\n\
+                      than overwritten. If FILE doesn't exist yet, the sweep\n\
+                      starts from the beginning. Must be combined with\n\
+                      \"--checkpoint=FILE\" and otherwise the same options.\n\
+  --progress          Report the rate at which numbers are being tested, and\n\
+                      how far the sweep has gotten, to standard error.\n\
+  --interval=SECONDS  How often to write checkpoints and progress reports. The\n\
+                      default is 10 seconds.\n\
+  --index=FILE        When \"-q\" or \"-Q\" read their queries from standard\n\
+                      input, load the matches already found by earlier runs\n\
+                      from FILE, and save them back to it when done, so that\n\
+                      those runs' work need not be repeated.\n\
+  --cache=ENTRIES     When matching numbers read from standard input (including\n\
+                      \"-q\" and \"-Q\" queries), remember the results for up to\n\
+                      ENTRIES of the most recently used numbers.\n\
+  --cache-file=FILE   Also keep match results in FILE, which is mapped into\n\
+                      memory, so that they are shared with other runs using the\n\
+                      same pattern and options.\n\
+  --cache-stats       Report the hit rate of the cache to standard error.\n\
+  --stack-stats       Report how many steps matching took, and how much of the\n\
+                      backtracking stack it used, to standard error.\n\
+  --bytecode          In numerical mode, compile the pattern to bytecode and\n\
+                      match with a bytecode interpreter instead of walking the\n\
+                      pattern's tree. Patterns using features that the\n\
+                      interpreter doesn't support are still matched by walking\n\
+                      the tree, with a warning.\n\
+  --bytecode-benchmark\n\
+                      Like \"--bytecode\", but match every number both ways,\n\
+                      and report the time taken by each, and any difference in\n\
+                      their results, to standard error.\n\
+  --emit-cpp=FILE     Write FILE, a standalone C++ program that matches numbers\n\
+                      against the pattern alone (in numerical mode), with each\n\
+                      of its bytecode instructions written out as code. See the\n\
+                      comment at the top of FILE for how to build and run it.\n\
+  --check-cpp=PROGRAM Run a program built from \"--emit-cpp\" over the range\n\
+                      given by \"-t\", and report any numbers on which it\n\
+                      disagrees with this one, and the time each took.\n\
 ", argv0);
 }
 
@@ -266,7 +837,7 @@ Numerical mode (unary) tests:\n\
 ");
 }
 
-static int loadPatternFile(char *&buf, const char *filename)
+static int loadPatternFile(char *&buf, const char *filename, RegexImage &image)
 {
     FILE *f = fopen(filename, "rb");
     if (!f)
@@ -274,6 +845,14 @@ static int loadPatternFile(char *&buf, const char *filename)
         fprintf(stderr, "Error opening pattern file \"%s\"\n", filename);
         return -1;
     }
+    if (RegexImage::isImage(f))
+    {
+        fclose(f);
+        if (image.open(filename))
+            return -1;
+        buf = image.getPattern();
+        return 0;
+    }
     setvbuf(f, NULL, _IONBF, 0);
     fseek(f, 0, SEEK_END);
     size_t size = ftell(f);
@@ -295,6 +874,14 @@ static void errorMoreThanOnePattern(const char *argv0)
     printShortUsage(argv0);
 }
 
+// FNV-1a
+static Uint64 hashString(Uint64 hash, const char *s)
+{
+    for (; *s; s++)
+        hash = (hash ^ (Uchar)*s) * 0x100000001B3uLL;
+    return hash;
+}
+
 static Uint64 largestPrimeFactor(Uint64 n)
 {
     for (Uint64 k=n/2; k>1;)
@@ -310,10 +897,64 @@ static Uint64 largestPrimeFactor(Uint64 n)
     return n;
 }
 
+// Advances n to the next member of the sequence that a numerical mode test expects to match, or returns false if
+// there is no member at or after n that fits in 64 bits.
+static bool nextNumericalModeTestMember(NumericalModeTest test, Uint64 &n)
+{
+    switch (test)
+    {
+    case NumericalModeTest_NUMBERS_FIBONACCI:
+        {
+            Uint64 a=0, b=1;
+            while (a < n)
+            {
+                if (a == 12200160415121876738uLL)
+                    return false;
+                Uint64 c = a + b;
+                a = b;
+                b = c;
+            }
+            n = a;
+            return true;
+        }
+    case NumericalModeTest_NUMBERS_POWER_OF_2:
+        {
+            Uint64 a=1;
+            while (a < n)
+            {
+                if (a + a == 0)
+                    return false;
+                a += a;
+            }
+            n = a;
+            return true;
+        }
+    case NumericalModeTest_NUMBERS_TRIANGULAR:
+        {
+            // start just below the m for which T(m) ~= n, then step up to it exactly
+            Uint64 m = (Uint64)((sqrt(8. * n + 1) - 1) / 2);
+            m = m > 2 ? m - 2 : 0;
+            Uint64 t = m % 2 == 0 ? m / 2 * (m + 1) : (m + 1) / 2 * m;
+            while (t < n)
+            {
+                m++;
+                if (t + m < t)
+                    return false;
+                t += m;
+            }
+            n = t;
+            return true;
+        }
+    default:
+        return true;
+    }
+}
+
 int main(int argc, char *argv[])
 {
     // crudely implemented getopt-command-line interface; probably replace it with getopt later
     char *buf = NULL;
+    RegexImage patternImage; // if the pattern was loaded from a compiled pattern file
     char mathMode = '\0'; // if nonzero, enables math mode and specifies what character to use
     StringModeTest stringModeTest = StringModeTest_NONE;
     NumericalModeTest numericalModeTest = NumericalModeTest_NONE;
@@ -322,13 +963,33 @@ int main(int argc, char *argv[])
     bool lineBuffered = false;
     bool showMatch = false;
     bool invertMatch = false;
+    bool rleInput = false;
     bool showSequenceNth = false;
     bool showSequenceUpTo = false;
     bool countPossibleMatches = false;
+    bool countByEnumeration = false;
     bool optionsDone = false;
     Uint showMatch_backrefIndex = 0;
+    Uint numThreads = 1;
+    SweepOptions sweepOptions;
+    SweepShard &shard = sweepOptions.shard;
+    int mergeShardsArg = 0;
+    const char *indexFilename = NULL;
+    size_t resultCacheCapacity = 0;
+    const char *resultCacheFilename = NULL;
+    bool showResultCacheStatistics = false;
+    bool showStackStatistics = false;
+    bool useBytecode = false;
+    bool benchmarkBytecode = false;
+    bool benchmarkCompiling = false;
+    const char *emitCppFilename = NULL;
+    const char *checkCppProgram = NULL;
+    const char *saveCompiledFilename = NULL;
+    const char *serveSocketPath = NULL;
+    const char *serveLoadSocketPath = NULL;
+    Uint serveLoadBatchSize = 1000;
     Uint64 testNum0, testNum1; Uint testNum_digits; int64 testNumInc = 0;
-    Uint64  seqNum0,  seqNum1; Uint  seqNum_digits; int64  seqNumInc = 0;
+    Uint64  seqNum0 = 0,  seqNum1 = 0; Uint  seqNum_digits = 0; int64  seqNumInc = 0;
     auto setFullTestRange = [&]()
     {
         testNum0 = 0;
@@ -407,7 +1068,7 @@ int main(int argc, char *argv[])
                         errorMoreThanOnePattern(argv[0]);
                         return -1;
                     }
-                    if (int result = loadPatternFile(buf, argv[i] + 2 + strlength("file=")))
+                    if (int result = loadPatternFile(buf, argv[i] + 2 + strlength("file="), patternImage))
                         return result;
                 }
                 else
@@ -424,6 +1085,9 @@ int main(int argc, char *argv[])
                 if (strcmp(&argv[i][2], "invert-match")==0)
                     invertMatch = true;
                 else
+                if (strcmp(&argv[i][2], "rle-input")==0)
+                    rleInput = true;
+                else
                 if (strncmp(&argv[i][2], "num=", strlength("num="))==0)
                 {
                     if (mathMode)
@@ -536,14 +1200,224 @@ int main(int argc, char *argv[])
                     else if (strcmp(&argv[i][2+strlength("test=")], "div-sqrt2-any"    )==0) numericalModeTest = NumericalModeTest_DIV_SQRT2_any;
                     else
                     {
-                        fprintf(stderr, "Error: Unrecognized test \"%s\"\n", &argv[i][2+strlength("test=")]);
+                        fprintf(stderr, "Error: Unrecognized test \"%s\"\n", &argv[i][2+strlength("test=")]);
+                        return -1;
+                    }
+                }
+                else
+                if (strcmp(&argv[i][2], "test-false+")==0)
+                {
+                    testForFalsePositives = true;
+                }
+                else
+                if (strncmp(&argv[i][2], "threads=", strlength("threads="))==0)
+                {
+                    try
+                    {
+                        const char *optStr = &argv[i][2 + strlength("threads=")];
+                        if (!inrange(*optStr, '0', '9'))
+                            throw ParsingError();
+                        numThreads = readNumericConstant<Uint>(optStr);
+                        if (numThreads == 0 || *optStr)
+                            throw ParsingError();
+                    }
+                    catch (ParsingError)
+                    {
+                        fprintf(stderr, "Error: \"--threads=\" must be followed by a positive number\n");
+                        printShortUsage(argv[0]);
+                        return -1;
+                    }
+                }
+                else
+                if (strncmp(&argv[i][2], "shard=", strlength("shard="))==0)
+                {
+                    try
+                    {
+                        const char *optStr = &argv[i][2 + strlength("shard=")];
+                        if (!inrange(*optStr, '0', '9'))
+                            throw ParsingError();
+                        Uint shardNum = readNumericConstant<Uint>(optStr);
+                        if (*optStr++ != '/' || !inrange(*optStr, '0', '9'))
+                            throw ParsingError();
+                        shard.count = readNumericConstant<Uint>(optStr);
+                        if (*optStr || shardNum == 0 || shardNum > shard.count)
+                            throw ParsingError();
+                        shard.index = shardNum - 1;
+                    }
+                    catch (ParsingError)
+                    {
+                        fprintf(stderr, "Error: \"--shard=\" must be followed by I/N, where I is from 1 to N\n");
+                        printShortUsage(argv[0]);
+                        return -1;
+                    }
+                }
+                else
+                if (strncmp(&argv[i][2], "shard-block=", strlength("shard-block="))==0)
+                {
+                    try
+                    {
+                        const char *optStr = &argv[i][2 + strlength("shard-block=")];
+                        if (!inrange(*optStr, '0', '9'))
+                            throw ParsingError();
+                        shard.blockSize = readNumericConstant<Uint64>(optStr);
+                        if (shard.blockSize == 0 || *optStr)
+                            throw ParsingError();
+                    }
+                    catch (ParsingError)
+                    {
+                        fprintf(stderr, "Error: \"--shard-block=\" must be followed by a positive number\n");
+                        printShortUsage(argv[0]);
+                        return -1;
+                    }
+                }
+                else
+                if (strncmp(&argv[i][2], "shard-file=", strlength("shard-file="))==0)
+                {
+                    sweepOptions.shardFilename = argv[i] + 2 + strlength("shard-file=");
+                }
+                else
+                if (strncmp(&argv[i][2], "checkpoint=", strlength("checkpoint="))==0)
+                {
+                    sweepOptions.checkpointFilename = argv[i] + 2 + strlength("checkpoint=");
+                }
+                else
+                if (strncmp(&argv[i][2], "index=", strlength("index="))==0)
+                {
+                    indexFilename = argv[i] + 2 + strlength("index=");
+                }
+                else
+                if (strncmp(&argv[i][2], "cache=", strlength("cache="))==0)
+                {
+                    try
+                    {
+                        const char *optStr = &argv[i][2 + strlength("cache=")];
+                        if (!inrange(*optStr, '0', '9'))
+                            throw ParsingError();
+                        resultCacheCapacity = (size_t)readNumericConstant<Uint64>(optStr);
+                        if (resultCacheCapacity == 0 || *optStr)
+                            throw ParsingError();
+                    }
+                    catch (ParsingError)
+                    {
+                        fprintf(stderr, "Error: \"--cache=\" must be followed by a positive number\n");
+                        printShortUsage(argv[0]);
+                        return -1;
+                    }
+                }
+                else
+                if (strncmp(&argv[i][2], "cache-file=", strlength("cache-file="))==0)
+                {
+                    resultCacheFilename = argv[i] + 2 + strlength("cache-file=");
+                }
+                else
+                if (strcmp(&argv[i][2], "cache-stats")==0)
+                {
+                    showResultCacheStatistics = true;
+                }
+                else
+                if (strcmp(&argv[i][2], "stack-stats")==0)
+                {
+                    showStackStatistics = true;
+                }
+                else
+                if (strcmp(&argv[i][2], "bytecode")==0)
+                {
+                    useBytecode = true;
+                }
+                else
+                if (strcmp(&argv[i][2], "count-by-enumeration")==0)
+                {
+                    countByEnumeration = true;
+                }
+                else
+                if (strcmp(&argv[i][2], "bytecode-benchmark")==0)
+                {
+                    useBytecode = true;
+                    benchmarkBytecode = true;
+                }
+                else
+                if (strncmp(&argv[i][2], "emit-cpp=", strlength("emit-cpp="))==0)
+                {
+                    emitCppFilename = argv[i] + 2 + strlength("emit-cpp=");
+                }
+                else
+                if (strncmp(&argv[i][2], "check-cpp=", strlength("check-cpp="))==0)
+                {
+                    checkCppProgram = argv[i] + 2 + strlength("check-cpp=");
+                }
+                else
+                if (strncmp(&argv[i][2], "save-compiled=", strlength("save-compiled="))==0)
+                {
+                    saveCompiledFilename = argv[i] + 2 + strlength("save-compiled=");
+                }
+                else
+                if (strncmp(&argv[i][2], "serve=", strlength("serve="))==0)
+                {
+                    serveSocketPath = argv[i] + 2 + strlength("serve=");
+                }
+                else
+                if (strncmp(&argv[i][2], "serve-load=", strlength("serve-load="))==0)
+                {
+                    serveLoadSocketPath = argv[i] + 2 + strlength("serve-load=");
+                }
+                else
+                if (strncmp(&argv[i][2], "batch=", strlength("batch="))==0)
+                {
+                    try
+                    {
+                        const char *optStr = &argv[i][2 + strlength("batch=")];
+                        if (!inrange(*optStr, '0', '9'))
+                            throw ParsingError();
+                        serveLoadBatchSize = readNumericConstant<Uint>(optStr);
+                        if (serveLoadBatchSize == 0 || *optStr)
+                            throw ParsingError();
+                    }
+                    catch (ParsingError)
+                    {
+                        fprintf(stderr, "Error: \"--batch=\" must be followed by a positive number\n");
+                        printShortUsage(argv[0]);
+                        return -1;
+                    }
+                }
+                else
+                if (strcmp(&argv[i][2], "resume")==0)
+                {
+                    sweepOptions.resume = true;
+                }
+                else
+                if (strcmp(&argv[i][2], "progress")==0)
+                {
+                    sweepOptions.showProgress = true;
+                }
+                else
+                if (strncmp(&argv[i][2], "interval=", strlength("interval="))==0)
+                {
+                    try
+                    {
+                        const char *optStr = &argv[i][2 + strlength("interval=")];
+                        if (!inrange(*optStr, '0', '9'))
+                            throw ParsingError();
+                        sweepOptions.interval = readNumericConstant<Uint>(optStr);
+                        if (*optStr)
+                            throw ParsingError();
+                    }
+                    catch (ParsingError)
+                    {
+                        fprintf(stderr, "Error: \"--interval=\" must be followed by a number of seconds\n");
+                        printShortUsage(argv[0]);
                         return -1;
                     }
                 }
                 else
-                if (strcmp(&argv[i][2], "test-false+")==0)
+                if (strcmp(&argv[i][2], "merge-shards")==0)
                 {
-                    testForFalsePositives = true;
+                    mergeShardsArg = i + 1;
+                    break;
+                }
+                else
+                if (strcmp(&argv[i][2], "compile-benchmark")==0)
+                {
+                    benchmarkCompiling = true;
                 }
                 else
                 {
@@ -668,13 +1542,13 @@ int main(int argc, char *argv[])
                 }
                 if (argv[i][2])
                 {
-                    if (int result = loadPatternFile(buf, &argv[i][2]))
+                    if (int result = loadPatternFile(buf, &argv[i][2], patternImage))
                         return result;
                 }
                 else
                 if (++i < argc)
                 {
-                    if (int result = loadPatternFile(buf, argv[i]))
+                    if (int result = loadPatternFile(buf, argv[i], patternImage))
                         return result;
                 }
                 else
@@ -873,6 +1747,55 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (mergeShardsArg)
+        return mergeShards(argc - mergeShardsArg, argv + mergeShardsArg, lineBuffered);
+    if (benchmarkCompiling)
+        return benchmarkCompilation();
+    if (serveSocketPath)
+    {
+        if (buf || mathMode || testNumInc || serveLoadSocketPath)
+        {
+            fprintf(stderr, "Error: --serve takes its patterns and numbers from its clients, and cannot be combined with a pattern,\n"
+                            "-n, -t, or --serve-load\n");
+            printShortUsage(argv[0]);
+            return -1;
+        }
+        CompiledPatternCache patterns(!countByEnumeration, numThreads);
+        return runMatchServer(serveSocketPath, numThreads, [&](const char *pattern, char basicChar, Uint returnMatch_backrefIndex, std::string &errorMessage) -> ServedMatcher
+        {
+            try
+            {
+                Regex &regex = patterns.get(pattern, basicChar, returnMatch_backrefIndex);
+                return [&regex, basicChar](Uint64 input, Uint returnMatch_backrefIndex, Uint64 &returnMatch, BigCount *possibleMatchesCount_ptr) -> bool
+                {
+                    if (!possibleMatchesCount_ptr)
+                        return regex.MatchNumber(input, basicChar, returnMatch_backrefIndex, returnMatch, NULL);
+                    regex.CountNumber(input, basicChar, *possibleMatchesCount_ptr);
+                    returnMatch = 0;
+                    return false; // as when counting by enumeration, which turns every match into a non-match to keep counting
+                };
+            }
+            catch (RegexParsingError err)
+            {
+                char message[64];
+                sprintf(message, "Error parsing regex pattern at offset %" PRIptrdiff_t ": ", err.buf - pattern);
+                errorMessage = std::string(message) + err.msg;
+                return ServedMatcher();
+            }
+        });
+    }
+    if (serveLoadSocketPath)
+    {
+        if (!buf || !mathMode || testNumInc != 1 || patternImage.isOpen())
+        {
+            fprintf(stderr, "Error: --serve-load requires a pattern given as text, numerical mode, and an ascending range given by -t\n");
+            printShortUsage(argv[0]);
+            return -1;
+        }
+        return runServerLoadTest(serveLoadSocketPath, buf, mathMode, showMatch_backrefIndex, countPossibleMatches,
+                                 testNum0, testNum1, numThreads, serveLoadBatchSize);
+    }
+
     if (invertMatch && (showMatch || countPossibleMatches || verbose))
     {
         fprintf(stderr, "Error: -v cannot be combined with -o, -X, or --verbose\n");
@@ -897,16 +1820,128 @@ int main(int argc, char *argv[])
         printShortUsage(argv[0]);
         return -1;
     }
+    if (numThreads > 1 && debugTrace)
+    {
+        fprintf(stderr, "Error: --threads cannot be combined with --trace\n");
+        printShortUsage(argv[0]);
+        return -1;
+    }
+    if ((shard.count || sweepOptions.checkpointFilename || sweepOptions.showProgress) &&
+        (!mathMode || !testNumInc && (numericalModeTest == NumericalModeTest_NONE || stringModeTest != StringModeTest_NONE)))
+    {
+        fprintf(stderr, "Error: --shard, --checkpoint and --progress require numerical mode, and either -t or a numerical mode --test=\n");
+        printShortUsage(argv[0]);
+        return -1;
+    }
+    if (indexFilename && (!mathMode || testNumInc || !showSequenceNth && !showSequenceUpTo))
+    {
+        fprintf(stderr, "Error: --index requires numerical mode, and -q or -Q taking queries from standard input\n");
+        printShortUsage(argv[0]);
+        return -1;
+    }
+    if ((resultCacheCapacity || resultCacheFilename || showResultCacheStatistics) &&
+        (!mathMode || testNumInc || numericalModeTest != NumericalModeTest_NONE || countPossibleMatches))
+    {
+        fprintf(stderr, "Error: --cache, --cache-file and --cache-stats require numerical mode taking input from standard input,\n"
+                        "and cannot be combined with -X\n");
+        printShortUsage(argv[0]);
+        return -1;
+    }
+    if (countByEnumeration && !countPossibleMatches)
+    {
+        fprintf(stderr, "Error: --count-by-enumeration must be combined with -X\n");
+        printShortUsage(argv[0]);
+        return -1;
+    }
+    if (useBytecode && (!mathMode || countPossibleMatches))
+    {
+        fprintf(stderr, "Error: --bytecode and --bytecode-benchmark require numerical mode, and cannot be combined with -X\n");
+        printShortUsage(argv[0]);
+        return -1;
+    }
+    if (emitCppFilename && !mathMode)
+    {
+        fprintf(stderr, "Error: --emit-cpp requires numerical mode\n");
+        printShortUsage(argv[0]);
+        return -1;
+    }
+    if (checkCppProgram && (!mathMode || !testNumInc || numericalModeTest != NumericalModeTest_NONE || countPossibleMatches || emitCppFilename))
+    {
+        fprintf(stderr, "Error: --check-cpp requires numerical mode with -t, and cannot be combined with -X or --emit-cpp\n");
+        printShortUsage(argv[0]);
+        return -1;
+    }
+    if (sweepOptions.resume && !sweepOptions.checkpointFilename)
+    {
+        fprintf(stderr, "Error: --resume must be combined with --checkpoint\n");
+        printShortUsage(argv[0]);
+        return -1;
+    }
+    if (!shard.count && (sweepOptions.shardFilename || shard.blockSize != SweepShard::DEFAULT_BLOCK_SIZE))
+    {
+        fprintf(stderr, "Error: --shard-file and --shard-block must be combined with --shard\n");
+        printShortUsage(argv[0]);
+        return -1;
+    }
     if (!buf)
     {
         fprintf(stderr, "Error: No pattern specified\n");
         printShortUsage(argv[0]);
         return -1;
     }
+    if (saveCompiledFilename && patternImage.isOpen())
+    {
+        fprintf(stderr, "Error: The pattern given to --save-compiled is already a compiled pattern file\n");
+        printShortUsage(argv[0]);
+        return -1;
+    }
+
+    // A checkpoint, sequence index or result cache may only be used with the same pattern and the same options, other
+    // than those that only affect how the work is carried out. A sequence index is shared by "-q" and "-Q", since it
+    // holds the same sequence either way, and a result cache is shared by all the ways of reporting results.
+    auto sweepKey = [&](std::initializer_list<const char *> alsoIgnore) -> Uint64
+    {
+        Uint64 key = hashString(0xCBF29CE484222325uLL, buf);
+        for (int i=1; i<argc; i++)
+        {
+            if (strncmp(argv[i], "--shard-file=", strlength("--shard-file="))==0 ||
+                strncmp(argv[i], "--checkpoint=", strlength("--checkpoint="))==0 ||
+                strncmp(argv[i], "--interval=",   strlength("--interval="  ))==0 ||
+                strncmp(argv[i], "--threads=",    strlength("--threads="   ))==0 ||
+                strncmp(argv[i], "--index=",      strlength("--index="     ))==0 ||
+                strncmp(argv[i], "--cache=",      strlength("--cache="     ))==0 ||
+                strncmp(argv[i], "--cache-file=", strlength("--cache-file="))==0 ||
+                strcmp (argv[i], "--cache-stats"  )==0 ||
+                strcmp (argv[i], "--stack-stats"  )==0 ||
+                strcmp (argv[i], "--bytecode"     )==0 ||
+                strcmp (argv[i], "--bytecode-benchmark")==0 ||
+                strcmp (argv[i], "--count-by-enumeration")==0 ||
+                strcmp (argv[i], "--resume"       )==0 ||
+                strcmp (argv[i], "--progress"     )==0 ||
+                strcmp (argv[i], "--line-buffered")==0)
+                continue;
+            bool ignored = false;
+            for (const char *option : alsoIgnore)
+                if (strcmp(argv[i], option)==0)
+                    ignored = true;
+            if (!ignored)
+                key = hashString(hashString(key, argv[i]), " ");
+        }
+        return key;
+    };
+    sweepOptions.key = sweepKey({});
 
     try
     {
-        Regex regex(buf);
+        Regex regex(buf, patternImage.isOpen() ? &patternImage : NULL);
+
+        if (saveCompiledFilename)
+            return regex.SaveImage(saveCompiledFilename, buf);
+        regex.SetReturnMatchBackref(showMatch_backrefIndex);
+
+        BacktrackStatistics stackStatistics;
+        if (showStackStatistics)
+            backtrackStatistics = &stackStatistics;
 
         if (mathMode)
         {
@@ -915,187 +1950,260 @@ int main(int argc, char *argv[])
                 fprintf(stderr, "Error: String Mode test specified in Numerical Mode\n");
                 return -1;
             }
-            switch (numericalModeTest)
+            if (rleInput)
             {
-                case NumericalModeTest_NUMBERS_FIBONACCI:
+                fprintf(stderr, "Error: \"--rle-input\" specified in Numerical Mode\n");
+                return -1;
+            }
+            if (numericalModeTest == NumericalModeTest_NONE && !countPossibleMatches && !benchmarkBytecode && !emitCppFilename && !checkCppProgram)
+            {
+                // "-t" without "-o", "-v" and the sequence queries only ask whether each number matches
+                const char *unsupported = regex.UsePeriodicMatchSet(mathMode, !showMatch && (testNumInc || invertMatch || showSequenceNth || showSequenceUpTo));
+                if (unsupported && debugTrace)
+                    fprintf(stderr, "Matching every number, since the matches can't be found all at once with %s\n\n", unsupported);
+            }
+            BytecodeBenchmark bytecodeBenchmark;
+            if (useBytecode)
+            {
+                if (const char *unsupported = regex.UseBytecode(mathMode, benchmarkBytecode ? &bytecodeBenchmark : NULL))
+                    fprintf(stderr, "Warning: The bytecode compiler doesn't support %s; matching by walking the tree instead\n", unsupported);
+            }
+            if (countPossibleMatches && !countByEnumeration)
+                regex.UseCountingEngine(mathMode); // if it can't be used, every count is made by enumeration
+            if (emitCppFilename)
+            {
+                FILE *f = fopen(emitCppFilename, "w");
+                if (!f)
                 {
-                    Uint64 a=0, b=1;
-                    for(;;)
-                    {
-                        Uint64 returnMatch;
-                        if (regex.MatchNumber(a, mathMode, showMatch_backrefIndex, returnMatch))
-                            printf("%llu -> %llu\n", a, returnMatch);
-                        else
-                            printf("%llu -> no match (FALSE NEGATIVE)\n", a);
-                        if (a == 12200160415121876738uLL)
-                        {
-                            if (testForFalsePositives)
-                                for (Uint64 i=a+1; i!=0; i++)
-                                    if (regex.MatchNumber(i, mathMode, showMatch_backrefIndex, returnMatch))
-                                        printf("%llu -> %llu (FALSE POSITIVE)\n", i, returnMatch);
-                            break;
-                        }
-                        if (testForFalsePositives)
-                            for (Uint64 i=a+1; i<b; i++)
-                                if (regex.MatchNumber(i, mathMode, showMatch_backrefIndex, returnMatch))
-                                    printf("%llu -> %llu (FALSE POSITIVE)\n", i, returnMatch);
-                        Uint64 c = a + b;
-                        a = b;
-                        b = c;
-                    }
-                    break;
+                    fprintf(stderr, "Error opening \"%s\" for writing\n", emitCppFilename);
+                    return -1;
                 }
-                case NumericalModeTest_NUMBERS_POWER_OF_2:
+                const char *unsupported = regex.EmitCpp(mathMode, f, buf);
+                fclose(f);
+                if (unsupported)
                 {
-                    Uint64 z=0;
-                    Uint64 a=1;
-                    for(;;)
-                    {
-                        Uint64 returnMatch;
-                        if (testForFalsePositives)
-                        {
-                            for (Uint64 i=z; i<a; i++)
-                                if (regex.MatchNumber(i, mathMode, showMatch_backrefIndex, returnMatch))
-                                    printf("%llu -> %llu (FALSE POSITIVE)\n", i, returnMatch);
-                            z = a+1;
-                        }
-                        if (regex.MatchNumber(a, mathMode, showMatch_backrefIndex, returnMatch))
-                            printf("%llu -> %llu\n", a, returnMatch);
-                        else
-                            printf("%llu -> no match (FALSE NEGATIVE)\n", a);
-                        Uint64 a2 = a + a;
-                        if (a2 == 0)
-                        {
-                            if (testForFalsePositives)
-                                for (Uint64 i=a+1; i!=0; i++)
-                                    if (regex.MatchNumber(i, mathMode, showMatch_backrefIndex, returnMatch))
-                                        printf("%llu -> %llu (FALSE POSITIVE)\n", i, returnMatch);
-                            break;
-                        }
-                        a = a2;
-                    }
-                    break;
+                    fprintf(stderr, "Error: --emit-cpp doesn't support %s\n", unsupported);
+                    remove(emitCppFilename);
+                    return -1;
                 }
-                case NumericalModeTest_NUMBERS_TRIANGULAR:
+                return 0;
+            }
+            if (checkCppProgram)
+            {
+                SweepRange range = { testNum0, testNum1, testNum_digits, testNumInc, seqNum0, seqNum1, seqNum_digits, seqNumInc, false };
+                int64 numMismatches = checkGeneratedMatcher(checkCppProgram, range, showMatch_backrefIndex, [&](Uint64 input, Uint64 &returnMatch) -> bool
                 {
-                    Uint n=0, m=1, z=0;
-                    for (;;)
-                    {
-                        Uint64 returnMatch;
-                        if (testForFalsePositives)
-                        {
-                            for (Uint64 i=z; i<n; i++)
-                                if (regex.MatchNumber(i, mathMode, showMatch_backrefIndex, returnMatch))
-                                    printf("%llu -> %llu (FALSE POSITIVE)\n", i, returnMatch);
-                            z = n+1;
-                        }
-                        if (regex.MatchNumber(n, mathMode, showMatch_backrefIndex, returnMatch))
-                            printf("%u -> %llu\n", n, returnMatch);
-                        else
-                            printf("%u -> no match (FALSE NEGATIVE)\n", n);
-                        n += m;
-                        m++;
-                    }
-                    break;
-                }
+                    return regex.MatchNumber(input, mathMode, showMatch_backrefIndex, returnMatch);
+                });
+                return numMismatches ? -1 : 0;
+            }
+            switch (numericalModeTest)
+            {
+                case NumericalModeTest_NUMBERS_FIBONACCI:
+                case NumericalModeTest_NUMBERS_POWER_OF_2:
+                case NumericalModeTest_NUMBERS_TRIANGULAR:
                 case NumericalModeTest_DIV_SQRT2:
                 case NumericalModeTest_DIV_SQRT2_up:
                 case NumericalModeTest_DIV_SQRT2_any:
                 {
+                    // All the tests sweep upward through every number, so that they can be sharded like "-t"; unless false
+                    // positives are being tested for, the sweep skips directly from each member of the sequence to the next.
+                    SweepRange range = { 0, ULLONG_MAX, 0, +1, 0, 0, 0, 0, false };
+                    SweepOutput output(range, lineBuffered);
+                    if (output.open(sweepOptions))
+                        return -1;
                     const double sqrt2 = sqrt(2.);
-                    for (Uint64 i=0;; i++)
+                    for (Uint64 i=0; output.advance(i); i++)
                     {
-                        Uint64 answer = (Uint64)floor(i / sqrt2);
-                        if (numericalModeTest == NumericalModeTest_DIV_SQRT2_up)
-                            answer += 1;
+                        Uint64 member = i;
+                        bool haveMember = nextNumericalModeTestMember(numericalModeTest, member);
+                        if (!testForFalsePositives && (!haveMember || member != i))
+                        {
+                            if (!haveMember)
+                                break;
+                            i = member - 1;
+                            continue;
+                        }
                         Uint64 returnMatch;
                         bool matched = regex.MatchNumber(i, mathMode, showMatch_backrefIndex, returnMatch);
-                        if (!matched)
+                        if (numericalModeTest == NumericalModeTest_DIV_SQRT2    ||
+                            numericalModeTest == NumericalModeTest_DIV_SQRT2_up ||
+                            numericalModeTest == NumericalModeTest_DIV_SQRT2_any)
                         {
-                            printf("%9llu -> NOT MATCHED!\n", i);
-                            if (lineBuffered)
-                                fflush(stdout);
+                            Uint64 answer = (Uint64)floor(i / sqrt2);
+                            if (numericalModeTest == NumericalModeTest_DIV_SQRT2_up)
+                                answer += 1;
+                            if (!matched)
+                                output.print("%9llu -> NOT MATCHED!\n", i);
+                            else
+                            if (returnMatch != answer && (numericalModeTest != NumericalModeTest_DIV_SQRT2_any || returnMatch != answer+1))
+                            {
+                                int64 error = returnMatch - answer;
+                                if (numericalModeTest == NumericalModeTest_DIV_SQRT2_any && error > 0)
+                                    error -= 1;
+                                if (numericalModeTest == NumericalModeTest_DIV_SQRT2_any)
+                                    output.print("%9llu -> %9llu (off by %2lld, should be %9llu or %9llu)\n", i, returnMatch, error, answer, answer+1);
+                                else
+                                    output.print("%9llu -> %9llu (off by %2lld, should be %9llu)\n", i, returnMatch, error, answer);
+                            }
+                            else
+                            if (i <= 10 || i % (1<<4) == 0 || i >= 940)
+                                output.print("%9llu -> %9llu\n", i, returnMatch);
                         }
                         else
-                        if (returnMatch != answer && (numericalModeTest != NumericalModeTest_DIV_SQRT2_any || returnMatch != answer+1))
+                        if (haveMember && member == i)
                         {
-                            int64 error = returnMatch - answer;
-                            if (numericalModeTest == NumericalModeTest_DIV_SQRT2_any && error > 0)
-                                error -= 1;
-                            printf("%9llu -> %9llu (off by %2lld, should be %9llu", i, returnMatch, error, answer);
-                            if (numericalModeTest == NumericalModeTest_DIV_SQRT2_any)
-                                printf(" or %9llu", answer+1);
-                            fputs(")\n", stdout);
-                            if (lineBuffered)
-                                fflush(stdout);
+                            // 1 occurs twice in the Fibonacci sequence
+                            Uint count = numericalModeTest == NumericalModeTest_NUMBERS_FIBONACCI && i == 1 ? 2 : 1;
+                            for (Uint j=0; j<count; j++)
+                                if (matched)
+                                    output.print("%llu -> %llu\n", i, returnMatch);
+                                else
+                                    output.print("%llu -> no match (FALSE NEGATIVE)\n", i);
                         }
                         else
-                        if (i <= 10 || i % (1<<4) == 0 || i >= 940)
-                        {
-                            printf("%9llu -> %9llu\n", i, returnMatch);
-                            if (lineBuffered)
-                                fflush(stdout);
-                        }
+                        if (matched)
+                            output.print("%llu -> %llu (FALSE POSITIVE)\n", i, returnMatch);
+                        if (i == ULLONG_MAX)
+                            break;
                     }
+                    output.finish();
                     break;
                 }
                 default:
                 {
-                    Uint64 possibleMatchesCount;
-                    Uint64 *possibleMatchesCount_ptr = countPossibleMatches ? &possibleMatchesCount : NULL;
+                    BigCount possibleMatchesCount;
+                    auto matchNumber = [&](Uint64 input, Uint64 &returnMatch) -> bool
+                    {
+                        if (!countPossibleMatches)
+                            return regex.MatchNumber(input, mathMode, showMatch_backrefIndex, returnMatch);
+                        regex.CountNumber(input, mathMode, possibleMatchesCount);
+                        returnMatch = 0;
+                        return false; // as when counting by enumeration, which turns every match into a non-match to keep counting
+                    };
 
-                    auto showSequence = [&](bool showIndex)
+                    auto showSequence = [&](bool showIndex) -> int
                     {
-                        Uint64 seqNum = 0;
-                        for (Uint64 i=testNum0;; i+=testNumInc)
+                        SweepRange range = { testNum0, testNum1, testNum_digits, testNumInc, seqNum0, seqNum1, seqNum_digits, seqNumInc, showIndex };
+                        SweepOutput output(range, lineBuffered);
+                        if (output.open(sweepOptions))
+                            return -1;
+                        std::vector<char> text(2 * testNum_digits + 64);
+                        for (Uint64 offset=0; output.advance(offset); offset++)
                         {
+                            Uint64 i = range.numberAt(offset);
                             Uint64 returnMatch;
-                            bool matched = regex.MatchNumber(i, mathMode, showMatch_backrefIndex, returnMatch, possibleMatchesCount_ptr);
-                            if (invertMatch)
-                            {
-                                if (!matched)
-                                {
-                                    if (showIndex && seqNumInc && seqNum >= seqNum0)
-                                        printf("%*llu: ", seqNum_digits, seqNum);
-                                    if (!seqNumInc || seqNum >= seqNum0)
-                                    {
-                                        printf("%*llu\n", testNum_digits, i);
-                                        if (lineBuffered)
-                                            fflush(stdout);
-                                    }
-                                    if (seqNumInc && seqNum++ >= seqNum1)
-                                        break;
-                                }
-                            }
-                            else
-                            if (matched || countPossibleMatches)
+                            bool matched = testNumInc > 0 && !countPossibleMatches ? regex.MatchNextNumber(i, mathMode, showMatch_backrefIndex, returnMatch)
+                                                                                   : matchNumber(i, returnMatch);
+                            if (invertMatch ? !matched : matched || countPossibleMatches)
                             {
-                                if (showIndex && seqNumInc && seqNum >= seqNum0)
-                                    printf("%*llu: ", seqNum_digits, seqNum);
-                                if (!seqNumInc || seqNum >= seqNum0)
+                                int length = snprintf(&text[0], text.size(), "%*llu", testNum_digits, i);
+                                if (countPossibleMatches)
                                 {
-                                    printf("%*llu", testNum_digits, i);
-                                    if (countPossibleMatches)
-                                        printf(" -> %llu", *possibleMatchesCount_ptr);
-                                    else
-                                    if (showMatch)
-                                        printf(" -> %*llu", testNum_digits, returnMatch);
-                                    putchar('\n');
-                                    if (lineBuffered)
-                                        fflush(stdout);
+                                    std::string count = possibleMatchesCount.toString();
+                                    if (text.size() < length + count.size() + 8)
+                                        text.resize(length + count.size() + 8);
+                                    snprintf(&text[length], text.size() - length, " -> %s", count.c_str());
                                 }
-                                if (seqNumInc && seqNum++ >= seqNum1)
+                                else
+                                if (showMatch)
+                                    snprintf(&text[length], text.size() - length, " -> %*llu", testNum_digits, returnMatch);
+                                if (!output.hit(&text[0]))
                                     break;
                             }
-                            if (i==testNum1)
+                            if (offset == range.lastOffset())
                                 break;
                         }
+                        output.finish();
+                        return 0;
+                    };
+
+                    auto printResult = [&](Uint64 input, bool matched, Uint64 returnMatch, const BigCount &possibleMatchesCount)
+                    {
+                        if (invertMatch)
+                        {
+                            if (!matched)
+                                printf("%llu\n", input);
+                        }
+                        else
+                        if (verbose)
+                        {
+                            if (countPossibleMatches)
+                                printf("%llu -> %s\n", input, possibleMatchesCount.toString().c_str());
+                            else
+                            if (matched)
+                                printf("%llu -> %llu\n", input, returnMatch);
+                            else
+                                printf("%llu -> no match\n", input);
+                        }
+                        else
+                        if (matched)
+                            printf("%llu\n", returnMatch);
                     };
 
+                    ResultCache resultCache(sweepKey({"-q", "-Q", "-v", "--invert-match", "--verbose"}),
+                                            resultCacheCapacity ? resultCacheCapacity : resultCacheFilename ? ResultCache::DEFAULT_CAPACITY : 0);
+                    if (resultCacheFilename && resultCache.openFile(resultCacheFilename))
+                        return -1;
+                    if (resultCacheCapacity || resultCacheFilename)
+                        regex.SetResultCache(&resultCache);
+                    if (countPossibleMatches)
+                        regex.SetCountingThreads(numThreads);
+
                     if (testNumInc)
-                        showSequence(true);
+                    {
+                        if (int result = showSequence(true))
+                            return result;
+                    }
                     else
+                    if (numThreads > 1 && !showSequenceNth && !showSequenceUpTo && !countPossibleMatches)
                     {
+                        regex.PrepareNumber(mathMode);
+                        LineGetter lineGetter(1<<5);
+                        runOrderedPipeline<LineBlock>(numThreads, numThreads * 4,
+                            [&](LineBlock &block)
+                            {
+                                return block.read(lineGetter, stdin);
+                            },
+                            [&](LineBlock &block)
+                            {
+                                for (size_t i=0; i<block.numLines(); i++)
+                                {
+                                    const char *line = block.line(i);
+                                    if (inrange(*line, '0', '9'))
+                                    {
+                                        LineBlock::Result &result = block.results[i];
+                                        Uint64 input = readNumericConstant<Uint64>(line);
+                                        result.matched = regex.MatchNumber(input, mathMode, showMatch_backrefIndex, result.returnMatch);
+                                    }
+                                }
+                            },
+                            [&](LineBlock &block)
+                            {
+                                for (size_t i=0; i<block.numLines(); i++)
+                                {
+                                    const char *line = block.line(i);
+                                    if (inrange(*line, '0', '9'))
+                                    {
+                                        LineBlock::Result &result = block.results[i];
+                                        printResult(readNumericConstant<Uint64>(line), result.matched, result.returnMatch, BigCount());
+                                    }
+                                    else
+                                        puts(line);
+                                }
+                            });
+                    }
+                    else
+                    {
+                        SequenceIndex sequenceIndex(sweepKey({"-q", "-Q"}));
+                        if (indexFilename && sequenceIndex.load(indexFilename))
+                            return -1;
+                        auto isMember = [&](Uint64 n) -> bool
+                        {
+                            Uint64 returnMatch;
+                            return regex.MatchNumber(n, mathMode, showMatch_backrefIndex, returnMatch) != invertMatch;
+                        };
+
                         LineGetter lineGetter(1<<5);
                         for (;;)
                         {
@@ -1107,54 +2215,47 @@ int main(int argc, char *argv[])
                                 Uint64 input = readNumericConstant<Uint64>(line);
                                 if (showSequenceNth)
                                 {
-                                    setFullTestRange();
-                                    seqNum0 = seqNum1 = input;
-                                    seqNumInc = 1;
-                                    seqNum_digits = 0;
-                                    showSequence(false);
+                                    sequenceIndex.lookup(input, input, isMember, [&](Uint64 seqNum, Uint64 member) -> bool
+                                    {
+                                        printf("%llu\n", member);
+                                        if (lineBuffered)
+                                            fflush(stdout);
+                                        return true;
+                                    });
                                 }
                                 else
                                 if (showSequenceUpTo)
                                 {
-                                    setFullTestRange();
-                                    seqNum0 = 0;
-                                    seqNum1 = input - 1;
-                                    seqNumInc = 1;
-                                    seqNum_digits = intLength(seqNum1);
-                                    showSequence(true);
+                                    Uint seqNum_digits = intLength(input - 1);
+                                    sequenceIndex.lookup(0, input - 1, isMember, [&](Uint64 seqNum, Uint64 member) -> bool
+                                    {
+                                        printf("%*llu: %llu\n", seqNum_digits, seqNum, member);
+                                        if (lineBuffered)
+                                            fflush(stdout);
+                                        return true;
+                                    });
                                 }
                                 else
                                 {
                                     Uint64 returnMatch;
-                                    bool matched = regex.MatchNumber(input, mathMode, showMatch_backrefIndex, returnMatch, possibleMatchesCount_ptr);
-                                    if (invertMatch)
-                                    {
-                                        if (!matched)
-                                            printf("%llu\n", input);
-                                    }
-                                    else
-                                    if (verbose)
-                                    {
-                                        if (countPossibleMatches)
-                                            printf("%llu -> %llu\n", input, *possibleMatchesCount_ptr);
-                                        else
-                                        if (matched)
-                                            printf("%llu -> %llu\n", input, returnMatch);
-                                        else
-                                            printf("%llu -> no match\n", input);
-                                    }
-                                    else
-                                    if (matched)
-                                        printf("%llu\n", returnMatch);
+                                    bool matched = matchNumber(input, returnMatch);
+                                    printResult(input, matched, returnMatch, possibleMatchesCount);
                                 }
                             }
                             else
                                 puts(line);
                         }
+                        if (indexFilename && sequenceIndex.save(indexFilename))
+                            return -1;
                     }
+                    if (showResultCacheStatistics)
+                        resultCache.printStatistics(stderr);
+                    regex.SetResultCache(NULL);
                     break;
                 }
             }
+            if (benchmarkBytecode)
+                bytecodeBenchmark.printStatistics(stderr);
         }
         else
         {
@@ -1201,6 +2302,7 @@ int main(int argc, char *argv[])
                     Uint start = stringModeTest==StringModeTest_MULTIPLICATION_INCLUDING_ZERO ? 0 : 1;
                     const Uint range = 25;
                     char str[range + strlength("*") + range + strlength("=") + range*range + 1];
+                    SubjectRuns runs;
                     for (Uint a=start; a<=range; a++)
                     {
                         for (Uint i=0; i<a; i++)
@@ -1223,12 +2325,18 @@ int main(int argc, char *argv[])
                                 for (Uint i=0; i<c; i++)
                                     str[a+1+b+1+i] = 'x';
                                 str[a+1+b+1+c] = '\0';
+                                runs.clear();
+                                runs.append('x', a);
+                                runs.append('*', 1);
+                                runs.append('x', b);
+                                runs.append('=', 1);
+                                runs.append('x', c);
 
                                 bool positive = a * b == c;
 
                                 const char *returnMatch;
                                 size_t returnMatchLength;
-                                if (regex.MatchString(str, showMatch_backrefIndex, returnMatch, returnMatchLength))
+                                if (regex.MatchString(str, showMatch_backrefIndex, returnMatch, returnMatchLength, NULL, &runs))
                                 {
                                     printf("%u * %u = %u", a, b, c);
                                     if (!positive)
@@ -1409,16 +2517,21 @@ int main(int argc, char *argv[])
                     char *str = new char [maxsize+1];
                     memset(str, numeral, 2+1+2);
                     str[2+1+2] = '\0';
+                    SubjectRuns runs;
                     for (Uint64 i=2+1+2; i < maxsize;)
                     {
                         for (Uint64 j=2; j<=(i-1)/2; j++)
                         {
                             const Uint64 k = i-1-j;
                             str[j] = ',';
+                            runs.clear();
+                            runs.append(numeral, j);
+                            runs.append(',', 1);
+                            runs.append(numeral, k);
 
                             const char *returnMatch;
                             size_t returnMatchLength;
-                            if (!regex.MatchString(str, showMatch_backrefIndex, returnMatch, returnMatchLength))
+                            if (!regex.MatchString(str, showMatch_backrefIndex, returnMatch, returnMatchLength, NULL, &runs))
                                 printf("%llu, %llu - NON-MATCH!\n", j, k);
                             else
                             if (inrangex64(j, returnMatch-str, returnMatch-str + returnMatchLength))
@@ -1457,6 +2570,7 @@ int main(int argc, char *argv[])
                     Uint64 maxSize = 64;
                     const char numeral = 'x';
                     char *str = (char*)malloc(maxSize*2+1+1);
+                    SubjectRuns runs;
                     for (Uint64 n = testNumInc ? testNum0 : 1;; n++)
                     {
                         if (n>1)
@@ -1481,10 +2595,14 @@ int main(int argc, char *argv[])
                             if (stringModeTest == StringModeTest_TRIANGULAR_TABLE2) {a=k; b=n;}
                             memset(str    , numeral, a); str[a    ] = ',';
                             memset(str+a+1, numeral, b); str[a+1+b] = 0;
+                            runs.clear();
+                            runs.append(numeral, a);
+                            runs.append(',', 1);
+                            runs.append(numeral, b);
 
                             const char *returnMatch;
                             size_t returnMatchLength;
-                            bool matched = regex.MatchString(str, showMatch_backrefIndex, returnMatch, returnMatchLength, possibleMatchesCount_ptr);
+                            bool matched = regex.MatchString(str, showMatch_backrefIndex, returnMatch, returnMatchLength, possibleMatchesCount_ptr, &runs);
                             if (countPossibleMatches)
                                 printf("%4llu", *possibleMatchesCount_ptr);
                             else if (matched)
@@ -1498,16 +2616,8 @@ int main(int argc, char *argv[])
                     Uint64 possibleMatchesCount;
                     Uint64 *possibleMatchesCount_ptr = countPossibleMatches ? &possibleMatchesCount : NULL;
 
-                    LineGetter lineGetter(1<<15);
-                    const char newline = '\n';
-                    for (;;)
+                    auto printResult = [&](const char *line, bool matched, const char *returnMatch, size_t returnMatchLength, Uint64 possibleMatchesCount)
                     {
-                        char *line = lineGetter.fgets(stdin);
-                        if (!line)
-                            break;
-                        const char *returnMatch;
-                        size_t returnMatchLength;
-                        bool matched = regex.MatchString(line, showMatch_backrefIndex, returnMatch, returnMatchLength, possibleMatchesCount_ptr);
                         if (invertMatch)
                         {
                             if (!matched)
@@ -1519,10 +2629,16 @@ int main(int argc, char *argv[])
                         }
                         else
                         if (countPossibleMatches)
-                            printf("%llu\n", *possibleMatchesCount_ptr);
+                            printf("%llu\n", possibleMatchesCount);
                         else
                         if (matched)
                         {
+                            if (showMatch && rleInput)
+                            {
+                                fprintRunLengths(stdout, returnMatch, returnMatchLength);
+                                putchar('\n');
+                            }
+                            else
                             if (showMatch)
                                 printf("%.*s\n", returnMatchLength < INT_MAX ? (int)returnMatchLength : INT_MAX, returnMatch);
                             else
@@ -1530,11 +2646,65 @@ int main(int argc, char *argv[])
                             if (lineBuffered)
                                 fflush(stdout);
                         }
+                    };
+
+                    LineGetter lineGetter(1<<15);
+                    if (numThreads > 1 && !rleInput)
+                    {
+                        regex.PrepareString();
+                        runOrderedPipeline<LineBlock>(numThreads, numThreads * 4,
+                            [&](LineBlock &block)
+                            {
+                                return block.read(lineGetter, stdin);
+                            },
+                            [&](LineBlock &block)
+                            {
+                                for (size_t i=0; i<block.numLines(); i++)
+                                {
+                                    LineBlock::Result &result = block.results[i];
+                                    result.matched = regex.MatchString(block.line(i), showMatch_backrefIndex, result.returnMatchString, result.returnMatchLength, countPossibleMatches ? &result.possibleMatchesCount : NULL);
+                                }
+                            },
+                            [&](LineBlock &block)
+                            {
+                                for (size_t i=0; i<block.numLines(); i++)
+                                {
+                                    LineBlock::Result &result = block.results[i];
+                                    printResult(block.line(i), result.matched, result.returnMatchString, result.returnMatchLength, result.possibleMatchesCount);
+                                }
+                            });
+                    }
+                    else
+                    {
+                        std::vector<char> decodedLine; // only used with rleInput
+                        SubjectRuns lineRuns;
+                        for (;;)
+                        {
+                            char *line = lineGetter.fgets(stdin);
+                            if (!line)
+                                break;
+                            const char *subject = line;
+                            if (rleInput)
+                            {
+                                if (const char *error = decodeRunLengths(line, decodedLine, lineRuns))
+                                {
+                                    fprintf(stderr, "Error: Run length at column %" PRIptrdiff_t " is too large\n", error - line + 1);
+                                    return -1;
+                                }
+                                subject = &decodedLine[0];
+                            }
+                            const char *returnMatch;
+                            size_t returnMatchLength;
+                            bool matched = regex.MatchString(subject, showMatch_backrefIndex, returnMatch, returnMatchLength, possibleMatchesCount_ptr, rleInput ? &lineRuns : NULL);
+                            printResult(line, matched, returnMatch, returnMatchLength, possibleMatchesCount);
+                        }
                     }
                 }
             }
         }
 
+        if (showStackStatistics)
+            stackStatistics.printStatistics(stderr);
         return 0;
     }
     catch (RegexParsingError err)
@@ -12,6 +12,7 @@
 #include <stack>
 #include <vector>
 #include <queue>
+#include <new>
 #include <limits.h>
 #include <stdlib.h>
 #include <malloc.h>
@@ -34,6 +35,7 @@ extern bool allow_conditionals;
 extern bool allow_lookaround_conditionals;
 extern bool allow_reset_start;
 extern bool enable_persistent_backrefs;
+extern bool enable_verbs;
 extern Uint optimizationLevel;
 
 enum RegexSymbolType
@@ -91,7 +93,79 @@ enum RegexVerb
     RegexVerb_Then,
 };
 
+// Owns all the memory of a parsed pattern: its symbols, its alternatives, and the arrays that link them. These are
+// allocated one after another in the order the parser creates them, so that a pattern of ordinary size occupies one
+// contiguous block, in roughly the order the matcher visits it; and they are all freed together with the arena.
+class RegexArena
+{
+    enum { MIN_CHUNK_SIZE = 4096 };
+    struct Chunk
+    {
+        Chunk *previous;
+        size_t size;
+        size_t used; // only kept up to date once a newer chunk has been added
+    };
+    Chunk *chunk;
+    Uint8 *next, *end;
+
+    RegexArena(const RegexArena &);
+    RegexArena &operator=(const RegexArena &);
+
+    void addChunk(size_t size)
+    {
+        if (size < MIN_CHUNK_SIZE)
+            size = MIN_CHUNK_SIZE;
+        Chunk *newChunk = (Chunk*)malloc(sizeof(Chunk) + size);
+        if (!newChunk)
+            throw std::bad_alloc();
+        if (chunk)
+            chunk->used = next - (Uint8*)(chunk + 1);
+        newChunk->previous = chunk;
+        newChunk->size     = size;
+        chunk = newChunk;
+        next  = (Uint8*)(newChunk + 1);
+        end   = next + size;
+    }
+public:
+    RegexArena() : chunk(NULL), next(NULL), end(NULL) {}
+    ~RegexArena()
+    {
+        while (chunk)
+        {
+            Chunk *previous = chunk->previous;
+            free(chunk);
+            chunk = previous;
+        }
+    }
+    void reserve(size_t size) // makes sure the next "size" bytes of allocations are contiguous
+    {
+        if ((size_t)(end - next) < size)
+            addChunk(size);
+    }
+    void *allocate(size_t size)
+    {
+        size = (size + sizeof(Uint64)*2 - 1) & ~(sizeof(Uint64)*2 - 1);
+        reserve(size);
+        void *p = next;
+        next += size;
+        return p;
+    }
+    template <typename T>
+    T *allocateArray(size_t count)
+    {
+        return (T*)allocate(count * sizeof(T));
+    }
+    template <typename VISIT>
+    void forEachChunk(VISIT visit) const // calls visit(start, bytesUsed) for each chunk, the most recently added first
+    {
+        for (Chunk *c = chunk; c; c = c->previous)
+            visit((const Uint8*)(c + 1), c == chunk ? (size_t)(next - (Uint8*)(c + 1)) : c->used);
+    }
+};
+
 class RegexPattern;
+class RegexBytecode;
+class RegexImage;
 
 template<bool> class RegexMatcher;
 template<bool, RegexVerb, const char *> class Backtrack_Verb;
@@ -114,6 +188,10 @@ template<bool> class Backtrack_ResetStart;
 
 class RegexSymbol
 {
+    friend class RegexBytecode;
+    friend class RegexImage;
+    friend class RegexAnalysis;
+    friend class UnaryNFA;
     friend class Regex;
     friend class RegexParser;
     friend class RegexMatcher<false>;
@@ -128,9 +206,6 @@ class RegexSymbol
     friend class Backtrack_LoopGroup<true>;
     friend class Backtrack_TryMatch<false>;
     friend class Backtrack_TryMatch<true>;
-    const char *originalCode;
-    RegexPattern **parentAlternative;
-    RegexSymbol  **self;
     union
     {
         void *initMatchFunction;
@@ -160,13 +235,50 @@ class RegexSymbol
         RegexVerb verb;
     };
     RegexSymbolType type;
+    RegexPattern **parentAlternative;
+    RegexSymbol  **self;
+    const char *originalCode; // only used for tracing and error messages, so it is kept after the fields used for matching
 public:
     RegexSymbol() {}
     RegexSymbol(RegexSymbolType type) : initMatchFunction(NULL), type(type), minCount(1), maxCount(1), lazy(false), possessive(false) {}
+    void *operator new(size_t size, RegexArena &arena)
+    {
+        return arena.allocate(size);
+    }
+    void operator delete(void *p, RegexArena &arena) // only called if a constructor throws; the arena still owns the memory
+    {
+    }
+};
+
+// A necessary condition for a root alternative to match, on how much of the input is left after its start position: it
+// must be at least minLength and at most maxLength, and differ from minLength by a multiple of stride (or by 0, if stride
+// is 0)
+class RegexLengthCondition
+{
+    friend class RegexAnalysis;
+    friend class RegexPattern;
+    Uint64 minLength, maxLength, stride;
+    RegexLengthCondition *next;
+public:
+    bool isSatisfiedBy(Uint64 length) const
+    {
+        return minLength <= length && length <= maxLength && (stride ? (length - minLength) % stride == 0 : length == minLength);
+    }
+    void *operator new(size_t size, RegexArena &arena)
+    {
+        return arena.allocate(size);
+    }
+    void operator delete(void *p, RegexArena &arena)
+    {
+    }
 };
 
 class RegexPattern
 {
+    friend class RegexBytecode;
+    friend class RegexImage;
+    friend class RegexAnalysis;
+    friend class UnaryNFA;
     friend class RegexParser;
     friend class RegexMatcher<false>;
     friend class RegexMatcher<true>;
@@ -177,10 +289,38 @@ class RegexPattern
     friend class Backtrack_LoopGroup<false>;
     friend class Backtrack_LoopGroup<true>;
     RegexSymbol **symbols; // list terminated with NULL
+    // Measured when the pattern is first prepared for matching: the fewest and most characters that a match of this
+    // alternative can consume (ULLONG_MAX if there's no limit), a number that the difference between any two of them is
+    // a multiple of (0 if there is only one), and whether every match of it ends at the end of the input
+    Uint64 minLength, maxLength, lengthStride;
+    bool endAnchored;
+    RegexLengthCondition *lengthConditions; // for a root alternative, what else its lookaheads require; NULL if nothing
+public:
+    // whether this root alternative can match from a start position with length characters of the input after it
+    bool canMatchWithLengthLeft(Uint64 length) const
+    {
+        if (length < minLength || endAnchored && (length > maxLength || (lengthStride ? (length - minLength) % lengthStride : length - minLength) != 0))
+            return false;
+        for (RegexLengthCondition *condition = lengthConditions; condition; condition = condition->next)
+            if (!condition->isSatisfiedBy(length))
+                return false;
+        return true;
+    }
+    void *operator new(size_t size, RegexArena &arena)
+    {
+        return arena.allocate(size);
+    }
+    void operator delete(void *p, RegexArena &arena)
+    {
+    }
 };
 
 class RegexGroup : public RegexSymbol
 {
+    friend class RegexBytecode;
+    friend class RegexImage;
+    friend class RegexAnalysis;
+    friend class UnaryNFA;
     friend class Regex;
     friend class RegexParser;
     friend class RegexMatcher<false>;
@@ -215,16 +355,29 @@ public:
 
 class RegexGroupRoot : public RegexGroup
 {
+    friend class Regex;
+    friend class RegexBytecode;
+    friend class RegexImage;
+    friend class RegexAnalysis;
+    friend class UnaryNFA;
     friend class RegexParser;
     friend class RegexMatcher<false>;
     friend class RegexMatcher<true>;
     bool anchored; // indicates whether we can optimize the search by only trying a match at the start
+    Uint64 minLength;      // no match can start closer than this to the end of the input
+    Uint64 maxLengthToEnd; // nor further than this from it (ULLONG_MAX if it can), when every alternative is end-anchored
+    bool startPositionIndependent; // in numerical mode, a match of N starting at P is then exactly a match of N-P starting at 0
+    Uint returnMatch_backrefIndex; // the capture that matches are asked to return (0 = the whole match), which is kept even if nothing reads it
+    RegexArena arena; // holds the rest of the pattern
 public:
     RegexGroupRoot() : RegexGroup(RegexGroup_NonCapturing) {}
 };
 
 class RegexGroupCapturing : public RegexGroup
 {
+    friend class RegexBytecode;
+    friend class RegexImage;
+    friend class RegexAnalysis;
     friend class RegexMatcher<false>;
     friend class RegexMatcher<true>;
     friend class Backtrack_LeaveGroup<false>;
@@ -242,6 +395,9 @@ public:
 
 class RegexConditional : public RegexGroup
 {
+    friend class RegexBytecode;
+    friend class RegexImage;
+    friend class RegexAnalysis;
     friend class RegexParser;
     friend class RegexMatcher<false>;
     friend class RegexMatcher<true>;
@@ -252,6 +408,8 @@ public:
 
 class RegexLookaroundConditional : public RegexGroup
 {
+    friend class RegexImage;
+    friend class RegexAnalysis;
     friend class RegexParser;
     friend class RegexMatcher<false>;
     friend class RegexMatcher<true>;
@@ -264,6 +422,8 @@ public:
 
 class RegexGroupLookinto : public RegexGroup
 {
+    friend class RegexImage;
+    friend class RegexAnalysis;
     friend class RegexParser;
     friend class RegexMatcher<false>;
     friend class RegexMatcher<true>;
@@ -276,6 +436,9 @@ public:
 
 class RegexBackref : public RegexSymbol
 {
+    friend class RegexBytecode;
+    friend class RegexImage;
+    friend class RegexAnalysis;
     friend class RegexParser;
     friend class RegexMatcher<false>;
     friend class RegexMatcher<true>;
@@ -302,22 +465,25 @@ public:
 
 class RegexConstGroup : public RegexSymbol
 {
+    friend RegexBytecode;
     friend RegexMatcher<false>;
     friend RegexMatcher<true>;
     RegexGroup *originalGroup;
+    bool flat; // false if the group also contains groups or lookaheads, which are themselves of constant width
 protected:
-    RegexConstGroup(RegexGroup *originalGroup, RegexSymbolType type) : RegexSymbol(type), originalGroup(originalGroup) {}
+    RegexConstGroup(RegexGroup *originalGroup, RegexSymbolType type, bool flat) : RegexSymbol(type), originalGroup(originalGroup), flat(flat) {}
 public:
-    RegexConstGroup(RegexGroup *originalGroup) : RegexSymbol(RegexSymbol_ConstGroupNonCapturing), originalGroup(originalGroup) {}
+    RegexConstGroup(RegexGroup *originalGroup, bool flat) : RegexSymbol(RegexSymbol_ConstGroupNonCapturing), originalGroup(originalGroup), flat(flat) {}
 };
 
 class RegexConstGroupCapturing : public RegexConstGroup
 {
+    friend RegexBytecode;
     friend RegexMatcher<false>;
     friend RegexMatcher<true>;
     Uint backrefIndex; // zero-numbered; 0 corresponds to \1
 public:
-    RegexConstGroupCapturing(RegexGroup *originalGroup, Uint backrefIndex) : RegexConstGroup(originalGroup, RegexSymbol_ConstGroupCapturing), backrefIndex(backrefIndex) {}
+    RegexConstGroupCapturing(RegexGroup *originalGroup, Uint backrefIndex, bool flat) : RegexConstGroup(originalGroup, RegexSymbol_ConstGroupCapturing, flat), backrefIndex(backrefIndex) {}
 };
 
 class RegexParsingError
@@ -0,0 +1,75 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include <string.h>
+#include "tools.h"
+#include "runs.h"
+
+void SubjectRuns::index(const char *s, size_t length)
+{
+    clear();
+    for (size_t i=0; i<length;)
+    {
+        size_t start = i;
+        while (++i < length && s[i] == s[start]);
+        append(s[start], i - start);
+    }
+}
+
+const char *decodeRunLengths(const char *line, std::vector<char> &str, SubjectRuns &runs)
+{
+    str.clear();
+    runs.clear();
+    for (const char *s = line; *s;)
+    {
+        char ch = *s++;
+        Uint64 count = 1;
+        const char *countStart = s + 1;
+        if (s[0] == '{' && inrange(s[1], '0', '9'))
+        {
+            const char *countEnd = countStart;
+            try
+            {
+                count = readNumericConstant<Uint64>(countEnd);
+            }
+            catch (ParsingError)
+            {
+                return countStart;
+            }
+            if (*countEnd == '}')
+                s = countEnd + 1;
+            else
+                count = 1;
+        }
+        if (count > (Uint64)(size_t)-1 - str.size())
+            return countStart;
+        str.insert(str.end(), (size_t)count, ch);
+        runs.append(ch, count);
+    }
+    str.push_back('\0');
+    return NULL;
+}
+
+void fprintRunLengths(FILE *f, const char *s, size_t length)
+{
+    for (size_t i=0; i<length;)
+    {
+        size_t start = i;
+        while (++i < length && s[i] == s[start]);
+        size_t count = i - start;
+        // "c{n}" takes at least 4 characters, and a "{" written literally could be read as the start of a count
+        if (count >= 4 || s[start] == '{')
+            fprintf(f, "%c{%" PRIsize_t "}", s[start], count);
+        else
+            for (size_t j=0; j<count; j++)
+                fputc(s[start], f);
+    }
+}
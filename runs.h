@@ -0,0 +1,54 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include <vector>
+#include <algorithm>
+
+// The runs of identical characters that a string to be matched consists of. Given these, the string matcher checks
+// repetitions of a character, of a character class, or of a backreference to a run of one character a run at a time
+// instead of a character at a time, so that unary inputs cost it about the same no matter how large their numbers are.
+class SubjectRuns
+{
+    std::vector<Uint64> runEnds; // the offset just past each run, in ascending order
+    char lastCharacter;
+public:
+    void clear()
+    {
+        runEnds.clear();
+    }
+    void append(char ch, Uint64 length) // for a string being built a run at a time
+    {
+        if (length == 0)
+            return;
+        if (!runEnds.empty() && ch == lastCharacter)
+            runEnds.back() += length;
+        else
+            runEnds.push_back(getLength() + length);
+        lastCharacter = ch;
+    }
+    void index(const char *s, size_t length); // for a string that has been built some other way
+    Uint64 getLength() const
+    {
+        return runEnds.empty() ? 0 : runEnds.back();
+    }
+    Uint64 getRunEnd(Uint64 offset) const // the offset just past the run containing offset, or offset itself if it is at the end
+    {
+        std::vector<Uint64>::const_iterator run = std::upper_bound(runEnds.begin(), runEnds.end(), offset);
+        return run == runEnds.end() ? offset : *run;
+    }
+};
+
+// Decodes a line in which a character followed by {n} stands for n of that character, e.g. "x{1000000},x{999}", into
+// str (NUL-terminated) and its runs. A "{" not followed by a count and "}" is taken literally; "{{1}" is always one "{".
+// Returns NULL on success, or else a pointer to the count that is too large.
+const char *decodeRunLengths(const char *line, std::vector<char> &str, SubjectRuns &runs);
+// Writes length characters of s in the form read by decodeRunLengths, abbreviating each run that that makes shorter
+void fprintRunLengths(FILE *f, const char *s, size_t length);
@@ -0,0 +1,582 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <map>
+#include <algorithm>
+#ifndef _MSC_VER
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#include "tools.h"
+#include "parallel.h"
+#include "server.h"
+#include "count.h"
+
+#ifdef _MSC_VER
+
+int runMatchServer(const char *socketPath, Uint numThreads, const ServedPatternLookup &lookup)
+{
+    fprintf(stderr, "Error: --serve is not supported on this platform\n");
+    return -1;
+}
+
+int runServerLoadTest(const char *socketPath, const char *pattern, char basicChar, Uint returnMatch_backrefIndex, bool countPossibleMatches,
+                      Uint64 num0, Uint64 num1, Uint numConnections, Uint batchSize)
+{
+    fprintf(stderr, "Error: --serve-load is not supported on this platform\n");
+    return -1;
+}
+
+#else
+
+enum
+{
+    JOB_SIZE           = 4096,    // the most inputs that a worker matches before sending their results
+    MAX_PATTERN_LENGTH = 1 << 26,
+    MAX_INPUTS         = 1 << 24, // in one match or count request
+    LOAD_TEST_REQUESTS_IN_FLIGHT = 4, // on each connection
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static bool readFully(int fd, void *buffer, size_t size)
+{
+    Uint8 *p = (Uint8*)buffer;
+    while (size)
+    {
+        ssize_t n = read(fd, p, size);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return false;
+        }
+        p    += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool writeFully(int fd, const void *buffer, size_t size)
+{
+    const Uint8 *p = (const Uint8*)buffer;
+    while (size)
+    {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL); // a client that has gone away must not kill the server with SIGPIPE
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return false;
+        }
+        p    += n;
+        size -= n;
+    }
+    return true;
+}
+
+static int makeAddress(sockaddr_un &address, const char *socketPath)
+{
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Error: Socket path \"%s\" is too long\n", socketPath);
+        return -1;
+    }
+    strcpy(address.sun_path, socketPath);
+    return 0;
+}
+
+static int connectToServer(const sockaddr_un &address)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (const sockaddr*)&address, sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+struct ServerConnection
+{
+    int fd;
+    std::mutex writeMutex;
+    std::atomic<bool> broken; // once a reply can't be sent, the connection's outstanding work is abandoned
+
+    ServerConnection(int fd) : fd(fd), broken(false)
+    {
+    }
+    ~ServerConnection()
+    {
+        close(fd);
+    }
+    void reply(Uint64 id, ServerReplyType type, const void *payload, size_t payloadSize)
+    {
+        ServerReplyHeader header = { id, (Uint32)type, (Uint32)payloadSize };
+        std::lock_guard<std::mutex> lock(writeMutex);
+        if (!broken && (!writeFully(fd, &header, sizeof(header)) || !writeFully(fd, payload, payloadSize)))
+            broken = true;
+    }
+};
+
+struct PatternCounters
+{
+    Uint64 numRequests, numInputs, numMatches;
+    double busySeconds;  // spent by the workers matching
+    double totalLatency; // from the time each request was read until its last reply was sent
+    double maxLatency;
+    PatternCounters() : numRequests(0), numInputs(0), numMatches(0), busySeconds(0), totalLatency(0), maxLatency(0)
+    {
+    }
+};
+
+struct ServerRequest
+{
+    std::shared_ptr<ServerConnection> connection;
+    ServerRequestHeader header;
+    ServedMatcher matcher;
+    PatternCounters *counters;
+    std::vector<Uint64> inputs;
+    std::atomic<Uint64> jobsLeft;
+    Clock::time_point received;
+    std::atomic<bool> failed; // once set by a worker, with errorMessage, the request's other jobs are skipped and it ends with an error
+    std::string errorMessage;
+    std::mutex errorMutex;
+
+    ServerRequest() : failed(false)
+    {
+    }
+    void fail(const std::string &message)
+    {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!failed)
+        {
+            errorMessage = message;
+            failed = true;
+        }
+    }
+};
+
+// A piece of a request for one worker: the inputs from index first to last inclusive, or for a sweep, those numbers
+struct ServerJob
+{
+    std::shared_ptr<ServerRequest> request;
+    Uint64 first, last;
+};
+
+class MatchServer
+{
+    const ServedPatternLookup &lookup;
+    BoundedQueue<ServerJob> jobs;
+    std::mutex countersMutex;
+    std::map<std::string, PatternCounters> counters; // keyed by the pattern's text followed by a zero and its basicChar
+
+    void finishRequest(ServerRequest &request);
+    std::string statistics();
+public:
+    MatchServer(const ServedPatternLookup &lookup, Uint numThreads) : lookup(lookup), jobs(numThreads * 4)
+    {
+    }
+    void work();
+    void serveConnection(std::shared_ptr<ServerConnection> connection);
+};
+
+void MatchServer::work()
+{
+    ServerJob job;
+    std::vector<ServerResult> results;
+    while (jobs.pop(job))
+    {
+        ServerRequest &request = *job.request;
+        if (!request.connection->broken && !request.failed)
+        {
+            results.clear();
+            Uint64 numMatches = 0;
+            Clock::time_point time0 = Clock::now();
+            for (Uint64 i = job.first;; i++)
+            {
+                ServerResult result;
+                result.input = request.header.type == ServerRequest_Sweep ? i : request.inputs[(size_t)i];
+                if (request.header.type == ServerRequest_Count)
+                {
+                    BigCount possibleMatchesCount;
+                    request.matcher(result.input, request.header.returnMatch_backrefIndex, result.value, &possibleMatchesCount);
+                    if (!possibleMatchesCount.fitsIn64Bits())
+                    {
+                        char message[128];
+                        sprintf(message, "The number of possible matches of %llu doesn't fit in 64 bits", result.input);
+                        request.fail(message);
+                        break;
+                    }
+                    result.value = possibleMatchesCount.saturated();
+                    results.push_back(result);
+                    numMatches += result.value != 0;
+                }
+                else
+                if (request.matcher(result.input, request.header.returnMatch_backrefIndex, result.value, NULL))
+                {
+                    results.push_back(result);
+                    numMatches++;
+                }
+                if (i == job.last)
+                    break;
+            }
+            double busySeconds = std::chrono::duration<double>(Clock::now() - time0).count();
+            {
+                std::lock_guard<std::mutex> lock(countersMutex);
+                request.counters->numInputs   += job.last - job.first + 1;
+                request.counters->numMatches  += numMatches;
+                request.counters->busySeconds += busySeconds;
+            }
+            if (!results.empty() && !request.failed)
+                request.connection->reply(request.header.id, ServerReply_Results, &results[0], results.size() * sizeof(ServerResult));
+        }
+        if (--request.jobsLeft == 0)
+            finishRequest(request);
+        job.request.reset();
+    }
+}
+
+void MatchServer::finishRequest(ServerRequest &request)
+{
+    double latency = std::chrono::duration<double>(Clock::now() - request.received).count();
+    {
+        std::lock_guard<std::mutex> lock(countersMutex);
+        request.counters->numRequests++;
+        request.counters->totalLatency += latency;
+        if (request.counters->maxLatency < latency)
+            request.counters->maxLatency = latency;
+    }
+    // after counting it, so a client that then asks for the statistics sees it
+    if (request.failed)
+        request.connection->reply(request.header.id, ServerReply_Error, request.errorMessage.c_str(), request.errorMessage.size());
+    else
+        request.connection->reply(request.header.id, ServerReply_Done, NULL, 0);
+}
+
+std::string MatchServer::statistics()
+{
+    std::string text;
+    char line[256];
+    sprintf(line, "%-40s %4s %10s %14s %14s %10s %14s %10s %10s\n",
+            "pattern", "num", "requests", "inputs", "matches", "busy (s)", "inputs/busy s", "mean (ms)", "max (ms)");
+    text += line;
+    std::lock_guard<std::mutex> lock(countersMutex);
+    for (auto &entry : counters)
+    {
+        const PatternCounters &c = entry.second;
+        std::string pattern = entry.first.c_str();
+        if (pattern.size() > 40)
+            pattern = pattern.substr(0, 37) + "...";
+        sprintf(line, "%-40s %4c %10llu %14llu %14llu %10.3f %14.0f %10.3f %10.3f\n",
+                pattern.c_str(), entry.first[entry.first.size() - 1], c.numRequests, c.numInputs, c.numMatches, c.busySeconds,
+                c.busySeconds ? c.numInputs / c.busySeconds : 0., c.numRequests ? c.totalLatency / c.numRequests * 1e3 : 0., c.maxLatency * 1e3);
+        text += line;
+    }
+    return text;
+}
+
+// Reads the requests on one connection and hands them out to the workers, split into jobs. Whatever the workers are
+// still doing for this connection keeps it open after the client has stopped sending.
+void MatchServer::serveConnection(std::shared_ptr<ServerConnection> connection)
+{
+    for (;;)
+    {
+        ServerRequestHeader header;
+        if (!readFully(connection->fd, &header, sizeof(header)))
+            break;
+        if (header.type > ServerRequest_Statistics || header.patternLength > MAX_PATTERN_LENGTH ||
+            header.type != ServerRequest_Sweep && header.type != ServerRequest_Statistics && header.numInputs > MAX_INPUTS)
+        {
+            static const char message[] = "Malformed request";
+            connection->reply(header.id, ServerReply_Error, message, strlength(message));
+            break; // there's no telling where the next request starts
+        }
+        std::shared_ptr<ServerRequest> request = std::make_shared<ServerRequest>();
+        request->received   = Clock::now();
+        request->connection = connection;
+        request->header     = header;
+        std::string pattern(header.patternLength, '\0');
+        if (header.patternLength && !readFully(connection->fd, &pattern[0], header.patternLength))
+            break;
+        if (header.type == ServerRequest_Match || header.type == ServerRequest_Count)
+        {
+            request->inputs.resize((size_t)header.numInputs);
+            if (header.numInputs && !readFully(connection->fd, &request->inputs[0], (size_t)header.numInputs * sizeof(Uint64)))
+                break;
+        }
+
+        if (header.type == ServerRequest_Statistics)
+        {
+            std::string text = statistics();
+            connection->reply(header.id, ServerReply_Statistics, text.c_str(), text.size());
+            continue;
+        }
+        std::string errorMessage;
+        if (!header.basicChar || strlen(pattern.c_str()) != pattern.size())
+            errorMessage = "The pattern and the character of numerical mode must not contain a zero byte";
+        else
+            request->matcher = lookup(pattern.c_str(), header.basicChar, header.returnMatch_backrefIndex, errorMessage);
+        if (!request->matcher)
+        {
+            connection->reply(header.id, ServerReply_Error, errorMessage.c_str(), errorMessage.size());
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(countersMutex);
+            request->counters = &counters[pattern + '\0' + header.basicChar];
+        }
+
+        Uint64 first, last;
+        if (header.type == ServerRequest_Sweep)
+        {
+            first = header.num0;
+            last  = header.num1;
+        }
+        else
+        {
+            first = 0;
+            last  = header.numInputs - 1;
+        }
+        if (header.type == ServerRequest_Sweep ? first > last : header.numInputs == 0)
+        {
+            request->jobsLeft = 1;
+            if (--request->jobsLeft == 0)
+                finishRequest(*request);
+            continue;
+        }
+        request->jobsLeft = (last - first) / JOB_SIZE + 1;
+        for (Uint64 start = first; !connection->broken; start += JOB_SIZE)
+        {
+            ServerJob job = { request, start, last - start < JOB_SIZE ? last : start + JOB_SIZE - 1 };
+            jobs.push(job);
+            if (job.last == last)
+                break;
+        }
+    }
+}
+
+int runMatchServer(const char *socketPath, Uint numThreads, const ServedPatternLookup &lookup)
+{
+    sockaddr_un address;
+    if (makeAddress(address, socketPath))
+        return -1;
+    struct stat st;
+    if (stat(socketPath, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        int fd = connectToServer(address);
+        if (fd >= 0)
+        {
+            close(fd);
+            fprintf(stderr, "Error: Another server is already listening on \"%s\"\n", socketPath);
+            return -1;
+        }
+        unlink(socketPath); // left behind by a server that is no longer running
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+    {
+        fprintf(stderr, "Error listening on \"%s\": %s\n", socketPath, strerror(errno));
+        if (listener >= 0)
+            close(listener);
+        return -1;
+    }
+    fprintf(stderr, "Listening on \"%s\" with %u worker thread%s\n", socketPath, numThreads, numThreads == 1 ? "" : "s");
+
+    MatchServer server(lookup, numThreads);
+    for (Uint i=0; i<numThreads; i++)
+        std::thread(&MatchServer::work, &server).detach();
+    for (;;)
+    {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            fprintf(stderr, "Error accepting a connection on \"%s\": %s\n", socketPath, strerror(errno));
+            return -1;
+        }
+        std::thread(&MatchServer::serveConnection, &server, std::make_shared<ServerConnection>(fd)).detach();
+    }
+}
+
+int runServerLoadTest(const char *socketPath, const char *pattern, char basicChar, Uint returnMatch_backrefIndex, bool countPossibleMatches,
+                      Uint64 num0, Uint64 num1, Uint numConnections, Uint batchSize)
+{
+    sockaddr_un address;
+    if (makeAddress(address, socketPath))
+        return -1;
+    Uint64 numBatches = (num1 - num0) / batchSize + 1;
+    std::atomic<Uint64> nextBatch(0);
+    std::mutex totalsMutex;
+    std::vector<double> latencies;
+    Uint64 numMatches = 0;
+    std::string errorMessage;
+    bool failed = false;
+
+    Clock::time_point time0 = Clock::now();
+    std::vector<std::thread> connections;
+    for (Uint c=0; c<numConnections; c++)
+        connections.push_back(std::thread([&]()
+        {
+            int fd = connectToServer(address);
+            if (fd < 0)
+            {
+                std::lock_guard<std::mutex> lock(totalsMutex);
+                failed = true;
+                return;
+            }
+            std::mutex mutex;
+            std::condition_variable condition;
+            std::map<Uint64, Clock::time_point> sentAt; // the requests in flight
+            bool receiverDone = false;
+
+            std::thread receiver([&]()
+            {
+                ServerReplyHeader header;
+                std::vector<ServerResult> results;
+                while (readFully(fd, &header, sizeof(header)))
+                {
+                    results.resize(header.payloadSize / sizeof(ServerResult) + 1);
+                    if (!readFully(fd, &results[0], header.payloadSize))
+                        break;
+                    if (header.type == ServerReply_Results)
+                    {
+                        Uint64 n = 0;
+                        for (size_t i=0; i < header.payloadSize / sizeof(ServerResult); i++)
+                            n += !countPossibleMatches || results[i].value != 0;
+                        std::lock_guard<std::mutex> lock(totalsMutex);
+                        numMatches += n;
+                        continue;
+                    }
+                    if (header.type == ServerReply_Error)
+                    {
+                        std::lock_guard<std::mutex> lock(totalsMutex);
+                        failed = true;
+                        errorMessage.assign((const char*)&results[0], header.payloadSize);
+                    }
+                    std::lock_guard<std::mutex> lock(mutex);
+                    double latency = std::chrono::duration<double>(Clock::now() - sentAt[header.id]).count();
+                    sentAt.erase(header.id);
+                    {
+                        std::lock_guard<std::mutex> lock(totalsMutex);
+                        latencies.push_back(latency);
+                    }
+                    condition.notify_all();
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                receiverDone = true;
+                condition.notify_all();
+            });
+
+            std::vector<Uint64> inputs;
+            for (;;)
+            {
+                Uint64 batch = nextBatch++;
+                if (batch >= numBatches)
+                    break;
+                Uint64 first = num0 + batch * batchSize;
+                Uint64 last  = num1 - first < batchSize ? num1 : first + batchSize - 1;
+                inputs.clear();
+                for (Uint64 n = first;; n++)
+                {
+                    inputs.push_back(n);
+                    if (n == last)
+                        break;
+                }
+                ServerRequestHeader header;
+                memset(&header, 0, sizeof(header));
+                header.type          = countPossibleMatches ? ServerRequest_Count : ServerRequest_Match;
+                header.patternLength = (Uint32)strlen(pattern);
+                header.id            = batch;
+                header.returnMatch_backrefIndex = returnMatch_backrefIndex;
+                header.basicChar     = basicChar;
+                header.numInputs     = inputs.size();
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    condition.wait(lock, [&]{ return sentAt.size() < LOAD_TEST_REQUESTS_IN_FLIGHT || receiverDone; });
+                    if (receiverDone)
+                        break;
+                    sentAt[batch] = Clock::now();
+                }
+                if (!writeFully(fd, &header, sizeof(header)) || !writeFully(fd, pattern, header.patternLength) ||
+                    !writeFully(fd, &inputs[0], inputs.size() * sizeof(Uint64)))
+                    break;
+            }
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [&]{ return sentAt.empty() || receiverDone; });
+                if (!sentAt.empty())
+                {
+                    std::lock_guard<std::mutex> lock(totalsMutex);
+                    failed = true;
+                }
+            }
+            shutdown(fd, SHUT_RDWR);
+            receiver.join();
+            close(fd);
+        }));
+    for (Uint c=0; c<numConnections; c++)
+        connections[c].join();
+    double seconds = std::chrono::duration<double>(Clock::now() - time0).count();
+
+    if (failed)
+    {
+        if (errorMessage.empty())
+            fprintf(stderr, "Error: Lost the connection to the server on \"%s\"\n", socketPath);
+        else
+            fprintf(stderr, "Error from the server: %s\n", errorMessage.c_str());
+        return -1;
+    }
+    Uint64 numInputs = num1 - num0 + 1;
+    std::sort(latencies.begin(), latencies.end());
+    double meanLatency = 0;
+    for (size_t i=0; i<latencies.size(); i++)
+        meanLatency += latencies[i];
+    meanLatency /= latencies.size();
+    printf("Sent %llu numbers in %llu request%s of up to %u over %u connection%s in %.3f seconds (%.0f numbers/s)\n",
+           numInputs, numBatches, numBatches == 1 ? "" : "s", batchSize, numConnections, numConnections == 1 ? "" : "s", seconds, numInputs / seconds);
+    printf(countPossibleMatches ? "%llu had possible matches\n" : "%llu matched\n", numMatches);
+    printf("Latency: mean %.3f ms, median %.3f ms, 99th percentile %.3f ms, max %.3f ms\n", meanLatency * 1e3,
+           latencies[latencies.size() / 2] * 1e3, latencies[latencies.size() * 99 / 100] * 1e3, latencies.back() * 1e3);
+
+    int fd = connectToServer(address);
+    ServerRequestHeader header;
+    memset(&header, 0, sizeof(header));
+    header.type = ServerRequest_Statistics;
+    ServerReplyHeader reply;
+    std::string text;
+    if (fd < 0 || !writeFully(fd, &header, sizeof(header)) || !readFully(fd, &reply, sizeof(reply)) ||
+        (text.resize(reply.payloadSize), !readFully(fd, &text[0], reply.payloadSize)))
+    {
+        fprintf(stderr, "Error: Couldn't get the statistics of the server on \"%s\"\n", socketPath);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    close(fd);
+    printf("\nServer statistics:\n%s", text.c_str());
+    return 0;
+}
+
+#endif
@@ -0,0 +1,82 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include <functional>
+#include <string>
+
+class BigCount;
+
+// The protocol spoken over the Unix domain socket of "--serve". All fields are in the byte order of the machine, as the
+// socket is local. A client sends any number of requests, each a ServerRequestHeader followed by the pattern's text
+// (without a terminating zero) and then, for a match or count request, numInputs Uint64 inputs. Requests on one
+// connection are started in the order sent, but run concurrently on the server's worker threads, so their replies may
+// be interleaved; each reply frame is a ServerReplyHeader carrying the id of its request, followed by payloadSize bytes.
+// A request's results come in any number of ServerReply_Results frames, each an array of ServerResult in the order of
+// the inputs they cover (though the frames themselves may arrive in any order), and end with a ServerReply_Done frame; or
+// else the request ends with a single ServerReply_Error frame, whose payload is the error message, in which case the
+// results sent before it are valid but incomplete. A statistics request is answered by one ServerReply_Statistics frame
+// holding a text table of every pattern's counters.
+enum ServerRequestType
+{
+    ServerRequest_Match,      // reports each input that matches, with the capture (or whole match) given by returnMatch_backrefIndex
+    ServerRequest_Count,      // reports each input with its number of possible matches, as "-X" does; fails if one doesn't fit in 64 bits
+    ServerRequest_Sweep,      // reports each number from num0 to num1 inclusive that matches, like an ascending "-t num0..num1"
+    ServerRequest_Statistics,
+};
+
+enum ServerReplyType
+{
+    ServerReply_Results,
+    ServerReply_Done,
+    ServerReply_Error,
+    ServerReply_Statistics,
+};
+
+struct ServerRequestHeader
+{
+    Uint32 type;
+    Uint32 patternLength;
+    Uint64 id;                       // chosen by the client, and echoed in every reply to the request
+    Uint32 returnMatch_backrefIndex; // as given by "-o"; 0 for the whole match
+    char basicChar;                  // the character of numerical mode, as given by "-n"
+    Uint8 reserved[3];
+    Uint64 numInputs;                // match and count requests
+    Uint64 num0, num1;               // sweep requests
+};
+
+struct ServerReplyHeader
+{
+    Uint64 id;
+    Uint32 type;
+    Uint32 payloadSize;
+};
+
+struct ServerResult
+{
+    Uint64 input;
+    Uint64 value; // the returned match, or the number of possible matches
+};
+
+// Matches input against one compiled pattern; counts its possible matches instead if possibleMatchesCount_ptr isn't NULL
+typedef std::function<bool(Uint64 input, Uint returnMatch_backrefIndex, Uint64 &returnMatch, BigCount *possibleMatchesCount_ptr)> ServedMatcher;
+// Finds the compiled form of a pattern for numerical mode with basicChar, whose matchers will be asked to return the
+// capture returnMatch_backrefIndex, compiling it on first use; returns an empty function, and sets errorMessage, if the
+// pattern can't be parsed. Called from any number of threads at once.
+typedef std::function<ServedMatcher(const char *pattern, char basicChar, Uint returnMatch_backrefIndex, std::string &errorMessage)> ServedPatternLookup;
+
+// "--serve": accepts connections on socketPath until killed, running requests on numThreads worker threads
+int runMatchServer(const char *socketPath, Uint numThreads, const ServedPatternLookup &lookup);
+
+// "--serve-load": a load generator for the server at socketPath. Sends every number from num0 to num1 in batches of
+// batchSize, over numConnections connections each keeping a few requests in flight, then reports the throughput and
+// latency it saw, followed by the server's statistics.
+int runServerLoadTest(const char *socketPath, const char *pattern, char basicChar, Uint returnMatch_backrefIndex, bool countPossibleMatches,
+                      Uint64 num0, Uint64 num1, Uint numConnections, Uint batchSize);
@@ -0,0 +1,596 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <vector>
+#include <string>
+#ifdef _MSC_VER
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "tools.h"
+#include "sweep.h"
+
+#define SHARD_FILE_SIGNATURE "#regex-shard"
+#define SHARD_FILE_VERSION   1
+
+bool SweepShard::nextOwned(Uint64 &offset)
+{
+    if (!count)
+        return true;
+    Uint64 block = offset / blockSize;
+    Uint skip = (Uint)((index + count - block % count) % count);
+    if (skip == 0)
+        return true;
+    if (block + skip > ULLONG_MAX / blockSize)
+        return false;
+    offset = (block + skip) * blockSize;
+    return true;
+}
+
+#define CHECKPOINT_FILE_SIGNATURE "#regex-checkpoint"
+#define CHECKPOINT_FILE_VERSION   1
+
+SweepOutput::SweepOutput(const SweepRange &range, bool lineBuffered)
+    : range(range), shardFile(NULL), lineBuffered(lineBuffered), atLineStart(true), alreadyComplete(false), currentOffset(0), currentBlock(ULLONG_MAX), seqNum(0),
+      bytesWritten(0), resumeOffset(0), numTested(0), numTestedAtLastReport(0)
+{
+}
+
+SweepOutput::~SweepOutput()
+{
+    if (shardFile && shardFile != stdout)
+        fclose(shardFile);
+}
+
+// Cuts the output back to the length it had at the checkpoint being resumed from
+static int truncateOutput(FILE *f, Uint64 length)
+{
+    fflush(f);
+    if (FSEEK64(f, 0, SEEK_END) != 0)
+    {
+        if (length)
+            fprintf(stderr, "Warning: Output is not going to a file, so anything written after the last checkpoint will be repeated\n");
+        return 0;
+    }
+    if ((Uint64)FTELL64(f) < length)
+    {
+        fprintf(stderr, "Error: The output is shorter than it was at the last checkpoint; when resuming, append to it (\">>\") instead of overwriting it\n");
+        return -1;
+    }
+#ifdef _MSC_VER
+    if (_chsize_s(_fileno(f), length) != 0)
+#else
+    if (ftruncate(fileno(f), length) != 0)
+#endif
+    {
+        fprintf(stderr, "Error: Unable to truncate the output to its length at the last checkpoint\n");
+        return -1;
+    }
+    FSEEK64(f, length, SEEK_SET);
+    return 0;
+}
+
+int SweepOutput::open(const SweepOptions &_options)
+{
+    options = _options;
+    shard = options.shard;
+    bool resuming = false;
+    if (options.resume)
+    {
+        if (readCheckpoint(resuming))
+            return -1;
+        if (alreadyComplete)
+            return 0;
+    }
+    if (shard.count)
+    {
+        const char *filename = options.shardFilename;
+        shardFile = !filename ? stdout : fopen(filename, resuming ? "r+b" : "wb");
+        if (!shardFile)
+        {
+            fprintf(stderr, "Error opening shard file \"%s\"\n", filename);
+            return -1;
+        }
+    }
+    if (options.resume && truncateOutput(shardFile ? shardFile : stdout, bytesWritten))
+        return -1;
+    if (shard.count)
+    {
+        if (resuming)
+            currentBlock = resumeOffset / shard.blockSize;
+        else
+            bytesWritten += fprintf(shardFile, SHARD_FILE_SIGNATURE " %u %u %u %llu %llu %llu %u %lld %llu %llu %u %lld %d\n", SHARD_FILE_VERSION,
+                shard.index, shard.count, shard.blockSize,
+                range.testNum0, range.testNum1, range.testNum_digits, range.testNumInc,
+                range. seqNum0, range. seqNum1, range. seqNum_digits, range. seqNumInc,
+                range.showIndex);
+    }
+    lastReport = std::chrono::steady_clock::now();
+    return 0;
+}
+
+int SweepOutput::readCheckpoint(bool &found)
+{
+    found = false;
+    FILE *f = fopen(options.checkpointFilename, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "No checkpoint file \"%s\" found; starting from the beginning\n", options.checkpointFilename);
+        return 0;
+    }
+    Uint version;
+    Uint64 key;
+    int complete;
+    int fields = fscanf(f, CHECKPOINT_FILE_SIGNATURE " %u %llu %llu %llu %llu %d", &version, &key, &resumeOffset, &seqNum, &bytesWritten, &complete);
+    fclose(f);
+    if (fields != 6 || version != CHECKPOINT_FILE_VERSION)
+    {
+        fprintf(stderr, "Error: \"%s\" is not a valid checkpoint file\n", options.checkpointFilename);
+        return -1;
+    }
+    if (key != options.key)
+    {
+        fprintf(stderr, "Error: Checkpoint file \"%s\" was written by a different sweep\n", options.checkpointFilename);
+        return -1;
+    }
+    found = true;
+    alreadyComplete = complete != 0;
+    return 0;
+}
+
+void SweepOutput::writeCheckpoint(Uint64 nextOffset, bool complete)
+{
+    // everything the checkpoint accounts for must already be in the output
+    fflush(shardFile ? shardFile : stdout);
+
+    // Write the new checkpoint to a temporary file and then rename it over the old one, so that if the process is
+    // killed at any point, there is still a complete checkpoint file.
+    std::string tempFilename = std::string(options.checkpointFilename) + ".tmp";
+    FILE *f = fopen(tempFilename.c_str(), "wb");
+    if (!f)
+    {
+        fprintf(stderr, "Warning: Unable to write checkpoint file \"%s\"\n", tempFilename.c_str());
+        return;
+    }
+    fprintf(f, CHECKPOINT_FILE_SIGNATURE " %u %llu %llu %llu %llu %d\n", CHECKPOINT_FILE_VERSION, options.key, nextOffset, seqNum, bytesWritten, complete);
+    bool failed = fclose(f) != 0;
+#ifdef _MSC_VER
+    remove(options.checkpointFilename); // rename() won't replace an existing file here
+#endif
+    if (failed || rename(tempFilename.c_str(), options.checkpointFilename) != 0)
+        fprintf(stderr, "Warning: Unable to write checkpoint file \"%s\"\n", options.checkpointFilename);
+}
+
+void SweepOutput::reportProgress(Uint64 nextOffset, double seconds)
+{
+    fprintf(stderr, "Progress: %llu numbers tested, now at %llu, %.1f numbers/sec\n", numTested, range.numberAt(nextOffset), (numTested - numTestedAtLastReport) / seconds);
+}
+
+void SweepOutput::shardCheckpoint(Uint64 nextOffset)
+{
+    bytesWritten += fprintf(shardFile, "@%llu\n", nextOffset);
+    fflush(shardFile);
+}
+
+bool SweepOutput::advance(Uint64 &offset)
+{
+    if (alreadyComplete)
+        return false;
+    if (offset < resumeOffset)
+        offset = resumeOffset;
+    if (shard.count)
+    {
+        if (!shard.nextOwned(offset))
+            return false;
+        Uint64 block = offset / shard.blockSize;
+        if (block != currentBlock)
+        {
+            if (currentBlock != ULLONG_MAX)
+                shardCheckpoint(offset);
+            currentBlock = block;
+        }
+    }
+    if (offset > range.lastOffset())
+        return false;
+    if (options.checkpointFilename || options.showProgress)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - lastReport).count();
+        if (seconds >= options.interval)
+        {
+            if (options.checkpointFilename)
+                writeCheckpoint(offset, false);
+            if (options.showProgress)
+                reportProgress(offset, seconds);
+            lastReport = now;
+            numTestedAtLastReport = numTested;
+        }
+    }
+    numTested++;
+    currentOffset = offset;
+    return true;
+}
+
+void SweepOutput::print(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    if (!shardFile)
+    {
+        int length = vprintf(format, args);
+        if (length > 0)
+            bytesWritten += length;
+        if (lineBuffered)
+            fflush(stdout);
+    }
+    else
+    {
+        char buf[256];
+        int length = vsnprintf(buf, sizeof(buf), format, args);
+        char *text = buf;
+        std::vector<char> bigBuf;
+        if (length >= (int)sizeof(buf))
+        {
+            va_end(args);
+            va_start(args, format);
+            bigBuf.resize(length + 1);
+            text = &bigBuf[0];
+            vsnprintf(text, length + 1, format, args);
+        }
+        for (char *end = text + length; text < end;)
+        {
+            if (atLineStart)
+            {
+                bytesWritten += fprintf(shardFile, "%llu\t", currentOffset);
+                atLineStart = false;
+            }
+            char *newline = (char*)memchr(text, '\n', end - text);
+            char *lineEnd = newline ? newline + 1 : end;
+            bytesWritten += fwrite(text, 1, lineEnd - text, shardFile);
+            atLineStart = newline != NULL;
+            text = lineEnd;
+        }
+    }
+    va_end(args);
+}
+
+bool SweepOutput::hit(const char *text)
+{
+    if (shardFile)
+        print("%s\n", text);
+    else
+    {
+        if (range.showIndex && range.seqNumInc && seqNum >= range.seqNum0)
+            bytesWritten += printf("%*llu: ", range.seqNum_digits, seqNum);
+        if (!range.seqNumInc || seqNum >= range.seqNum0)
+        {
+            fputs(text, stdout);
+            putchar('\n');
+            bytesWritten += strlen(text) + 1;
+            if (lineBuffered)
+                fflush(stdout);
+        }
+    }
+    if (range.seqNumInc && seqNum++ >= range.seqNum1)
+        return false;
+    return true;
+}
+
+void SweepOutput::finish()
+{
+    if (alreadyComplete)
+        return;
+    if (shardFile)
+        bytesWritten += fprintf(shardFile, "@end\n");
+    if (options.checkpointFilename)
+        writeCheckpoint(range.lastOffset(), true);
+    if (options.showProgress)
+        reportProgress(currentOffset, std::chrono::duration<double>(std::chrono::steady_clock::now() - lastReport).count());
+    if (shardFile)
+    {
+        if (shardFile != stdout)
+            fclose(shardFile);
+        else
+            fflush(stdout);
+        shardFile = NULL;
+    }
+}
+
+
+class ShardReader
+{
+    FILE *f;
+    LineGetter lineGetter;
+    int64 trustedEnd; // lines past the last complete checkpoint may have been cut off by the shard's process being killed
+    void findTrustedEnd();
+public:
+    const char *filename;
+    SweepRange range;
+    SweepShard shard;
+    bool havePending; // if true, pendingOffset and pendingText hold this shard's next output line
+    Uint64 pendingOffset;
+    const char *pendingText;
+    Uint64 covered; // every offset below this that the shard owns has been processed
+    bool complete;
+
+    ShardReader(const char *filename) : f(NULL), lineGetter(1<<8), filename(filename), havePending(false), covered(0), complete(false)
+    {
+    }
+    ~ShardReader()
+    {
+        if (f)
+            fclose(f);
+    }
+    int open()
+    {
+        f = fopen(filename, "rb");
+        if (!f)
+        {
+            fprintf(stderr, "Error opening shard file \"%s\"\n", filename);
+            return -1;
+        }
+        const char *header = lineGetter.fgets(f);
+        Uint version;
+        int showIndex;
+        if (!header || sscanf(header, SHARD_FILE_SIGNATURE " %u %u %u %llu %llu %llu %u %lld %llu %llu %u %lld %d", &version,
+                &shard.index, &shard.count, &shard.blockSize,
+                &range.testNum0, &range.testNum1, &range.testNum_digits, &range.testNumInc,
+                &range. seqNum0, &range. seqNum1, &range. seqNum_digits, &range. seqNumInc,
+                &showIndex) != 13 || version != SHARD_FILE_VERSION || shard.count == 0 || shard.index >= shard.count || shard.blockSize == 0)
+        {
+            fprintf(stderr, "Error: \"%s\" is not a valid shard file\n", filename);
+            return -1;
+        }
+        range.showIndex = showIndex != 0;
+        findTrustedEnd();
+        return readNext();
+    }
+    int readNext()
+    {
+        havePending = false;
+        for (;;)
+        {
+            if (FTELL64(f) >= trustedEnd)
+                return 0;
+            const char *line = lineGetter.fgets(f);
+            if (!line)
+                return 0;
+            try
+            {
+                if (*line == '@')
+                {
+                    line++;
+                    if (strcmp(line, "end")==0)
+                    {
+                        complete = true;
+                        continue;
+                    }
+                    if (!inrange(*line, '0', '9'))
+                        throw ParsingError();
+                    covered = readNumericConstant<Uint64>(line);
+                    if (*line)
+                        throw ParsingError();
+                    continue;
+                }
+                if (!inrange(*line, '0', '9'))
+                    throw ParsingError();
+                pendingOffset = readNumericConstant<Uint64>(line);
+                if (*line++ != '\t')
+                    throw ParsingError();
+                pendingText = line;
+                havePending = true;
+                return 0;
+            }
+            catch (ParsingError)
+            {
+                fprintf(stderr, "Error: Shard file \"%s\" is corrupt\n", filename);
+                return -1;
+            }
+        }
+    }
+};
+
+void ShardReader::findTrustedEnd()
+{
+    // Scan backwards for the last line that begins with '@' and is terminated by a newline
+    int64 headerEnd = FTELL64(f);
+    FSEEK64(f, 0, SEEK_END);
+    int64 pos = FTELL64(f);
+    trustedEnd = headerEnd;
+    int64 newlineAfter = -1;
+    int charAfter = EOF;
+    char buf[4096];
+    while (pos > headerEnd - 1 && trustedEnd == headerEnd)
+    {
+        size_t chunk = (size_t)(pos - (headerEnd - 1) < (int64)sizeof(buf) ? pos - (headerEnd - 1) : (int64)sizeof(buf));
+        pos -= chunk;
+        FSEEK64(f, pos, SEEK_SET);
+        if (fread(buf, 1, chunk, f) != chunk)
+            break;
+        for (size_t i=chunk; i-->0;)
+        {
+            if (buf[i] == '\n')
+            {
+                if (charAfter == '@' && newlineAfter >= 0)
+                {
+                    trustedEnd = newlineAfter + 1;
+                    break;
+                }
+                newlineAfter = pos + i;
+            }
+            charAfter = (Uchar)buf[i];
+        }
+    }
+    FSEEK64(f, headerEnd, SEEK_SET);
+}
+
+int mergeShards(int numFiles, char *const *filenames, bool lineBuffered)
+{
+    std::vector<ShardReader*> shards;
+    int result = 0;
+    for (int i=0; i<numFiles; i++)
+    {
+        ShardReader *shard = new ShardReader(filenames[i]);
+        shards.push_back(shard);
+        if ((result = shard->open()) != 0)
+            goto done;
+    }
+    if (numFiles == 0 || shards[0]->shard.count != (Uint)numFiles)
+    {
+        fprintf(stderr, "Error: Expected %u shard files, but %d were given\n", numFiles ? shards[0]->shard.count : 1, numFiles);
+        result = -1;
+        goto done;
+    }
+    for (int i=0; i<numFiles; i++)
+    {
+        SweepRange &a = shards[0]->range, &b = shards[i]->range;
+        if (shards[i]->shard.count != shards[0]->shard.count || shards[i]->shard.blockSize != shards[0]->shard.blockSize ||
+            a.testNum0 != b.testNum0 || a.testNum1 != b.testNum1 || a.testNum_digits != b.testNum_digits || a.testNumInc != b.testNumInc ||
+            a. seqNum0 != b. seqNum0 || a. seqNum1 != b. seqNum1 || a. seqNum_digits != b. seqNum_digits || a. seqNumInc != b. seqNumInc ||
+            a.showIndex != b.showIndex)
+        {
+            fprintf(stderr, "Error: Shard file \"%s\" belongs to a different sweep than \"%s\"\n", shards[i]->filename, shards[0]->filename);
+            result = -1;
+            goto done;
+        }
+        for (int j=0; j<i; j++)
+            if (shards[j]->shard.index == shards[i]->shard.index)
+            {
+                fprintf(stderr, "Error: Shard files \"%s\" and \"%s\" are the same shard\n", shards[j]->filename, shards[i]->filename);
+                result = -1;
+                goto done;
+            }
+    }
+
+    {
+        SweepOutput output(shards[0]->range, lineBuffered);
+        for (;;)
+        {
+            // The next line of output is the pending line with the lowest offset, unless some shard that has run out
+            // of lines hasn't yet covered that offset, in which case the merged output can't go any further yet.
+            ShardReader *next = NULL;
+            Uint64 frontier = ULLONG_MAX;
+            bool allComplete = true;
+            for (int i=0; i<numFiles; i++)
+            {
+                ShardReader *shard = shards[i];
+                if (shard->havePending)
+                {
+                    if (!next || shard->pendingOffset < next->pendingOffset)
+                        next = shard;
+                }
+                else
+                if (!shard->complete)
+                {
+                    allComplete = false;
+                    if (frontier > shard->covered)
+                        frontier = shard->covered;
+                }
+            }
+            if (!next || !allComplete && next->pendingOffset >= frontier)
+            {
+                if (!allComplete)
+                {
+                    fflush(stdout);
+                    fprintf(stderr, "Warning: The shards are incomplete; output was merged only up to offset %llu of the sweep\n", frontier);
+                }
+                break;
+            }
+            if (!output.hit(next->pendingText))
+                break;
+            if ((result = next->readNext()) != 0)
+                break;
+        }
+    }
+
+done:
+    for (size_t i=0; i<shards.size(); i++)
+        delete shards[i];
+    return result;
+}
+
+#define INDEX_FILE_SIGNATURE "#regex-index"
+#define INDEX_FILE_VERSION   1
+
+int SequenceIndex::load(const char *filename)
+{
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+        return 0;
+    Uint version;
+    Uint64 fileKey, numMembers, numCheckpoints;
+    int fileExhausted;
+    if (fscanf(f, INDEX_FILE_SIGNATURE " %u %llu %llu %llu %d %llu %llu", &version, &fileKey, &numFound, &scanPosition, &fileExhausted, &numMembers, &numCheckpoints) != 7 ||
+        version != INDEX_FILE_VERSION || numMembers > numFound || numMembers > MAX_DENSE_MEMBERS || numCheckpoints != (numFound + CHECKPOINT_SPACING - 1) / CHECKPOINT_SPACING)
+    {
+        fclose(f);
+        fprintf(stderr, "Error: \"%s\" is not a valid sequence index file\n", filename);
+        return -1;
+    }
+    if (fileKey != key)
+    {
+        fclose(f);
+        fprintf(stderr, "Error: Sequence index file \"%s\" was written for a different pattern or different options\n", filename);
+        return -1;
+    }
+    exhausted = fileExhausted != 0;
+    members.resize((size_t)numMembers);
+    checkpoints.resize((size_t)numCheckpoints);
+    for (size_t i=0; i<members.size(); i++)
+        if (fscanf(f, "%llu", &members[i]) != 1)
+            goto corrupt;
+    for (size_t i=0; i<checkpoints.size(); i++)
+        if (fscanf(f, "%llu", &checkpoints[i]) != 1)
+            goto corrupt;
+    fclose(f);
+    return 0;
+
+corrupt:
+    fclose(f);
+    members.clear();
+    checkpoints.clear();
+    numFound = scanPosition = 0;
+    exhausted = false;
+    fprintf(stderr, "Error: Sequence index file \"%s\" is corrupt\n", filename);
+    return -1;
+}
+
+int SequenceIndex::save(const char *filename)
+{
+    // written under a temporary name and then renamed, so that an interrupted save leaves the old index intact
+    std::string tempFilename = std::string(filename) + ".tmp";
+    FILE *f = fopen(tempFilename.c_str(), "wb");
+    if (!f)
+    {
+        fprintf(stderr, "Error writing sequence index file \"%s\"\n", tempFilename.c_str());
+        return -1;
+    }
+    fprintf(f, INDEX_FILE_SIGNATURE " %u %llu %llu %llu %d %llu %llu\n", INDEX_FILE_VERSION, key, numFound, scanPosition, exhausted, (Uint64)members.size(), (Uint64)checkpoints.size());
+    for (size_t i=0; i<members.size(); i++)
+        fprintf(f, "%llu\n", members[i]);
+    for (size_t i=0; i<checkpoints.size(); i++)
+        fprintf(f, "%llu\n", checkpoints[i]);
+    bool failed = fclose(f) != 0;
+#ifdef _MSC_VER
+    remove(filename); // rename() won't replace an existing file here
+#endif
+    if (failed || rename(tempFilename.c_str(), filename) != 0)
+    {
+        fprintf(stderr, "Error writing sequence index file \"%s\"\n", filename);
+        return -1;
+    }
+    return 0;
+}
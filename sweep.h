@@ -0,0 +1,214 @@
+/**
+ * License:
+ *   This Source Code Form is subject to the terms of
+ *   the Mozilla Public License, v. 2.0. If a copy of
+ *   the MPL was not distributed with this file, You
+ *   can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Authors:
+ *   David Ellsworth <davide.by.zero@gmail.com>
+ */
+
+#include <vector>
+#include <chrono>
+
+// The range of numbers a sweep tests, and how its matches are numbered (for -q and -Q). A sweep visits the numbers in
+// order of their offset from testNum0, so that ascending and descending ranges can be treated alike.
+struct SweepRange
+{
+    Uint64 testNum0, testNum1; Uint testNum_digits; int64 testNumInc;
+    Uint64  seqNum0,  seqNum1; Uint  seqNum_digits; int64  seqNumInc;
+    bool showIndex;
+
+    Uint64 offsetOf(Uint64 n)
+    {
+        return testNumInc >= 0 ? n - testNum0 : testNum0 - n;
+    }
+    Uint64 numberAt(Uint64 offset)
+    {
+        return testNumInc >= 0 ? testNum0 + offset : testNum0 - offset;
+    }
+    Uint64 lastOffset()
+    {
+        return offsetOf(testNum1);
+    }
+};
+
+// Deterministic partition of a sweep into interleaved blocks; shard "index" takes every count'th block, so that
+// expensive regions of the range are spread evenly across all the shards.
+struct SweepShard
+{
+    enum { DEFAULT_BLOCK_SIZE = 1<<16 };
+
+    Uint index;
+    Uint count; // zero if the sweep isn't sharded
+    Uint64 blockSize;
+
+    SweepShard() : index(0), count(0), blockSize(DEFAULT_BLOCK_SIZE)
+    {
+    }
+    bool owns(Uint64 offset)
+    {
+        return !count || offset / blockSize % count == index;
+    }
+    bool nextOwned(Uint64 &offset); // advances offset to the first one at or after it that this shard owns; returns false if there is none
+};
+
+// Settings that control how a sweep is carried out, as opposed to what it computes
+struct SweepOptions
+{
+    enum { DEFAULT_INTERVAL = 10 };
+
+    SweepShard shard;
+    const char *shardFilename; // NULL for standard output
+    const char *checkpointFilename; // NULL if checkpoints aren't to be written
+    Uint interval; // seconds between checkpoints and progress reports
+    bool resume;
+    bool showProgress;
+    Uint64 key; // identifies the sweep, so that a checkpoint can't be resumed by a different one
+
+    SweepOptions() : shardFilename(NULL), checkpointFilename(NULL), interval(DEFAULT_INTERVAL), resume(false), showProgress(false), key(0)
+    {
+    }
+};
+
+// Destination for the output of a sweep. Unsharded, this is standard output, formatted exactly as it always has been.
+// Sharded, it is a shard file, in which every output line is tagged with the offset of the number that produced it,
+// and which records a checkpoint each time the sweep finishes one of its blocks. Merging the shard files with
+// mergeShards() reproduces the output of the unsharded sweep, including its -q/-Q numbering.
+//
+// Either way, the sweep can periodically record its position, its -q/-Q count and the length of its output so far in a
+// checkpoint file. Resuming from the checkpoint cuts the output back to that length and carries on from there, so that
+// the output ends up the same as if the sweep had never been interrupted.
+class SweepOutput
+{
+    SweepRange range;
+    SweepOptions options;
+    SweepShard shard;
+    FILE *shardFile;
+    bool lineBuffered;
+    bool atLineStart;
+    bool alreadyComplete;
+    Uint64 currentOffset;
+    Uint64 currentBlock;
+    Uint64 seqNum;
+    Uint64 bytesWritten;
+    Uint64 resumeOffset;
+    Uint64 numTested, numTestedAtLastReport;
+    std::chrono::steady_clock::time_point lastReport;
+
+    void shardCheckpoint(Uint64 nextOffset);
+    int readCheckpoint(bool &found);
+    void writeCheckpoint(Uint64 nextOffset, bool complete);
+    void reportProgress(Uint64 nextOffset, double seconds);
+public:
+    SweepOutput(const SweepRange &range, bool lineBuffered);
+    ~SweepOutput();
+    int open(const SweepOptions &options); // if options.resume is set, picks up from the checkpoint, if there is one
+
+    // Moves offset forward to the next one this sweep should test, and returns false if the sweep is complete.
+    bool advance(Uint64 &offset);
+
+    void print(const char *format, ...);
+
+    // Reports one member of the sequence; returns false when the sequence range (if any) has been exhausted.
+    bool hit(const char *text);
+
+    void finish();
+};
+
+// The members of a sequence (the numbers a pattern matches, or with -v, doesn't match) found so far by "-q" and "-Q"
+// queries on standard input, so that each query can pick up from the closest member already known instead of testing
+// every number from 0 again. The first members are all kept; past that, only every CHECKPOINT_SPACING-th one is.
+class SequenceIndex
+{
+    enum
+    {
+        MAX_DENSE_MEMBERS  = 1<<20,
+        CHECKPOINT_SPACING = 1<<10,
+    };
+    Uint64 key;
+    std::vector<Uint64> members;     // members 0 through members.size()-1
+    std::vector<Uint64> checkpoints; // members 0, CHECKPOINT_SPACING, 2*CHECKPOINT_SPACING, ...
+    Uint64 numFound;                 // number of members below scanPosition
+    Uint64 scanPosition;             // every number below this has been tested
+    bool exhausted;                  // every number up to ULLONG_MAX has been tested
+
+public:
+    SequenceIndex(Uint64 key) : key(key), numFound(0), scanPosition(0), exhausted(false)
+    {
+    }
+    int load(const char *filename); // a missing file is not an error
+    int save(const char *filename);
+
+    // Calls report(seqNum, member) for members first through last, in order, using test(n) to determine whether n is a
+    // member. Stops early if report() returns false, or if the sequence runs out.
+    template <class TEST, class REPORT>
+    void lookup(Uint64 first, Uint64 last, TEST test, REPORT report)
+    {
+        Uint64 seqNum, n; // member seqNum is the first member at or after n
+        if (first < members.size())
+        {
+            seqNum = first;
+            n = members[first];
+        }
+        else
+        if (first < numFound)
+        {
+            seqNum = first / CHECKPOINT_SPACING * CHECKPOINT_SPACING;
+            n = checkpoints[first / CHECKPOINT_SPACING];
+        }
+        else
+        {
+            seqNum = numFound;
+            n = scanPosition;
+        }
+        for (;;)
+        {
+            Uint64 member;
+            if (seqNum < members.size())
+                member = members[seqNum];
+            else
+            {
+                if (seqNum == numFound)
+                {
+                    if (exhausted)
+                        return;
+                    if (n < scanPosition)
+                        n = scanPosition; // everything in between is already known not to be a member
+                }
+                for (;;)
+                {
+                    bool found = test(n);
+                    if (seqNum == numFound)
+                    {
+                        if (n == ULLONG_MAX)
+                            exhausted = true;
+                        else
+                            scanPosition = n + 1;
+                    }
+                    if (found)
+                        break;
+                    if (n == ULLONG_MAX)
+                        return;
+                    n++;
+                }
+                member = n;
+                if (seqNum == numFound)
+                {
+                    if (members.size() == seqNum && seqNum < MAX_DENSE_MEMBERS)
+                        members.push_back(member);
+                    if (seqNum % CHECKPOINT_SPACING == 0)
+                        checkpoints.push_back(member);
+                    numFound++;
+                }
+            }
+            if ((seqNum >= first && !report(seqNum, member)) || seqNum == last || member == ULLONG_MAX)
+                return;
+            seqNum++;
+            n = member + 1;
+        }
+    }
+};
+
+int mergeShards(int numFiles, char *const *filenames, bool lineBuffered);
@@ -9,6 +9,17 @@
  *   David Ellsworth <davide.by.zero@gmail.com>
  */
 
+#ifdef _MSC_VER
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include "tools.h"
 
 template <typename UINT_TYPE>
@@ -105,3 +116,145 @@ Uint intLength(Uint64 i)
 	    }
     }
 }
+
+MappedFile::MappedFile() : data(NULL), size(0)
+#ifdef _MSC_VER
+    , fileHandle(INVALID_HANDLE_VALUE), mappingHandle(NULL)
+#else
+    , fd(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _MSC_VER
+
+int MappedFile::open(const char *filename, size_t minimumSize)
+{
+    close();
+    fileHandle = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER fileSize;
+    if (fileHandle == INVALID_HANDLE_VALUE || !GetFileSizeEx(fileHandle, &fileSize))
+    {
+        close();
+        return -1;
+    }
+    size = (size_t)fileSize.QuadPart;
+    if (size < minimumSize)
+        size = minimumSize;
+    mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READWRITE, (DWORD)((Uint64)size >> 32), (DWORD)size, NULL); // extends the file with zeroes if need be
+    if (!mappingHandle || !(data = MapViewOfFile(mappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, size)))
+    {
+        close();
+        return -1;
+    }
+    return 0;
+}
+
+int MappedFile::openPrivate(const char *filename)
+{
+    close();
+    fileHandle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER fileSize;
+    if (fileHandle == INVALID_HANDLE_VALUE || !GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+    {
+        close();
+        return -1;
+    }
+    size = (size_t)fileSize.QuadPart;
+    mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    if (!mappingHandle || !(data = MapViewOfFile(mappingHandle, FILE_MAP_COPY, 0, 0, size)))
+    {
+        close();
+        return -1;
+    }
+    return 0;
+}
+
+void MappedFile::close()
+{
+    if (data)
+        UnmapViewOfFile(data);
+    if (mappingHandle)
+        CloseHandle(mappingHandle);
+    if (fileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(fileHandle);
+    data = NULL;
+    size = 0;
+    mappingHandle = NULL;
+    fileHandle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+int MappedFile::open(const char *filename, size_t minimumSize)
+{
+    close();
+    fd = ::open(filename, O_RDWR | O_CREAT, 0666);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        close();
+        return -1;
+    }
+    size = (size_t)st.st_size;
+    if (size < minimumSize)
+    {
+        if (ftruncate(fd, minimumSize) != 0)
+        {
+            close();
+            return -1;
+        }
+        size = minimumSize;
+    }
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        data = NULL;
+        close();
+        return -1;
+    }
+    return 0;
+}
+
+int MappedFile::openPrivate(const char *filename)
+{
+    close();
+    fd = ::open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close();
+        return -1;
+    }
+    size = (size_t)st.st_size;
+#ifdef MAP_POPULATE
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0); // the whole file is about to be read anyway
+#else
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+#endif
+    if (data == MAP_FAILED)
+    {
+        data = NULL;
+        close();
+        return -1;
+    }
+    return 0;
+}
+
+void MappedFile::close()
+{
+    if (data)
+        munmap(data, size);
+    if (fd >= 0)
+        ::close(fd);
+    data = NULL;
+    size = 0;
+    fd = -1;
+}
+
+#endif
@@ -86,12 +86,42 @@ inline void tellCompilerVariableIsntUninitialized(TYPE &n)
 {
 }
 
+#ifdef _MSC_VER
+#define FSEEK64 _fseeki64
+#define FTELL64 _ftelli64
+#else
+#define FSEEK64 fseeko
+#define FTELL64 ftello
+#endif
+
 #ifdef _MSC_VER
 #define GETC _getc_nolock  // using this results in a huge speed-up under MS Visual C++
 #else
 #define GETC getc
 #endif
 
+// A file mapped into memory for reading and writing, so that changes made through getData() end up in the file and
+// are shared with any other process that has it mapped
+class MappedFile
+{
+    void *data;
+    size_t size;
+#ifdef _MSC_VER
+    void *fileHandle;
+    void *mappingHandle;
+#else
+    int fd;
+#endif
+public:
+    MappedFile();
+    ~MappedFile();
+    int open(const char *filename, size_t minimumSize); // creates or extends the file (with zeroes) if it is smaller than minimumSize
+    int openPrivate(const char *filename); // maps an existing file copy-on-write, so that changes made through getData() stay in this process
+    void close();
+    void *getData() { return data; }
+    size_t getSize() { return size; }
+};
+
 class LineGetter
 {
     char *buf;